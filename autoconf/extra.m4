@@ -242,7 +242,7 @@ dnl	])
 	AC_CHECK_FUNCS([gethostbyname inet_ntoa mkdir]) 
 	AC_HEADER_STDC    
 	AC_HEADER_STDBOOL 
-	AC_CHECK_HEADERS([netinet/in.h fcntl.h sys/signal.h stdio.h errno.h ctype.h assert.h sys/sysinfo.h])
+	AC_CHECK_HEADERS([netinet/in.h fcntl.h sys/signal.h stdio.h errno.h ctype.h assert.h sys/sysinfo.h sys/epoll.h])
 	AC_STRUCT_TM
 	AC_STRUCT_TIMEZONE
 ])
@@ -997,6 +997,36 @@ AC_DEFUN([CS_WITH_HASH_SIZE], [
 	AC_MSG_RESULT([--with-hash-size: ${ac_cv_set_hashsize}])
 ])
 
+AC_DEFUN([CS_WITH_DEBUG_CATEGORIES], [
+	AC_ARG_WITH(debug_categories,
+		[AC_HELP_STRING([--with-debug-categories], [comma separated list of debug categories to compile in (core,sccp,device,socket,...), sccp_log calls for the other categories are removed from the module (default=all)])],
+		[ac_cv_debug_categories=$withval], [ac_cv_debug_categories=all])
+	AS_CASE([${ac_cv_debug_categories}],
+		[''|'yes'|'all'], [
+			ac_cv_debug_categories=all
+			],
+		[*], [
+			cs_debug_mask="DEBUGCAT_FILELINEFUNC | DEBUGCAT_TRACE"
+			for cs_debug_category in `echo "${ac_cv_debug_categories}" | ${SED} 's/,/ /g'`; do
+				AS_CASE([${cs_debug_category}],
+					[core|sccp|hint|rtp|device|line|action|channel|cli|config|feature|feature_button|softkey|indicate|pbx|socket|mwi|event|conference|buttontemplate|speeddial|codec|realtime|callinfo|refcount|message|newcode|high], [
+						cs_debug_mask="${cs_debug_mask} | DEBUGCAT_`echo ${cs_debug_category} | tr 'a-z' 'A-Z'`"
+						],
+					[threadpool], [
+						cs_debug_mask="${cs_debug_mask} | DEBUGCAT_THPOOL"
+						],
+					[none|no], [],
+					[*], [
+						AC_MSG_ERROR([--with-debug-categories: unknown debug category '${cs_debug_category}'])
+						]
+				)
+			done
+			AC_DEFINE_UNQUOTED(CS_DEBUG_CATEGORIES, (${cs_debug_mask}), [debug categories compiled in])
+			]
+	)
+	AC_MSG_RESULT([--with-debug-categories: ${ac_cv_debug_categories}])
+])
+
 AC_DEFUN([CS_PARSE_WITH_AND_ENABLE], [
 	CS_DISABLE_SECTION_RELOCATION
 	AC_MSG_RESULT([--enable-optimization: ${enable_optimization}]) 
@@ -1024,6 +1054,7 @@ AC_DEFUN([CS_PARSE_WITH_AND_ENABLE], [
 	CS_ENABLE_EXPERIMENTAL_MODE
 	AC_MSG_RESULT([--enable-experimental-xml: ${ac_cv_experimental_xml}])
 	CS_WITH_HASH_SIZE
+	CS_WITH_DEBUG_CATEGORIES
 ])
 
 AC_DEFUN([CS_SETUP_MODULE_DIR], [
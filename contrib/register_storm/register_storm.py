@@ -0,0 +1,246 @@
+#!/usr/bin/env python3
+#
+# Registration storm simulator for chan-sccp-b
+#
+# Opens N skinny connections to chan-sccp and lets every one of them walk through the registration flow of a phone:
+#   Register -> RegisterAck + CapabilitiesReq -> CapabilitiesRes -> ButtonTemplateReq -> SoftKeyTemplateReq ->
+#   SoftKeySetReq -> LineStatReq -> TimeDateReq (registration finished)
+# and reports the registration latency percentiles, failures and (when the server pid is given and the server runs on this
+# host) the cpu time used by asterisk during the storm.
+#
+# See README for the chan-sccp configuration needed to accept the simulated phones.
+#
+import argparse, asyncio, os, struct, time
+
+KeepAliveMessage = 0x0000
+RegisterMessage = 0x0001
+LineStatReqMessage = 0x000B
+TimeDateReqMessage = 0x000D
+ButtonTemplateReqMessage = 0x000E
+CapabilitiesResMessage = 0x0010
+SoftKeySetReqMessage = 0x0025
+SoftKeyTemplateReqMessage = 0x0028
+RegisterAckMessage = 0x0081
+LineStatMessage = 0x0092
+DefineTimeDate = 0x0094
+ButtonTemplateMessage = 0x0097
+CapabilitiesReqMessage = 0x009B
+RegisterRejectMessage = 0x009D
+Reset = 0x009F
+KeepAliveAckMessage = 0x0100
+SoftKeyTemplateResMessage = 0x0108
+SoftKeySetResMessage = 0x0109
+
+SKINNY_CODEC_G711_ULAW_64K = 0x0004
+SKINNY_CODEC_G711_ALAW_64K = 0x0002
+
+STEPS = ('connect', 'registerack', 'capabilities', 'buttontemplate', 'softkeys', 'linestat', 'registered')
+
+
+class RegistrationFailed(Exception):
+    pass
+
+
+def packet(messageId, data=b''):
+    """ skinny packet: length (of messageId + data), reserved / protocol version, messageId, data """
+    data += b'\0' * ((4 - len(data) % 4) % 4)
+    return struct.pack('<III', len(data) + 4, 0, messageId) + data
+
+
+def register_packet(name, devicetype, protocol, ip):
+    sid = struct.pack('<16sII', name.encode(), 0, 1)
+    features = 0x85600000 | protocol
+    body = sid + struct.pack('<4sIIII', ip, devicetype, 5, 0, features)
+    body += struct.pack('<II12sII16sI32s48s', 0, 0, name[3:].encode(), 0, 0, b'', 0, b'register_storm', b'')
+    return packet(RegisterMessage, body)
+
+
+def capabilities_packet():
+    caps = [(SKINNY_CODEC_G711_ULAW_64K, 40), (SKINNY_CODEC_G711_ALAW_64K, 40)]
+    body = struct.pack('<I', len(caps))
+    for codec, frames in caps:
+        body += struct.pack('<II8s', codec, frames, b'')
+    return packet(CapabilitiesResMessage, body)
+
+
+class Phone:
+    def __init__(self, args, index):
+        self.args = args
+        self.name = 'SEP%s%06X' % (args.prefix, args.first + index)
+        self.times = {}
+        self.failure = None
+        self.keepalive = 30
+        self.reader = None
+        self.writer = None
+
+    async def read_message(self):
+        header = await self.reader.readexactly(12)
+        length, _, messageId = struct.unpack('<III', header)
+        data = await self.reader.readexactly(length - 4) if length > 4 else b''
+        return messageId, data
+
+    async def expect(self, *wanted):
+        """ read messages until one of wanted arrives, skipping everything else the server sends along the way """
+        while True:
+            messageId, data = await self.read_message()
+            if messageId in wanted:
+                return messageId, data
+            if messageId in (RegisterRejectMessage, Reset):
+                raise RegistrationFailed('reject' if messageId == RegisterRejectMessage else 'reset')
+
+    def mark(self, step):
+        self.times[step] = time.monotonic() - self.start
+
+    async def register(self):
+        args = self.args
+        self.start = time.monotonic()
+        self.reader, self.writer = await asyncio.open_connection(args.host, args.port)
+        self.mark('connect')
+        ip = self.writer.get_extra_info('sockname')[0]
+        ip = bytes(int(octet) for octet in ip.split('.')) if ip.count('.') == 3 else b'\0\0\0\0'
+
+        self.writer.write(register_packet(self.name, args.devicetype, args.protocol, ip))
+        _, data = await self.expect(RegisterAckMessage)
+        self.keepalive = struct.unpack_from('<I', data)[0] or 30
+        self.mark('registerack')
+        await self.expect(CapabilitiesReqMessage)
+        self.writer.write(capabilities_packet())
+        self.mark('capabilities')
+
+        self.writer.write(packet(ButtonTemplateReqMessage))
+        await self.expect(ButtonTemplateMessage)
+        self.mark('buttontemplate')
+        self.writer.write(packet(SoftKeyTemplateReqMessage))
+        await self.expect(SoftKeyTemplateResMessage)
+        self.writer.write(packet(SoftKeySetReqMessage))
+        await self.expect(SoftKeySetResMessage)
+        self.mark('softkeys')
+        for line in range(1, args.lines + 1):
+            self.writer.write(packet(LineStatReqMessage, struct.pack('<I', line)))
+            await self.expect(LineStatMessage)
+        self.mark('linestat')
+        self.writer.write(packet(TimeDateReqMessage))
+        await self.expect(DefineTimeDate)
+        self.mark('registered')
+
+    async def run(self, done):
+        try:
+            await asyncio.wait_for(self.register(), self.args.timeout)
+        except asyncio.TimeoutError:
+            self.failure = 'timeout'
+        except RegistrationFailed as e:
+            self.failure = str(e)
+        except (asyncio.IncompleteReadError, ConnectionError, OSError) as e:
+            self.failure = type(e).__name__
+        if self.failure is None:
+            await self.hold(done)
+        if self.writer:
+            self.writer.close()
+
+    async def drain(self):
+        while True:
+            await self.read_message()
+
+    async def hold(self, done):
+        """ stay registered (sending keepalives) until the whole storm is over """
+        drain = asyncio.ensure_future(self.drain())
+        while not done.is_set() and not drain.done():
+            self.writer.write(packet(KeepAliveMessage))
+            try:
+                await asyncio.wait_for(done.wait(), self.keepalive * 0.8)
+            except asyncio.TimeoutError:
+                pass
+        if drain.done():
+            self.failure = 'dropped'
+            drain.exception()
+        else:
+            drain.cancel()
+
+
+def percentile(values, pct):
+    if not values:
+        return float('nan')
+    values = sorted(values)
+    return values[min(len(values) - 1, int(round(pct / 100.0 * (len(values) - 1))))]
+
+
+def cputime(pid):
+    """ utime + stime of pid in seconds, None if it is not available """
+    try:
+        with open('/proc/%d/stat' % pid) as f:
+            fields = f.read().rsplit(')', 1)[1].split()
+        return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+    except (OSError, ValueError, IndexError):
+        return None
+
+
+async def storm(args):
+    phones = [Phone(args, i) for i in range(args.phones)]
+    done = asyncio.Event()
+    tasks = []
+    cpu_before = cputime(args.pid) if args.pid else None
+    start = time.monotonic()
+    for i, phone in enumerate(phones):
+        if args.rate:
+            delay = start + i / float(args.rate) - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+        tasks.append(asyncio.ensure_future(phone.run(done)))
+
+    while any(len(p.times) < len(STEPS) and p.failure is None for p in phones):
+        await asyncio.sleep(0.1)
+    elapsed = time.monotonic() - start
+    cpu_after = cputime(args.pid) if args.pid else None
+    if args.hold:
+        await asyncio.sleep(args.hold)
+    done.set()
+    await asyncio.gather(*tasks)
+    return phones, elapsed, cpu_before, cpu_after
+
+
+def report(args, phones, elapsed, cpu_before, cpu_after):
+    registered = [p for p in phones if p.failure is None]
+    failures = {}
+    for p in phones:
+        if p.failure:
+            failures[p.failure] = failures.get(p.failure, 0) + 1
+
+    print('phones: %d, registered: %d, failed: %d, storm took %.2fs (%.0f registrations/s)' % (
+        len(phones), len(registered), len(phones) - len(registered), elapsed, len(registered) / elapsed if elapsed else 0))
+    for reason, count in sorted(failures.items()):
+        print('  failed (%s): %d' % (reason, count))
+    print('%-16s %9s %9s %9s %9s %9s' % ('latency (ms)', 'p50', 'p90', 'p99', 'p99.9', 'max'))
+    for step in STEPS:
+        values = [p.times[step] * 1000 for p in phones if step in p.times]
+        print('%-16s %9.1f %9.1f %9.1f %9.1f %9.1f' % (step, percentile(values, 50), percentile(values, 90),
+              percentile(values, 99), percentile(values, 99.9), max(values) if values else float('nan')))
+    if cpu_before is not None and cpu_after is not None:
+        used = cpu_after - cpu_before
+        print('server cpu (pid %d): %.2fs during the storm, %.0f%% of one core' % (args.pid, used, used / elapsed * 100 if elapsed else 0))
+    elif args.pid:
+        print('server cpu: could not read /proc/%d/stat (server has to run on this host)' % args.pid)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Simulate a registration storm of skinny phones against chan-sccp-b')
+    parser.add_argument('--host', default='127.0.0.1', help='chan-sccp bindaddr (default: %(default)s)')
+    parser.add_argument('--port', type=int, default=2000, help='chan-sccp port (default: %(default)s)')
+    parser.add_argument('-n', '--phones', type=int, default=100, help='number of phones (default: %(default)s)')
+    parser.add_argument('-r', '--rate', type=float, default=0, help='new connections per second, 0 = all at once (default: %(default)s)')
+    parser.add_argument('--prefix', default='000000', help='first six hex digits of the mac address (default: %(default)s)')
+    parser.add_argument('--first', type=lambda x: int(x, 0), default=1, help='number of the first phone, added to the last six digits of the mac address (default: %(default)s)')
+    parser.add_argument('--devicetype', type=int, default=7, help='skinny device type, 7 = Cisco 7960 (default: %(default)s)')
+    parser.add_argument('--protocol', type=int, default=11, help='skinny protocol version (default: %(default)s)')
+    parser.add_argument('--lines', type=int, default=1, help='LineStatReq messages per phone (default: %(default)s)')
+    parser.add_argument('--timeout', type=float, default=60, help='seconds a phone may take to register (default: %(default)s)')
+    parser.add_argument('--hold', type=float, default=0, help='seconds to stay registered after the storm (default: %(default)s)')
+    parser.add_argument('--pid', type=int, default=0, help='asterisk pid, to report the cpu time used by the server')
+    args = parser.parse_args()
+
+    if len(args.prefix) != 6:
+        parser.error('--prefix should be six hex digits')
+    report(args, *asyncio.run(storm(args)))
+
+
+if __name__ == '__main__':
+    main()
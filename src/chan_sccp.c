@@ -83,6 +83,8 @@ int load_config(void)
  */
 boolean_t sccp_prePBXLoad(void)
 {
+	int hash;
+
 	pbx_log(LOG_NOTICE, "preloading pbx module\n");
 	/* make globals */
 	sccp_globals = sccp_calloc(sizeof *sccp_globals, 1);
@@ -109,6 +111,11 @@ boolean_t sccp_prePBXLoad(void)
 	SCCP_RWLIST_HEAD_INIT(&GLOB(sessions));
 	SCCP_RWLIST_HEAD_INIT(&GLOB(devices));
 	SCCP_RWLIST_HEAD_INIT(&GLOB(lines));
+	for (hash = 0; hash < SCCP_HASH_PRIME; hash++) {
+		SCCP_RWLIST_HEAD_INIT(&GLOB(device_index)[hash]);
+		SCCP_RWLIST_HEAD_INIT(&GLOB(line_index)[hash]);
+		SCCP_RWLIST_HEAD_INIT(&GLOB(channel_index)[hash]);
+	}
 
 	GLOB(general_threadpool) = sccp_threadpool_init(THREADPOOL_MIN_SIZE);
 
@@ -218,6 +225,7 @@ int sccp_preUnload(void)
 {
 	sccp_device_t *d = NULL;
 	sccp_line_t *l = NULL;
+	int hash;
 
 	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_1 "SCCP: Unloading Module\n");
 
@@ -245,6 +253,9 @@ int sccp_preUnload(void)
 	SCCP_RWLIST_TRAVERSE_SAFE_END;
 	if (SCCP_RWLIST_EMPTY(&GLOB(devices))) {
 		SCCP_RWLIST_HEAD_DESTROY(&GLOB(devices));
+		for (hash = 0; hash < SCCP_HASH_PRIME; hash++) {
+			SCCP_RWLIST_HEAD_DESTROY(&GLOB(device_index)[hash]);
+		}
 	}
 
 	/* hotline will be removed by line removing function */
@@ -268,6 +279,9 @@ int sccp_preUnload(void)
 	SCCP_RWLIST_TRAVERSE_SAFE_END;
 	if (SCCP_RWLIST_EMPTY(&GLOB(lines))) {
 		SCCP_RWLIST_HEAD_DESTROY(&GLOB(lines));
+		for (hash = 0; hash < SCCP_HASH_PRIME; hash++) {
+			SCCP_RWLIST_HEAD_DESTROY(&GLOB(line_index)[hash]);
+		}
 	}
 	usleep(100);												// wait for events to finalize
 
@@ -283,8 +297,14 @@ int sccp_preUnload(void)
 	sccp_softkey_clear();
 	sccp_hint_module_stop();
 	sccp_event_module_stop();
+	sccp_netsock_stop_externhost();
+	sccp_featurestore_module_stop();
 	sccp_threadpool_destroy(GLOB(general_threadpool));
 	sccp_refcount_destroy();
+	sccp_trace_module_stop();
+	for (hash = 0; hash < SCCP_HASH_PRIME; hash++) {
+		SCCP_RWLIST_HEAD_DESTROY(&GLOB(channel_index)[hash]);
+	}
 
 	/* free resources */
 	if (GLOB(config_file_name)) {
@@ -319,6 +339,7 @@ int sccp_reload(void)
 	sccp_readingtype_t readingtype;
 	int returnval = 0;
 
+	sccp_featurestore_invalidate();									/* pick up feature state changed in the database (console) */
 	pbx_rwlock_wrlock(&GLOB(lock));
 	if (GLOB(reload_in_progress) == TRUE) {
 		pbx_log(LOG_ERROR, "SCCP reloading already in progress.\n");
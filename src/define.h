@@ -154,6 +154,8 @@ SCCP_LINE unsigned long long __bswap_64(unsigned long long x)
 #define THREADPOOL_MIN_SIZE 2
 #define THREADPOOL_MAX_SIZE 10
 #define THREADPOOL_RESIZE_INTERVAL 10
+#define THREADPOOL_QUEUE_SIZE 1024										/* shared job queue, needs to be a power of two */
+#define THREADPOOL_LOCAL_QUEUE_SIZE 64										/* per worker job queue, needs to be a power of two */
 
 #define CAS32_TYPE int
 #define SCCP_TIME_TO_KEEP_REFCOUNTEDOBJECT 2000									// ms
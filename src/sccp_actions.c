@@ -118,7 +118,7 @@ gcc_inline static sccp_device_t * const check_session_message_device(constSessio
 		errors++;
 	}
 
-	if (msg && (GLOB(debug) & (DEBUGCAT_MESSAGE)) != 0) {
+	if (msg && sccp_debug_enabled(DEBUGCAT_MESSAGE)) {
 		uint32_t mid = letohl(msg->header.lel_messageId);
 		pbx_log(LOG_NOTICE, "%s: SCCP Handle Message: %s(0x%04X) %d bytes length\n", sccp_session_getDesignator(s), msgtype2str(mid), mid, msg->header.length);
 		sccp_dump_msg(msg);
@@ -323,7 +323,7 @@ void handle_unknown_message(constSessionPtr no_s, devicePtr no_d, constMessagePt
 {
 	uint32_t mid = letohl(msg_in->header.lel_messageId);
 
-	if ((GLOB(debug) & DEBUGCAT_MESSAGE) != 0) {								// only show when debugging messages
+	if (sccp_debug_enabled(DEBUGCAT_MESSAGE)) {								// only show when debugging messages
 		pbx_log(LOG_WARNING, "Unhandled SCCP Message: %s(0x%04X) %d bytes length\n", msgtype2str(mid), mid, msg_in->header.length);
 		sccp_dump_msg(msg_in);
 	}
@@ -446,7 +446,7 @@ void handle_XMLAlarmMessage(constSessionPtr s, devicePtr no_d, constMessagePtr m
 		   }
 		 */
 	}
-	if ((GLOB(debug) & DEBUGCAT_MESSAGE) != 0) {								// only show when debugging messages
+	if (sccp_debug_enabled(DEBUGCAT_MESSAGE)) {								// only show when debugging messages
 		pbx_log(LOG_WARNING, "SCCP XMLAlarm Message: %s(0x%04X) %d bytes length\n", msgtype2str(mid), mid, msg_in->header.length);
 		sccp_dump_msg(msg_in);
 	}
@@ -463,7 +463,7 @@ void handle_LocationInfoMessage(constSessionPtr s, devicePtr d, constMessagePtr
 	char *xmldata = pbx_strdupa(msg_in->data.LocationInfoMessage.xmldata);
 	sccp_log(DEBUGCAT_DEVICE)(VERBOSE_PREFIX_2 "SCCP: LocationInfo (WIFI) Message: %s\n", xmldata);
 	
-	if ((GLOB(debug) & DEBUGCAT_MESSAGE) != 0) {								// only show when debugging messages
+	if (sccp_debug_enabled(DEBUGCAT_MESSAGE)) {								// only show when debugging messages
 		sccp_dump_msg(msg_in);
         }
 }
@@ -497,12 +497,17 @@ void handle_token_request(constSessionPtr s, devicePtr no_d, constMessagePtr msg
 	deviceInstance = letohl(msg_in->data.RegisterTokenRequest.sId.lel_instance);
 	deviceType = letohl(msg_in->data.RegisterTokenRequest.lel_deviceType);
 	int token_backoff_time = GLOB(token_backoff_time) >= 30 ? GLOB(token_backoff_time) : 60;
+	uint32_t admission_backoff_time = 0;
 
 	if (GLOB(reload_in_progress)) {
 		pbx_log(LOG_NOTICE, "SCCP: Reload in progress. Come back later.\n");
 		sccp_session_tokenReject(s, 10);
 		return;
 	}
+	if (!sccp_session_admitRegistration(s, &admission_backoff_time)) {
+		sccp_session_tokenReject(s, admission_backoff_time);
+		return;
+	}
 	if (!sccp_strlen_zero(GLOB(token_fallback))) {
 		if (sccp_false(GLOB(token_fallback))) {
 			sccp_log_and((DEBUGCAT_ACTION + DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "%s: Sending phone a token rejection (sccp.conf:fallback=%s)\n", deviceName, GLOB(token_fallback));
@@ -674,12 +679,17 @@ void handle_SPCPTokenReq(constSessionPtr s, devicePtr no_d, constMessagePtr msg_
 	deviceName = pbx_strdupa(msg_in->data.RegisterTokenRequest.sId.deviceName);
 	deviceType = letohl(msg_in->data.SPCPRegisterTokenRequest.lel_deviceType);
 	int token_backoff_time = GLOB(token_backoff_time) >= 30 ? GLOB(token_backoff_time) : 60;
+	uint32_t admission_backoff_time = 0;
 
 	if (GLOB(reload_in_progress)) {
 		pbx_log(LOG_NOTICE, "SCCP: Reload in progress. Come back later.\n");
 		sccp_session_tokenReject(s, 10);
 		return;
 	}
+	if (!sccp_session_admitRegistration(s, &admission_backoff_time)) {
+		sccp_session_tokenReject(s, admission_backoff_time);
+		return;
+	}
 
 	if (!skinny_devicetype_exists(deviceType)) {
 		pbx_log(LOG_NOTICE, "%s: We currently do not (fully) support this device type (%d).\n" "Please send this device type number plus the information about the phone model you are using to one of our developers.\n" "Be Warned you should Expect Trouble Ahead\nWe will try to go ahead (Without any guarantees)\n", deviceName, deviceType);
@@ -792,6 +802,7 @@ void handle_register(constSessionPtr s, devicePtr maybe_d, constMessagePtr msg_i
 	//uint32_t maxStreams = letohl(msg_in->data.RegisterMessage.lel_maxStreams);
 	//uint32_t activeStreams = letohl(msg_in->data.RegisterMessage.lel_activeStreams);
 	uint8_t protocolVer = letohl(msg_in->data.RegisterMessage.phone_features) & SKINNY_PHONE_FEATURES_PROTOCOLVERSION;
+	uint32_t admission_backoff_time = 0;
 	//uint32_t maxConferences = letohl(msg_in->data.RegisterMessage.lel_maxConferences);
 	//uint32_t activeConferences = letohl(msg_in->data.RegisterMessage.lel_activeConferences);
 	uint8_t macAddress[12];
@@ -806,6 +817,10 @@ void handle_register(constSessionPtr s, devicePtr maybe_d, constMessagePtr msg_i
 		sccp_session_reject(s, "Reload in progress");
 		return;
 	}
+	if (!sccp_session_admitRegistration(s, &admission_backoff_time)) {
+		sccp_session_reject(s, "Server busy");
+		return;
+	}
 
 	if (!skinny_devicetype_exists(deviceType)) {
 		pbx_log(LOG_NOTICE, "%s: We currently do not (fully) support this device type (%d).\n" "Please send this device type number plus the information about the phone model you are using to one of our developers.\n" "Be Warned you should Expect Trouble Ahead\nWe will try to go ahead (Without any guarantees)\n", deviceName, deviceType);
@@ -4608,7 +4623,7 @@ void handle_device_to_user(constSessionPtr s, devicePtr d, constMessagePtr msg_i
  */
 void handle_device_to_user_response(constSessionPtr s, devicePtr d, constMessagePtr msg_in)
 {
-	if ((GLOB(debug) & DEBUGCAT_MESSAGE) != 0) {
+	if (sccp_debug_enabled(DEBUGCAT_MESSAGE)) {
 		uint32_t appID;
 		uint32_t lineInstance;
 		uint32_t callReference;
@@ -47,22 +47,101 @@ enum callinfo_types {
 
 /*!
  * \brief SCCP CallInfo Structure
+ *
+ * Writers are serialized by writelock and make seq odd while they change content. Readers do not lock, they copy
+ * content and retry when seq was odd or changed during the copy (seqlock).
  */
 struct sccp_callinfo {
-	pbx_rwlock_t lock;
+	pbx_mutex_t writelock;
+	volatile uint32_t seq;											/*!< odd while content is being written */
+	uint32_t sentVersion;											/*!< content.version last sent to the device (protected by writelock) */
+	sccp_callinfo_t *nextFree;										/*!< next object in callinfo_cache (only while cached) */
+	struct {
+		uint32_t version;										/*!< content.version the body was encoded from, 0 = none */
+		uint32_t hits;											/*!< number of times the body was reused */
+		int len;
+		size_t allocated;
+		uint8_t *data;
+	} encoded[SCCP_CALLINFO_ENCODING_SENTINEL];								/*!< Encoded message bodies (protected by writelock) */
 	struct ci_content {
 		callinfo_entry_t entries[HUNT_PILOT + 1];
 		uint32_t originalCdpnRedirectReason;								/*!< Original Called Party Redirect Reason */
 		uint32_t lastRedirectingReason;									/*!< Last Redirecting Reason */
 		sccp_callerid_presentation_t presentation;							/*!< Should this callerinfo be shown (privacy) */
-		boolean_t changed;										/*! Changes since last send */
+		uint32_t version;										/*!< Incremented on every change */
 		uint8_t callInstance;
 	} content;
 };														/*!< SCCP CallInfo Structure */
 
-#define sccp_callinfo_wrlock(x) pbx_rwlock_wrlock(&((sccp_callinfo_t * const)(x))->lock)				/* discard const */
-#define sccp_callinfo_rdlock(x) pbx_rwlock_rdlock(&((sccp_callinfo_t * const)(x))->lock)				/* discard const */
-#define sccp_callinfo_unlock(x) pbx_rwlock_unlock(&((sccp_callinfo_t * const)(x))->lock)				/* discard const */
+#define SCCP_CALLINFO_CACHE_DEPTH 64										/* number of released callinfo objects kept for reuse */
+
+/*
+ * Callinfo Cache
+ *
+ * Released callinfo objects are kept (with their writelock still initialized) for the next Constructor call, up to
+ * SCCP_CALLINFO_CACHE_DEPTH objects.
+ */
+AST_MUTEX_DEFINE_STATIC(callinfo_cache_lock);
+static sccp_callinfo_t *callinfo_cache = NULL;
+static uint32_t callinfo_cache_count = 0;
+
+static void callinfo_freeEncoded(sccp_callinfo_t * const ci)
+{
+	int encoding = 0;
+
+	for (encoding = 0; encoding < SCCP_CALLINFO_ENCODING_SENTINEL; encoding++) {
+		if (ci->encoded[encoding].data) {
+			sccp_free(ci->encoded[encoding].data);
+		}
+	}
+	memset(ci->encoded, 0, sizeof(ci->encoded));
+}
+
+static void __attribute__((destructor)) callinfo_cache_destroy(void)
+{
+	sccp_callinfo_t *ci = NULL;
+
+	pbx_mutex_lock(&callinfo_cache_lock);
+	while ((ci = callinfo_cache)) {
+		callinfo_cache = ci->nextFree;
+		callinfo_freeEncoded(ci);
+		pbx_mutex_destroy(&ci->writelock);
+		sccp_free(ci);
+	}
+	callinfo_cache_count = 0;
+	pbx_mutex_unlock(&callinfo_cache_lock);
+}
+
+static gcc_inline void callinfo_write_begin(sccp_callinfo_t * const ci)
+{
+	pbx_mutex_lock(&ci->writelock);
+	ci->seq++;
+	__sync_synchronize();
+}
+
+static gcc_inline void callinfo_write_end(sccp_callinfo_t * const ci)
+{
+	__sync_synchronize();
+	ci->seq++;
+	pbx_mutex_unlock(&ci->writelock);
+}
+
+/*!
+ * \brief Take a consistent copy of the callinfo content, without locking
+ */
+static gcc_inline void callinfo_read(const sccp_callinfo_t * const ci, struct ci_content * const content)
+{
+	uint32_t seq = 0;
+
+	do {
+		while ((seq = ci->seq) & 1) {
+			sched_yield();
+		}
+		__sync_synchronize();
+		memcpy(content, (const void *) &ci->content, sizeof(struct ci_content));
+		__sync_synchronize();
+	} while (seq != ci->seq);
+}
 
 struct callinfo_lookup {
 	const enum callinfo_groups group;
@@ -90,18 +169,36 @@ struct callinfo_lookup {
 
 static sccp_callinfo_t * const callinfo_Constructor(uint8_t callInstance)
 {
-	sccp_callinfo_t *const ci = sccp_calloc(sizeof *ci, 1);
+	sccp_callinfo_t *ci = NULL;
 
-	if (!ci) {
-		pbx_log(LOG_ERROR, "SCCP: No memory to allocate callinfo object. Failing\n");
-		return NULL;
+	pbx_mutex_lock(&callinfo_cache_lock);
+	if ((ci = callinfo_cache)) {
+		callinfo_cache = ci->nextFree;
+		callinfo_cache_count--;
+	}
+	pbx_mutex_unlock(&callinfo_cache_lock);
+
+	if (ci) {
+		int encoding = 0;
+		ci->seq = 0;
+		ci->nextFree = NULL;
+		memset(&ci->content, 0, sizeof(struct ci_content));
+		for (encoding = 0; encoding < SCCP_CALLINFO_ENCODING_SENTINEL; encoding++) {
+			ci->encoded[encoding].version = 0;					/* keep the buffer for reuse */
+		}
+	} else {
+		if (!(ci = sccp_calloc(sizeof *ci, 1))) {
+			pbx_log(LOG_ERROR, "SCCP: No memory to allocate callinfo object. Failing\n");
+			return NULL;
+		}
+		pbx_mutex_init(&ci->writelock);
 	}
-	pbx_rwlock_init(&ci->lock);
 
 	/* by default we allow callerid presentation */
 	ci->content.presentation = CALLERID_PRESENTATION_ALLOWED;
-	ci->content.changed = TRUE;
+	ci->content.version = 1;										/* differs from sentVersion, i.e. not sent yet */
 	ci->content.callInstance = callInstance;
+	ci->sentVersion = 0;
 
 	sccp_log(DEBUGCAT_CALLINFO) (VERBOSE_PREFIX_1 "SCCP: callinfo constructor: %p\n", ci);
 	return ci;
@@ -110,11 +207,20 @@ static sccp_callinfo_t * const callinfo_Constructor(uint8_t callInstance)
 static sccp_callinfo_t * const callinfo_Destructor(sccp_callinfo_t * * const ci)
 {
 	pbx_assert(ci != NULL && *ci != NULL);
-	//sccp_callinfo_wrlock(ci);
-	//sccp_callinfo_unlock(ci);
-	pbx_rwlock_destroy(&(*ci)->lock);
-	sccp_free(*ci);
-	*ci = NULL;
+	pbx_mutex_lock(&callinfo_cache_lock);
+	if (callinfo_cache_count < SCCP_CALLINFO_CACHE_DEPTH) {
+		(*ci)->nextFree = callinfo_cache;
+		callinfo_cache = *ci;
+		callinfo_cache_count++;
+		*ci = NULL;
+	}
+	pbx_mutex_unlock(&callinfo_cache_lock);
+	if (*ci) {
+		callinfo_freeEncoded(*ci);
+		pbx_mutex_destroy(&(*ci)->writelock);
+		sccp_free(*ci);
+		*ci = NULL;
+	}
 	sccp_log(DEBUGCAT_CALLINFO) (VERBOSE_PREFIX_2 "SCCP: callinfo destructor\n");
 	return *ci;
 }
@@ -127,10 +233,9 @@ static sccp_callinfo_t * callinfo_CopyConstructor(const sccp_callinfo_t * const
 		if (!tmp_ci) {
 			return NULL;
 		}
-		sccp_callinfo_rdlock(src_ci);
-		memcpy(&tmp_ci->content, &src_ci->content, sizeof(struct ci_content));
-		tmp_ci->content.changed = TRUE;
-		sccp_callinfo_unlock(src_ci);
+		callinfo_read(src_ci, &tmp_ci->content);
+		tmp_ci->sentVersion = 0;
+		tmp_ci->content.version = 1;
 
 		return tmp_ci;
 	}
@@ -145,14 +250,12 @@ static boolean_t callinfo_Copy(const sccp_callinfo_t * const src_ci, sccp_callin
 		struct ci_content tmp_ci_content;
 		memset(&tmp_ci_content, 0, sizeof(struct ci_content));
 
-		sccp_callinfo_rdlock(src_ci);
-		memcpy(&tmp_ci_content, &src_ci->content, sizeof(struct ci_content));
-		sccp_callinfo_unlock(src_ci);
+		callinfo_read(src_ci, &tmp_ci_content);
 
-		sccp_callinfo_wrlock(dst_ci);
+		callinfo_write_begin(dst_ci);
+		tmp_ci_content.version = dst_ci->content.version + 1;
 		memcpy(&dst_ci->content, &tmp_ci_content, sizeof(struct ci_content));
-		dst_ci->content.changed = TRUE;
-		sccp_callinfo_unlock(dst_ci);
+		callinfo_write_end(dst_ci);
 
 		return TRUE;
 	}
@@ -178,7 +281,7 @@ static int callinfo_Setter(sccp_callinfo_t * const ci, int key, ...)							// ke
 	}
 	*/
 	
-	sccp_callinfo_wrlock(ci);
+	callinfo_write_begin(ci);
 	va_list ap;
 	va_start(ap, key);
 	for (curkey = key; curkey > SCCP_CALLINFO_NONE && curkey < SCCP_CALLINFO_KEY_SENTINEL; curkey = va_arg(ap, sccp_callinfo_key_t)) {
@@ -255,11 +358,11 @@ static int callinfo_Setter(sccp_callinfo_t * const ci, int key, ...)							// ke
 
 	va_end(ap);
 	if (changes) {
-		ci->content.changed = TRUE;
+		ci->content.version++;
 	}
-	sccp_callinfo_unlock(ci);
+	callinfo_write_end(ci);
 
-	if ((GLOB(debug) & (DEBUGCAT_CALLINFO)) != 0) {
+	if (sccp_debug_enabled(DEBUGCAT_CALLINFO)) {
 		iCallInfo.Print2log(ci, "SCCP: (sccp_callinfo_setter) after:");
 	}
 	sccp_log(DEBUGCAT_CALLINFO)(VERBOSE_PREFIX_3 "%p: (sccp_callinfo_setter) changes:%d\n", ci, changes);
@@ -287,7 +390,8 @@ static int callinfo_CopyByKey(const sccp_callinfo_t * const src_ci, sccp_callinf
 		iCallInfo.Print2log(dst_ci, "SCCP: (sccp_callinfo_copyByKey) orig dst_ci");
 	}
 	*/
-	sccp_callinfo_rdlock(src_ci);
+	struct ci_content src_content;
+	callinfo_read(src_ci, &src_content);
 	va_list ap;
 	va_start(ap, key);
 	dstkey=va_arg(ap, sccp_callinfo_key_t);
@@ -300,8 +404,8 @@ static int callinfo_CopyByKey(const sccp_callinfo_t * const src_ci, sccp_callinf
 		case SCCP_CALLINFO_ORIG_CALLEDPARTY_REDIRECT_REASON:
 			{
 				if (srckey == dstkey) {
-					if (tmp_ci_content.originalCdpnRedirectReason != src_ci->content.originalCdpnRedirectReason) {
-						tmp_ci_content.originalCdpnRedirectReason = src_ci->content.originalCdpnRedirectReason;
+					if (tmp_ci_content.originalCdpnRedirectReason != src_content.originalCdpnRedirectReason) {
+						tmp_ci_content.originalCdpnRedirectReason = src_content.originalCdpnRedirectReason;
 						changes++;
 					}
 				} else {
@@ -312,8 +416,8 @@ static int callinfo_CopyByKey(const sccp_callinfo_t * const src_ci, sccp_callinf
 		case SCCP_CALLINFO_LAST_REDIRECT_REASON:
 			{
 				if (srckey == dstkey) {
-					if (tmp_ci_content.lastRedirectingReason != src_ci->content.lastRedirectingReason) {
-						tmp_ci_content.lastRedirectingReason = src_ci->content.lastRedirectingReason;
+					if (tmp_ci_content.lastRedirectingReason != src_content.lastRedirectingReason) {
+						tmp_ci_content.lastRedirectingReason = src_content.lastRedirectingReason;
 						changes++;
 					}
 				} else {
@@ -324,8 +428,8 @@ static int callinfo_CopyByKey(const sccp_callinfo_t * const src_ci, sccp_callinf
 		case SCCP_CALLINFO_PRESENTATION:
 			{
 				if (srckey == dstkey) {
-					if (tmp_ci_content.presentation != src_ci->content.presentation) {
-						tmp_ci_content.presentation = src_ci->content.presentation;
+					if (tmp_ci_content.presentation != src_content.presentation) {
+						tmp_ci_content.presentation = src_content.presentation;
 						changes++;
 					}
 				} else {
@@ -337,7 +441,7 @@ static int callinfo_CopyByKey(const sccp_callinfo_t * const src_ci, sccp_callinf
 			{
 				struct callinfo_lookup src_entry = callinfo_lookup[srckey];
 				struct callinfo_lookup tmp_entry = callinfo_lookup[dstkey];
-				callinfo_entry_t *src_callinfo = (callinfo_entry_t *const) &src_ci->content.entries[src_entry.group];
+				callinfo_entry_t *src_callinfo = &src_content.entries[src_entry.group];
 				callinfo_entry_t *tmp_callinfo = &tmp_ci_content.entries[tmp_entry.group];
 				
 				char *srcPtr = NULL;
@@ -397,14 +501,13 @@ static int callinfo_CopyByKey(const sccp_callinfo_t * const src_ci, sccp_callinf
 		}
 	}
 	va_end(ap);
-	sccp_callinfo_unlock(src_ci);
 	
-	sccp_callinfo_wrlock(dst_ci);
+	callinfo_write_begin(dst_ci);
+	tmp_ci_content.version = dst_ci->content.version + 1;
 	memcpy(&dst_ci->content, &tmp_ci_content, sizeof(struct ci_content));
-	dst_ci->content.changed = TRUE;
-	sccp_callinfo_unlock(dst_ci);
+	callinfo_write_end(dst_ci);
 	
-	if ((GLOB(debug) & (DEBUGCAT_CALLINFO)) != 0) {
+	if (sccp_debug_enabled(DEBUGCAT_CALLINFO)) {
 		iCallInfo.Print2log(dst_ci, "SCCP: (sccp_callinfo_copyByKey) new dst_ci");
 	}
 	sccp_log(DEBUGCAT_CALLINFO)(VERBOSE_PREFIX_3 "%p: (sccp_callinfo_copyByKey) changes:%d\n", dst_ci, changes);
@@ -421,7 +524,8 @@ static int callinfo_Getter(const sccp_callinfo_t * const ci, int key, ...)
 	sccp_callinfo_key_t curkey = SCCP_CALLINFO_NONE;
 	int entries = 0;
 
-	sccp_callinfo_rdlock(ci);
+	struct ci_content content;
+	callinfo_read(ci, &content);
 	va_list ap;
 	va_start(ap, key);
 
@@ -431,8 +535,8 @@ static int callinfo_Getter(const sccp_callinfo_t * const ci, int key, ...)
 		case SCCP_CALLINFO_ORIG_CALLEDPARTY_REDIRECT_REASON:
 			{
 				uint *dstPtr = va_arg(ap, uint *);
-				if (*dstPtr != ci->content.originalCdpnRedirectReason) {
-					*dstPtr = ci->content.originalCdpnRedirectReason;
+				if (*dstPtr != content.originalCdpnRedirectReason) {
+					*dstPtr = content.originalCdpnRedirectReason;
 					entries++;
 				}
 			}
@@ -440,8 +544,8 @@ static int callinfo_Getter(const sccp_callinfo_t * const ci, int key, ...)
 		case SCCP_CALLINFO_LAST_REDIRECT_REASON:
 			{
 				uint *dstPtr = va_arg(ap, uint *);
-				if (*dstPtr != ci->content.lastRedirectingReason) {
-					*dstPtr = ci->content.lastRedirectingReason;
+				if (*dstPtr != content.lastRedirectingReason) {
+					*dstPtr = content.lastRedirectingReason;
 					entries++;
 				}
 			}
@@ -449,8 +553,8 @@ static int callinfo_Getter(const sccp_callinfo_t * const ci, int key, ...)
 		case SCCP_CALLINFO_PRESENTATION:
 			{
 				sccp_callerid_presentation_t *dstPtr = va_arg(ap, sccp_callerid_presentation_t *);
-				if (*dstPtr != ci->content.presentation) {
-					*dstPtr = ci->content.presentation;
+				if (*dstPtr != content.presentation) {
+					*dstPtr = content.presentation;
 					entries++;
 				}
 			}
@@ -463,7 +567,7 @@ static int callinfo_Getter(const sccp_callinfo_t * const ci, int key, ...)
 					char *srcPtr = NULL;
 					uint16_t *validPtr = NULL;
 					struct callinfo_lookup entry = callinfo_lookup[curkey];
-					callinfo_entry_t *callinfo = (callinfo_entry_t *const) &(ci->content.entries[entry.group]);
+					callinfo_entry_t *callinfo = &(content.entries[entry.group]);
 
 					switch(entry.type) {
 						case NAME:
@@ -504,9 +608,8 @@ static int callinfo_Getter(const sccp_callinfo_t * const ci, int key, ...)
 	}
 
 	va_end(ap);
-	sccp_callinfo_unlock(ci);
 
-	if ((GLOB(debug) & (DEBUGCAT_CALLINFO)) != 0) {
+	if (sccp_debug_enabled(DEBUGCAT_CALLINFO)) {
 		//#ifdef DEBUG
 		//sccp_do_backtrace();
 		//#endif
@@ -518,16 +621,20 @@ static int callinfo_Getter(const sccp_callinfo_t * const ci, int key, ...)
 
 static int callinfo_Send(sccp_callinfo_t * const ci, const uint32_t callid, const skinny_calltype_t calltype, const uint8_t lineInstance, const sccp_device_t * const device, boolean_t force)
 {
-	if (ci->content.changed || force) {
+	uint32_t version = ci->content.version;									/* single word, read without the seqlock */
+
+	if (version != ci->sentVersion || force) {
 		/* dependency on sccp_device.h should be fixed */
 		if (device && device->protocol && device->protocol->sendCallInfo) {
 			// using for to set the callsecuritystate is a temporary solution
 			// when indicating ringout the security state should be SKINNY_CALLSECURITYSTATE_UNKNOWN
 			// when indicating connected it should change to SKINNY_CALLSECURITYSTATE_NOTAUTHENTICATED
 			device->protocol->sendCallInfo(ci, callid, calltype, lineInstance, ci->content.callInstance, force ? SKINNY_CALLSECURITYSTATE_NOTAUTHENTICATED : SKINNY_CALLSECURITYSTATE_UNKNOWN, device);
-			sccp_callinfo_wrlock(ci);
-			ci->content.changed = FALSE;
-			sccp_callinfo_unlock(ci);
+			pbx_mutex_lock(&ci->writelock);
+			if ((int32_t)(version - ci->sentVersion) > 0) {						/* changes made while sending remain unsent */
+				ci->sentVersion = version;
+			}
+			pbx_mutex_unlock(&ci->writelock);
 			return 1;
 		}
 	} else {
@@ -537,6 +644,37 @@ static int callinfo_Send(sccp_callinfo_t * const ci, const uint32_t callid, cons
 	return 0;
 }
 
+static int callinfo_Encode(const sccp_callinfo_t * const ci, sccp_callinfo_encoding_t encoding, sccp_callinfo_encoder_t encoder, void * const buffer, const size_t size)
+{
+	pbx_assert(ci != NULL && encoder != NULL && buffer != NULL);
+	sccp_callinfo_t * const ci_rw = (sccp_callinfo_t * const) ci;						/* discard const, only touching the cache */
+	int len = -1;
+
+	if (encoding >= SCCP_CALLINFO_ENCODING_SENTINEL) {
+		return encoder(ci, buffer, size);
+	}
+	pbx_mutex_lock(&ci_rw->writelock);									/* content cannot change while we hold the writelock */
+	if (ci_rw->encoded[encoding].version == ci->content.version && ci_rw->encoded[encoding].len <= (int) size) {
+		len = ci_rw->encoded[encoding].len;
+		memcpy(buffer, ci_rw->encoded[encoding].data, len);
+		ci_rw->encoded[encoding].hits++;
+	} else if ((len = encoder(ci, buffer, size)) >= 0) {
+		if ((size_t) len > ci_rw->encoded[encoding].allocated) {
+			uint8_t *data = sccp_realloc(ci_rw->encoded[encoding].data, len);
+			if (data) {
+				ci_rw->encoded[encoding].data = data;
+				ci_rw->encoded[encoding].allocated = len;
+			}
+		}
+		if ((size_t) len <= ci_rw->encoded[encoding].allocated) {
+			memcpy(ci_rw->encoded[encoding].data, buffer, len);
+			ci_rw->encoded[encoding].len = len;
+			ci_rw->encoded[encoding].version = ci->content.version;
+		}
+	}
+	pbx_mutex_unlock(&ci_rw->writelock);
+	return len;
+}
 
 static int callinfo_SetCalledParty(sccp_callinfo_t * const ci, const char name[StationMaxNameSize], const char number[StationMaxDirnumSize], const char voicemail[StationMaxDirnumSize])
 {
@@ -571,38 +709,38 @@ static int callinfo_SetLastRedirectingParty(sccp_callinfo_t * const ci, const ch
 static gcc_inline boolean_t __GetCallInfoStr(const sccp_callinfo_t * const ci, pbx_str_t ** const buf)
 {
 	pbx_assert(ci != NULL);
-	sccp_callinfo_rdlock(ci);
+	struct ci_content content;
+	callinfo_read(ci, &content);
 	pbx_str_append(buf, 0, "%p: (getCallInfoStr):\n", ci);
-	if (ci->content.entries[CALLED_PARTY].NumberValid || ci->content.entries[CALLED_PARTY].VoiceMailboxValid) {
-		pbx_str_append(buf, 0, " - calledParty: %s <%s>%s%s%s\n", ci->content.entries[CALLED_PARTY].Name, ci->content.entries[CALLED_PARTY].Number, 
-			(ci->content.entries[CALLED_PARTY].VoiceMailboxValid) ? " voicemail: " : "", ci->content.entries[CALLED_PARTY].VoiceMailbox, 
-			(ci->content.entries[CALLED_PARTY].NumberValid) ? ", valid" : ", invalid");
+	if (content.entries[CALLED_PARTY].NumberValid || content.entries[CALLED_PARTY].VoiceMailboxValid) {
+		pbx_str_append(buf, 0, " - calledParty: %s <%s>%s%s%s\n", content.entries[CALLED_PARTY].Name, content.entries[CALLED_PARTY].Number, 
+			(content.entries[CALLED_PARTY].VoiceMailboxValid) ? " voicemail: " : "", content.entries[CALLED_PARTY].VoiceMailbox, 
+			(content.entries[CALLED_PARTY].NumberValid) ? ", valid" : ", invalid");
 	}
-	if (ci->content.entries[CALLING_PARTY].NumberValid || ci->content.entries[CALLING_PARTY].VoiceMailboxValid) {
-		pbx_str_append(buf, 0, " - callingParty: %s <%s>%s%s%s\n", ci->content.entries[CALLING_PARTY].Name, ci->content.entries[CALLING_PARTY].Number, 
-			(ci->content.entries[CALLING_PARTY].VoiceMailboxValid) ? " voicemail: " : "", ci->content.entries[CALLING_PARTY].VoiceMailbox, 
-			(ci->content.entries[CALLING_PARTY].NumberValid) ? ", valid" : ", invalid");
+	if (content.entries[CALLING_PARTY].NumberValid || content.entries[CALLING_PARTY].VoiceMailboxValid) {
+		pbx_str_append(buf, 0, " - callingParty: %s <%s>%s%s%s\n", content.entries[CALLING_PARTY].Name, content.entries[CALLING_PARTY].Number, 
+			(content.entries[CALLING_PARTY].VoiceMailboxValid) ? " voicemail: " : "", content.entries[CALLING_PARTY].VoiceMailbox, 
+			(content.entries[CALLING_PARTY].NumberValid) ? ", valid" : ", invalid");
 	}
-	if (ci->content.entries[ORIG_CALLED_PARTY].NumberValid || ci->content.entries[ORIG_CALLED_PARTY].VoiceMailboxValid) {
-		pbx_str_append(buf, 0, " - originalCalledParty: %s <%s>%s%s%s, reason: %d\n", ci->content.entries[ORIG_CALLED_PARTY].Name, ci->content.entries[ORIG_CALLED_PARTY].Number, 
-			(ci->content.entries[ORIG_CALLED_PARTY].VoiceMailboxValid) ? " voicemail: " : "", ci->content.entries[ORIG_CALLED_PARTY].VoiceMailbox, 
-			(ci->content.entries[ORIG_CALLED_PARTY].NumberValid) ? ", valid" : ", invalid",
-			ci->content.originalCdpnRedirectReason);
+	if (content.entries[ORIG_CALLED_PARTY].NumberValid || content.entries[ORIG_CALLED_PARTY].VoiceMailboxValid) {
+		pbx_str_append(buf, 0, " - originalCalledParty: %s <%s>%s%s%s, reason: %d\n", content.entries[ORIG_CALLED_PARTY].Name, content.entries[ORIG_CALLED_PARTY].Number, 
+			(content.entries[ORIG_CALLED_PARTY].VoiceMailboxValid) ? " voicemail: " : "", content.entries[ORIG_CALLED_PARTY].VoiceMailbox, 
+			(content.entries[ORIG_CALLED_PARTY].NumberValid) ? ", valid" : ", invalid",
+			content.originalCdpnRedirectReason);
 	}
-	if (ci->content.entries[ORIG_CALLING_PARTY].NumberValid) {
-		pbx_str_append(buf, 0, " - originalCallingParty: %s <%s>, valid\n", ci->content.entries[ORIG_CALLING_PARTY].Name, ci->content.entries[ORIG_CALLING_PARTY].Number);
+	if (content.entries[ORIG_CALLING_PARTY].NumberValid) {
+		pbx_str_append(buf, 0, " - originalCallingParty: %s <%s>, valid\n", content.entries[ORIG_CALLING_PARTY].Name, content.entries[ORIG_CALLING_PARTY].Number);
 	}
-	if (ci->content.entries[LAST_REDIRECTING_PARTY].NumberValid || ci->content.entries[LAST_REDIRECTING_PARTY].VoiceMailboxValid) {
-		pbx_str_append(buf, 0, " - lastRedirectingParty: %s <%s>%s%s%s, reason: %d\n", ci->content.entries[LAST_REDIRECTING_PARTY].Name, ci->content.entries[LAST_REDIRECTING_PARTY].Number, 
-			(ci->content.entries[LAST_REDIRECTING_PARTY].VoiceMailboxValid) ? " voicemail: " : "", ci->content.entries[LAST_REDIRECTING_PARTY].VoiceMailbox, 
-			(ci->content.entries[LAST_REDIRECTING_PARTY].NumberValid) ? ", valid" : ", invalid",
-			ci->content.lastRedirectingReason);
+	if (content.entries[LAST_REDIRECTING_PARTY].NumberValid || content.entries[LAST_REDIRECTING_PARTY].VoiceMailboxValid) {
+		pbx_str_append(buf, 0, " - lastRedirectingParty: %s <%s>%s%s%s, reason: %d\n", content.entries[LAST_REDIRECTING_PARTY].Name, content.entries[LAST_REDIRECTING_PARTY].Number, 
+			(content.entries[LAST_REDIRECTING_PARTY].VoiceMailboxValid) ? " voicemail: " : "", content.entries[LAST_REDIRECTING_PARTY].VoiceMailbox, 
+			(content.entries[LAST_REDIRECTING_PARTY].NumberValid) ? ", valid" : ", invalid",
+			content.lastRedirectingReason);
 	}
-	if (ci->content.entries[HUNT_PILOT].NumberValid) {
-		pbx_str_append(buf, 0, " - huntPilot: %s <%s>, valid\n", ci->content.entries[HUNT_PILOT].Name, ci->content.entries[HUNT_PILOT].Number);
+	if (content.entries[HUNT_PILOT].NumberValid) {
+		pbx_str_append(buf, 0, " - huntPilot: %s <%s>, valid\n", content.entries[HUNT_PILOT].Name, content.entries[HUNT_PILOT].Number);
 	}
-	pbx_str_append(buf, 0, " - presentation: %s\n\n", sccp_callerid_presentation2str(ci->content.presentation));
-	sccp_callinfo_unlock(ci);
+	pbx_str_append(buf, 0, " - presentation: %s\n\n", sccp_callerid_presentation2str(content.presentation));
 	return TRUE;
 }
 
@@ -626,6 +764,7 @@ const CallInfoInterface iCallInfo = {
 	callinfo_Setter,
 	callinfo_CopyByKey,
 	callinfo_Send,
+	callinfo_Encode,
 	callinfo_Getter,
 	callinfo_SetCalledParty,
 	callinfo_SetCallingParty,
@@ -778,14 +917,82 @@ AST_TEST_DEFINE(sccp_callinfo_tests)
 	return AST_TEST_PASS;
 }
 
+static int encodeCount = 0;
+static int sccp_callinfo_test_encoder(const sccp_callinfo_t * const ci, void * const buffer, const size_t size)
+{
+	encodeCount++;
+	return iCallInfo.Getter(ci, SCCP_CALLINFO_CALLINGPARTY_NAME, buffer, SCCP_CALLINFO_KEY_SENTINEL) >= 0 ? (int) strlen(buffer) + 1 : -1;
+}
+
+AST_TEST_DEFINE(sccp_callinfo_version_tests)
+{
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "callinfo_version";
+			info->category = "/channels/chan_sccp/";
+			info->summary = "chan-sccp-b callinfo version and cache test";
+			info->description = "chan-sccp-b callinfo version is only advanced by changes, reused objects come back clean";
+			return AST_TEST_NOT_RUN;
+	        case TEST_EXECUTE:
+	        	break;
+	}
+	sccp_callinfo_t *citest = NULL;
+	uint32_t version = 0;
+	char name[StationMaxNameSize] = "";
+
+	pbx_test_status_update(test, "New callinfo has not been sent...\n");
+	citest = iCallInfo.Constructor(3);
+	pbx_test_validate(test, citest != NULL);
+	pbx_test_validate(test, citest->content.version != citest->sentVersion);
+	version = citest->content.version;
+
+	pbx_test_status_update(test, "Setter advances version on change only...\n");
+	pbx_test_validate(test, iCallInfo.Setter(citest, SCCP_CALLINFO_CALLINGPARTY_NAME, "name", SCCP_CALLINFO_KEY_SENTINEL) == 1);
+	pbx_test_validate(test, citest->content.version == version + 1);
+	pbx_test_validate(test, iCallInfo.Setter(citest, SCCP_CALLINFO_CALLINGPARTY_NAME, "name", SCCP_CALLINFO_KEY_SENTINEL) == 0);
+	pbx_test_validate(test, citest->content.version == version + 1);
+	pbx_test_validate(test, (citest->seq & 1) == 0);
+
+	pbx_test_status_update(test, "Encode only calls the encoder when the version changed...\n");
+	encodeCount = 0;
+	pbx_test_validate(test, iCallInfo.Encode(citest, SCCP_CALLINFO_ENCODING_V7, sccp_callinfo_test_encoder, name, sizeof(name)) == 5);
+	memset(name, 0, sizeof(name));
+	pbx_test_validate(test, iCallInfo.Encode(citest, SCCP_CALLINFO_ENCODING_V7, sccp_callinfo_test_encoder, name, sizeof(name)) == 5);
+	pbx_test_validate(test, encodeCount == 1 && sccp_strequals(name, "name"));
+	pbx_test_validate(test, iCallInfo.Encode(citest, SCCP_CALLINFO_ENCODING_V16, sccp_callinfo_test_encoder, name, sizeof(name)) == 5);
+	pbx_test_validate(test, encodeCount == 2);
+	iCallInfo.Setter(citest, SCCP_CALLINFO_CALLINGPARTY_NAME, "other", SCCP_CALLINFO_KEY_SENTINEL);
+	pbx_test_validate(test, iCallInfo.Encode(citest, SCCP_CALLINFO_ENCODING_V7, sccp_callinfo_test_encoder, name, sizeof(name)) == 6);
+	pbx_test_validate(test, encodeCount == 3 && sccp_strequals(name, "other"));
+	name[0] = '\0';
+
+	pbx_test_status_update(test, "Released callinfo comes back clean...\n");
+	citest = iCallInfo.Destructor(&citest);
+	pbx_test_validate(test, citest == NULL);
+	citest = iCallInfo.Constructor(4);
+	pbx_test_validate(test, citest != NULL);
+	pbx_test_validate(test, iCallInfo.Getter(citest, SCCP_CALLINFO_CALLINGPARTY_NAME, &name, SCCP_CALLINFO_KEY_SENTINEL) == 0);
+	pbx_test_validate(test, sccp_strlen_zero(name));
+	pbx_test_validate(test, citest->content.callInstance == 4);
+	pbx_test_validate(test, citest->content.version != citest->sentVersion);
+	pbx_test_validate(test, iCallInfo.Encode(citest, SCCP_CALLINFO_ENCODING_V7, sccp_callinfo_test_encoder, name, sizeof(name)) == 1);
+	pbx_test_validate(test, encodeCount == 4);
+	citest = iCallInfo.Destructor(&citest);
+	pbx_test_validate(test, citest == NULL);
+
+	return AST_TEST_PASS;
+}
+
 static void __attribute__((constructor)) sccp_register_tests(void)
 {
         AST_TEST_REGISTER(sccp_callinfo_tests);
+        AST_TEST_REGISTER(sccp_callinfo_version_tests);
 }
 
 static void __attribute__((destructor)) sccp_unregister_tests(void)
 {
         AST_TEST_UNREGISTER(sccp_callinfo_tests);
+        AST_TEST_UNREGISTER(sccp_callinfo_version_tests);
 }
 #endif
 // kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
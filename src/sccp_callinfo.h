@@ -23,6 +23,21 @@ __BEGIN_C_EXTERN__
 /* forward declaration */
 struct sccp_callinfo;
 
+/*!
+ * \brief CallInfo message encodings, which can be cached per callinfo (see iCallInfo.Encode)
+ */
+typedef enum {
+	SCCP_CALLINFO_ENCODING_V3,										/*!< CallInfoMessage */
+	SCCP_CALLINFO_ENCODING_V7,										/*!< CallInfoDynamicMessage (v7 - v15) */
+	SCCP_CALLINFO_ENCODING_V16,										/*!< CallInfoDynamicMessage (v16+) */
+	SCCP_CALLINFO_ENCODING_SENTINEL,
+} sccp_callinfo_encoding_t;
+
+/*!
+ * \brief encode the device independent part of a callinfo message into buffer, returning the encoded length (or -1)
+ */
+typedef int (*sccp_callinfo_encoder_t)(const sccp_callinfo_t * const ci, void * const buffer, const size_t size);
+
 /* Definition of the functions associated with this type. */
 typedef struct tagCallInfo {
 	sccp_callinfo_t * const (*Constructor)(uint8_t callInstance);
@@ -45,6 +60,12 @@ typedef struct tagCallInfo {
 	 * \brief send callinfo to device
 	 */
 	int (*Send)(sccp_callinfo_t * const ci, const uint32_t callid, const skinny_calltype_t calltype, const uint8_t lineInstance, const sccp_device_t * const device, boolean_t force);
+	/*
+	 * \brief get the encoded message body for this callinfo, only calling the encoder when the callinfo changed since the last time
+	 * buffer is used as scratch space by the encoder, and receives the (cached) body
+	 * \returns: length of the body in buffer, or -1
+	 */
+	int (*Encode)(const sccp_callinfo_t * const ci, sccp_callinfo_encoding_t encoding, sccp_callinfo_encoder_t encoder, void * const buffer, const size_t size);
 
 	/*
 	 * \brief callinfo getter with variable number of arguments, destination parameter needs to be prodided by reference
@@ -83,6 +83,58 @@ static void sccp_channel_setMicrophoneState(sccp_channel_t * channel, boolean_t
 	}
 }
 
+/*!
+ * \brief Add a channel to the global callid index
+ * \param channel SCCP Channel
+ *
+ * \note the index does not hold a reference, channels are removed again when they leave their line or get destroyed
+ * \note passthrupartyid is derived from the callid, so the same index is used to look up both
+ */
+static void sccp_channel_addToIndex(sccp_channel_t * channel)
+{
+	uint32_t hash = channel->callid % SCCP_HASH_PRIME;
+
+	SCCP_RWLIST_WRLOCK(&GLOB(channel_index)[hash]);
+	SCCP_RWLIST_INSERT_HEAD(&GLOB(channel_index)[hash], channel, hashlist);
+	SCCP_RWLIST_UNLOCK(&GLOB(channel_index)[hash]);
+}
+
+/*!
+ * \brief Remove a channel from the global callid index
+ * \param channel SCCP Channel
+ *
+ * \note safe to call for channels which are not (or no longer) indexed
+ */
+void sccp_channel_removeFromIndex(sccp_channel_t * channel)
+{
+	uint32_t hash = channel->callid % SCCP_HASH_PRIME;
+
+	SCCP_RWLIST_WRLOCK(&GLOB(channel_index)[hash]);
+	SCCP_RWLIST_REMOVE(&GLOB(channel_index)[hash], channel, hashlist);
+	SCCP_RWLIST_UNLOCK(&GLOB(channel_index)[hash]);
+}
+
+/*!
+ * \brief Find a channel, which is not DOWN, in the global callid index
+ * \param callid Call ID
+ * \return *refcounted* SCCP Channel (can be null)
+ */
+static sccp_channel_t *sccp_channel_find_inIndex(uint32_t callid)
+{
+	uint32_t hash = callid % SCCP_HASH_PRIME;
+	sccp_channel_t *c = NULL;
+	sccp_channel_t *tmpc = NULL;
+
+	SCCP_RWLIST_RDLOCK(&GLOB(channel_index)[hash]);
+	SCCP_RWLIST_TRAVERSE(&GLOB(channel_index)[hash], tmpc, hashlist) {
+		if (tmpc->callid == callid && tmpc->state != SCCP_CHANNELSTATE_DOWN && (c = sccp_channel_retain(tmpc))) {	/* retain fails when the channel is being destroyed */
+			break;
+		}
+	}
+	SCCP_RWLIST_UNLOCK(&GLOB(channel_index)[hash]);
+	return c;
+}
+
 /*!
  * \brief Allocate SCCP Channel on Device
  * \param l SCCP Line
@@ -196,6 +248,7 @@ channelPtr sccp_channel_allocate(constLinePtr l, constDevicePtr device)
 
 		/* run setters */
 		sccp_line_addChannel(l, channel);
+		sccp_channel_addToIndex(channel);
 		channel->setDevice(channel, device);
 
 		/* return new channel */
@@ -480,7 +533,7 @@ void sccp_channel_setChannelstate(channelPtr channel, sccp_channelstate_t state)
  */
 void sccp_channel_display_callInfo(sccp_channel_t * channel)
 {
-	if ((GLOB(debug) & (DEBUGCAT_CHANNEL)) != 0) {
+	if (sccp_debug_enabled(DEBUGCAT_CHANNEL)) {
 		iCallInfo.Print2log(channel->privateData->callInfo, channel->designator);
 	}
 }
@@ -2020,6 +2073,7 @@ void __sccp_channel_destroy(sccp_channel_t * channel)
 	}
 
 	sccp_log((DEBUGCAT_CHANNEL)) (VERBOSE_PREFIX_3 "Destroying channel %s\n", channel->designator);
+	sccp_channel_removeFromIndex(channel);
 	AUTO_RELEASE(sccp_device_t, d , sccp_channel_getDevice(channel));
 	if (d) {
 		sccp_channel_closeAllMediaTransmitAndReceive(d, channel);
@@ -2806,18 +2860,10 @@ sccp_channel_t *sccp_find_channel_by_lineInstance_and_callid(const sccp_device_t
 sccp_channel_t *sccp_channel_find_byid(uint32_t callid)
 {
 	sccp_channel_t *channel = NULL;
-	sccp_line_t *l = NULL;
 
 	sccp_log((DEBUGCAT_CHANNEL)) (VERBOSE_PREFIX_3 "SCCP: Looking for channel by id %u\n", callid);
 
-	SCCP_RWLIST_RDLOCK(&GLOB(lines));
-	SCCP_RWLIST_TRAVERSE(&GLOB(lines), l, list) {
-		channel = sccp_find_channel_on_line_byid(l, callid);
-		if (channel) {
-			break;
-		}
-	}
-	SCCP_RWLIST_UNLOCK(&GLOB(lines));
+	channel = sccp_channel_find_inIndex(callid);
 	if (!channel) {
 		sccp_log((DEBUGCAT_CHANNEL)) (VERBOSE_PREFIX_3 "SCCP: Could not find channel for callid:%d on device\n", callid);
 	}
@@ -2839,20 +2885,10 @@ sccp_channel_t *sccp_channel_find_byid(uint32_t callid)
 sccp_channel_t *sccp_channel_find_bypassthrupartyid(uint32_t passthrupartyid)
 {
 	sccp_channel_t *c = NULL;
-	sccp_line_t *l = NULL;
 
 	sccp_log((DEBUGCAT_CHANNEL)) (VERBOSE_PREFIX_3 "SCCP: Looking for channel by PassThruId %u\n", passthrupartyid);
 
-	SCCP_RWLIST_RDLOCK(&GLOB(lines));
-	SCCP_RWLIST_TRAVERSE(&GLOB(lines), l, list) {
-		SCCP_LIST_LOCK(&l->channels);
-		c = SCCP_LIST_FIND(&l->channels, sccp_channel_t, tmpc, list, (tmpc->passthrupartyid == passthrupartyid && tmpc->state != SCCP_CHANNELSTATE_DOWN), TRUE, __FILE__, __LINE__, __PRETTY_FUNCTION__);
-		SCCP_LIST_UNLOCK(&l->channels);
-		if (c) {
-			break;
-		}
-	}
-	SCCP_RWLIST_UNLOCK(&GLOB(lines));
+	c = sccp_channel_find_inIndex(passthrupartyid ^ 0xFFFFFFFF);						/* passthrupartyid = callid ^ 0xFFFFFFFF, see sccp_channel_allocate */
 
 	if (!c) {
 		sccp_log((DEBUGCAT_CHANNEL)) (VERBOSE_PREFIX_3 "SCCP: Could not find active channel with Passthrupartyid %u\n", passthrupartyid);
@@ -34,6 +34,7 @@ struct sccp_channel {
 	PBX_CHANNEL_TYPE *owner;										/*!< Asterisk Channel Owner */
 	sccp_line_t * const line;										/*!< SCCP Line */
 	SCCP_LIST_ENTRY (sccp_channel_t) list;									/*!< Channel Linked List */
+	SCCP_RWLIST_ENTRY (sccp_channel_t) hashlist;								/*!< Global Channel Index Entry (by callid) */
 	char dialedNumber[SCCP_MAX_EXTENSION];									/*!< Last Dialed Number */
 	const char * const designator;
 	sccp_subscription_id_t subscriptionId;
@@ -205,6 +206,7 @@ SCCP_API const char *sccp_channel_getLinkedId(const sccp_channel_t * channel);
 #endif
 
 // find channel
+SCCP_API void SCCP_CALL sccp_channel_removeFromIndex(sccp_channel_t * channel);
 SCCP_API sccp_channel_t * SCCP_CALL sccp_channel_find_byid(uint32_t callid);
 SCCP_API sccp_channel_t * SCCP_CALL sccp_find_channel_on_line_byid(constLinePtr l, uint32_t id);
 SCCP_API sccp_channel_t * SCCP_CALL sccp_channel_find_bypassthrupartyid(uint32_t passthrupartyid);
@@ -583,7 +583,7 @@ static int sccp_show_globals(int fd, sccp_cli_totals_t *totals, struct mansessio
 	if (sccp_netsock_is_any_addr(&GLOB(externip)) && GLOB(externhost)) {
 		struct sockaddr_storage externip;
 		boolean_t lookup_success = sccp_netsock_getExternalAddr(&externip, sccp_netsock_is_IPv6(&GLOB(bindaddr)) ? AF_INET6 : AF_INET);
-		CLI_AMI_OUTPUT_PARAM("Extern Host", CLI_AMI_LIST_WIDTH, "%s -> %s", GLOB(externhost), lookup_success ? sccp_netsock_stringify_addr(&externip) : "Resolve Failed!");
+		CLI_AMI_OUTPUT_PARAM("Extern Host", CLI_AMI_LIST_WIDTH, "%s -> %s", GLOB(externhost), lookup_success ? sccp_netsock_stringify_addr(&externip) : "Not Resolved (Yet)");
 		CLI_AMI_OUTPUT_PARAM("Extern Refresh", CLI_AMI_LIST_WIDTH, "%d", GLOB(externrefresh));
 	}
 
@@ -1892,6 +1892,38 @@ CLI_ENTRY(cli_test, sccp_test, "Test", cli_test_usage, FALSE)
 
 #endif														// CS_EXPERIMENTAL
 
+    /* ---------------------------------------------------------------------------------------------SHOW_THREADPOOL - */
+static char cli_show_threadpool_usage[] = "Usage: sccp show threadpool\n" "	Show SCCP Threadpool queue depth and latency statistics.\n";
+static char ami_show_threadpool_usage[] = "Usage: SCCPShowThreadpool\n" "Show SCCP Threadpool queue depth and latency statistics.\n\n" "PARAMS: None\n";
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CLI_COMMAND "sccp", "show", "threadpool"
+#define AMI_COMMAND "SCCPShowThreadpool"
+#define CLI_COMPLETE SCCP_CLI_NULL_COMPLETER
+#define CLI_AMI_PARAMS ""
+CLI_AMI_ENTRY(show_threadpool, sccp_show_threadpool, "Show Threadpool Statistics", cli_show_threadpool_usage, FALSE, TRUE)
+#undef CLI_AMI_PARAMS
+#undef CLI_COMPLETE
+#undef AMI_COMMAND
+#undef CLI_COMMAND
+#endif														/* DOXYGEN_SHOULD_SKIP_THIS */
+
+    /* ----------------------------------------------------------------------------------------------SHOW_ADMISSION - */
+static char cli_show_admission_usage[] = "Usage: sccp show admission\n" "	Show SCCP Registration Admission Control statistics.\n";
+static char ami_show_admission_usage[] = "Usage: SCCPShowAdmission\n" "Show SCCP Registration Admission Control statistics.\n\n" "PARAMS: None\n";
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CLI_COMMAND "sccp", "show", "admission"
+#define AMI_COMMAND "SCCPShowAdmission"
+#define CLI_COMPLETE SCCP_CLI_NULL_COMPLETER
+#define CLI_AMI_PARAMS ""
+CLI_AMI_ENTRY(show_admission, sccp_cli_show_admission, "Show Registration Admission Statistics", cli_show_admission_usage, FALSE, TRUE)
+#undef CLI_AMI_PARAMS
+#undef CLI_COMPLETE
+#undef AMI_COMMAND
+#undef CLI_COMMAND
+#endif														/* DOXYGEN_SHOULD_SKIP_THIS */
+
     /* ---------------------------------------------------------------------------------------------SHOW_REFCOUNT - */
 static char cli_show_refcount_usage[] = "Usage: sccp show refcount [show|suppress]\n" "	Show All SCCP Refcount Entries.\n";
 static char ami_show_refcount_usage[] = "Usage: SCCPShowRefcount\n" "Show All Refcount Entries.\n\n" "Optional PARAMS: inuse [show, suppress]\n";
@@ -2402,7 +2434,7 @@ static int sccp_do_debug(int fd, int argc, char *argv[])
 	return RESULT_SUCCESS;
 }
 
-static char do_debug_usage[] = "Usage: SCCP debug [no] <level or categories>\n" "       Where categories is one or more (separated by commas) of:\n" "       core, sccp, hint, rtp, device, line, action, channel, cli, config, feature, feature_button, softkey,\n" "       indicate, pbx, socket, mwi, event, adv_feature, conference, buttontemplate, speeddial, codec, realtime,\n" "       lock, newcode, high\n";
+static char do_debug_usage[] = "Usage: SCCP debug [no] <level or categories>\n" "       Where categories is one or more (separated by commas) of:\n" "       core, sccp, hint, rtp, device, line, action, channel, cli, config, feature, feature_button, softkey,\n" "       indicate, pbx, socket, mwi, event, adv_feature, conference, buttontemplate, speeddial, codec, realtime,\n" "       lock, newcode, high, trace\n";
 
 #ifndef DOXYGEN_SHOULD_SKIP_THIS
 #define CLI_COMMAND "sccp", "debug"
@@ -2439,6 +2471,90 @@ static char no_debug_usage[] = "Usage: SCCP no debug\n" "       Disables dumping
 CLI_ENTRY(cli_no_debug, sccp_no_debug, "Set SCCP Debugging Types", no_debug_usage, FALSE)
 #undef CLI_COMMAND
 #undef CLI_COMPLETE
+#endif														/* DOXYGEN_SHOULD_SKIP_THIS */
+    /* ----------------------------------------------------------------------------------------------------------SHOW TRACE- */
+static void sccp_cli_trace_print(void *data, const char *line)
+{
+	pbx_cli(*(int *) data, "%s", line);
+}
+
+static void sccp_cli_trace_write(void *data, const char *line)
+{
+	fputs(line, (FILE *) data);
+}
+
+    /*!
+     * \brief Show the most recent records of the debug trace buffer
+     * \param fd Fd as int
+     * \param argc Argc as int
+     * \param argv[] Argv[] as char
+     * \return Result as int
+     * 
+     * \called_from_asterisk
+     */
+static int sccp_show_trace(int fd, int argc, char *argv[])
+{
+	int max = 100;
+	int count = 0;
+
+	if (argc > 4 || (argc == 4 && (sscanf(argv[3], "%d", &max) != 1 || max < 0))) {
+		return RESULT_SHOWUSAGE;
+	}
+	if ((count = sccp_trace_print(max, sccp_cli_trace_print, &fd)) < 0) {
+		return RESULT_FAILURE;
+	}
+	pbx_cli(fd, "%d trace records%s\n", count, (GLOB(debug) & DEBUGCAT_TRACE) ? "" : " (tracing is off, use 'sccp debug trace' to enable)");
+	return RESULT_SUCCESS;
+}
+
+static char show_trace_usage[] = "Usage: sccp show trace [count]\n" "       Show the last [count] (default 100, 0 for all) records of the debug trace buffer.\n" "       Debug output is sent to the trace buffer instead of the log while 'sccp debug trace' is active.\n";
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CLI_COMMAND "sccp", "show", "trace"
+#define CLI_COMPLETE SCCP_CLI_NULL_COMPLETER
+CLI_ENTRY(cli_show_trace, sccp_show_trace, "Show SCCP debug trace buffer", show_trace_usage, FALSE)
+#undef CLI_COMMAND
+#undef CLI_COMPLETE
+#endif														/* DOXYGEN_SHOULD_SKIP_THIS */
+    /* ----------------------------------------------------------------------------------------------------------SAVE TRACE- */
+    /*!
+     * \brief Write the debug trace buffer to a file
+     * \param fd Fd as int
+     * \param argc Argc as int
+     * \param argv[] Argv[] as char
+     * \return Result as int
+     * 
+     * \called_from_asterisk
+     */
+static int sccp_save_trace(int fd, int argc, char *argv[])
+{
+	FILE *file = NULL;
+	int count = 0;
+
+	if (argc != 4 || sccp_strlen_zero(argv[3])) {
+		return RESULT_SHOWUSAGE;
+	}
+	if (!(file = fopen(argv[3], "w"))) {
+		pbx_cli(fd, "Unable to open '%s' for writing: %s\n", argv[3], strerror(errno));
+		return RESULT_FAILURE;
+	}
+	count = sccp_trace_print(0, sccp_cli_trace_write, file);
+	fclose(file);
+	if (count < 0) {
+		return RESULT_FAILURE;
+	}
+	pbx_cli(fd, "%d trace records written to '%s'\n", count, argv[3]);
+	return RESULT_SUCCESS;
+}
+
+static char save_trace_usage[] = "Usage: sccp save trace <filename>\n" "       Write the complete debug trace buffer to <filename>.\n";
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CLI_COMMAND "sccp", "save", "trace"
+#define CLI_COMPLETE SCCP_CLI_NULL_COMPLETER
+CLI_ENTRY(cli_save_trace, sccp_save_trace, "Save SCCP debug trace buffer", save_trace_usage, FALSE)
+#undef CLI_COMMAND
+#undef CLI_COMPLETE
 #endif														/* DOXYGEN_SHOULD_SKIP_THIS */
 /* --------------------------------------------------------------------------------------------------------------RELOAD- */
 /*!
@@ -3408,6 +3524,8 @@ static struct pbx_cli_entry cli_entries[] = {
 	AST_CLI_DEFINE(cli_dnd_device, "Set DND on a device"),
 	AST_CLI_DEFINE(cli_do_debug, "Enable SCCP debugging."),
 	AST_CLI_DEFINE(cli_no_debug, "Disable SCCP debugging."),
+	AST_CLI_DEFINE(cli_show_trace, "Show SCCP debug trace buffer."),
+	AST_CLI_DEFINE(cli_save_trace, "Save SCCP debug trace buffer to a file."),
 	AST_CLI_DEFINE(cli_config_generate, "SCCP generate config file."),
 	AST_CLI_DEFINE(cli_reload, "SCCP module reload."),
 	AST_CLI_DEFINE(cli_reload_file, "SCCP module reload file."),
@@ -3424,6 +3542,8 @@ static struct pbx_cli_entry cli_entries[] = {
 	AST_CLI_DEFINE(cli_test, "Test message."),
 #endif
 	AST_CLI_DEFINE(cli_show_refcount, "Test message."),
+	AST_CLI_DEFINE(cli_show_threadpool, "Show threadpool statistics."),
+	AST_CLI_DEFINE(cli_show_admission, "Show registration admission statistics."),
 	AST_CLI_DEFINE(cli_tokenack, "Send Token Acknowledgement."),
 #ifdef CS_SCCP_CONFERENCE
 	AST_CLI_DEFINE(cli_show_conferences, "Show running SCCP Conferences."),
@@ -3476,6 +3596,8 @@ int sccp_register_cli(void)
 	res |= pbx_manager_register("SCCPShowHintLineStates", _MAN_REP_FLAGS, manager_show_hint_lineStates, "show hint lineStates", ami_show_hint_lineStates_usage);
 	res |= pbx_manager_register("SCCPShowHintSubscriptions", _MAN_REP_FLAGS, manager_show_hint_subscriptions, "show hint subscriptions", ami_show_hint_subscriptions_usage);
 	res |= pbx_manager_register("SCCPShowRefcount", _MAN_REP_FLAGS, manager_show_refcount, "show refcount", ami_show_refcount_usage);
+	res |= pbx_manager_register("SCCPShowThreadpool", _MAN_REP_FLAGS, manager_show_threadpool, "show threadpool", ami_show_threadpool_usage);
+	res |= pbx_manager_register("SCCPShowAdmission", _MAN_REP_FLAGS, manager_show_admission, "show admission", ami_show_admission_usage);
 
 	return res;
 }
@@ -3515,6 +3637,8 @@ int sccp_unregister_cli(void)
 	res |= pbx_manager_unregister("SCCPShowHintLineStates");
 	res |= pbx_manager_unregister("SCCPShowHintSubscriptions");
 	res |= pbx_manager_unregister("SCCPShowRefcount");
+	res |= pbx_manager_unregister("SCCPShowThreadpool");
+	res |= pbx_manager_unregister("SCCPShowAdmission");
 
 	return res;
 }
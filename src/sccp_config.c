@@ -34,6 +34,8 @@
  *    - lines (via sccp_line_pre_reload)
  *    - softkey (via sccp_softkey_pre_reload)
  *    .
+ *  - skips device and line sections which did not change since the last (re)load (hash over the section and the general section),
+ *    clearing the pendingDelete markings for them
  *  - calls sccp_config_buildDevice as usual
  *    - calls sccp_config_buildDevice as usual
  *      - find device
@@ -244,9 +246,9 @@ static const SCCPConfigSegment *sccp_find_segment(const sccp_config_segment_t se
 }
 
 /*!
- * \brief Find of SCCP Config Options
+ * \brief Find of SCCP Config Options, by walking the option table (splitting aliased names)
  */
-static const SCCPConfigOption *sccp_find_config(const sccp_config_segment_t segment, const char *name)
+static const SCCPConfigOption *sccp_find_config_linear(const sccp_config_segment_t segment, const char *name)
 {
 	long unsigned int i = 0;
 	const SCCPConfigSegment *sccpConfigSegment = sccp_find_segment(segment);
@@ -275,6 +277,139 @@ static const SCCPConfigOption *sccp_find_config(const sccp_config_segment_t segm
 	return NULL;
 }
 
+/*!
+ * \brief SCCP Config Option Index Entry
+ */
+typedef struct SCCPConfigIndexEntry {
+	const char *name;											/*!< Option name, or one of its '|' separated aliases */
+	const SCCPConfigOption *option;										/*!< Option this name resolves to */
+} SCCPConfigIndexEntry;
+
+/*!
+ * \brief SCCP Config Option Index, per segment sorted by name (case insensitive), built once on first use
+ */
+static struct {
+	SCCPConfigIndexEntry *entries;
+	size_t size;
+	char *names;												/*!< Storage for the split up alias names */
+} sccpConfigIndex[ARRAY_LEN(sccpConfigSegments)];
+static pthread_once_t sccpConfigIndexOnce = PTHREAD_ONCE_INIT;
+
+static int sccp_config_index_cmp(const void *a, const void *b)
+{
+	const SCCPConfigIndexEntry *ea = (const SCCPConfigIndexEntry *) a;
+	const SCCPConfigIndexEntry *eb = (const SCCPConfigIndexEntry *) b;
+	int res = strcasecmp(ea->name, eb->name);
+
+	if (!res) {												/* same name: keep option table order, first one wins */
+		res = (ea->option > eb->option) - (ea->option < eb->option);
+	}
+	return res;
+}
+
+static int sccp_config_index_search(const void *key, const void *entry)
+{
+	return strcasecmp((const char *) key, ((const SCCPConfigIndexEntry *) entry)->name);
+}
+
+/*!
+ * \brief Build the Config Option Index for all segments
+ * \note A segment without index (allocation failure) falls back to sccp_find_config_linear
+ */
+static void sccp_config_buildIndex(void)
+{
+	long unsigned int i = 0;
+	uint8_t segment = 0;
+
+	for (segment = 0; segment < ARRAY_LEN(sccpConfigSegments); segment++) {
+		const SCCPConfigSegment *sccpConfigSegment = &sccpConfigSegments[segment];
+		const SCCPConfigOption *config = sccpConfigSegment->config;
+		SCCPConfigIndexEntry *entries = NULL;
+		size_t namesLen = 0;
+		size_t maxEntries = 0;
+		size_t size = 0;
+		char *names = NULL;
+		char *next = NULL;
+		const char *c = NULL;
+
+		for (i = 0; i < sccpConfigSegment->config_size; i++) {
+			maxEntries++;
+			if (strchr(config[i].name, '|')) {
+				namesLen += strlen(config[i].name) + 1;
+				for (c = config[i].name, maxEntries++; *c; c++) {
+					maxEntries += (*c == '|');
+				}
+			}
+		}
+		if (!(entries = sccp_calloc(sizeof(SCCPConfigIndexEntry), maxEntries)) || (namesLen && !(names = sccp_calloc(sizeof(char), namesLen)))) {
+			pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+			sccp_free(entries);
+			continue;
+		}
+
+		next = names;
+		for (i = 0; i < sccpConfigSegment->config_size; i++) {
+			entries[size].name = config[i].name;
+			entries[size++].option = &config[i];
+			if (strchr(config[i].name, '|')) {
+				char *token = NULL;
+				char *parse = strcpy(next, config[i].name);
+				next += strlen(config[i].name) + 1;
+				while ((token = strsep(&parse, "|"))) {
+					entries[size].name = token;
+					entries[size++].option = &config[i];
+				}
+			}
+		}
+		qsort(entries, size, sizeof(SCCPConfigIndexEntry), sccp_config_index_cmp);
+
+		for (i = 1, maxEntries = size, size = (size ? 1 : 0); i < maxEntries; i++) {					/* drop duplicate names */
+			if (strcasecmp(entries[i].name, entries[size - 1].name)) {
+				entries[size++] = entries[i];
+			}
+		}
+		sccpConfigIndex[segment].entries = entries;
+		sccpConfigIndex[segment].names = names;
+		sccpConfigIndex[segment].size = size;
+	}
+}
+
+static void __attribute__((destructor)) sccp_config_destroyIndex(void)
+{
+	uint8_t segment = 0;
+
+	for (segment = 0; segment < ARRAY_LEN(sccpConfigSegments); segment++) {
+		if (sccpConfigIndex[segment].entries) {
+			sccp_free(sccpConfigIndex[segment].entries);
+		}
+		if (sccpConfigIndex[segment].names) {
+			sccp_free(sccpConfigIndex[segment].names);
+		}
+		sccpConfigIndex[segment].size = 0;
+	}
+}
+
+/*!
+ * \brief Find of SCCP Config Options
+ */
+static const SCCPConfigOption *sccp_find_config(const sccp_config_segment_t segment, const char *name)
+{
+	const SCCPConfigSegment *sccpConfigSegment = sccp_find_segment(segment);
+	const SCCPConfigIndexEntry *entry = NULL;
+	size_t idx = 0;
+
+	if (!sccpConfigSegment || !name) {
+		return NULL;
+	}
+	pthread_once(&sccpConfigIndexOnce, sccp_config_buildIndex);
+	idx = sccpConfigSegment - sccpConfigSegments;
+	if (!sccpConfigIndex[idx].entries) {
+		return sccp_find_config_linear(segment, name);
+	}
+	entry = bsearch(name, sccpConfigIndex[idx].entries, sccpConfigIndex[idx].size, sizeof(SCCPConfigIndexEntry), sccp_config_index_search);
+	return entry ? entry->option : NULL;
+}
+
 /* Create new variable structure for Multi Entry Parameters */
 static PBX_VARIABLE_TYPE *createVariableSetForMultiEntryParameters(PBX_VARIABLE_TYPE * cat_root, const char *configOptionName, PBX_VARIABLE_TYPE * out)
 {
@@ -1508,6 +1643,7 @@ sccp_value_changed_t sccp_config_parse_deny_permit(void *dest, const size_t size
 				if (prev_ha) {
 					sccp_free_ha(prev_ha);
 				}
+				sccp_compile_ha(ha);
 				*(struct sccp_ha **) dest = ha;
 				changed = SCCP_CONFIG_CHANGE_CHANGED;
 				ha = NULL;					// passed on to dest, will not be freed at exit
@@ -2398,6 +2534,50 @@ void cleanup_stale_contexts(char *new, char *old)
 	}
 }
 
+/*!
+ * \brief Hash a Config Category's Variable Set
+ * \param v Asterisk Variable (first variable of the category)
+ * \param hash Initial hash value (used to chain in the general section)
+ * \return Hash over all name/value pairs in order (names case insensitive)
+ */
+static uint64_t sccp_config_hashVariables(PBX_VARIABLE_TYPE * v, uint64_t hash)
+{
+	const char *c = NULL;
+
+	for (; v; v = v->next) {
+		for (c = v->name; *c; c++) {
+			hash = ((hash << 5) + hash) + tolower(*c);
+		}
+		hash = ((hash << 5) + hash) + '=';
+		for (c = v->value; *c; c++) {
+			hash = ((hash << 5) + hash) + *c;
+		}
+		hash = ((hash << 5) + hash) + '\n';
+	}
+	return hash;
+}
+
+/*!
+ * \brief Keep a device whose section did not change since the last (re)load
+ * \param d SCCP Device
+ *
+ * Undoes the markings of sccp_device_pre_reload, so that neither the device nor its buttons get removed or restarted.
+ * The softkeyset is re-attached for all devices by sccp_softkey_post_reload.
+ */
+static void sccp_config_keepDevice(sccp_device_t * d)
+{
+	sccp_buttonconfig_t *config = NULL;
+
+	d->pendingDelete = 0;
+	d->pendingUpdate = 0;
+	SCCP_LIST_LOCK(&d->buttonconfig);
+	SCCP_LIST_TRAVERSE(&d->buttonconfig, config, list) {
+		config->pendingDelete = 0;
+		config->pendingUpdate = 0;
+	}
+	SCCP_LIST_UNLOCK(&d->buttonconfig);
+}
+
 /*!
  * \brief Read Lines from the Config File
  *
@@ -2418,6 +2598,13 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 	uint8_t device_count = 0;
 	uint8_t line_count = 0;
 	sccp_device_t *d = NULL;
+	uint64_t generalHash = 0;
+	uint64_t sectionHash = 0;
+	struct {
+		int created;
+		int changed;
+		int unchanged;
+	} devices = {0}, lines = {0};
 
 	sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_1 "Loading Devices and Lines from config\n");
 
@@ -2435,6 +2622,7 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 		pbx_log(LOG_NOTICE, "SCCP: (sccp_config_readDevicesLines) Unable to load config file sccp.conf, SCCP disabled\n");
 		return FALSE;
 	}
+	generalHash = sccp_config_hashVariables(ast_variable_browse(GLOB(cfg), "general"), 5381);		/* device/line defaults are taken from general */
 
 	while ((cat = pbx_category_browse(GLOB(cfg), cat))) {
 
@@ -2457,6 +2645,7 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 				continue;
 			} else {
 				v = ast_variable_browse(GLOB(cfg), cat);
+				sectionHash = sccp_config_hashVariables(v, generalHash);
 
 				// Try to find out if we have the device already on file.
 				// However, do not look into realtime, since
@@ -2471,13 +2660,21 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 					// sccp_copy_string(d->id, cat, sizeof(d->id));         /* set device name */
 					sccp_device_addToGlobals(device);
 					device_count++;
+					devices.created++;
+				} else if (readingtype == SCCP_CONFIG_READRELOAD && !device->realtime && device->configHash == sectionHash) {
+					sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_3 "%s: device section unchanged, skipping\n", cat);
+					sccp_config_keepDevice(device);
+					devices.unchanged++;
+					continue;
 				} else {
 					if (device->pendingDelete) {
 						nat = device->nat;
 						device->pendingDelete = 0;
 					}
+					devices.changed++;
 				}
 				sccp_config_buildDevice(device, v, cat, FALSE);
+				device->configHash = sectionHash;
 				sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_3 "found device %d: %s\n", device_count, cat);
 				/* load saved settings from ast db */
 				sccp_config_restoreDeviceFeatureStatus(device);
@@ -2500,15 +2697,25 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 			line_count++;
 
 			v = ast_variable_browse(GLOB(cfg), cat);
+			sectionHash = sccp_config_hashVariables(v, generalHash);
 			AUTO_RELEASE(sccp_line_t, l , sccp_line_find_byname(cat, FALSE));
 
 			/* check if we have this line already */
 			//    SCCP_RWLIST_WRLOCK(&GLOB(lines));
-			if (l) {
+			if (l && readingtype == SCCP_CONFIG_READRELOAD && !l->realtime && l->configHash == sectionHash) {
+				sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_3 "%s: line section unchanged, skipping\n", cat);
+				l->pendingDelete = 0;
+				l->pendingUpdate = 0;
+				lines.unchanged++;
+			} else if (l) {
 				sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_3 "found line %d: %s, do update\n", line_count, cat);
 				sccp_config_buildLine(l, v, cat, FALSE);
+				l->configHash = sectionHash;
+				lines.changed++;
 			} else if ((l = sccp_line_create(cat))) {
 				sccp_config_buildLine(l, v, cat, FALSE);
+				l->configHash = sectionHash;
+				lines.created++;
 				sccp_line_addToGlobals(l);						/* may find another line instance create by another thread, in that case the newly created line is going to be dropped when l is released */
 			}
 			//    SCCP_RWLIST_UNLOCK(&GLOB(lines));
@@ -2619,10 +2826,21 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 		 */
 		sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_2 "Line Post Reload\n");
 		sccp_line_post_reload();
+		int restart_count = 0;
+		SCCP_RWLIST_RDLOCK(&GLOB(devices));
+		SCCP_RWLIST_TRAVERSE(&GLOB(devices), d, list) {
+			if (d->pendingUpdate || d->pendingDelete) {
+				sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_3 "%s: configuration changed, device will be %s\n", d->id, d->pendingDelete ? "removed" : "restarted");
+				restart_count++;
+			}
+		}
+		SCCP_RWLIST_UNLOCK(&GLOB(devices));
 		sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_2 "Device Post Reload\n");
 		sccp_device_post_reload();
 		sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_2 "Softkey Post Reload\n");
 		sccp_softkey_post_reload();
+		pbx_log(LOG_NOTICE, "SCCP: Reload finished, devices: %d new, %d changed, %d unchanged, %d to restart/remove / lines: %d new, %d changed, %d unchanged\n",
+			devices.created, devices.changed, devices.unchanged, restart_count, lines.created, lines.changed, lines.unchanged);
 	}
 	return TRUE;
 }
@@ -3500,6 +3718,41 @@ AST_TEST_DEFINE(sccp_config_base_functions)
 	return AST_TEST_PASS;
 }
 
+AST_TEST_DEFINE(sccp_config_option_index)
+{
+	uint8_t segment = 0;
+	long unsigned int i = 0;
+
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "OptionIndex";
+			info->category = "/channels/chan_sccp/config/";
+			info->summary = "chan-sccp-b config test";
+			info->description = "chan-sccp-b config option index lookup matches a linear scan of the option tables";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+
+	pbx_test_status_update(test, "sccp_find_config (index) vs sccp_find_config_linear...\n");
+	for (segment = 0; segment < ARRAY_LEN(sccpConfigSegments); segment++) {
+		const SCCPConfigSegment *sccpConfigSegment = &sccpConfigSegments[segment];
+		for (i = 0; i < sccpConfigSegment->config_size; i++) {
+			char *config_name = pbx_strdupa(sccpConfigSegment->config[i].name);
+			char *token = NULL;
+			pbx_test_validate(test, sccp_find_config(sccpConfigSegment->segment, sccpConfigSegment->config[i].name) == sccp_find_config_linear(sccpConfigSegment->segment, sccpConfigSegment->config[i].name));
+			while ((token = strsep(&config_name, "|"))) {
+				pbx_test_validate(test, sccp_find_config(sccpConfigSegment->segment, token) != NULL);
+				pbx_test_validate(test, sccp_find_config(sccpConfigSegment->segment, token) == sccp_find_config_linear(sccpConfigSegment->segment, token));
+			}
+		}
+	}
+	pbx_test_validate(test, sccp_find_config(SCCP_CONFIG_GLOBAL_SEGMENT, "DeBuG") == sccp_find_config_linear(SCCP_CONFIG_GLOBAL_SEGMENT, "debug"));
+	pbx_test_validate(test, sccp_find_config(SCCP_CONFIG_GLOBAL_SEGMENT, "no_such_option") == NULL);
+
+	return AST_TEST_PASS;
+}
+
 AST_TEST_DEFINE(sccp_config_multientry)
 {
 	switch(cmd) {
@@ -3608,6 +3861,7 @@ AST_TEST_DEFINE(sccp_config_setDefault)
 static void __attribute__((constructor)) sccp_register_tests(void)
 {
 	AST_TEST_REGISTER(sccp_config_base_functions);
+	AST_TEST_REGISTER(sccp_config_option_index);
 	AST_TEST_REGISTER(sccp_config_multientry);
 	AST_TEST_REGISTER(sccp_config_tokenized_default);
 	//AST_TEST_REGISTER(sccp_config_setValue);
@@ -3617,6 +3871,7 @@ static void __attribute__((constructor)) sccp_register_tests(void)
 static void __attribute__((destructor)) sccp_unregister_tests(void)
 {
 	AST_TEST_UNREGISTER(sccp_config_base_functions);
+	AST_TEST_UNREGISTER(sccp_config_option_index);
 	AST_TEST_UNREGISTER(sccp_config_multientry);
 	AST_TEST_UNREGISTER(sccp_config_tokenized_default);
 	//AST_TEST_UNREGISTER(sccp_config_setValue);
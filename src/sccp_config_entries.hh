@@ -158,6 +158,15 @@ static const SCCPConfigOption sccpGlobalConfigOptions[]={
 	{"backoff_time", 		G_OBJ_REF(token_backoff_time),		TYPE_INT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"60",				"Time to wait before re-asking to fallback to primairy server (Token Reject Backoff Time)\n"},
 	{"server_priority", 		G_OBJ_REF(server_priority),		TYPE_INT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"1",				"Server Priority for fallback: 1=Primairy, 2=Secundary, 3=Tertiary etc\n"
 																																					"For active-active (fallback=odd/even) use 1 for both\n"},
+	{"registration_maxpending",	G_OBJ_REF(registration_maxpending),	TYPE_UINT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"0",				"Maximum number of phones registering at the same time (0 = unlimited). Phones beyond this number are told to come back later\n"
+																																					"(TokenReject with registration_backoff, RegisterReject when the phone does not use tokens).\n"},
+	{"registration_rate",		G_OBJ_REF(registration_rate),		TYPE_UINT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"0",				"Maximum number of registrations per second from one subnet (0 = unlimited), see registration_prefix and registration_burst\n"},
+	{"registration_burst",		G_OBJ_REF(registration_burst),		TYPE_UINT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"20",				"Number of registrations from one subnet accepted in a burst, before registration_rate applies\n"},
+	{"registration_prefix",		G_OBJ_REF(registration_prefix),		TYPE_UINT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"24",				"Prefix length of an IPv4 subnet for registration_rate (IPv6 subnets are /64)\n"},
+	{"registration_backoff",	G_OBJ_REF(registration_backoff),	TYPE_UINT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"10",				"Seconds a phone is told to wait before retrying, when its registration is not admitted. A random part of up to the same\n"
+																																					"number of seconds is added, to spread the retries.\n"},
+	{"sessionthreads",		G_OBJ_REF(session_threads),		TYPE_UINT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"4",				"Number of threads handling the phone connections (sessions). Every thread handles the signalling of many phones.\n"
+																																					"Set to 0 to use one thread per connected phone (old behaviour). Changing this value requires a module reload.\n"},
 //#if defined(CS_EXPERIMENTAL_XML)
 //	{"webdir",			G_OBJ_REF(webdir),			TYPE_PARSER(sccp_config_parse_webdir),						SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"",				"Directory where xslt stylesheets can be found.\n"},
 //#endif
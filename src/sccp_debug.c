@@ -11,12 +11,15 @@
 #include "sccp_debug.h"
 
 SCCP_FILE_VERSION(__FILE__, "");
+
+#include <asterisk/threadstorage.h>
+
 const char *SS_Memory_Allocation_Error = "%s: Memory Allocation Error.\n";
 
 /*!
  * \brief SCCP Verbose Level Structure
  */
-struct sccp_debug_category const sccp_debug_categories[32] = {
+struct sccp_debug_category const sccp_debug_categories[33] = {
 	/* *INDENT-OFF* */
 	{"all",			"all debug levels", 			DEBUGCAT_ALL,},
 	{"none",		"all debug levels", 			DEBUGCAT_NONE,},
@@ -50,6 +53,7 @@ struct sccp_debug_category const sccp_debug_categories[32] = {
 	{"threadpool",		"threadpool debug level",	 	DEBUGCAT_THPOOL},
 	{"filelinefunc",	"add line/file/function to debug output", DEBUGCAT_FILELINEFUNC},
 	{"high",		"high debug level", 			DEBUGCAT_HIGH},
+	{"trace",		"send debug output to the trace buffer (sccp show trace)", DEBUGCAT_TRACE},
 	/* *INDENT-ON* */
 };
 
@@ -79,12 +83,7 @@ int32_t sccp_parse_debugline(char *arguments[], int startat, int argc, int32_t n
 			} else if (!strncmp(argument, "no", 2)) {
 				subtract = 1;
 			} else if (!strncmp(argument, "all", 3)) {
-				new_debug_value = 0;
-				for (i = 0; i < ARRAY_LEN(sccp_debug_categories); i++) {
-					if (!subtract) {
-						new_debug_value += sccp_debug_categories[i].category;
-					}
-				}
+				new_debug_value = subtract ? 0 : (DEBUGCAT_ALL & ~DEBUGCAT_TRACE);				/* trace has to be switched on explicitly */
 			} else {
 				// parse comma separated debug_var
 				boolean_t matched = FALSE;
@@ -103,6 +102,9 @@ int32_t sccp_parse_debugline(char *arguments[], int startat, int argc, int32_t n
 								}
 							}
 							matched=TRUE;
+							if (!subtract && sccp_debug_categories[i].category && !(sccp_debug_categories[i].category & (uint32_t)(CS_DEBUG_CATEGORIES))) {
+								pbx_log(LOG_NOTICE, "SCCP: debug category '%s' has not been compiled in (see configure --with-debug-categories)\n", token);
+							}
 						}
 					}
 					if (!matched) {
@@ -154,4 +156,244 @@ char *sccp_get_debugcategories(int32_t debugvalue)
 	return res;
 }
 
+/*
+ * Debug Trace Buffer
+ *
+ * With 'sccp debug trace' switched on, sccp_log output is not sent to the asterisk logger, but stored in a ring buffer owned by
+ * the logging thread. Writing a record does not take a lock or allocate memory, the record is formatted straight into its slot.
+ * File/line/function are kept as pointers to their string constants and only turned into text when the buffer is read by
+ * 'sccp show trace' or 'sccp save trace'. Readers use the per record sequence number (odd while it is being written) to skip
+ * records that are overwritten while they are being copied.
+ *
+ * Rings are only allocated (never moved or freed) while the module is loaded, so a thread can keep using the ring it claimed
+ * without taking trace_lock. A thread that could not claim a ring remembers that, and only tries again after another thread
+ * has given up its ring.
+ */
+#define SCCP_TRACE_RINGS 64											/* threads that can own a ring at the same time */
+#define SCCP_TRACE_RECORDS 256											/* records per ring */
+#define SCCP_TRACE_MSGLEN 176
+
+typedef struct sccp_trace_record {
+	volatile uint32_t seq;
+	int line;
+	struct timeval tv;
+	const char *file;
+	const char *function;
+	unsigned long thread;
+	char msg[SCCP_TRACE_MSGLEN];
+} sccp_trace_record_t;
+
+typedef struct sccp_trace_ring {
+	unsigned long owner;											/*!< 0: free for the next thread */
+	uint32_t head;												/*!< only changed by the owner */
+	sccp_trace_record_t records[SCCP_TRACE_RECORDS];
+} sccp_trace_ring_t;
+
+static sccp_trace_ring_t *trace_rings[SCCP_TRACE_RINGS];
+static volatile uint32_t trace_released = 0;									/*!< bumped every time a ring is given up (trace_lock) */
+AST_MUTEX_DEFINE_STATIC(trace_lock);
+
+struct sccp_trace_thread {
+	int ring;												/*!< index + 1 into trace_rings, 0: none claimed, -1: none available */
+	uint32_t released;											/*!< trace_released when no ring was available */
+};
+
+static void sccp_trace_thread_cleanup(void *data)
+{
+	struct sccp_trace_thread *trace_thread = data;
+
+	if (trace_thread->ring > 0) {
+		pbx_mutex_lock(&trace_lock);
+		if (trace_rings[trace_thread->ring - 1]) {							/* NULL once the module has been unloaded */
+			trace_rings[trace_thread->ring - 1]->owner = 0;						/* content stays readable until reused */
+			trace_released++;
+		}
+		pbx_mutex_unlock(&trace_lock);
+	}
+	sccp_free(trace_thread);
+}
+AST_THREADSTORAGE_CUSTOM(sccp_trace_thread_buf, NULL, sccp_trace_thread_cleanup);
+static boolean_t trace_thread_key_created = FALSE;								/*!< sccp_trace_thread_buf.key has been created and has to be deleted on unload */
+
+static sccp_trace_ring_t *sccp_trace_claim_ring(struct sccp_trace_thread *trace_thread)
+{
+	sccp_trace_ring_t *ring = NULL;
+	int idx = 0;
+	int found = -1;
+
+	pbx_mutex_lock(&trace_lock);
+	for (idx = 0; idx < SCCP_TRACE_RINGS; idx++) {
+		if (trace_rings[idx] && !trace_rings[idx]->owner) {
+			found = idx;
+			break;
+		} else if (!trace_rings[idx] && found < 0) {
+			found = idx;
+		}
+	}
+	if (found >= 0 && !trace_rings[found]) {
+		trace_rings[found] = sccp_calloc(sizeof(sccp_trace_ring_t), 1);
+	}
+	if (found >= 0 && (ring = trace_rings[found])) {
+		ring->owner = (unsigned long) pthread_self();
+		trace_thread->ring = found + 1;
+	} else {
+		trace_thread->ring = -1;									/* all rings taken, don't retry until one is released */
+		trace_thread->released = trace_released;
+	}
+	pbx_mutex_unlock(&trace_lock);
+	return ring;
+}
+
+/*!
+ * \brief Store a debug message in the trace buffer of the current thread
+ * \note falls back to the asterisk logger, when no trace ring is available for this thread
+ */
+void sccp_trace_log(const char *file, int line, const char *function, const char *fmt, ...)
+{
+	struct sccp_trace_thread *trace_thread = ast_threadstorage_get(&sccp_trace_thread_buf, sizeof(struct sccp_trace_thread));
+	sccp_trace_ring_t *ring = NULL;
+	sccp_trace_record_t *record = NULL;
+	va_list ap;
+
+	if (trace_thread && !trace_thread_key_created) {
+		trace_thread_key_created = TRUE;
+	}
+	if (trace_thread && trace_thread->ring > 0) {
+		ring = trace_rings[trace_thread->ring - 1];							/* ours, stays allocated until the module is unloaded */
+	} else if (trace_thread && (trace_thread->ring == 0 || trace_thread->released != trace_released)) {
+		ring = sccp_trace_claim_ring(trace_thread);
+	}
+	if (!ring) {
+		char buf[SCCP_TRACE_MSGLEN * 2];
+
+		va_start(ap, fmt);
+		vsnprintf(buf, sizeof(buf), fmt, ap);
+		va_end(ap);
+		pbx_log(NO_FILE_LINE_FUNC_DEBUG, "%s", buf);
+		return;
+	}
+
+	record = &ring->records[ring->head++ % SCCP_TRACE_RECORDS];
+	record->seq++;												/* odd: being written */
+	__sync_synchronize();
+	record->tv = pbx_tvnow();
+	record->file = file;
+	record->line = line;
+	record->function = function;
+	record->thread = ring->owner;
+	va_start(ap, fmt);
+	vsnprintf(record->msg, sizeof(record->msg), fmt, ap);
+	va_end(ap);
+	__sync_synchronize();
+	record->seq++;
+}
+
+static int sccp_trace_record_cmp(const void *a, const void *b)
+{
+	const sccp_trace_record_t *ra = a;
+	const sccp_trace_record_t *rb = b;
+
+	if (ra->tv.tv_sec != rb->tv.tv_sec) {
+		return ra->tv.tv_sec < rb->tv.tv_sec ? -1 : 1;
+	}
+	return ra->tv.tv_usec < rb->tv.tv_usec ? -1 : (ra->tv.tv_usec > rb->tv.tv_usec);
+}
+
+/*!
+ * \brief Print the content of the trace buffers, oldest record first
+ * \param max Maximum number of (most recent) records to print, 0 for all
+ * \param print Callback receiving one formatted line at a time
+ * \param data Passed on to print
+ * \return number of records printed, -1 on allocation failure
+ */
+int sccp_trace_print(int max, void (*const print)(void *data, const char *line), void *data)
+{
+	sccp_trace_record_t *records = NULL;
+	int count = 0;
+	int idx = 0;
+	int rec = 0;
+
+	if (!(records = sccp_malloc(sizeof(sccp_trace_record_t) * SCCP_TRACE_RINGS * SCCP_TRACE_RECORDS))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return -1;
+	}
+	pbx_mutex_lock(&trace_lock);
+	for (idx = 0; idx < SCCP_TRACE_RINGS; idx++) {
+		if (!trace_rings[idx]) {
+			continue;
+		}
+		for (rec = 0; rec < SCCP_TRACE_RECORDS; rec++) {
+			sccp_trace_record_t *record = &trace_rings[idx]->records[rec];
+			uint32_t seq = record->seq;
+
+			if (!seq || (seq & 1)) {
+				continue;
+			}
+			__sync_synchronize();
+			memcpy(&records[count], record, sizeof(sccp_trace_record_t));
+			__sync_synchronize();
+			if (record->seq == seq) {
+				records[count].msg[SCCP_TRACE_MSGLEN - 1] = '\0';
+				count++;
+			}
+		}
+	}
+	pbx_mutex_unlock(&trace_lock);
+
+	qsort(records, count, sizeof(sccp_trace_record_t), sccp_trace_record_cmp);
+	for (idx = (max > 0 && count > max) ? count - max : 0; idx < count; idx++) {
+		struct tm tm;
+		char timestr[16] = "";
+		char line[SCCP_TRACE_MSGLEN + 128];
+		size_t len = 0;
+		time_t sec = records[idx].tv.tv_sec;
+
+		localtime_r(&sec, &tm);
+		strftime(timestr, sizeof(timestr), "%H:%M:%S", &tm);
+		snprintf(line, sizeof(line), "[%s.%06ld] [%#lx] %s:%d %s: %s", timestr, (long) records[idx].tv.tv_usec, records[idx].thread, records[idx].file, records[idx].line, records[idx].function, records[idx].msg);
+		len = strlen(line);
+		if (!len || line[len - 1] != '\n') {
+			snprintf(line + len, sizeof(line) - len, "\n");
+		}
+		print(data, line);
+	}
+	sccp_free(records);
+	return (max > 0 && count > max) ? max : count;
+}
+
+/*!
+ * \brief Switch tracing off (module unload)
+ *
+ * \note The trace buffers are not released here, threads that are still logging keep writing into the ring they own. They are
+ * freed by sccp_trace_destroy, when the module itself is unloaded.
+ */
+void sccp_trace_module_stop(void)
+{
+	sccp_globals->debug &= ~DEBUGCAT_TRACE;
+}
+
+/*!
+ * \brief Release the trace buffers (module image unload)
+ *
+ * \note The thread storage key is deleted first, so that threads exiting after the module has gone do not call back into
+ * sccp_trace_thread_cleanup. Their struct sccp_trace_thread is not freed in that case.
+ */
+static void __attribute__((destructor)) sccp_trace_destroy(void)
+{
+	int idx = 0;
+
+	if (trace_thread_key_created) {
+		pthread_key_delete(sccp_trace_thread_buf.key);
+		trace_thread_key_created = FALSE;
+	}
+	pbx_mutex_lock(&trace_lock);
+	for (idx = 0; idx < SCCP_TRACE_RINGS; idx++) {
+		if (trace_rings[idx]) {
+			sccp_free(trace_rings[idx]);
+			trace_rings[idx] = NULL;
+		}
+	}
+	pbx_mutex_unlock(&trace_lock);
+}
+
 // kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
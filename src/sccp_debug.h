@@ -18,15 +18,24 @@
 #define __LOG_VERBOSE    2
 #define NO_FILE_LINE_FUNC_DEBUG      __LOG_VERBOSE, _B_
 
+/* debug categories compiled into the module (configure --with-debug-categories), the others are removed by the compiler */
+#ifndef CS_DEBUG_CATEGORIES
+#define CS_DEBUG_CATEGORIES DEBUGCAT_ALL
+#endif
+#define sccp_debug_enabled(_x) (((uint32_t)(_x) & (uint32_t)(CS_DEBUG_CATEGORIES)) && dont_expect((sccp_globals->debug & (_x)) != 0))
+#define sccp_debug_enabled_and(_x) (((uint32_t)(_x) & (uint32_t)(CS_DEBUG_CATEGORIES)) == (uint32_t)(_x) && dont_expect((sccp_globals->debug & (_x)) == (_x)))
+
 #define sccp_log1(...) {									\
-	if ((sccp_globals->debug & (DEBUGCAT_FILELINEFUNC)) == DEBUGCAT_FILELINEFUNC) {		\
+	if ((sccp_globals->debug & (DEBUGCAT_TRACE)) == DEBUGCAT_TRACE) {			\
+		sccp_trace_log(__FILE__, __LINE__, __PRETTY_FUNCTION__, __VA_ARGS__);		\
+	} else if ((sccp_globals->debug & (DEBUGCAT_FILELINEFUNC)) == DEBUGCAT_FILELINEFUNC) {	\
 		pbx_log(AST_LOG_NOTICE, __VA_ARGS__);						\
 	} else {										\
 		pbx_log(NO_FILE_LINE_FUNC_DEBUG, __VA_ARGS__);					\
 	}											\
 }
-#define sccp_log(_x) if ((sccp_globals->debug & (_x))) sccp_log1
-#define sccp_log_and(_x) if ((sccp_globals->debug & (_x)) == (_x)) sccp_log1
+#define sccp_log(_x) if (sccp_debug_enabled(_x)) sccp_log1
+#define sccp_log_and(_x) if (sccp_debug_enabled_and(_x)) sccp_log1
 
 __BEGIN_C_EXTERN__
 extern const char *SS_Memory_Allocation_Error;
@@ -66,6 +75,7 @@ typedef enum {
 	DEBUGCAT_THPOOL			= 1 << 27,
 	DEBUGCAT_FILELINEFUNC		= 1 << 28,
 	DEBUGCAT_HIGH 			= 1 << 29,
+	DEBUGCAT_TRACE			= 1 << 30,
 	DEBUGCAT_ALL 			= 0xffffffff,
 	/* *INDENT-ON* */
 } sccp_debug_category_t;											/*!< SCCP Debug Category Enum (saved in global_vars:debug = uint32_t) */
@@ -75,9 +85,12 @@ struct sccp_debug_category {
 	const char *const text;
 	sccp_debug_category_t category;
 };
-extern const struct sccp_debug_category sccp_debug_categories[32];
+extern const struct sccp_debug_category sccp_debug_categories[33];
 
 SCCP_API int32_t SCCP_CALL sccp_parse_debugline(char *arguments[], int startat, int argc, int32_t new_debug_value);
 SCCP_API char * SCCP_CALL sccp_get_debugcategories(int32_t debugvalue);
+SCCP_API void SCCP_CALL sccp_trace_log(const char *file, int line, const char *function, const char *fmt, ...) __attribute__ ((format(printf, 4, 5)));
+SCCP_API int SCCP_CALL sccp_trace_print(int max, void (*const print)(void *data, const char *line), void *data);
+SCCP_API void SCCP_CALL sccp_trace_module_stop(void);
 __END_C_EXTERN__
 // kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -40,6 +40,7 @@ SCCP_FILE_VERSION(__FILE__, "");
 #if defined(CS_AST_HAS_EVENT) && defined(HAVE_PBX_EVENT_H) 	// ast_event_subscribe
 #  include <asterisk/event.h>
 #endif
+#include <asterisk/threadstorage.h>
 
 int __sccp_device_destroy(const void *ptr);
 void sccp_device_removeFromGlobals(devicePtr device);
@@ -673,9 +674,9 @@ static void __saveLastDialedNumberToDatabase(constDevicePtr device)
 	if (!sccp_strlen_zero(device->redialInformation.number)) {
 		char buffer[SCCP_MAX_EXTENSION+16] = "\0";
 		snprintf (buffer, sizeof(buffer), "%s;lineInstance=%d", device->redialInformation.number, device->redialInformation.lineInstance);
-		iPbx.feature_addToDatabase(family, "lastDialedNumber", buffer);
+		sccp_featurestore_put(family, "lastDialedNumber", buffer);
 	} else {
-		iPbx.feature_removeFromDatabase(family, "lastDialedNumber");
+		sccp_featurestore_put(family, "lastDialedNumber", NULL);
 	}
 }
 
@@ -793,8 +794,13 @@ void sccp_device_addToGlobals(constDevicePtr device)
 	}
 	sccp_device_t *d = sccp_device_retain(device);
 	if (d) {
+		uint32_t hash = sccp_strcase_hash(d->id) % SCCP_HASH_PRIME;
+
 		SCCP_RWLIST_WRLOCK(&GLOB(devices));
 		SCCP_RWLIST_INSERT_SORTALPHA(&GLOB(devices), d, list, id);
+		SCCP_RWLIST_WRLOCK(&GLOB(device_index)[hash]);						/* index shares the list's reference */
+		SCCP_RWLIST_INSERT_HEAD(&GLOB(device_index)[hash], d, hashlist);
+		SCCP_RWLIST_UNLOCK(&GLOB(device_index)[hash]);
 		SCCP_RWLIST_UNLOCK(&GLOB(devices));
 		sccp_log((DEBUGCAT_DEVICE)) (VERBOSE_PREFIX_3 "Added device '%s' to Glob(devices)\n", d->id);
 	}
@@ -815,9 +821,13 @@ void sccp_device_removeFromGlobals(devicePtr device)
 		return;
 	}
 	sccp_device_t * d = NULL;
+	uint32_t hash = sccp_strcase_hash(device->id) % SCCP_HASH_PRIME;
 
 	SCCP_RWLIST_WRLOCK(&GLOB(devices));
 	if ((d = SCCP_RWLIST_REMOVE(&GLOB(devices), device, list))) {
+		SCCP_RWLIST_WRLOCK(&GLOB(device_index)[hash]);
+		SCCP_RWLIST_REMOVE(&GLOB(device_index)[hash], d, hashlist);
+		SCCP_RWLIST_UNLOCK(&GLOB(device_index)[hash]);
 		sccp_log((DEBUGCAT_CORE + DEBUGCAT_DEVICE)) (VERBOSE_PREFIX_3 "Removed device '%s' from Glob(devices)\n", DEV_ID_LOG(device));
 		sccp_device_release(&d);					/* explicit release of device after removing from list */
 	}
@@ -1197,18 +1207,104 @@ uint8_t sccp_dev_build_buttontemplate(devicePtr d, btnlist * btn)
 	return btn_index;
 }
 
+/*
+ * Packet Pool
+ *
+ * Outgoing packets are taken from a per thread cache of free buffers, split into size classes. Most messages
+ * (sccp_messagetypes[].size) fit the smaller classes, the largest class holds any sccp_msg_t. Freed packets go back to
+ * the cache of the thread releasing them, up to SCCP_PACKET_POOL_DEPTH per class, anything beyond that is returned to
+ * the allocator.
+ */
+#define SCCP_PACKET_POOL_CLASSES 4
+#define SCCP_PACKET_POOL_DEPTH 32
+#define SCCP_PACKET_POOL_UNPOOLED SCCP_PACKET_POOL_CLASSES
+static const size_t sccp_packet_pool_size[SCCP_PACKET_POOL_CLASSES] = {64, 256, 1024, SCCP_MAX_PACKET};
+
+typedef struct sccp_packet_block sccp_packet_block_t;
+struct sccp_packet_block {
+	sccp_packet_block_t *next;										/*!< next free block (only while cached) */
+	uint32_t sizeclass;
+	uint32_t _padding;
+} __attribute__((aligned(8)));
+
+struct sccp_packet_pool {
+	sccp_packet_block_t *free[SCCP_PACKET_POOL_CLASSES];
+	uint16_t count[SCCP_PACKET_POOL_CLASSES];
+};
+
+static void sccp_packet_pool_cleanup(void *data)
+{
+	struct sccp_packet_pool *pool = data;
+	sccp_packet_block_t *block;
+	int sizeclass;
+
+	for (sizeclass = 0; sizeclass < SCCP_PACKET_POOL_CLASSES; sizeclass++) {
+		while ((block = pool->free[sizeclass])) {
+			pool->free[sizeclass] = block->next;
+			sccp_free(block);
+		}
+	}
+	sccp_free(pool);
+}
+AST_THREADSTORAGE_CUSTOM(sccp_packet_pool_buf, NULL, sccp_packet_pool_cleanup);
+
+static sccp_msg_t *sccp_packet_pool_get(size_t size, boolean_t clear)
+{
+	struct sccp_packet_pool *pool = ast_threadstorage_get(&sccp_packet_pool_buf, sizeof(struct sccp_packet_pool));
+	sccp_packet_block_t *block = NULL;
+	uint32_t sizeclass = 0;
+
+	while (sizeclass < SCCP_PACKET_POOL_CLASSES && size > sccp_packet_pool_size[sizeclass]) {
+		sizeclass++;
+	}
+	if (pool && sizeclass < SCCP_PACKET_POOL_CLASSES && (block = pool->free[sizeclass])) {
+		pool->free[sizeclass] = block->next;
+		pool->count[sizeclass]--;
+	} else if (!(block = sccp_malloc(sizeof *block + (sizeclass < SCCP_PACKET_POOL_CLASSES ? sccp_packet_pool_size[sizeclass] : size)))) {
+		return NULL;
+	}
+	block->next = NULL;
+	block->sizeclass = sizeclass;
+	if (clear) {
+		memset(block + 1, 0, size);									/* only clear what the packet is going to use */
+	}
+	return (sccp_msg_t *) (block + 1);
+}
+
+/*!
+ * \brief Release an SCCP Message Packet created by sccp_build_packet
+ * \param msg SCCP Message (can be NULL)
+ */
+void sccp_free_packet(sccp_msg_t * msg)
+{
+	struct sccp_packet_pool *pool = NULL;
+	sccp_packet_block_t *block;
+
+	if (!msg) {
+		return;
+	}
+	block = ((sccp_packet_block_t *) msg) - 1;
+	if (block->sizeclass < SCCP_PACKET_POOL_UNPOOLED && (pool = ast_threadstorage_get(&sccp_packet_pool_buf, sizeof(struct sccp_packet_pool))) && pool->count[block->sizeclass] < SCCP_PACKET_POOL_DEPTH) {
+		block->next = pool->free[block->sizeclass];
+		pool->free[block->sizeclass] = block;
+		pool->count[block->sizeclass]++;
+		return;
+	}
+	sccp_free(block);
+}
+
 /*!
  * \brief Build an SCCP Message Packet
  * \param[in] t SCCP Message Text
  * \param[out] pkt_len Packet Length
- * \return SCCP Message
+ * \return SCCP Message, to be released using sccp_free_packet (sccp_session_send2 does this for you)
  */
 sccp_msg_t __attribute__ ((malloc)) * sccp_build_packet(sccp_mid_t t, size_t pkt_len)
 {
 	int padding = ((pkt_len + 8) % 4);
 	padding = (padding > 0) ? 4 - padding : 0;
 	
-	sccp_msg_t *msg = sccp_calloc(1, pkt_len + SCCP_PACKET_HEADER + padding);
+	sccp_msg_t *msg = sccp_packet_pool_get(pkt_len + SCCP_PACKET_HEADER + padding, TRUE);
 
 	if (!msg) {
 		pbx_log(LOG_WARNING, "SCCP: Packet memory allocation error\n");
@@ -1221,11 +1317,34 @@ sccp_msg_t __attribute__ ((malloc)) * sccp_build_packet(sccp_mid_t t, size_t pkt
 	return msg;
 }
 
+/*!
+ * \brief Build an SCCP Message Packet with a fixed layout, which the caller is going to fill in completely (see REQFIXED)
+ * \param[in] t SCCP Message Text
+ * \param[in] pkt_len Packet Length (compile time constant, padded to a multiple of 4 by REQFIXED)
+ * \return SCCP Message, to be released using sccp_free_packet (sccp_session_send2 does this for you)
+ *
+ * \note Only the header is written, the body is left uninitialized. Use REQ for messages which have reserved fields, unused
+ * strings or variable length content.
+ */
+sccp_msg_t __attribute__ ((malloc)) * sccp_build_fixed_packet(sccp_mid_t t, size_t pkt_len)
+{
+	sccp_msg_t *msg = sccp_packet_pool_get(pkt_len + SCCP_PACKET_HEADER, FALSE);
+
+	if (!msg) {
+		pbx_log(LOG_WARNING, "SCCP: Packet memory allocation error\n");
+		return NULL;
+	}
+	msg->header.length = htolel(pkt_len + 4);
+	msg->header.lel_protocolVer = 0;
+	msg->header.lel_messageId = htolel(t);
+	return msg;
+}
+
 /*!
  * \brief Send SCCP Message to Device
  * \param d SCCP Device
  * \param msg SCCP Message
- * \return Status as int
+ * \return Number of bytes queued for sending, -1 on error (see sccp_session_send2)
  *
  * \callgraph
  */
@@ -1237,7 +1356,7 @@ int sccp_dev_send(constDevicePtr d, sccp_msg_t * msg)
 		sccp_log((DEBUGCAT_MESSAGE)) (VERBOSE_PREFIX_3 "%s: >> Send message %s\n", d->id, msgtype2str(letohl(msg->header.lel_messageId)));
 		result = sccp_session_send(d, msg);
 	} else {
-		sccp_free(msg);
+		sccp_free_packet(msg);
 	}
 	return result;
 }
@@ -1281,6 +1400,7 @@ void sccp_dev_set_registered(devicePtr d, skinny_registrationstate_t state)
 			sccp_handle_AvailableLines(d->session, d, NULL);
 		}
 
+		sccp_session_admissionDone(d->session);
 		sccp_dev_postregistration(d);
 	} else if (state == SKINNY_DEVICE_RS_PROGRESS) {
 		memset(&event, 0, sizeof(sccp_event_t));
@@ -1534,7 +1654,7 @@ void sccp_dev_starttone(constDevicePtr d, uint8_t tone, uint8_t lineInstance, ui
 		return;
 	}
 
-	REQ(msg, StartToneMessage);
+	REQFIXED(msg, StartToneMessage);
 	if (!msg) {
 		return;
 	}
@@ -2136,12 +2256,12 @@ void sccp_dev_postregistration(void *data)
 				AUTO_RELEASE(sccp_linedevices_t, linedevice , sccp_linedevice_retain(d->lineButtons.instance[instance]));
 
 				snprintf(family, sizeof(family), "SCCP/%s/%s", d->id, linedevice->line->name);
-				if (iPbx.feature_getFromDatabase(family, "cfwdAll", buffer, sizeof(buffer)) && strcmp(buffer, "")) {
+				if (sccp_featurestore_get(family, "cfwdAll", buffer, sizeof(buffer)) && strcmp(buffer, "")) {
 					linedevice->cfwdAll.enabled = TRUE;
 					sccp_copy_string(linedevice->cfwdAll.number, buffer, sizeof(linedevice->cfwdAll.number));
 					sccp_feat_changed(d, linedevice, SCCP_FEATURE_CFWDALL);
 				}
-				if (iPbx.feature_getFromDatabase(family, "cfwdBusy", buffer, sizeof(buffer)) && strcmp(buffer, "")) {
+				if (sccp_featurestore_get(family, "cfwdBusy", buffer, sizeof(buffer)) && strcmp(buffer, "")) {
 					linedevice->cfwdBusy.enabled = TRUE;
 					sccp_copy_string(linedevice->cfwdBusy.number, buffer, sizeof(linedevice->cfwdAll.number));
 					sccp_feat_changed(d, linedevice, SCCP_FEATURE_CFWDBUSY);
@@ -2162,23 +2282,23 @@ void sccp_dev_postregistration(void *data)
 		}
 
 		snprintf(family, sizeof(family), "SCCP/%s", d->id);
-		if (iPbx.feature_getFromDatabase(family, "dnd", buffer, sizeof(buffer)) && strcmp(buffer, "")) {
+		if (sccp_featurestore_get(family, "dnd", buffer, sizeof(buffer)) && strcmp(buffer, "")) {
 			d->dndFeature.status = sccp_dndmode_str2val(buffer);
 			sccp_feat_changed(d, NULL, SCCP_FEATURE_DND);
 		}
 
-		if (iPbx.feature_getFromDatabase(family, "privacy", buffer, sizeof(buffer)) && strcmp(buffer, "")) {
+		if (sccp_featurestore_get(family, "privacy", buffer, sizeof(buffer)) && strcmp(buffer, "")) {
 			d->privacyFeature.status = TRUE;
 			sccp_feat_changed(d, NULL, SCCP_FEATURE_PRIVACY);
 		}
 
-		if (iPbx.feature_getFromDatabase(family, "monitor", buffer, sizeof(buffer)) && strcmp(buffer, "")) {
+		if (sccp_featurestore_get(family, "monitor", buffer, sizeof(buffer)) && strcmp(buffer, "")) {
 			sccp_feat_monitor(d, NULL, 0, NULL);
 			sccp_feat_changed(d, NULL, SCCP_FEATURE_MONITOR);
 		}
 
 		char lastNumber[SCCP_MAX_EXTENSION] = "";
-		if (iPbx.feature_getFromDatabase(family, "lastDialedNumber", buffer, sizeof(buffer))) {
+		if (sccp_featurestore_get(family, "lastDialedNumber", buffer, sizeof(buffer))) {
 			sscanf(buffer,"%79[^;];lineInstance=%d", lastNumber, &instance);
 			AUTO_RELEASE(sccp_linedevices_t, linedevice , sccp_linedevice_findByLineinstance(d, instance));
 			if(linedevice){ 
@@ -2203,15 +2323,7 @@ void sccp_dev_postregistration(void *data)
 	sccp_dev_check_displayprompt(d);
 
 	d->mwilight = 0;
-	for (instance = SCCP_FIRST_LINEINSTANCE; instance < d->lineButtons.size; instance++) {
-		if (d->lineButtons.instance[instance]) {
-			AUTO_RELEASE(sccp_linedevices_t, linedevice , sccp_linedevice_retain(d->lineButtons.instance[instance]));
-			if (linedevice) {
-				sccp_mwi_setMWILineStatus(linedevice);
-			}
-		}
-	}
-	sccp_mwi_check(d);
+	sccp_mwi_setMWIDeviceStatus(d);
 #ifdef CS_SCCP_PARK
 	sccp_buttonconfig_t *config = NULL;
 	SCCP_LIST_LOCK(&d->buttonconfig);
@@ -2703,7 +2815,7 @@ void sccp_device_sendcallstate(constDevicePtr d, uint8_t instance, uint32_t call
 	if (!d) {
 		return;
 	}
-	REQ(msg, CallStateMessage);
+	REQFIXED(msg, CallStateMessage);
 	if (!msg) {
 		return;
 	}
@@ -3233,9 +3345,11 @@ sccp_device_t *sccp_device_find_byid(const char *id, boolean_t useRealtime)
 		return NULL;
 	}
 
-	SCCP_RWLIST_RDLOCK(&GLOB(devices));
-	d = SCCP_RWLIST_FIND(&GLOB(devices), sccp_device_t, tmpd, list, (sccp_strcaseequals(tmpd->id, id)), TRUE, __FILE__, __LINE__, __PRETTY_FUNCTION__);
-	SCCP_RWLIST_UNLOCK(&GLOB(devices));
+	uint32_t hash = sccp_strcase_hash(id) % SCCP_HASH_PRIME;
+
+	SCCP_RWLIST_RDLOCK(&GLOB(device_index)[hash]);
+	d = SCCP_RWLIST_FIND(&GLOB(device_index)[hash], sccp_device_t, tmpd, hashlist, (sccp_strcaseequals(tmpd->id, id)), TRUE, __FILE__, __LINE__, __PRETTY_FUNCTION__);
+	SCCP_RWLIST_UNLOCK(&GLOB(device_index)[hash]);
 
 #ifdef CS_SCCP_REALTIME
 	if (!d && useRealtime) {
@@ -3308,7 +3422,7 @@ void sccp_device_setLamp(constDevicePtr device, skinny_stimulus_t stimulus, uint
 {
 	sccp_msg_t *msg = NULL;
 
-	REQ(msg, SetLampMessage);
+	REQFIXED(msg, SetLampMessage);
 
 	if (msg) {
 		msg->data.SetLampMessage.lel_stimulus = htolel(stimulus);
@@ -3318,4 +3432,86 @@ void sccp_device_setLamp(constDevicePtr device, skinny_stimulus_t stimulus, uint
 	}
 }
 
+#if CS_TEST_FRAMEWORK
+#include <asterisk/test.h>
+#define SCCP_PACKET_BENCH_ROUNDS 100000
+AST_TEST_DEFINE(sccp_device_fixed_packet_tests)
+{
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "fixed_packet";
+			info->category = "/channels/chan_sccp/device/";
+			info->summary = "chan-sccp-b fixed layout packet test";
+			info->description = "chan-sccp-b REQFIXED builds the same packets as REQ, and compares the time both take";
+			return AST_TEST_NOT_RUN;
+	        case TEST_EXECUTE:
+	        	break;
+	}
+	sccp_msg_t *msg = NULL;
+	sccp_msg_t *fixed = NULL;
+	struct timeval start;
+	int64_t req_us = 0;
+	int64_t fixed_us = 0;
+	int round = 0;
+
+	pbx_test_status_update(test, "Fixed layout packets match...\n");
+	REQ(msg, SetLampMessage);
+	REQFIXED(fixed, SetLampMessage);
+	pbx_test_validate(test, msg != NULL && fixed != NULL);
+	msg->data.SetLampMessage.lel_stimulus = fixed->data.SetLampMessage.lel_stimulus = htolel(SKINNY_STIMULUS_VOICEMAIL);
+	msg->data.SetLampMessage.lel_stimulusInstance = fixed->data.SetLampMessage.lel_stimulusInstance = htolel(1);
+	msg->data.SetLampMessage.lel_lampMode = fixed->data.SetLampMessage.lel_lampMode = htolel(SKINNY_LAMP_ON);
+	pbx_test_validate(test, msg->header.length == fixed->header.length);
+	pbx_test_validate(test, memcmp(msg, fixed, letohl(msg->header.length) + 4) == 0);
+	sccp_free_packet(msg);
+	sccp_free_packet(fixed);
+
+	REQ(msg, DisplayPromptStatusMessage);
+	REQFIXED(fixed, DisplayPromptStatusMessage);
+	pbx_test_validate(test, msg != NULL && fixed != NULL);
+	pbx_test_validate(test, msg->header.length == fixed->header.length);
+	sccp_free_packet(msg);
+	sccp_free_packet(fixed);
+
+	pbx_test_status_update(test, "Comparing REQ and REQFIXED over %d rounds...\n", SCCP_PACKET_BENCH_ROUNDS);
+	start = pbx_tvnow();
+	for (round = 0; round < SCCP_PACKET_BENCH_ROUNDS; round++) {
+		REQ(msg, CallStateMessage);
+		msg->data.CallStateMessage.lel_callState = htolel(SKINNY_CALLSTATE_CONNECTED);
+		msg->data.CallStateMessage.lel_lineInstance = htolel(1);
+		msg->data.CallStateMessage.lel_callReference = htolel(round);
+		msg->data.CallStateMessage.lel_visibility = htolel(SKINNY_CALLINFO_VISIBILITY_DEFAULT);
+		msg->data.CallStateMessage.precedence.lel_level = htolel(SKINNY_CALLPRIORITY_LOW);
+		msg->data.CallStateMessage.precedence.lel_domain = htolel(0);
+		sccp_free_packet(msg);
+	}
+	req_us = ast_tvdiff_us(pbx_tvnow(), start);
+	start = pbx_tvnow();
+	for (round = 0; round < SCCP_PACKET_BENCH_ROUNDS; round++) {
+		REQFIXED(msg, CallStateMessage);
+		msg->data.CallStateMessage.lel_callState = htolel(SKINNY_CALLSTATE_CONNECTED);
+		msg->data.CallStateMessage.lel_lineInstance = htolel(1);
+		msg->data.CallStateMessage.lel_callReference = htolel(round);
+		msg->data.CallStateMessage.lel_visibility = htolel(SKINNY_CALLINFO_VISIBILITY_DEFAULT);
+		msg->data.CallStateMessage.precedence.lel_level = htolel(SKINNY_CALLPRIORITY_LOW);
+		msg->data.CallStateMessage.precedence.lel_domain = htolel(0);
+		sccp_free_packet(msg);
+	}
+	fixed_us = ast_tvdiff_us(pbx_tvnow(), start);
+	pbx_test_status_update(test, "CallStateMessage: REQ %lld us, REQFIXED %lld us\n", (long long) req_us, (long long) fixed_us);
+
+	return AST_TEST_PASS;
+}
+
+static void __attribute__((constructor)) sccp_register_tests(void)
+{
+        AST_TEST_REGISTER(sccp_device_fixed_packet_tests);
+}
+
+static void __attribute__((destructor)) sccp_unregister_tests(void)
+{
+        AST_TEST_UNREGISTER(sccp_device_fixed_packet_tests);
+}
+#endif
+
 // kate: indent-width 4; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets on;
@@ -169,6 +169,7 @@ struct sccp_device {
 	sccp_nat_t nat;												/*!< Network Address Translation Support (Boolean, default=on) */
 	sccp_session_t *session;										/*!< Current Session */
 	SCCP_RWLIST_ENTRY (sccp_device_t) list;									/*!< Global Device Linked List */
+	SCCP_RWLIST_ENTRY (sccp_device_t) hashlist;								/*!< Global Device Index Entry */
 
 	sccp_private_device_data_t *privateData;
 	
@@ -347,6 +348,7 @@ struct sccp_device {
 #endif
 	boolean_t pendingDelete;										/*!< this bit will tell the scheduler to delete this line when unused */
 	boolean_t pendingUpdate;										/*!< this will contain the updated line struct once reloaded from config to update the line when unused */
+	uint64_t configHash;											/*!< hash of the sccp.conf section (and general) this device was last built from */
 };
 
 // Number of additional keys per addon -FS
@@ -413,7 +415,12 @@ SCCP_API sccp_buttonconfig_t * SCCP_CALL sccp_dev_serviceURL_find_byindex(device
 
 #define REQ(x,y) x = sccp_build_packet(y, sizeof(x->data.y))
 #define REQCMD(x,y) x = sccp_build_packet(y, 0)
+/* fixed layout messages of which every field is set by the caller: the length is a constant and the body is not cleared */
+#define SCCP_PACKET_PADDED(_len) ((_len) + ((4 - (((_len) + 8) % 4)) % 4))
+#define REQFIXED(x,y) x = sccp_build_fixed_packet(y, SCCP_PACKET_PADDED(sizeof(x->data.y)))
 SCCP_API sccp_msg_t * SCCP_CALL sccp_build_packet(sccp_mid_t t, size_t pkt_len);
+SCCP_API sccp_msg_t * SCCP_CALL sccp_build_fixed_packet(sccp_mid_t t, size_t pkt_len);
+SCCP_API void SCCP_CALL sccp_free_packet(sccp_msg_t * msg);
 
 SCCP_API void SCCP_CALL sccp_dev_check_displayprompt(constDevicePtr d);
 SCCP_API void SCCP_CALL sccp_device_setLastNumberDialed(devicePtr device, const char *lastNumberDialed, const sccp_linedevices_t *linedevice);
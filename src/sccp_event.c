@@ -25,6 +25,7 @@ SCCP_FILE_VERSION(__FILE__, "");
 
 void sccp_event_destroy(sccp_event_t * event);
 #define SCCP_EVENT_EXPECTED_SUBSCRIPTIONS 9			/* grep sccp_event_subscribe *.c */
+#define SCCP_EVENT_LANES 8					/* async events for the same device (or line) always use the same lane */
 
 #if CS_TEST_FRAMEWORK
 #include <asterisk/test.h>
@@ -37,9 +38,11 @@ typedef struct sccp_event_subscriber sccp_event_subscriber_t;
 typedef struct sccp_event_subscriptions sccp_event_subscriptions_t;
 typedef SCCP_VECTOR_RW(, sccp_event_subscriber_t) sccp_event_vector_t;
 
+typedef struct sccp_event_snapshot sccp_event_snapshot_t;
+typedef struct __aSyncEventProcessorThreadArg AsyncArgs_t;
+
 /* vector compare functions */
 #define SUBSCRIBER_CB_CMP(elem, value) ((elem).callback_function == (value))
-#define SUBSCRIBER_EXEC_CMP(elem, value) ((elem).execution == (value))
 
 /*!
  * \brief Execution Mode Enum
@@ -58,6 +61,20 @@ struct sccp_event_subscriber {
 	sccp_event_callback_t callback_function;
 };
 
+/*!
+ * \brief SCCP Event Subscriber Snapshot Structure
+ *
+ * Immutable copy of the subscribers of one event type, split into sync and async callbacks. A new snapshot is published
+ * every time the subscribers change, so that sccp_event_fire can use it without locking or copying. Replaced snapshots
+ * are kept chained to their successor and freed at module stop, as a reader might still be walking them.
+ */
+struct sccp_event_snapshot {
+	sccp_event_snapshot_t *previous;					/*!< replaced snapshot, freed at module stop */
+	uint16_t syncsize;							/*!< number of sync callbacks */
+	uint16_t asyncsize;							/*!< number of async callbacks */
+	sccp_event_callback_t callbacks[];					/*!< sync callbacks, followed by async callbacks */
+};
+
 /*!
  * \brief SCCP Event Subscriptions Structure
  */
@@ -66,6 +83,7 @@ static struct sccp_event_subscriptions {
 							// same as: SCCP_VECTOR_RW(sccp_event_vector, sccp_event_subscriber_t) subscribers;
 							// typedef struct sccp_event_vector sccp_event_vector_t;
 							// but using predeclared type instead
+	sccp_event_snapshot_t * volatile snapshot;				/*!< published by the writer holding the subscribers wrlock */
 } event_subscriptions[NUMBER_OF_EVENT_TYPES] = {{{0}}};
 
 /*
@@ -122,14 +140,80 @@ void sccp_event_destroy(sccp_event_t * event)
 	//pbx_log(LOG_NOTICE, "destroyed- %p type: %d\n", event, event->type);
 }
 
+/*!
+ * \brief SCCP Event Lane Structure
+ *
+ * Async events are queued on the lane belonging to their line/device and handled one after the other by a single
+ * threadpool job, so that events for the same object are never processed concurrently or out of order.
+ */
+static struct sccp_event_lane {
+	SCCP_LIST_HEAD (, AsyncArgs_t) queue;					/*!< pending events, queue lock protects scheduled as well */
+	boolean_t scheduled;							/*!< a threadpool job is draining this lane */
+} event_lanes[SCCP_EVENT_LANES];
+
 static volatile boolean_t sccp_event_running = FALSE;
 
+/*!
+ * \brief Build and publish a new snapshot of the subscribers vector
+ * \note subscribers wrlock needs to be held by caller
+ */
+static boolean_t __publish_snapshot(struct sccp_event_subscriptions *subscriptions)
+{
+	sccp_event_vector_t *subscribers = &subscriptions->subscribers;
+	sccp_event_snapshot_t *snapshot = NULL;
+	size_t size = SCCP_VECTOR_SIZE(subscribers);
+	uint32_t n = 0;
+	uint16_t pos = 0;
+
+	if (!(snapshot = sccp_calloc(1, sizeof(sccp_event_snapshot_t) + size * sizeof(sccp_event_callback_t)))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return FALSE;
+	}
+	for (n = 0; n < size; n++) {
+		sccp_event_subscriber_t *subscriber = SCCP_VECTOR_GET_ADDR(subscribers, n);
+		if (subscriber->execution == SCCP_EVENT_SYNC) {
+			snapshot->callbacks[pos++] = subscriber->callback_function;
+		}
+	}
+	snapshot->syncsize = pos;
+	for (n = 0; n < size; n++) {
+		sccp_event_subscriber_t *subscriber = SCCP_VECTOR_GET_ADDR(subscribers, n);
+		if (subscriber->execution == SCCP_EVENT_ASYNC) {
+			snapshot->callbacks[pos++] = subscriber->callback_function;
+		}
+	}
+	snapshot->asyncsize = pos - snapshot->syncsize;
+	snapshot->previous = subscriptions->snapshot;
+	__sync_synchronize();							/* snapshot content needs to be visible before the pointer */
+	subscriptions->snapshot = snapshot;
+	return TRUE;
+}
+
+/*!
+ * \brief Unpublish and free the snapshot and all the snapshots it replaced
+ * \note subscribers wrlock needs to be held by caller
+ */
+static void __free_snapshots(struct sccp_event_subscriptions *subscriptions)
+{
+	sccp_event_snapshot_t *snapshot = subscriptions->snapshot;
+	subscriptions->snapshot = NULL;
+	while (snapshot) {
+		sccp_event_snapshot_t *previous = snapshot->previous;
+		sccp_free(snapshot);
+		snapshot = previous;
+	}
+}
+
 //static void __attribute__((constructor)) sccp_event_module_init(void)
 void sccp_event_module_start(void)
 {
 	uint _idx = 0;
 	if (!sccp_event_running) {
 		sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "Starting event system\n");
+		for (_idx = 0; _idx < SCCP_EVENT_LANES; _idx++) {
+			SCCP_LIST_HEAD_INIT(&event_lanes[_idx].queue);
+			event_lanes[_idx].scheduled = FALSE;
+		}
 		for (_idx = 0; _idx < NUMBER_OF_EVENT_TYPES; _idx++) {
 			if (SCCP_VECTOR_RW_INIT(&event_subscriptions[_idx].subscribers, SCCP_EVENT_EXPECTED_SUBSCRIPTIONS) != 0) {
 				pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
@@ -147,7 +231,19 @@ void sccp_event_module_stop(void)
 	if (sccp_event_running) {
 		sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "Stopping event system\n");
 		sccp_event_running = FALSE;
+		for (_idx = 0; _idx < SCCP_EVENT_LANES; _idx++) {		/* drop queued events, running lane jobs will find their queue empty */
+			AsyncArgs_t *arg = NULL;
+			SCCP_LIST_LOCK(&event_lanes[_idx].queue);
+			while ((arg = SCCP_LIST_REMOVE_HEAD(&event_lanes[_idx].queue, list))) {
+				sccp_event_destroy(&arg->event);
+				sccp_free(arg);
+			}
+			SCCP_LIST_UNLOCK(&event_lanes[_idx].queue);
+		}
 		for (_idx = 0; _idx < NUMBER_OF_EVENT_TYPES; _idx++) {
+			SCCP_VECTOR_RW_WRLOCK(&event_subscriptions[_idx].subscribers);
+			__free_snapshots(&event_subscriptions[_idx]);
+			SCCP_VECTOR_RW_UNLOCK(&event_subscriptions[_idx].subscribers);
 			SCCP_VECTOR_RW_FREE(&event_subscriptions[_idx].subscribers);
 		}
 	}
@@ -176,7 +272,11 @@ boolean_t sccp_event_subscribe(sccp_event_type_t eventType, sccp_event_callback_
 			sccp_event_vector_t *subscribers = &(event_subscriptions[_idx].subscribers);
 			SCCP_VECTOR_RW_WRLOCK(subscribers);
 			if (SCCP_VECTOR_APPEND(subscribers, subscriber) == 0) {
-				res = TRUE;
+				if (__publish_snapshot(&event_subscriptions[_idx])) {
+					res = TRUE;
+				} else {
+					SCCP_VECTOR_REMOVE_UNORDERED(subscribers, SCCP_VECTOR_SIZE(subscribers) - 1);	/* roll back */
+				}
 			} else {
 				pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
 			}
@@ -203,6 +303,7 @@ boolean_t sccp_event_unsubscribe(sccp_event_type_t eventType, sccp_event_callbac
 			{
 				SCCP_VECTOR_RW_WRLOCK(subscribers);
 				if (SCCP_VECTOR_REMOVE_CMP_UNORDERED(subscribers, cb, SUBSCRIBER_CB_CMP, SCCP_VECTOR_ELEM_CLEANUP_NOOP) == 0) {
+					__publish_snapshot(&event_subscriptions[_idx]);
 					res = TRUE;
 				} else {
 					pbx_log(LOG_ERROR, "SCCP: (sccp_event_subscribe) Failed to remove subscriber from subscribers vector\n");
@@ -216,52 +317,76 @@ boolean_t sccp_event_unsubscribe(sccp_event_type_t eventType, sccp_event_callbac
 
 /* helpers */
 /*!
- * \brief execute the callback off each subscriber in the subscribers array, for a particular event
- * \note should be handed an copied non-lockedable vector
+ * \brief execute the callbacks of a snapshot, for a particular event
  */
-static gcc_inline boolean_t __execute_callback_helper(const sccp_event_t *event, sccp_event_vector_t *subs_vector) 
+static gcc_inline boolean_t __execute_callback_helper(const sccp_event_t *event, sccp_event_callback_t const callbacks[], uint16_t size) 
 {
 	boolean_t res = FALSE;
-	if (subs_vector) {
-		uint32_t n = 0;
-		for (n = 0; n < SCCP_VECTOR_SIZE(subs_vector) && sccp_event_running; n++) {
-			sccp_event_subscriber_t subscriber = SCCP_VECTOR_GET(subs_vector, n);
-			if (subscriber.callback_function != NULL) {
-				//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "Processing Event %p of Type %s via %d callback:%p\n", event, sccp_event_type2str(event->type), n, subscriber.callback_function);
-				subscriber.callback_function(event);
-				res = TRUE;
-			}
+	uint16_t n = 0;
+	for (n = 0; n < size && sccp_event_running; n++) {
+		if (callbacks[n] != NULL) {
+			//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "Processing Event %p of Type %s via %d callback:%p\n", event, sccp_event_type2str(event->type), n, callbacks[n]);
+			callbacks[n](event);
+			res = TRUE;
 		}
-		SCCP_VECTOR_PTR_FREE(subs_vector);
 	}
 	return res;
 }
 
 /*!
- * search for position in event_subscriptions[] array 
+ * position in event_subscriptions[] array, event types are single bit values (returns NUMBER_OF_EVENT_TYPES if not found)
  */
 static gcc_inline uint8_t __search_for_position_in_event_array(sccp_event_type_t eventType) {
-	uint8_t _idx = 0;
-	sccp_event_type_t _mask;
-	for (_idx = 0, _mask = 1 << _idx; sccp_event_running && _idx < NUMBER_OF_EVENT_TYPES; _mask = 1 << ++_idx) {
-		if (eventType & _mask) {
-			//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "SCCP: (__search_for_position_in_event_array) found index:%d\n", _idx);
+	int _pos = __builtin_ffs((int) eventType);
+	return (_pos > 0 && _pos <= NUMBER_OF_EVENT_TYPES) ? _pos - 1 : NUMBER_OF_EVENT_TYPES;
+}
+
+/*!
+ * \brief select the lane for an event, based on the device or line it is about
+ *
+ * \note Every event about a device (registration, attaching/detaching its lines, feature changes) uses the lane of the device,
+ * so they are handled in the order they were fired. Line events (created, status changed) are only ordered per line.
+ */
+static gcc_inline struct sccp_event_lane *__search_for_lane(const sccp_event_t *event)
+{
+	const void *key = NULL;
+	switch (event->type) {
+		case SCCP_EVENT_LINE_CREATED:
+			key = event->event.lineCreated.line;
+			break;
+		case SCCP_EVENT_DEVICE_ATTACHED:
+		case SCCP_EVENT_DEVICE_DETACHED:
+			key = event->event.deviceAttached.linedevice ? event->event.deviceAttached.linedevice->device : NULL;
+			break;
+		case SCCP_EVENT_LINESTATUS_CHANGED:
+			key = event->event.lineStatusChanged.line;
+			break;
+		case SCCP_EVENT_DEVICE_REGISTERED:
+		case SCCP_EVENT_DEVICE_UNREGISTERED:
+		case SCCP_EVENT_DEVICE_PREREGISTERED:
+			key = event->event.deviceRegistered.device;
+			break;
+		case SCCP_EVENT_FEATURE_CHANGED:
+			key = event->event.featureChanged.device;
+			break;
+		default:
 			break;
-		}
 	}
-	return _idx;
+	return &event_lanes[(((uintptr_t) key >> 4) * 2654435761U) % SCCP_EVENT_LANES];
 }
 /* end helpers */
 
 /*!
  * async thread arguments
  */
-typedef struct __aSyncEventProcessorThreadArg
+struct __aSyncEventProcessorThreadArg
 {
+	SCCP_LIST_ENTRY (AsyncArgs_t) list;
 	uint8_t idx;
 	sccp_event_t event;
-	sccp_event_vector_t *async_subscribers;
-} AsyncArgs_t;
+	uint16_t size;
+	sccp_event_callback_t callbacks[];
+};
 /*!
  * async thread run within threadpool
  */
@@ -270,13 +395,32 @@ static void *sccp_event_processor(void *data)
 	AsyncArgs_t *arg = data;
 	if (arg) {
 		//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "Async Processing Event Callbacks Type %s\n", sccp_event_type2str(arg->event.type));
-		__execute_callback_helper(&arg->event, arg->async_subscribers);
+		__execute_callback_helper(&arg->event, arg->callbacks, arg->size);
 		sccp_event_destroy(&arg->event);
 		sccp_free(arg);
 	}
 	return NULL;
 }
 
+/*!
+ * lane job run within threadpool, handles the queued events of one lane in order
+ */
+static void *sccp_event_lane_processor(void *data)
+{
+	struct sccp_event_lane *lane = data;
+	AsyncArgs_t *arg = NULL;
+
+	SCCP_LIST_LOCK(&lane->queue);
+	while ((arg = SCCP_LIST_REMOVE_HEAD(&lane->queue, list))) {
+		SCCP_LIST_UNLOCK(&lane->queue);
+		sccp_event_processor(arg);
+		SCCP_LIST_LOCK(&lane->queue);
+	}
+	lane->scheduled = FALSE;
+	SCCP_LIST_UNLOCK(&lane->queue);
+	return NULL;
+}
+
 /*!
  * \brief Fire an Event
  * \param event SCCP Event
@@ -289,60 +433,51 @@ boolean_t sccp_event_fire(sccp_event_t * event)
 {
 	boolean_t res = FALSE;
 	if (event) {
-		sccp_event_vector_t *sync_subscribers_cpy = NULL, *async_subscribers_cpy = NULL;
-		size_t subsize = 0, syncsize = 0, asyncsize = 0;
 		uint8_t _idx = __search_for_position_in_event_array(event->type);
-		
-		/* copy both vectors to a local copy while holding the rwlock */
-		sccp_event_vector_t *subscribers = &event_subscriptions[_idx].subscribers;
-		SCCP_VECTOR_RW_RDLOCK(subscribers);
-		if ((subsize = SCCP_VECTOR_SIZE(subscribers))) {
-			sync_subscribers_cpy = SCCP_VECTOR_CALLBACK_MULTIPLE(subscribers, SUBSCRIBER_EXEC_CMP, SCCP_EVENT_SYNC);
-			async_subscribers_cpy = SCCP_VECTOR_CALLBACK_MULTIPLE(subscribers, SUBSCRIBER_EXEC_CMP, SCCP_EVENT_ASYNC);
-			syncsize = sync_subscribers_cpy ? SCCP_VECTOR_SIZE(sync_subscribers_cpy) : 0;
-			asyncsize = async_subscribers_cpy ? SCCP_VECTOR_SIZE(async_subscribers_cpy) : 0;
-		}
-		SCCP_VECTOR_RW_UNLOCK(subscribers);
+		const sccp_event_snapshot_t *snapshot = (sccp_event_running && _idx < NUMBER_OF_EVENT_TYPES) ? event_subscriptions[_idx].snapshot : NULL;
 
-		// handle synchronous events first (if any)
-		if (sync_subscribers_cpy) {
-			if (syncsize) {
-				res |= __execute_callback_helper(event, sync_subscribers_cpy);
-			} else {
-				SCCP_VECTOR_PTR_FREE(sync_subscribers_cpy);
+		if (snapshot) {
+			// handle synchronous events first (if any)
+			if (snapshot->syncsize) {
+				res |= __execute_callback_helper(event, snapshot->callbacks, snapshot->syncsize);
 			}
-		}
 
-		// handle the others asynchonously via threadpool (if any)
-		do {
-			if (async_subscribers_cpy) {
-				if (asyncsize) {
-					AsyncArgs_t *arg = NULL;
-					if (GLOB(general_threadpool) && sccp_event_running && (arg = sccp_malloc(sizeof *arg))) {
-						arg->idx = _idx;
-						memcpy(&arg->event, event, sizeof(sccp_event_t));
-						arg->async_subscribers = async_subscribers_cpy;
-						if (sccp_threadpool_add_work(GLOB(general_threadpool), (void *) sccp_event_processor, (void *) arg)) {
-							//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "Work added to threadpool for event: %p, type: %s\n", event, sccp_event_type2str(event->type));
-							event = NULL;					// set to NULL, thread will clean event up later.
-							res |= true;
-							break;						// break out of do/while loop, no further processing needed
+			// handle the others asynchonously via threadpool (if any)
+			if (snapshot->asyncsize) {
+				const sccp_event_callback_t *async_callbacks = &snapshot->callbacks[snapshot->syncsize];
+				AsyncArgs_t *arg = NULL;
+				if (GLOB(general_threadpool) && sccp_event_running && (arg = sccp_malloc(sizeof *arg + snapshot->asyncsize * sizeof(sccp_event_callback_t)))) {
+					arg->idx = _idx;
+					memcpy(&arg->event, event, sizeof(sccp_event_t));
+					arg->size = snapshot->asyncsize;
+					memcpy(arg->callbacks, async_callbacks, snapshot->asyncsize * sizeof(sccp_event_callback_t));
+					struct sccp_event_lane *lane = __search_for_lane(event);
+					boolean_t queued = TRUE;
+
+					SCCP_LIST_LOCK(&lane->queue);
+					SCCP_LIST_INSERT_TAIL(&lane->queue, arg, list);
+					if (!lane->scheduled) {
+						if (sccp_threadpool_add_work(GLOB(general_threadpool), (void *) sccp_event_lane_processor, (void *) lane)) {
+							lane->scheduled = TRUE;
 						} else {
-							pbx_log(LOG_ERROR, "Could not add work to threadpool for event: %s\n", sccp_event_type2str(event->type));
-							sccp_free(arg);					// explicit failure release
+							SCCP_LIST_REMOVE(&lane->queue, arg, list);	// lane was idle, so arg is the only entry
+							queued = FALSE;
 						}
 					}
-					res |= __execute_callback_helper(event, async_subscribers_cpy);	// fallback to handling synchronously in case something prevented async
-				} else {
-					SCCP_VECTOR_PTR_FREE(async_subscribers_cpy);
+					SCCP_LIST_UNLOCK(&lane->queue);
+					if (queued) {
+						//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "Event: %p, type: %s queued on lane:%d\n", event, sccp_event_type2str(event->type), (int)(lane - event_lanes));
+						return TRUE;					// lane job will clean event up later.
+					}
+					pbx_log(LOG_ERROR, "Could not add work to threadpool for event: %s\n", sccp_event_type2str(event->type));
+					sccp_free(arg);						// explicit failure release
 				}
+				res |= __execute_callback_helper(event, async_callbacks, snapshot->asyncsize);	// fallback to handling synchronously in case something prevented async
 			}
-		} while (0);
+		}
 
 		/* cleanup */
-		if (event) {
-			sccp_event_destroy(event);
-		}
+		sccp_event_destroy(event);
 	}
 	return res;
 }
@@ -502,11 +637,197 @@ cleanup:
 	return rc;
 }
 
+AST_TEST_DEFINE(sccp_event_test_subscribe_mixed)
+{
+	int rc = AST_TEST_PASS;
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "subscribe_mixed";
+			info->category = "/channels/chan_sccp/event/";
+			info->summary = "chan-sccp-b event subscribe sync and async";
+			info->description = "chan-sccp-b event subscribe synchonously and asynchonously, fire test event, unsubscribe and fire again";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+	boolean_t syncSubscribed = FALSE, asyncSubscribed = FALSE;
+	const sccp_event_snapshot_t *snapshot = NULL;
+	uint8_t _idx = __search_for_position_in_event_array(SCCP_EVENT_TEST);
+
+	pbx_test_status_update(test, "event type lookup\n");
+	pbx_test_validate(test, __search_for_position_in_event_array(SCCP_EVENT_LINE_CREATED) == 0);
+	pbx_test_validate(test, __search_for_position_in_event_array(SCCP_EVENT_LINESTATUS_CHANGED) == 9);
+	pbx_test_validate(test, __search_for_position_in_event_array(SCCP_EVENT_NULL) == NUMBER_OF_EVENT_TYPES);
+	pbx_test_validate(test, _idx == NUMBER_OF_EVENT_TYPES - 1);
+
+	pbx_test_status_update(test, "subscribe to SCCP_EVENT_TEST sync and async\n");
+	pbx_test_validate_cleanup(test, (syncSubscribed = sccp_event_subscribe(SCCP_EVENT_TEST, sccp_event_testListener, FALSE)), rc, cleanup);
+	pbx_test_validate_cleanup(test, (asyncSubscribed = sccp_event_subscribe(SCCP_EVENT_TEST, sccp_event_testListener, TRUE)), rc, cleanup);
+
+	snapshot = event_subscriptions[_idx].snapshot;
+	pbx_test_validate_cleanup(test, snapshot && snapshot->syncsize == 1 && snapshot->asyncsize == 1, rc, cleanup);
+
+	uint32_t EventReceivedBeforeTest = _sccp_event_TestEventReceived;
+
+	pbx_test_status_update(test, "fire SCCP_EVENT_TEST\n");
+	sccp_event_t event = {{{0}}};
+	event.type = SCCP_EVENT_TEST;
+	event.event.TestEvent.value = _sccp_event_TestValue;
+	event.event.TestEvent.str = pbx_strdup(_sccp_event_TestStr);
+	sccp_event_fire(&event);
+	pbx_test_validate_cleanup(test, _sccp_event_TestEventReceived >= EventReceivedBeforeTest + 1, rc, cleanup);
+
+	/* wait for async result */
+	int loopcount = 0;
+	while (_sccp_event_TestEventReceived < EventReceivedBeforeTest + 2 && 100 > loopcount++) {
+		sccp_safe_sleep(10);
+	}
+	pbx_test_status_update(test, "before test:%d, received:%d, expected:%d\n", EventReceivedBeforeTest, _sccp_event_TestEventReceived, EventReceivedBeforeTest + 2);
+	pbx_test_validate_cleanup(test, _sccp_event_TestEventReceived == EventReceivedBeforeTest + 2, rc, cleanup);
+
+	pbx_test_status_update(test, "unsubscribe both and fire SCCP_EVENT_TEST again\n");
+	pbx_test_validate_cleanup(test, sccp_event_unsubscribe(SCCP_EVENT_TEST, sccp_event_testListener), rc, cleanup);
+	syncSubscribed = FALSE;
+	pbx_test_validate_cleanup(test, sccp_event_unsubscribe(SCCP_EVENT_TEST, sccp_event_testListener), rc, cleanup);
+	asyncSubscribed = FALSE;
+	snapshot = event_subscriptions[_idx].snapshot;
+	pbx_test_validate_cleanup(test, snapshot && snapshot->syncsize == 0 && snapshot->asyncsize == 0, rc, cleanup);
+
+	EventReceivedBeforeTest = _sccp_event_TestEventReceived;
+	sccp_event_t event2 = {{{0}}};
+	event2.type = SCCP_EVENT_TEST;
+	event2.event.TestEvent.value = _sccp_event_TestValue;
+	event2.event.TestEvent.str = pbx_strdup(_sccp_event_TestStr);
+	pbx_test_validate_cleanup(test, sccp_event_fire(&event2) == FALSE, rc, cleanup);
+	pbx_test_validate_cleanup(test, _sccp_event_TestEventReceived == EventReceivedBeforeTest, rc, cleanup);
+
+cleanup:
+	if (syncSubscribed) {
+		sccp_event_unsubscribe(SCCP_EVENT_TEST, sccp_event_testListener);
+	}
+	if (asyncSubscribed) {
+		sccp_event_unsubscribe(SCCP_EVENT_TEST, sccp_event_testListener);
+	}
+	return rc;
+}
+
+static uint32_t _sccp_event_TestOrderReceived = 0;
+static boolean_t _sccp_event_TestOrderValid = TRUE;
+
+static void sccp_event_testOrderListener(const sccp_event_t * event) {
+	if (event->event.TestEvent.value != _sccp_event_TestOrderReceived) {
+		pbx_log(LOG_NOTICE, "SCCP: Test Order Listener, received event value:%d, expected:%d\n", event->event.TestEvent.value, _sccp_event_TestOrderReceived);
+		_sccp_event_TestOrderValid = FALSE;
+	}
+	sccp_safe_sleep(1);
+	_sccp_event_TestOrderReceived++;
+}
+
+AST_TEST_DEFINE(sccp_event_test_ordered_lane)
+{
+	int rc = AST_TEST_PASS;
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "ordered_lane";
+			info->category = "/channels/chan_sccp/event/";
+			info->summary = "chan-sccp-b async events are handled in order";
+			info->description = "chan-sccp-b fire a series of async test events and check they arrive in order";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+	uint32_t numevents = 20, n = 0;
+
+	_sccp_event_TestOrderReceived = 0;
+	_sccp_event_TestOrderValid = TRUE;
+
+	pbx_test_status_update(test, "subscribe to SCCP_EVENT_TEST async\n");
+	pbx_test_validate(test, sccp_event_subscribe(SCCP_EVENT_TEST, sccp_event_testOrderListener, TRUE));
+
+	pbx_test_status_update(test, "fire %d SCCP_EVENT_TEST\n", numevents);
+	for (n = 0; n < numevents; n++) {
+		sccp_event_t event = {{{0}}};
+		event.type = SCCP_EVENT_TEST;
+		event.event.TestEvent.value = n;
+		sccp_event_fire(&event);
+	}
+
+	/* wait for async result */
+	int loopcount = 0;
+	while (_sccp_event_TestOrderReceived < numevents && 200 > loopcount++) {
+		sccp_safe_sleep(10);
+	}
+	pbx_test_status_update(test, "received:%d, expected:%d, in order:%s\n", _sccp_event_TestOrderReceived, numevents, _sccp_event_TestOrderValid ? "yes" : "no");
+	pbx_test_validate_cleanup(test, _sccp_event_TestOrderReceived == numevents, rc, cleanup);
+	pbx_test_validate_cleanup(test, _sccp_event_TestOrderValid, rc, cleanup);
+
+cleanup:
+	pbx_test_status_update(test, "unsubscribe from SCCP_EVENT_TEST\n");
+	pbx_test_validate(test, sccp_event_unsubscribe(SCCP_EVENT_TEST, sccp_event_testOrderListener));
+	return rc;
+}
+
+AST_TEST_DEFINE(sccp_event_test_device_lane)
+{
+	static char fake_devices[SCCP_EVENT_LANES * 2][64];
+	static char fake_lines[SCCP_EVENT_LANES * 2 + 1][64];
+	sccp_event_type_t device_events[] = {SCCP_EVENT_DEVICE_PREREGISTERED, SCCP_EVENT_DEVICE_REGISTERED, SCCP_EVENT_DEVICE_ATTACHED, SCCP_EVENT_FEATURE_CHANGED, SCCP_EVENT_DEVICE_DETACHED, SCCP_EVENT_DEVICE_UNREGISTERED};
+	uint32_t d = 0, e = 0;
+
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "device_lane";
+			info->category = "/channels/chan_sccp/event/";
+			info->summary = "chan-sccp-b device events share a lane";
+			info->description = "chan-sccp-b check that all async events about one device are queued on the same lane";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+
+	pbx_test_status_update(test, "check the lanes of the device events for %d devices\n", (int) ARRAY_LEN(fake_devices));
+	for (d = 0; d < ARRAY_LEN(fake_devices); d++) {
+		sccp_device_t *device = (sccp_device_t *) fake_devices[d];
+		sccp_linedevices_t linedevice = {0};
+		struct sccp_event_lane *lane = NULL;
+
+		linedevice.device = device;
+		linedevice.line = (sccp_line_t *) fake_lines[d + 1];						/* a different line for every device */
+		for (e = 0; e < ARRAY_LEN(device_events); e++) {
+			sccp_event_t event = {{{0}}};
+			event.type = device_events[e];
+			switch (event.type) {
+				case SCCP_EVENT_DEVICE_ATTACHED:
+				case SCCP_EVENT_DEVICE_DETACHED:
+					event.event.deviceAttached.linedevice = &linedevice;
+					break;
+				case SCCP_EVENT_FEATURE_CHANGED:
+					event.event.featureChanged.device = device;
+					event.event.featureChanged.optional_linedevice = &linedevice;
+					break;
+				default:
+					event.event.deviceRegistered.device = device;
+					break;
+			}
+			if (!lane) {
+				lane = __search_for_lane(&event);
+			} else if (lane != __search_for_lane(&event)) {
+				pbx_test_status_update(test, "device:%d, event %s uses lane:%d instead of lane:%d\n", d, sccp_event_type2str(event.type), (int) (__search_for_lane(&event) - event_lanes), (int) (lane - event_lanes));
+				return AST_TEST_FAIL;
+			}
+		}
+	}
+	return AST_TEST_PASS;
+}
+
 static void __attribute__((constructor)) sccp_register_tests(void)
 {
 	AST_TEST_REGISTER(sccp_event_test_subscribe_single);
 	AST_TEST_REGISTER(sccp_event_test_subscribe_multi);
 	AST_TEST_REGISTER(sccp_event_test_subscribe_multi_sync);
+	AST_TEST_REGISTER(sccp_event_test_subscribe_mixed);
+	AST_TEST_REGISTER(sccp_event_test_ordered_lane);
+	AST_TEST_REGISTER(sccp_event_test_device_lane);
 }
 
 static void __attribute__((destructor)) sccp_unregister_tests(void)
@@ -514,6 +835,9 @@ static void __attribute__((destructor)) sccp_unregister_tests(void)
 	AST_TEST_UNREGISTER(sccp_event_test_subscribe_single);
 	AST_TEST_UNREGISTER(sccp_event_test_subscribe_multi);
 	AST_TEST_UNREGISTER(sccp_event_test_subscribe_multi_sync);
+	AST_TEST_UNREGISTER(sccp_event_test_subscribe_mixed);
+	AST_TEST_UNREGISTER(sccp_event_test_ordered_lane);
+	AST_TEST_UNREGISTER(sccp_event_test_device_lane);
 }
 #endif
 
@@ -45,10 +45,14 @@ struct sccp_global_vars {
 #endif
 
 	sccp_threadpool_t *general_threadpool;									/*!< General Work Threadpool */
+	uint8_t session_threads;										/*!< Number of Session Reactor Threads (0 = one thread per session) */
 
 	SCCP_RWLIST_HEAD (, sccp_session_t) sessions;								/*!< SCCP Sessions */
 	SCCP_RWLIST_HEAD (, sccp_device_t) devices;								/*!< SCCP Devices */
 	SCCP_RWLIST_HEAD (, sccp_line_t) lines;									/*!< SCCP Lines */
+	SCCP_RWLIST_HEAD (, sccp_device_t) device_index[SCCP_HASH_PRIME];					/*!< SCCP Devices hashed by (case insensitive) id */
+	SCCP_RWLIST_HEAD (, sccp_line_t) line_index[SCCP_HASH_PRIME];						/*!< SCCP Lines hashed by (case insensitive) name */
+	SCCP_RWLIST_HEAD (, sccp_channel_t) channel_index[SCCP_HASH_PRIME];					/*!< SCCP Channels hashed by callid */
 
 	sccp_mutex_t socket_lock;										/*!< Socket Lock */
 #ifndef SCCP_ATOMIC	
@@ -147,6 +151,11 @@ struct sccp_global_vars {
 	char *token_fallback;											/*!< Fall back immediatly on TokenReq (true/false/odd/even) */
 	int token_backoff_time;											/*!< Backoff time on TokenReject */
 	int server_priority;											/*!< Server Priority to fallback to */
+	uint16_t registration_maxpending;									/*!< Maximum number of registrations in progress (0 = unlimited) */
+	uint16_t registration_rate;										/*!< Registrations per second per subnet (0 = unlimited) */
+	uint16_t registration_burst;										/*!< Registrations per subnet allowed in a burst */
+	uint8_t registration_prefix;										/*!< IPv4 prefix length of a subnet for registration_rate */
+	uint16_t registration_backoff;										/*!< Seconds a phone is told to wait when its registration is not admitted */
 
 
 	boolean_t reload_in_progress;										/*!< Reload in Progress */
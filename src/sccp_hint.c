@@ -32,6 +32,7 @@ SCCP_FILE_VERSION(__FILE__, "");
 #include "sccp_device.h"
 #include "sccp_indicate.h"											// only for SCCP_CHANNELSTATE_Idling
 #include "sccp_line.h"
+#include "sccp_session.h"
 #include "sccp_utils.h"
 #include "sccp_labels.h"
 
@@ -39,6 +40,8 @@ SCCP_FILE_VERSION(__FILE__, "");
 #  include <asterisk/event.h>
 #endif
 
+#define SCCP_HINT_COALESCE_WINDOW 50										/* millisecs during which hint changes are collected before they are sent to the subscribers */
+
 /* ========================================================================================================================= Struct Definitions */
 /*!
  *\brief SCCP Hint Subscribing Device Structure
@@ -75,6 +78,7 @@ struct sccp_hint_lineState
 	} callInfo;												/*!< Call Information Structure */
 
 	SCCP_LIST_ENTRY (struct sccp_hint_lineState) list;							/*!< Hint Type Linked List Entry */
+	struct sccp_hint_lineState *hashnext;									/*!< Next lineState in the same lineStateIndex bucket */
 };
 
 /*!
@@ -89,6 +93,10 @@ struct sccp_hint_list {
 
 	sccp_channelstate_t currentState;									/*!< current State */
 	sccp_channelstate_t previousState;									/*!< current State */
+	sccp_channelstate_t notifiedState;									/*!< State last sent to the subscribers */
+	boolean_t pending;											/*!< Changed since the subscribers were last notified (protected by hintNotifyLock) */
+	uint32_t notified;											/*!< Number of notification batches sent to the subscribers */
+	uint32_t suppressed;											/*!< Number of changes merged into a pending notification */
 
 	/*!
 	 * \brief Call Information Structure
@@ -117,6 +125,7 @@ static void sccp_hint_updateLineStateForSingleChannel(struct sccp_hint_lineState
 static void sccp_hint_checkForDND(struct sccp_hint_lineState *lineState);
 static sccp_hint_list_t *sccp_hint_create(char *hint_exten, char *hint_context);
 static void sccp_hint_notifySubscribers(sccp_hint_list_t * hint);			/* old */
+static void sccp_hint_queueNotify(sccp_hint_list_t * hint);
 static void sccp_hint_notifyLineStateUpdate(struct sccp_hint_lineState *linestate); 	/* new */
 static void sccp_hint_deviceRegistered(const sccp_device_t * device);
 static void sccp_hint_deviceUnRegistered(const char *deviceName);
@@ -191,8 +200,15 @@ static void sccp_hint_distributed_devstate_cb(const pbx_event_t * event, void *d
 
 /* ========================================================================================================================= List Declarations */
 static SCCP_LIST_HEAD (, struct sccp_hint_lineState) lineStates;
+static struct sccp_hint_lineState *lineStateIndex[SCCP_HASH_PRIME];					/* lineStates hashed by line name, protected by the lineStates lock */
 static SCCP_LIST_HEAD (, sccp_hint_list_t) sccp_hint_subscriptions;
 
+AST_MUTEX_DEFINE_STATIC(hintNotifyLock);									/* protects hint->pending and the notify schedule */
+AST_MUTEX_DEFINE_STATIC(hintNotifyBatchLock);								/* held while a notification batch is running */
+static int hintNotifySchedId = -1;
+static boolean_t hintNotifyScheduled = FALSE;
+static boolean_t hintNotifyStopped = FALSE;
+
 /* ========================================================================================================================= Module Start/Stop */
 /*!
  * \brief starting hint-module
@@ -201,7 +217,11 @@ void sccp_hint_module_start(void)
 {
 	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "SCCP: Starting hint system\n");
 	SCCP_LIST_HEAD_INIT(&lineStates);
+	memset(lineStateIndex, 0, sizeof(lineStateIndex));
 	SCCP_LIST_HEAD_INIT(&sccp_hint_subscriptions);
+	pbx_mutex_lock(&hintNotifyLock);
+	hintNotifyStopped = FALSE;
+	pbx_mutex_unlock(&hintNotifyLock);
 	sccp_event_subscribe(SCCP_EVENT_DEVICE_REGISTERED | SCCP_EVENT_DEVICE_UNREGISTERED | SCCP_EVENT_DEVICE_DETACHED | SCCP_EVENT_DEVICE_ATTACHED | SCCP_EVENT_LINESTATUS_CHANGED, sccp_hint_eventListener, TRUE);
 	sccp_event_subscribe(SCCP_EVENT_FEATURE_CHANGED, sccp_hint_handleFeatureChangeEvent, TRUE);
 #ifdef CS_USE_ASTERISK_DISTRIBUTED_DEVSTATE
@@ -215,11 +235,25 @@ void sccp_hint_module_start(void)
  */
 void sccp_hint_module_stop(void)
 {
+	int schedId = -1;
+
 	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "SCCP: Stopping hint system\n");
+	pbx_mutex_lock(&hintNotifyLock);
+	hintNotifyStopped = TRUE;
+	schedId = hintNotifySchedId;
+	hintNotifySchedId = -1;
+	hintNotifyScheduled = FALSE;
+	pbx_mutex_unlock(&hintNotifyLock);
+	if (schedId > -1) {
+		schedId = SCCP_SCHED_DEL(schedId);							/* outside hintNotifyLock, the callback may run sccp_hint_notifyPending inline */
+	}
+	pbx_mutex_lock(&hintNotifyBatchLock);								/* wait for a running batch, later ones see hintNotifyStopped */
+	pbx_mutex_unlock(&hintNotifyBatchLock);
 	{
 		struct sccp_hint_lineState *lineState;
 
 		SCCP_LIST_LOCK(&lineStates);
+		memset(lineStateIndex, 0, sizeof(lineStateIndex));
 		while ((lineState = SCCP_LIST_REMOVE_HEAD(&lineStates, list))) {
 			if (lineState->line) {
 				sccp_line_release(&lineState->line);		/* explicit release*/
@@ -370,7 +404,7 @@ static int sccp_hint_devstate_cb(char *context, char *id, enum ast_extension_sta
 			break;
 	}
 
-	sccp_hint_notifySubscribers(hint);
+	sccp_hint_queueNotify(hint);
 	return 0;
 }
 
@@ -569,7 +603,7 @@ static void sccp_hint_addSubscription4Device(const sccp_device_t * device, const
 
 	sccp_dev_set_keyset(device, subscriber->instance, 0, KEYMODE_ONHOOK);
 
-	sccp_hint_notifySubscribers(hint);
+	sccp_hint_queueNotify(hint);
 }
 
 /*!
@@ -654,16 +688,40 @@ static sccp_hint_list_t *sccp_hint_create(char *hint_exten, char *hint_context)
 }
 
 /* ========================================================================================================================= Event Handlers : LineState */
+/*!
+ * \brief Find the lineState for a line name using the lineStateIndex
+ * \note lineStates needs to be locked by caller
+ */
+static struct sccp_hint_lineState *sccp_hint_findLineStateByName(const char *lineName)
+{
+	struct sccp_hint_lineState *lineState = lineStateIndex[sccp_strcase_hash(lineName) % SCCP_HASH_PRIME];
+
+	while (lineState && !(lineState->line && sccp_strcaseequals(lineState->line->name, lineName))) {
+		lineState = lineState->hashnext;
+	}
+	return lineState;
+}
+
+/*!
+ * \brief Find the lineState for a line using the lineStateIndex
+ * \note lineStates needs to be locked by caller
+ */
+static struct sccp_hint_lineState *sccp_hint_findLineState(const sccp_line_t * line)
+{
+	struct sccp_hint_lineState *lineState = lineStateIndex[sccp_strcase_hash(line->name) % SCCP_HASH_PRIME];
+
+	while (lineState && lineState->line != line) {
+		lineState = lineState->hashnext;
+	}
+	return lineState;
+}
+
 static void sccp_hint_attachLine(sccp_line_t * line, sccp_device_t * device) 
 {
 	struct sccp_hint_lineState *lineState = NULL;
 
 	SCCP_LIST_LOCK(&lineStates);
-	SCCP_LIST_TRAVERSE(&lineStates, lineState, list) {
-		if (lineState->line == line) {
-			break;
-		}
-	}
+	lineState = sccp_hint_findLineState(line);
 	if (!lineState) {		/* create new lineState if necessary */
 		sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "%s (hint_attachLine) Create new hint_lineState for line: %s\n", DEV_ID_LOG(device), line->name);
 		lineState = sccp_calloc(sizeof *lineState, 1);
@@ -677,7 +735,11 @@ static void sccp_hint_attachLine(sccp_line_t * line, sccp_device_t * device)
 
 	if (!lineState->line) {		/* retain one instance of line in lineState->line */
 		//sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_attachLine) attaching line: %s\n", DEV_ID_LOG(device), line->name);
-		lineState->line = sccp_line_retain(line);
+		if ((lineState->line = sccp_line_retain(line))) {
+			unsigned int hash = sccp_strcase_hash(line->name) % SCCP_HASH_PRIME;
+			lineState->hashnext = lineStateIndex[hash];
+			lineStateIndex[hash] = lineState;
+		}
 	}
 	SCCP_LIST_UNLOCK(&lineStates);
 	
@@ -692,18 +754,19 @@ static void sccp_hint_detachLine(sccp_line_t * line, sccp_device_t * device)
 	if (line->statistic.numberOfActiveDevices == 0) {		/* release last instance of lineState->line */
 		//sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "%s (hint_detachLine) detaching line: %s, \n", DEV_ID_LOG(device), line->name);
 		SCCP_LIST_LOCK(&lineStates);
-		SCCP_LIST_TRAVERSE_SAFE_BEGIN(&lineStates, lineState, list) {
-			if (lineState->line == line) {
-				//sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_detachLine) line: %s detached\n", DEV_ID_LOG(device), line->name);
-				if (lineState->line) {
-					sccp_line_release(&lineState->line);		/* explicit release*/
-				}
-				SCCP_LIST_REMOVE_CURRENT(list);
-				sccp_free(lineState)
-				break;
+		if ((lineState = sccp_hint_findLineState(line))) {
+			struct sccp_hint_lineState **bucket = &lineStateIndex[sccp_strcase_hash(line->name) % SCCP_HASH_PRIME];
+			while (*bucket && *bucket != lineState) {
+				bucket = &(*bucket)->hashnext;
+			}
+			if (*bucket) {
+				*bucket = lineState->hashnext;
 			}
+			//sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_detachLine) line: %s detached\n", DEV_ID_LOG(device), line->name);
+			sccp_line_release(&lineState->line);		/* explicit release*/
+			SCCP_LIST_REMOVE(&lineStates, lineState, list);
+			sccp_free(lineState)
 		}
-		SCCP_LIST_TRAVERSE_SAFE_END;
 		SCCP_LIST_UNLOCK(&lineStates);
 	}
 }
@@ -719,11 +782,7 @@ static void sccp_hint_lineStatusChanged(sccp_line_t * line, sccp_device_t * devi
 	struct sccp_hint_lineState *lineState = NULL;
 
 	SCCP_LIST_LOCK(&lineStates);
-	SCCP_LIST_TRAVERSE(&lineStates, lineState, list) {
-		if (lineState->line == line) {
-			break;
-		}
-	}
+	lineState = sccp_hint_findLineState(line);
 	SCCP_LIST_UNLOCK(&lineStates);
 	
 	if (lineState && lineState->line) {
@@ -1127,6 +1186,8 @@ static void sccp_hint_notifySubscribers(sccp_hint_list_t * hint)
 		AUTO_RELEASE(sccp_device_t, d , sccp_device_retain((sccp_device_t *) subscriber->device));
 
 		if (d) {
+			sccp_session_t *session = sccp_session_retainByDevice(d);				/* keep the session we corked until it is uncorked */
+			sccp_session_cork(session);								/* write all updates for this subscriber at once */
 			//sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_notifySubscribers) notify subscriber %s of %s's state %s (%d)\n", DEV_ID_LOG(d), d->id, hint->hint_dialplan, sccp_channelstate2str(hint->currentState), hint->currentState);
 #ifdef CS_DYNAMIC_SPEEDDIAL
 			sccp_msg_t *msg = NULL;
@@ -1213,7 +1274,7 @@ static void sccp_hint_notifySubscribers(sccp_hint_list_t * hint)
 					msg->data.FeatureStatDynamicMessage.featureTextLabel[strlen(displayMessage)-1] = '\0';
 					sccp_dev_send(d, msg);
 				} else {
-					sccp_free(msg);
+					sccp_free_packet(msg);
 				}
 
 				/*!
@@ -1226,7 +1287,7 @@ static void sccp_hint_notifySubscribers(sccp_hint_list_t * hint)
 					msg->data.FeatureStatDynamicMessage.lel_featureStatus = htolel(status);
 					sccp_dev_send(d, msg);
 				} else {
-					sccp_free(msg);
+					sccp_free_packet(msg);
 				}
 			} else
 #endif
@@ -1284,7 +1345,7 @@ static void sccp_hint_notifySubscribers(sccp_hint_list_t * hint)
 				}
 				sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_notifySubscribers) setting icon to state %s (%d)\n", DEV_ID_LOG(d), skinny_callstate2str(iconstate), iconstate);
 
-				if (SCCP_CHANNELSTATE_RINGING == hint->previousState) {
+				if (SCCP_CHANNELSTATE_RINGING == hint->notifiedState) {
 					/* we send a congestion to the phone, so call will not be marked as missed call */
 					sccp_device_sendcallstate(d, subscriber->instance, 0, SKINNY_CALLSTATE_CONGESTION, SKINNY_CALLPRIORITY_NORMAL, SKINNY_CALLINFO_VISIBILITY_HIDDEN);
 				}
@@ -1305,11 +1366,135 @@ static void sccp_hint_notifySubscribers(sccp_hint_list_t * hint)
 					sccp_dev_set_keyset(d, subscriber->instance, 0 /*callid*/, KEYMODE_INUSEHINT);
 				}
 			}
+			sccp_session_uncork(session);
+			sccp_session_release(&session);
 		} else {
 			sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "SCCP: (sccp_hint_notifySubscribers) device not found/retained\n");
 		}
 	}
 	SCCP_LIST_UNLOCK(&hint->subscribers);
+	hint->notifiedState = hint->currentState;
+	hint->notified++;
+}
+
+/* ========================================================================================================================= Subscriber Notify : Coalescing */
+/*!
+ * \brief Send all pending hint changes to their subscribers
+ *
+ * The pending hints and their subscribers are collected while holding the subscriptions lock, the updates are sent after
+ * releasing it. Every subscribing session is corked for the duration of the batch, so that all updates for one device
+ * (possibly for many hints) are written to its session at once.
+ *
+ * \note hints are only removed/freed by sccp_hint_module_stop, which waits for a running batch using hintNotifyBatchLock
+ */
+static void *sccp_hint_notifyPending(void *data)
+{
+	sccp_hint_list_t *hint = NULL;
+	sccp_hint_list_t **notify = NULL;
+	sccp_hint_SubscribingDevice_t *subscriber = NULL;
+	struct corked {
+		sccp_device_t *device;
+		sccp_session_t *session;
+	} *corked = NULL;
+	int num_notify = 0;
+	int max_notify = 0;
+	int num_corked = 0;
+	int max_corked = 0;
+	int i = 0;
+
+	pbx_mutex_lock(&hintNotifyBatchLock);
+	pbx_mutex_lock(&hintNotifyLock);
+	hintNotifyScheduled = FALSE;									/* sccp_hint_queueNotify may re-arm the sched entry now */
+	if (hintNotifyStopped) {
+		pbx_mutex_unlock(&hintNotifyLock);
+		pbx_mutex_unlock(&hintNotifyBatchLock);
+		return NULL;
+	}
+	pbx_mutex_unlock(&hintNotifyLock);
+
+	SCCP_LIST_LOCK(&sccp_hint_subscriptions);
+	if ((max_notify = SCCP_LIST_GETSIZE(&sccp_hint_subscriptions)) && (notify = sccp_calloc(sizeof *notify, max_notify))) {
+		SCCP_LIST_TRAVERSE(&sccp_hint_subscriptions, hint, list) {			/* claim pending hints */
+			pbx_mutex_lock(&hintNotifyLock);
+			if (hint->pending && num_notify < max_notify) {
+				hint->pending = FALSE;
+				notify[num_notify++] = hint;
+				max_corked += SCCP_LIST_GETSIZE(&hint->subscribers);
+			}
+			pbx_mutex_unlock(&hintNotifyLock);
+		}
+	}
+	if (max_corked && (corked = sccp_calloc(sizeof *corked, max_corked))) {
+		for (i = 0; i < num_notify; i++) {							/* hold back the messages to all subscribers */
+			SCCP_LIST_LOCK(&notify[i]->subscribers);
+			SCCP_LIST_TRAVERSE(&notify[i]->subscribers, subscriber, list) {
+				if (num_corked < max_corked && (corked[num_corked].device = sccp_device_retain(subscriber->device))) {
+					corked[num_corked].session = sccp_session_retainByDevice(corked[num_corked].device);
+					sccp_session_cork(corked[num_corked].session);
+					num_corked++;
+				}
+			}
+			SCCP_LIST_UNLOCK(&notify[i]->subscribers);
+		}
+	}
+	SCCP_LIST_UNLOCK(&sccp_hint_subscriptions);
+
+	for (i = 0; i < num_notify; i++) {
+		sccp_hint_notifySubscribers(notify[i]);
+	}
+	for (i = 0; i < num_corked; i++) {								/* flush per device */
+		sccp_session_uncork(corked[i].session);						/* always the session we corked, even if the device moved on */
+		sccp_session_release(&corked[i].session);
+		sccp_device_release(&corked[i].device);						/* explicit release */
+	}
+	if (corked) {
+		sccp_free(corked);
+	}
+	if (notify) {
+		sccp_free(notify);
+	}
+	pbx_mutex_unlock(&hintNotifyBatchLock);
+	return NULL;
+}
+
+static int sccp_hint_notifyPending_cb(const void *data)
+{
+	pbx_mutex_lock(&hintNotifyLock);
+	hintNotifySchedId = -1;										/* sched entry has fired, module_stop must not delete it anymore */
+	pbx_mutex_unlock(&hintNotifyLock);
+	if (!GLOB(general_threadpool) || !sccp_threadpool_add_work(GLOB(general_threadpool), sccp_hint_notifyPending, NULL)) {
+		sccp_hint_notifyPending(NULL);
+	}
+	return 0;
+}
+
+/*!
+ * \brief Queue a hint change for its subscribers
+ * \param hint SCCP Hint Linked List Pointer
+ *
+ * Changes arriving within SCCP_HINT_COALESCE_WINDOW are merged, only the last state is sent to the subscribers.
+ */
+static void sccp_hint_queueNotify(sccp_hint_list_t * hint)
+{
+	boolean_t notifyNow = FALSE;
+
+	pbx_mutex_lock(&hintNotifyLock);
+	if (hint->pending) {
+		hint->suppressed++;
+	}
+	hint->pending = TRUE;
+	if (!hintNotifyScheduled && !hintNotifyStopped) {
+		hintNotifyScheduled = TRUE;
+		if ((hintNotifySchedId = iPbx.sched_add(SCCP_HINT_COALESCE_WINDOW, sccp_hint_notifyPending_cb, NULL)) < 0) {
+			hintNotifySchedId = -1;
+			notifyNow = TRUE;
+		}
+	}
+	pbx_mutex_unlock(&hintNotifyLock);
+
+	if (notifyNow) {
+		sccp_hint_notifyPending(NULL);
+	}
 }
 
 /* ========================================================================================================================= PBX Notify */
@@ -1419,7 +1604,7 @@ static void sccp_hint_notifyLineStateUpdate(struct sccp_hint_lineState *lineStat
 			sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "SCCP: (sccp_hint_notifyLineStateUpdate) Notify asterisk to set state to sccp channelstate '%s' (%d) on line 'SCCP/%s'\n", sccp_channelstate2str(lineState->state), lineState->state, lineName);
 			sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "SCCP: (sccp_hint_notifyLineStateUpdate) => asterisk: '%s' (%d) => '%s' (%d) on line SCCP/%s\n", pbxsccp_devicestate2str(oldDeviceState), oldDeviceState, pbxsccp_devicestate2str(newDeviceState), newDeviceState, lineName);
 			if (newDeviceState == oldDeviceState) {
-				sccp_hint_notifySubscribers(hint);							/* shortcut to inform sccp subscribers about cid update changes only */
+				sccp_hint_queueNotify(hint);								/* shortcut to inform sccp subscribers about cid update changes only */
 			}
 		}
 	}
@@ -1490,14 +1675,11 @@ sccp_channelstate_t sccp_hint_getLinestate(const char *linename, const char *dev
 	sccp_channelstate_t state = SCCP_CHANNELSTATE_CONGESTION;
 
 	SCCP_LIST_LOCK(&lineStates);
-	SCCP_LIST_TRAVERSE(&lineStates, lineState, list) {
-		if (lineState->line && sccp_strcaseequals(lineState->line->name, linename)) {
-                	sccp_log(DEBUGCAT_HINT)(VERBOSE_PREFIX_3 "%s (getLinestate) state:%s, party:%s/%s, calltype:%s\n", lineState->line->name, sccp_channelstate2str(lineState->state),
-                	        lineState->callInfo.partyNumber,lineState->callInfo.partyName,
-                	        (!SCCP_CHANNELSTATE_Idling(lineState->state) && lineState->callInfo.calltype) ? skinny_calltype2str(lineState->callInfo.calltype) : "INACTIVE");
-                        state = lineState->state;
-			break;
-		}
+	if ((lineState = sccp_hint_findLineStateByName(linename))) {
+		sccp_log(DEBUGCAT_HINT)(VERBOSE_PREFIX_3 "%s (getLinestate) state:%s, party:%s/%s, calltype:%s\n", lineState->line->name, sccp_channelstate2str(lineState->state),
+			lineState->callInfo.partyNumber,lineState->callInfo.partyName,
+			(!SCCP_CHANNELSTATE_Idling(lineState->state) && lineState->callInfo.calltype) ? skinny_calltype2str(lineState->callInfo.calltype) : "INACTIVE");
+		state = lineState->state;
 	}
 	SCCP_LIST_UNLOCK(&lineStates);
 	return state;
@@ -1594,7 +1776,9 @@ int sccp_show_hint_subscriptions(int fd, sccp_cli_totals_t *totals, struct manse
  		CLI_AMI_TABLE_FIELD(CallInfoNumber,	"-15.15",	s,	15,	cidNumber)			\
  		CLI_AMI_TABLE_FIELD(CallInfoName,	"-30.30",	s,	30,	cidName)			\
  		CLI_AMI_TABLE_FIELD(Direction,		"-10.10",	s,	10,	(subscription->calltype && subscription->calltype != SKINNY_CALLTYPE_SENTINEL) ? skinny_calltype2str(subscription->calltype) : "") \
- 		CLI_AMI_TABLE_FIELD(Subs,		"-4",		d,	4,	SCCP_LIST_GETSIZE(&subscription->subscribers))
+ 		CLI_AMI_TABLE_FIELD(Subs,		"-4",		d,	4,	SCCP_LIST_GETSIZE(&subscription->subscribers))		\
+ 		CLI_AMI_TABLE_FIELD(Notified,		"-8",		u,	8,	subscription->notified)					\
+ 		CLI_AMI_TABLE_FIELD(Suppressed,		"-10",		u,	10,	subscription->suppressed)
 
 #include "sccp_cli_table.h"
 
@@ -146,9 +146,14 @@ void sccp_line_addToGlobals(sccp_line_t * line)
 
 	SCCP_RWLIST_WRLOCK(&GLOB(lines));
 	if (l) {
+		uint32_t hash = sccp_strcase_hash(l->name) % SCCP_HASH_PRIME;
+
 		/* add to list */
 		sccp_line_retain(l);										/* add retained line to the list */
 		SCCP_RWLIST_INSERT_SORTALPHA(&GLOB(lines), l, list, cid_num);
+		SCCP_RWLIST_WRLOCK(&GLOB(line_index)[hash]);						/* index shares the list's reference */
+		SCCP_RWLIST_INSERT_HEAD(&GLOB(line_index)[hash], l, hashlist);
+		SCCP_RWLIST_UNLOCK(&GLOB(line_index)[hash]);
 		sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Added line '%s' to Glob(lines)\n", l->name);
 
 		/* emit event */
@@ -173,8 +178,14 @@ void sccp_line_removeFromGlobals(sccp_line_t * line)
 {
 	sccp_line_t *removed_line = NULL;
 	if (line) {
+		uint32_t hash = sccp_strcase_hash(line->name) % SCCP_HASH_PRIME;
+
 		SCCP_RWLIST_WRLOCK(&GLOB(lines));
-		removed_line = SCCP_RWLIST_REMOVE(&GLOB(lines), line, list);
+		if ((removed_line = SCCP_RWLIST_REMOVE(&GLOB(lines), line, list))) {
+			SCCP_RWLIST_WRLOCK(&GLOB(line_index)[hash]);
+			SCCP_RWLIST_REMOVE(&GLOB(line_index)[hash], removed_line, hashlist);
+			SCCP_RWLIST_UNLOCK(&GLOB(line_index)[hash]);
+		}
 		SCCP_RWLIST_UNLOCK(&GLOB(lines));
 
 		sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Removed line '%s' from Glob(lines)\n", removed_line->name);
@@ -673,6 +684,7 @@ void sccp_line_removeChannel(sccp_line_t * line, sccp_channel_t * channel)
 			if (c->state == SCCP_CHANNELSTATE_HOLD) {
 				c->line->statistic.numberOfHeldChannels--;
 			}
+			sccp_channel_removeFromIndex(c);						/* no longer findable by callid/passthrupartyid */
 			sccp_log((DEBUGCAT_LINE)) (VERBOSE_PREFIX_1 "SCCP: Removing channel %d from line %s\n", c->callid, l->name);
 			sccp_channel_release(&c);					/* explicit release of channel from list */
 		}
@@ -817,10 +829,11 @@ sccp_channelstate_t sccp_line_getDNDChannelState(sccp_line_t * line)
 sccp_line_t *sccp_line_find_byname(const char *name, uint8_t useRealtime)
 {
 	sccp_line_t *l = NULL;
+	uint32_t hash = sccp_strcase_hash(name) % SCCP_HASH_PRIME;
 
-	SCCP_RWLIST_RDLOCK(&GLOB(lines));
-	l = SCCP_RWLIST_FIND(&GLOB(lines), sccp_line_t, tmpl, list, (sccp_strcaseequals(tmpl->name, name)), TRUE, __FILE__, __LINE__, __PRETTY_FUNCTION__);
-	SCCP_RWLIST_UNLOCK(&GLOB(lines));
+	SCCP_RWLIST_RDLOCK(&GLOB(line_index)[hash]);
+	l = SCCP_RWLIST_FIND(&GLOB(line_index)[hash], sccp_line_t, tmpl, hashlist, (sccp_strcaseequals(tmpl->name, name)), TRUE, __FILE__, __LINE__, __PRETTY_FUNCTION__);
+	SCCP_RWLIST_UNLOCK(&GLOB(line_index)[hash]);
 #ifdef CS_SCCP_REALTIME
 	if (!l && useRealtime) {
 		l = sccp_line_find_realtime_byname(name);
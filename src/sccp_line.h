@@ -33,6 +33,7 @@ struct sccp_line {
 	uint8_t _padding1[3];
 #endif
 	SCCP_RWLIST_ENTRY (sccp_line_t) list;									/*!< global list entry */
+	SCCP_RWLIST_ENTRY (sccp_line_t) hashlist;								/*!< global index entry */
 	struct {
 		uint8_t numberOfActiveDevices;									/*!< Number of Active Devices */
 		uint8_t numberOfActiveChannels;									/*!< Number of Active Channels */
@@ -97,6 +98,7 @@ struct sccp_line {
 	/* this is for reload routines */
 	boolean_t pendingDelete;										/*!< this bit will tell the scheduler to delete this line when unused */
 	boolean_t pendingUpdate;										/*!< this bit will tell the scheduler to update this line when unused */
+	uint64_t configHash;											/*!< hash of the sccp.conf section (and general) this line was last built from */
 };														/*!< SCCP Line Structure */
 
 /*!
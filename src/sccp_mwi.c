@@ -12,9 +12,12 @@
 #include "sccp_mwi.h"
 #include "sccp_atomic.h"
 #include "sccp_channel.h"
+#include "sccp_device.h"
 #include "sccp_line.h"
+#include "sccp_session.h"
 #include "sccp_utils.h"
 #include "sccp_labels.h"
+#include "sccp_vector.h"
 
 SCCP_FILE_VERSION(__FILE__, "");
 
@@ -65,6 +68,9 @@ struct sccp_mailbox_subscriber_list {
 
 	SCCP_LIST_HEAD (, sccp_mailboxLine_t) sccp_mailboxLine;
 	SCCP_LIST_ENTRY (sccp_mailbox_subscriber_list_t) list;
+	sccp_mailbox_subscriber_list_t *hashnext;								/*!< Next subscription in the same mailboxIndex bucket */
+	uint32_t updates;											/*!< Number of count changes sent to the lines */
+	uint32_t duplicates;											/*!< Number of pbx updates which did not change the count */
 
 	/*!
 	 * \brief Current Voicemail Statistic Structure
@@ -100,6 +106,52 @@ void sccp_mwi_addMailboxSubscription(char *mailbox, char *context, sccp_line_t *
 void sccp_mwi_lineStatusChangedEvent(const sccp_event_t * event);
 
 static SCCP_LIST_HEAD (, sccp_mailbox_subscriber_list_t) sccp_mailbox_subscriptions;
+static sccp_mailbox_subscriber_list_t *mailboxIndex[SCCP_HASH_PRIME];					/* subscriptions hashed by mailbox@context, protected by the sccp_mailbox_subscriptions lock */
+
+/*!
+ * \brief Device and the (retained) session its lamp updates are being held back on
+ */
+struct sccp_mwi_batchDevice {
+	sccp_device_t *device;
+	sccp_session_t *session;
+};
+typedef SCCP_VECTOR(, struct sccp_mwi_batchDevice) sccp_mwi_batch_t;
+
+static gcc_inline unsigned int sccp_mwi_hash(const char *mailbox, const char *context)
+{
+	return (sccp_strcase_hash(mailbox) * 33 + sccp_strcase_hash(context)) % SCCP_HASH_PRIME;
+}
+
+/*!
+ * \brief Find Mailbox Subscription using the mailboxIndex
+ * \note sccp_mailbox_subscriptions needs to be locked by caller
+ */
+static sccp_mailbox_subscriber_list_t *sccp_mwi_findSubscription(const char *mailbox, const char *context)
+{
+	sccp_mailbox_subscriber_list_t *subscription = mailboxIndex[sccp_mwi_hash(mailbox, context)];
+
+	while (subscription && !(sccp_strequals(mailbox, subscription->mailbox) && sccp_strequals(context, subscription->context))) {
+		subscription = subscription->hashnext;
+	}
+	return subscription;
+}
+
+/*!
+ * \brief Remove Mailbox Subscription from the mailboxIndex
+ * \note sccp_mailbox_subscriptions needs to be locked by caller
+ */
+static void sccp_mwi_unindexSubscription(sccp_mailbox_subscriber_list_t *subscription)
+{
+	sccp_mailbox_subscriber_list_t **bucket = &mailboxIndex[sccp_mwi_hash(subscription->mailbox, subscription->context)];
+
+	while (*bucket && *bucket != subscription) {
+		bucket = &(*bucket)->hashnext;
+	}
+	if (*bucket) {
+		*bucket = subscription->hashnext;
+	}
+	subscription->hashnext = NULL;
+}
 
 /*!
  * start mwi module.
@@ -107,6 +159,7 @@ static SCCP_LIST_HEAD (, sccp_mailbox_subscriber_list_t) sccp_mailbox_subscripti
 void sccp_mwi_module_start(void)
 {
 	SCCP_LIST_HEAD_INIT(&sccp_mailbox_subscriptions);
+	memset(mailboxIndex, 0, sizeof(mailboxIndex));
 	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "SCCP: Starting MWI system\n");
 
 	sccp_event_subscribe(SCCP_EVENT_LINE_CREATED, sccp_mwi_linecreatedEvent, TRUE);
@@ -127,6 +180,7 @@ void sccp_mwi_module_stop(void)
 	sccp_event_unsubscribe(SCCP_EVENT_LINESTATUS_CHANGED, sccp_mwi_lineStatusChangedEvent);
 
 	SCCP_LIST_LOCK(&sccp_mailbox_subscriptions);
+	memset(mailboxIndex, 0, sizeof(mailboxIndex));
 	while ((subscription = SCCP_LIST_REMOVE_HEAD(&sccp_mailbox_subscriptions, list))) {
 		sccp_mwi_destroySubscription(subscription);
 	}
@@ -134,15 +188,68 @@ void sccp_mwi_module_stop(void)
 	SCCP_LIST_HEAD_DESTROY(&sccp_mailbox_subscriptions);
 }
 
+static void sccp_mwi_setLineLamp(sccp_linedevices_t * lineDevice);
+
+/*!
+ * \brief Add a device to a lamp update batch, holding back its messages until sccp_mwi_batchFlush
+ * \note devices already in the batch are skipped
+ */
+static void sccp_mwi_batchAdd(sccp_mwi_batch_t *batch, sccp_device_t * d)
+{
+	struct sccp_mwi_batchDevice entry = {0};
+	uint32_t n = 0;
+
+	for (n = 0; n < SCCP_VECTOR_SIZE(batch); n++) {
+		if (SCCP_VECTOR_GET(batch, n).device == d) {
+			return;
+		}
+	}
+	if ((entry.device = sccp_device_retain(d))) {
+		entry.session = sccp_session_retainByDevice(entry.device);				/* released after uncorking it in sccp_mwi_batchFlush */
+		if (SCCP_VECTOR_APPEND(batch, entry) == 0) {
+			sccp_session_cork(entry.session);
+		} else {
+			sccp_session_release(&entry.session);
+			sccp_device_release(&entry.device);						/* explicit release */
+		}
+	}
+}
+
+/*!
+ * \brief Update the device mwi lamp and display once per device in the batch and send the held back messages
+ */
+static void sccp_mwi_batchFlush(sccp_mwi_batch_t *batch)
+{
+	uint32_t n = 0;
+
+	for (n = 0; n < SCCP_VECTOR_SIZE(batch); n++) {
+		struct sccp_mwi_batchDevice *entry = SCCP_VECTOR_GET_ADDR(batch, n);
+		if (sccp_device_getRegistrationState(entry->device) == SKINNY_DEVICE_RS_OK) {
+			sccp_mwi_check(entry->device);							/* enable/disable device mwi light, respecting mwioncall */
+		}
+		sccp_session_uncork(entry->session);							/* always the session we corked, even if the device moved on */
+		sccp_session_release(&entry->session);
+		sccp_device_release(&entry->device);							/* explicit release */
+	}
+	SCCP_VECTOR_RESET(batch, SCCP_VECTOR_ELEM_CLEANUP_NOOP);
+}
+
 /*!
  * \brief Generic update mwi count
  * \param subscription Pointer to a mailbox subscription
+ *
+ * Line lamps are collected per device, every device then gets a single mwi check and all its lamp updates in one write
  */
 static void sccp_mwi_updatecount(sccp_mailbox_subscriber_list_t * subscription)
 {
 	sccp_mailboxLine_t *mailboxLine = NULL;
+	sccp_mwi_batch_t batch;
 
 	sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "(sccp_mwi_updatecount)\n");
+	if (SCCP_VECTOR_INIT(&batch, 4) != 0) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return;
+	}
 	SCCP_LIST_LOCK(&subscription->sccp_mailboxLine);
 	SCCP_LIST_TRAVERSE(&subscription->sccp_mailboxLine, mailboxLine, list) {
 		AUTO_RELEASE(sccp_line_t, line , sccp_line_retain(mailboxLine->line));
@@ -163,7 +270,8 @@ static void sccp_mwi_updatecount(sccp_mailbox_subscriber_list_t * subscription)
 			SCCP_LIST_LOCK(&line->devices);
 			SCCP_LIST_TRAVERSE(&line->devices, lineDevice, list) {
 				if (lineDevice && lineDevice->device) {
-					sccp_mwi_setMWILineStatus(lineDevice);
+					sccp_mwi_batchAdd(&batch, lineDevice->device);
+					sccp_mwi_setLineLamp(lineDevice);
 				} else {
 					pbx_log(LOG_ERROR, "error: null line device.\n");
 				}
@@ -172,6 +280,31 @@ static void sccp_mwi_updatecount(sccp_mailbox_subscriber_list_t * subscription)
 		}
 	}
 	SCCP_LIST_UNLOCK(&subscription->sccp_mailboxLine);
+	sccp_mwi_batchFlush(&batch);
+	SCCP_VECTOR_FREE(&batch);
+}
+
+/*!
+ * \brief Store a new voicemail count for a subscription and pass it on to the lines, when it differs from the current one
+ * \note voicemail servers tend to resend unchanged counts (i.e. after a restart), these are dropped here
+ */
+static void sccp_mwi_setCount(sccp_mailbox_subscriber_list_t * subscription, int newmsgs, int oldmsgs)
+{
+	if (newmsgs == -1 || oldmsgs == -1) {
+		return;
+	}
+	if (subscription->currentVoicemailStatistic.newmsgs == newmsgs && subscription->currentVoicemailStatistic.oldmsgs == oldmsgs) {
+		subscription->duplicates++;
+		return;
+	}
+	/* for calculation store previous voicemail counts */
+	subscription->previousVoicemailStatistic.newmsgs = subscription->currentVoicemailStatistic.newmsgs;
+	subscription->previousVoicemailStatistic.oldmsgs = subscription->currentVoicemailStatistic.oldmsgs;
+
+	subscription->currentVoicemailStatistic.newmsgs = newmsgs;
+	subscription->currentVoicemailStatistic.oldmsgs = oldmsgs;
+	subscription->updates++;
+	sccp_mwi_updatecount(subscription);
 }
 
 #if defined(CS_AST_HAS_EVENT)
@@ -192,17 +325,7 @@ void sccp_mwi_event(const struct ast_event *event, void *data)
 	int oldmsgs = pbx_event_get_ie_uint(event, AST_EVENT_IE_OLDMSGS);
 	sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "SCCP: Received PBX mwi event (%s) for %s@%s, newmsgs:%d, oldmsgs:%d\n", ast_event_get_type_name(event), subscription->mailbox, subscription->context, newmsgs, oldmsgs);
 
-	/* for calculation store previous voicemail counts */
-	subscription->previousVoicemailStatistic.newmsgs = subscription->currentVoicemailStatistic.newmsgs;
-	subscription->previousVoicemailStatistic.oldmsgs = subscription->currentVoicemailStatistic.oldmsgs;
-
-	if (newmsgs != -1 && oldmsgs != -1) {
-		subscription->currentVoicemailStatistic.newmsgs = newmsgs;
-		subscription->currentVoicemailStatistic.oldmsgs = oldmsgs;
-		if (subscription->previousVoicemailStatistic.newmsgs != subscription->currentVoicemailStatistic.newmsgs && subscription->currentVoicemailStatistic.newmsgs != -1) {
-			sccp_mwi_updatecount(subscription);
-		}
-	}
+	sccp_mwi_setCount(subscription, newmsgs, oldmsgs);
 }
 
 #elif defined(CS_AST_HAS_STASIS)
@@ -228,16 +351,7 @@ void sccp_mwi_event(void *userdata, struct stasis_subscription *sub, struct stas
 
 		sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "SCCP: Received PBX mwi event for %s@%s, newmsgs:%d, oldmsgs:%d\n", subscription->mailbox, subscription->context, newmsgs, oldmsgs);
 
-		subscription->previousVoicemailStatistic.newmsgs = subscription->currentVoicemailStatistic.newmsgs;
-		subscription->previousVoicemailStatistic.oldmsgs = subscription->currentVoicemailStatistic.oldmsgs;
-
-		if (newmsgs != -1 && oldmsgs != -1) {
-			subscription->currentVoicemailStatistic.newmsgs = newmsgs;
-			subscription->currentVoicemailStatistic.oldmsgs = oldmsgs;
-			if (subscription->previousVoicemailStatistic.newmsgs != subscription->currentVoicemailStatistic.newmsgs) {
-				sccp_mwi_updatecount(subscription);
-			}
-		}
+		sccp_mwi_setCount(subscription, newmsgs, oldmsgs);
 	}
 }
 
@@ -259,8 +373,6 @@ int sccp_mwi_checksubscription(const void *ptr)
 	if (!subscription || !GLOB(module_running)) {
 		return -1;
 	}
-	subscription->previousVoicemailStatistic.newmsgs = subscription->currentVoicemailStatistic.newmsgs;
-	subscription->previousVoicemailStatistic.oldmsgs = subscription->currentVoicemailStatistic.oldmsgs;
 
 	char buffer[512];
 	int newmsgs = 0, oldmsgs = 0;
@@ -269,15 +381,7 @@ int sccp_mwi_checksubscription(const void *ptr)
 	snprintf(buffer, 512, "%s@%s", subscription->mailbox, subscription->context);
 	sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_4 "SCCP: checking mailbox: %s\n", buffer);
 	if (pbx_app_inboxcount(buffer, &newmsgs, &oldmsgs) == 0) {
-		if (newmsgs != -1 && oldmsgs != -1) {
-			subscription->currentVoicemailStatistic.newmsgs = newmsgs;
-			subscription->currentVoicemailStatistic.oldmsgs = oldmsgs;
-
-			/* update devices if something changed */
-			if (subscription->previousVoicemailStatistic.newmsgs != subscription->currentVoicemailStatistic.newmsgs) {
-				sccp_mwi_updatecount(subscription);
-			}
-		}
+		sccp_mwi_setCount(subscription, newmsgs, oldmsgs);			/* update devices if something changed */
 	} else {
 		interval = SCCP_MWI_CHECK_INTERVAL * 10;			/* if we failed, slow down polling */
 	}	
@@ -338,13 +442,11 @@ void sccp_mwi_unsubscribeMailbox(sccp_mailbox_t * mailbox)
 	sccp_mailbox_subscriber_list_t *subscription = NULL;
 
 	SCCP_LIST_LOCK(&sccp_mailbox_subscriptions);
-	SCCP_LIST_TRAVERSE_SAFE_BEGIN(&sccp_mailbox_subscriptions, subscription, list) {
-		if (sccp_strequals(mailbox->mailbox, subscription->mailbox) && sccp_strequals(mailbox->context, subscription->context)) {
-			SCCP_LIST_REMOVE_CURRENT(list);
-			sccp_mwi_destroySubscription(subscription);
-		}
+	if ((subscription = sccp_mwi_findSubscription(mailbox->mailbox, mailbox->context))) {
+		sccp_mwi_unindexSubscription(subscription);
+		SCCP_LIST_REMOVE(&sccp_mailbox_subscriptions, subscription, list);
+		sccp_mwi_destroySubscription(subscription);
 	}
-	SCCP_LIST_TRAVERSE_SAFE_END;
 	SCCP_LIST_UNLOCK(&sccp_mailbox_subscriptions);
 }
 
@@ -448,17 +550,13 @@ void sccp_mwi_addMailboxSubscription(char *mailbox, char *context, sccp_line_t *
 	sccp_mailbox_subscriber_list_t *subscription = NULL;
 	sccp_mailboxLine_t *mailboxLine = NULL;
 
-	SCCP_LIST_LOCK(&sccp_mailbox_subscriptions);
-	SCCP_LIST_TRAVERSE(&sccp_mailbox_subscriptions, subscription, list) {
-		if (sccp_strequals(mailbox, subscription->mailbox) && sccp_strequals(context, subscription->context)) {
-			break;
-		}
-	}
-	SCCP_LIST_UNLOCK(&sccp_mailbox_subscriptions);
+	boolean_t created = FALSE;
 
-	if (!subscription) {
+	SCCP_LIST_LOCK(&sccp_mailbox_subscriptions);
+	if (!(subscription = sccp_mwi_findSubscription(mailbox, context))) {
 		subscription = sccp_calloc(sizeof *subscription, 1);
 		if (!subscription) {
+			SCCP_LIST_UNLOCK(&sccp_mailbox_subscriptions);
 			pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, line->name);
 			return;
 		}
@@ -468,9 +566,15 @@ void sccp_mwi_addMailboxSubscription(char *mailbox, char *context, sccp_line_t *
 		sccp_copy_string(subscription->context, context, sizeof(subscription->context));
 		sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "SCCP: (mwi_addMailboxSubscription) creating subscription for: %s@%s\n", subscription->mailbox, subscription->context);
 
-		SCCP_LIST_LOCK(&sccp_mailbox_subscriptions);
+		unsigned int hash = sccp_mwi_hash(subscription->mailbox, subscription->context);
+		subscription->hashnext = mailboxIndex[hash];
+		mailboxIndex[hash] = subscription;
 		SCCP_LIST_INSERT_HEAD(&sccp_mailbox_subscriptions, subscription, list);
-		SCCP_LIST_UNLOCK(&sccp_mailbox_subscriptions);
+		created = TRUE;
+	}
+	SCCP_LIST_UNLOCK(&sccp_mailbox_subscriptions);
+
+	if (created) {
 
 		/* get initial value */
 
@@ -561,6 +665,45 @@ void sccp_mwi_addMailboxSubscription(char *mailbox, char *context, sccp_line_t *
  * \param lineDevice SCCP LineDevice
  */
 void sccp_mwi_setMWILineStatus(sccp_linedevices_t * lineDevice)
+{
+	pbx_assert(lineDevice != NULL && lineDevice->device != NULL);
+
+	sccp_mwi_setLineLamp(lineDevice);
+	if (sccp_device_getRegistrationState(lineDevice->device) == SKINNY_DEVICE_RS_OK) {
+		sccp_mwi_check(lineDevice->device); /* we need to check mwi status again, to enable/disable device mwi light */
+	}
+}
+
+/*!
+ * \brief Set all MWI Line Lamps of a Device, followed by a single device mwi check
+ * \param d SCCP Device
+ */
+void sccp_mwi_setMWIDeviceStatus(sccp_device_t * d)
+{
+	sccp_mwi_batch_t batch;
+	uint32_t instance = 0;
+
+	if (!d || SCCP_VECTOR_INIT(&batch, 1) != 0) {
+		return;
+	}
+	sccp_mwi_batchAdd(&batch, d);
+	for (instance = SCCP_FIRST_LINEINSTANCE; instance < d->lineButtons.size; instance++) {
+		if (d->lineButtons.instance[instance]) {
+			AUTO_RELEASE(sccp_linedevices_t, linedevice , sccp_linedevice_retain(d->lineButtons.instance[instance]));
+			if (linedevice) {
+				sccp_mwi_setLineLamp(linedevice);
+			}
+		}
+	}
+	sccp_mwi_batchFlush(&batch);
+	SCCP_VECTOR_FREE(&batch);
+}
+
+/*!
+ * \brief Set the MWI Lamp of a single line instance on the device
+ * \param lineDevice SCCP LineDevice
+ */
+static void sccp_mwi_setLineLamp(sccp_linedevices_t * lineDevice)
 {
 	pbx_assert(lineDevice != NULL && lineDevice->device != NULL);
 	
@@ -590,7 +733,7 @@ void sccp_mwi_setMWILineStatus(sccp_linedevices_t * lineDevice)
 			d->mwilight &= ~mask;
 		}
 		sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "%s: (mwi_setMWILineStatus) new mwilight:%s value: %d\n", DEV_ID_LOG(lineDevice->device), sccp_dec2binstr(binstr, 32, d->mwilight), d->mwilight);
-		REQ(msg, SetLampMessage);
+		REQFIXED(msg, SetLampMessage);
 		msg->data.SetLampMessage.lel_stimulus = htolel(SKINNY_STIMULUS_VOICEMAIL);
 		msg->data.SetLampMessage.lel_stimulusInstance = htolel(instance);
 		msg->data.SetLampMessage.lel_lampMode = state ? htolel(SKINNY_LAMP_ON) : htolel(SKINNY_LAMP_OFF);
@@ -599,9 +742,6 @@ void sccp_mwi_setMWILineStatus(sccp_linedevices_t * lineDevice)
 	} else {
 		sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "%s: (mwi_setMWILineStatus) Device already knows this state %s on line %s (%d). skipping update\n", DEV_ID_LOG(d), status ? "ON" : "OFF", (l ? l->name : "unknown"), instance);
 	}
-	if (sccp_device_getRegistrationState(d) == SKINNY_DEVICE_RS_OK) {
-		sccp_mwi_check(d); /* we need to check mwi status again, to enable/disable device mwi light */
-	}
 }
 
 /*!
@@ -669,7 +809,7 @@ void sccp_mwi_check(sccp_device_t * d)
 		//sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "%s: (mwi_check) new device->mwilight:%s\n", DEV_ID_LOG(device), sccp_dec2binstr(binstr1, 32, device->mwilight));
 		sccp_msg_t *msg = NULL;
 
-		REQ(msg, SetLampMessage);
+		REQFIXED(msg, SetLampMessage);
 		msg->data.SetLampMessage.lel_stimulus = htolel(SKINNY_STIMULUS_VOICEMAIL);
 		msg->data.SetLampMessage.lel_stimulusInstance = 0;
 		msg->data.SetLampMessage.lel_lampMode = (device->mwilight & (1 << SCCP_DEVICE_MWILIGHT)) ? htolel(device->mwilamp) : htolel(SKINNY_LAMP_OFF);
@@ -732,6 +872,8 @@ int sccp_show_mwi_subscriptions(int fd, sccp_cli_totals_t *totals, struct manses
  		CLI_AMI_TABLE_FIELD(Context,		"-15.15",	s,	15,	subscription->context)						\
  		CLI_AMI_TABLE_FIELD(New,		"3.3",		d,	3,	subscription->currentVoicemailStatistic.newmsgs)		\
  		CLI_AMI_TABLE_FIELD(Old,		"3.3",		d,	3,	subscription->currentVoicemailStatistic.oldmsgs)		\
+ 		CLI_AMI_TABLE_FIELD(Updates,		"7",		u,	7,	subscription->updates)						\
+ 		CLI_AMI_TABLE_FIELD(Dups,		"5",		u,	5,	subscription->duplicates)					\
  		CLI_AMI_TABLE_FIELD(Sub,		"-3.3",		s,	3,	subscription->event_sub ? "YES" : "NO")
 #include "sccp_cli_table.h"
 #else
@@ -740,7 +882,9 @@ int sccp_show_mwi_subscriptions(int fd, sccp_cli_totals_t *totals, struct manses
  		CLI_AMI_TABLE_FIELD(LineName,		"-30.30",	s,	30,	linebuf)							\
  		CLI_AMI_TABLE_FIELD(Context,		"-15.15",	s,	15,	subscription->context)						\
  		CLI_AMI_TABLE_FIELD(New,		"3.3",		d,	3,	subscription->currentVoicemailStatistic.newmsgs)		\
- 		CLI_AMI_TABLE_FIELD(Old,		"3.3",		d,	3,	subscription->currentVoicemailStatistic.oldmsgs)
+ 		CLI_AMI_TABLE_FIELD(Old,		"3.3",		d,	3,	subscription->currentVoicemailStatistic.oldmsgs)		\
+ 		CLI_AMI_TABLE_FIELD(Updates,		"7",		u,	7,	subscription->updates)						\
+ 		CLI_AMI_TABLE_FIELD(Dups,		"5",		u,	5,	subscription->duplicates)
 #include "sccp_cli_table.h"
 #endif
 
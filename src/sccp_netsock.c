@@ -13,6 +13,7 @@
 SCCP_FILE_VERSION(__FILE__, "");
 
 #include "sccp_session.h"
+#include "sccp_utils.h"
 #include <netinet/in.h>
 
 /* arbitrary values */
@@ -91,6 +92,7 @@ static boolean_t __netsock_resolve_first_af(struct sockaddr_storage *addr, const
 
 	if ((e = getaddrinfo(name, NULL, &hints, &res)) == 0) {
 		memcpy(addr, res->ai_addr, res->ai_addrlen);
+		freeaddrinfo(res);
 		result = TRUE;
 	} else {
 		if (e == EAI_NONAME) {
@@ -99,33 +101,156 @@ static boolean_t __netsock_resolve_first_af(struct sockaddr_storage *addr, const
 			pbx_log(LOG_ERROR, "getaddrinfo(\"%s\") failed: %s\n", name, gai_strerror(e));
 		}
 	}
-	freeaddrinfo(res);
 	return result;
 }
 
+/*
+ * externhost resolution
+ *
+ * externhost is resolved on the general threadpool, never by the thread asking for the address. The result is published
+ * per address family under a sequence counter, so readers (media setup) do not take a lock. A resolve is started by a timer
+ * every externrefresh seconds, and by a reader finding an expired address, which still gets the expired address
+ * (stale-while-revalidate). A failed resolve keeps the last address and is retried after NETSOCK_EXTERNHOST_RETRY seconds.
+ */
+#define NETSOCK_EXTERNHOST_RETRY 10										/* seconds before retrying a failed resolve */
+
 static struct {
+	volatile uint32_t seq;											/*!< odd while being updated */
+	boolean_t resolved;											/*!< ip has been resolved (for hosthash) */
+	unsigned int hosthash;											/*!< sccp_strcase_hash of the externhost ip belongs to */
 	time_t expire;
 	struct sockaddr_storage ip;
+	boolean_t refreshing;											/*!< resolve queued or running (externhost_lock) */
+	int schedId;												/*!< refresh timer (externhost_lock) */
+	unsigned int timer;											/*!< generation of the armed refresh timer, passed to its callback (externhost_lock) */
 } externhost[] = {
-	[AF_INET]  = {0, {.ss_family = AF_INET}},
-	[AF_INET6] = {0, {.ss_family = AF_INET6}},
+	[AF_INET]  = {0, FALSE, 0, 0, {.ss_family = AF_INET}, FALSE, -1, 0},
+	[AF_INET6] = {0, FALSE, 0, 0, {.ss_family = AF_INET6}, FALSE, -1, 0},
 };
+#define NETSOCK_EXTERNHOST_TIMER(_family, _timer) ((void *) ((((intptr_t) (_timer) & 0xffffff) << 8) | (_family)))	/* sched callback data */
+AST_MUTEX_DEFINE_STATIC(externhost_lock);									/* serializes writers, refreshing and schedId */
+static boolean_t externhost_stopped = FALSE;
 
+static int sccp_netsock_externhost_timer_cb(const void *data);
+
+static void *sccp_netsock_externhost_resolve(void *data)
+{
+	int family = (int) (intptr_t) data;
+	char host[256] = "";
+	struct sockaddr_storage ip = { 0 };
+	boolean_t resolved = FALSE;
+	int refresh = GLOB(externrefresh) > 0 ? GLOB(externrefresh) : 60;
+	int schedId = -1;
+
+	if (GLOB(externhost)) {
+		sccp_copy_string(host, GLOB(externhost), sizeof(host));
+	}
+	if (!sccp_strlen_zero(host) && !(resolved = __netsock_resolve_first_af(&ip, host, family))) {
+		pbx_log(LOG_NOTICE, "Warning: Resolving '%s' failed!%s\n", host, externhost[family].resolved ? " Keeping the previous address." : "");
+	}
+
+	pbx_mutex_lock(&externhost_lock);
+	externhost[family].seq++;
+	__sync_synchronize();
+	if (resolved) {
+		memcpy(&externhost[family].ip, &ip, sizeof(struct sockaddr_storage));
+		externhost[family].hosthash = sccp_strcase_hash(host);
+		externhost[family].resolved = TRUE;
+	}
+	externhost[family].expire = time(NULL) + (resolved ? refresh : NETSOCK_EXTERNHOST_RETRY);
+	__sync_synchronize();
+	externhost[family].seq++;
+	externhost[family].refreshing = FALSE;
+
+	/* (re)arm the refresh timer, a previous one is cancelled after unlocking (its callback takes externhost_lock) */
+	schedId = externhost[family].schedId;
+	externhost[family].schedId = -1;
+	externhost[family].timer++;
+	if (!externhost_stopped && !sccp_strlen_zero(host)) {
+		externhost[family].schedId = iPbx.sched_add((resolved ? refresh : NETSOCK_EXTERNHOST_RETRY) * 1000, sccp_netsock_externhost_timer_cb, NETSOCK_EXTERNHOST_TIMER(family, externhost[family].timer));
+	}
+	pbx_mutex_unlock(&externhost_lock);
+	if (schedId > -1) {
+		schedId = SCCP_SCHED_DEL(schedId);
+	}
+
+	if (resolved) {
+		sccp_log(DEBUGCAT_SOCKET) (VERBOSE_PREFIX_3 "SCCP: %s resolved to %s\n", host, sccp_netsock_stringify_addr(&ip));
+	}
+	return NULL;
+}
+
+/* queue a background resolve for family, unless one is queued already (externhost_lock must be held) */
+static void sccp_netsock_externhost_refresh(int family)
+{
+	if (externhost[family].refreshing || externhost_stopped) {
+		return;
+	}
+	externhost[family].refreshing = TRUE;
+	if (!GLOB(general_threadpool) || !sccp_threadpool_add_work(GLOB(general_threadpool), sccp_netsock_externhost_resolve, (void *) (intptr_t) family)) {
+		externhost[family].refreshing = FALSE;								/* retried by the next reader */
+	}
+}
+
+static int sccp_netsock_externhost_timer_cb(const void *data)
+{
+	int family = (int) ((intptr_t) data & 0xff);
+	unsigned int timer = (unsigned int) ((intptr_t) data >> 8);
+
+	pbx_mutex_lock(&externhost_lock);
+	if ((externhost[family].timer & 0xffffff) == timer) {							/* still the armed timer, not one replaced/cancelled while we were waiting */
+		externhost[family].schedId = -1;
+	}
+	sccp_netsock_externhost_refresh(family);
+	pbx_mutex_unlock(&externhost_lock);
+	return 0;
+}
+
+/*!
+ * \brief Get the external address (externip, or the address externhost resolved to)
+ * \param sockAddrStorage Result
+ * \param family AF_INET or AF_INET6
+ * \return TRUE when an address was found
+ *
+ * \note Never resolves externhost itself: until the first background resolve has finished FALSE is returned, after that
+ * the last resolved address is returned, also while it is being refreshed.
+ */
 boolean_t sccp_netsock_getExternalAddr(struct sockaddr_storage *sockAddrStorage, int family)
 {
 	boolean_t result = FALSE;
 	if (sccp_netsock_is_any_addr(&GLOB(externip))) {
-		if (GLOB(externhost) && strlen(GLOB(externhost)) != 0 && GLOB(externrefresh) > 0) {
-			if (time(NULL) >= externhost[family].expire) {
-				if (!__netsock_resolve_first_af(&externhost[family].ip, GLOB(externhost), family)) {
-					pbx_log(LOG_NOTICE, "Warning: Resolving '%s' failed!\n", GLOB(externhost));
-					return FALSE;
+		if (GLOB(externhost) && strlen(GLOB(externhost)) != 0 && GLOB(externrefresh) > 0 && (family == AF_INET || family == AF_INET6)) {
+			struct sockaddr_storage ip;
+			boolean_t resolved = FALSE;
+			unsigned int hosthash = 0;
+			time_t expire = 0;
+			uint32_t seq = 0;
+
+			do {
+				while ((seq = externhost[family].seq) & 1) {
+					sched_yield();
 				}
-				externhost[family].expire = time(NULL) + GLOB(externrefresh);
+				__sync_synchronize();
+				resolved = externhost[family].resolved;
+				hosthash = externhost[family].hosthash;
+				expire = externhost[family].expire;
+				memcpy(&ip, &externhost[family].ip, sizeof(struct sockaddr_storage));
+				__sync_synchronize();
+			} while (seq != externhost[family].seq);
+
+			resolved = resolved && hosthash == sccp_strcase_hash(GLOB(externhost));			/* externhost changed since */
+			if (!resolved || time(NULL) >= expire) {
+				pbx_mutex_lock(&externhost_lock);
+				sccp_netsock_externhost_refresh(family);
+				pbx_mutex_unlock(&externhost_lock);
+			}
+			if (resolved) {
+				memcpy(sockAddrStorage, &ip, sizeof(struct sockaddr_storage));
+				sccp_log(DEBUGCAT_SOCKET) (VERBOSE_PREFIX_3 "SCCP: %s resolved to %s\n", GLOB(externhost), sccp_netsock_stringify_addr(sockAddrStorage));
+				result = TRUE;
+			} else {
+				sccp_log(DEBUGCAT_SOCKET) (VERBOSE_PREFIX_3 "SCCP: %s has not been resolved yet\n", GLOB(externhost));
 			}
-			memcpy(sockAddrStorage, &externhost[family].ip, sizeof(struct sockaddr_storage));
-			sccp_log(DEBUGCAT_SOCKET) (VERBOSE_PREFIX_3 "SCCP: %s resolved to %s\n", GLOB(externhost), sccp_netsock_stringify_addr(sockAddrStorage));
-			result = TRUE;
 		} else {
 			sccp_log(DEBUGCAT_CORE) (VERBOSE_PREFIX_3 "SCCP: No externip/externhost set in sccp.conf.\nWhen you are running your PBX on a seperate host behind a NAT-TING Firewall you need to set externip/externhost.\n");
 		}
@@ -136,10 +261,44 @@ boolean_t sccp_netsock_getExternalAddr(struct sockaddr_storage *sockAddrStorage,
 	return result;
 }
 
+/*!
+ * \brief Expire the resolved externhost addresses and resolve them again in the background (after a (re)load)
+ */
 void sccp_netsock_flush_externhost(void) 
 {
+	pbx_mutex_lock(&externhost_lock);
+	externhost_stopped = FALSE;
 	externhost[AF_INET].expire = 0;
 	externhost[AF_INET6].expire = 0;
+	sccp_netsock_externhost_refresh(AF_INET);
+	if (sccp_netsock_is_IPv6(&GLOB(bindaddr))) {
+		sccp_netsock_externhost_refresh(AF_INET6);
+	}
+	pbx_mutex_unlock(&externhost_lock);
+}
+
+/*!
+ * \brief Stop refreshing externhost (module unload)
+ */
+void sccp_netsock_stop_externhost(void)
+{
+	int schedId[] = {-1, -1};
+	int family[] = {AF_INET, AF_INET6};
+	uint i = 0;
+
+	pbx_mutex_lock(&externhost_lock);
+	externhost_stopped = TRUE;
+	for (i = 0; i < ARRAY_LEN(family); i++) {
+		schedId[i] = externhost[family[i]].schedId;
+		externhost[family[i]].schedId = -1;
+		externhost[family[i]].timer++;
+	}
+	pbx_mutex_unlock(&externhost_lock);
+	for (i = 0; i < ARRAY_LEN(schedId); i++) {							/* outside externhost_lock, the callback takes it */
+		if (schedId[i] > -1) {
+			schedId[i] = SCCP_SCHED_DEL(schedId[i]);
+		}
+	}
 }
 
 size_t __PURE__ sccp_netsock_sizeof(const struct sockaddr_storage * sockAddrStorage)
@@ -33,11 +33,13 @@
  * navigate the list, and an externally visible 'struct ast_ha_entry', at least in the short term it is more convenient to make the whole
  * thing public and let users play with them.
  */
+struct sccp_ha_tree;
 struct sccp_ha {
 	struct sockaddr_storage netaddr;
 	struct sockaddr_storage netmask;
 	struct sccp_ha *next;
 	int sense;
+	struct sccp_ha_tree *tree;										/*!< Compiled lookup tree of the whole list (head only, see sccp_compile_ha) */
 };
 
 __BEGIN_C_EXTERN__
@@ -48,6 +50,7 @@ SCCP_API void SCCP_CALL sccp_netsock_setPort(const struct sockaddr_storage *sock
 SCCP_API int __PURE__ SCCP_CALL sccp_netsock_is_any_addr(const struct sockaddr_storage *sockAddrStorage);
 SCCP_API boolean_t SCCP_CALL sccp_netsock_getExternalAddr(struct sockaddr_storage *sockAddrStorage, int family);
 SCCP_API void SCCP_CALL sccp_netsock_flush_externhost(void);
+SCCP_API void SCCP_CALL sccp_netsock_stop_externhost(void);
 SCCP_API size_t __PURE__ SCCP_CALL sccp_netsock_sizeof(const struct sockaddr_storage *sockAddrStorage);
 SCCP_API boolean_t __PURE__ SCCP_CALL sccp_netsock_is_mapped_IPv4(const struct sockaddr_storage *sockAddrStorage);
 SCCP_API boolean_t SCCP_CALL sccp_netsock_ipv4_mapped(const struct sockaddr_storage *sockAddrStorage, struct sockaddr_storage *sockAddrStorage_mapped);
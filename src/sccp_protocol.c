@@ -24,48 +24,69 @@ SCCP_FILE_VERSION(__FILE__, "");
 /* CallInfo Message */
 
 /* =================================================================================================================== Send Messages */
-static void sccp_protocol_sendCallInfoV3 (const sccp_callinfo_t * const ci, const uint32_t callid, const skinny_calltype_t calltype, const uint8_t lineInstance, const uint8_t callInstance, const skinny_callsecuritystate_t callsecurityState, constDevicePtr device)
+/*
+ * The callinfo encoders only produce the device independent part of the message (strings, redirect reasons and presentation).
+ * Their result is cached per callinfo version by iCallInfo.Encode, so a callinfo shared by many devices (hints, shared lines)
+ * is only encoded once per change. The senders patch in the per device fields afterwards.
+ */
+static int sccp_protocol_encodeCallInfoV3(const sccp_callinfo_t * const ci, void * const buffer, const size_t size)
 {
- 	pbx_assert(device != NULL);
-	sccp_msg_t *msg;
+	sccp_data_t *data = (sccp_data_t *) buffer;
+	int len = sizeof(data->CallInfoMessage);
 
-	REQ(msg, CallInfoMessage);
+	if ((size_t) len > size) {
+		return -1;
+	}
+	memset(data, 0, len);
 
 	int originalCdpnRedirectReason = 0;
 	int lastRedirectingReason = 0;
 	sccp_callerid_presentation_t presentation = CALLERID_PRESENTATION_ALLOWED;
 
 	iCallInfo.Getter(ci,
-		SCCP_CALLINFO_CALLEDPARTY_NAME, &msg->data.CallInfoMessage.calledPartyName,
-		SCCP_CALLINFO_CALLEDPARTY_NUMBER, &msg->data.CallInfoMessage.calledParty,
-		SCCP_CALLINFO_CALLEDPARTY_VOICEMAIL, &msg->data.CallInfoMessage.cdpnVoiceMailbox,
-		SCCP_CALLINFO_CALLINGPARTY_NAME, &msg->data.CallInfoMessage.callingPartyName,
-		SCCP_CALLINFO_CALLINGPARTY_NUMBER, &msg->data.CallInfoMessage.callingParty,
-		SCCP_CALLINFO_CALLINGPARTY_VOICEMAIL, &msg->data.CallInfoMessage.cgpnVoiceMailbox,
-		SCCP_CALLINFO_ORIG_CALLEDPARTY_NAME, &msg->data.CallInfoMessage.originalCalledPartyName,
-		SCCP_CALLINFO_ORIG_CALLEDPARTY_NUMBER, &msg->data.CallInfoMessage.originalCalledParty,
-		SCCP_CALLINFO_ORIG_CALLEDPARTY_VOICEMAIL, &msg->data.CallInfoMessage.originalCdpnVoiceMailbox,
-		SCCP_CALLINFO_LAST_REDIRECTINGPARTY_NAME, &msg->data.CallInfoMessage.lastRedirectingPartyName,
-		SCCP_CALLINFO_LAST_REDIRECTINGPARTY_NUMBER, &msg->data.CallInfoMessage.lastRedirectingParty,
-		SCCP_CALLINFO_LAST_REDIRECTINGPARTY_VOICEMAIL, &msg->data.CallInfoMessage.lastRedirectingVoiceMailbox,
+		SCCP_CALLINFO_CALLEDPARTY_NAME, &data->CallInfoMessage.calledPartyName,
+		SCCP_CALLINFO_CALLEDPARTY_NUMBER, &data->CallInfoMessage.calledParty,
+		SCCP_CALLINFO_CALLEDPARTY_VOICEMAIL, &data->CallInfoMessage.cdpnVoiceMailbox,
+		SCCP_CALLINFO_CALLINGPARTY_NAME, &data->CallInfoMessage.callingPartyName,
+		SCCP_CALLINFO_CALLINGPARTY_NUMBER, &data->CallInfoMessage.callingParty,
+		SCCP_CALLINFO_CALLINGPARTY_VOICEMAIL, &data->CallInfoMessage.cgpnVoiceMailbox,
+		SCCP_CALLINFO_ORIG_CALLEDPARTY_NAME, &data->CallInfoMessage.originalCalledPartyName,
+		SCCP_CALLINFO_ORIG_CALLEDPARTY_NUMBER, &data->CallInfoMessage.originalCalledParty,
+		SCCP_CALLINFO_ORIG_CALLEDPARTY_VOICEMAIL, &data->CallInfoMessage.originalCdpnVoiceMailbox,
+		SCCP_CALLINFO_LAST_REDIRECTINGPARTY_NAME, &data->CallInfoMessage.lastRedirectingPartyName,
+		SCCP_CALLINFO_LAST_REDIRECTINGPARTY_NUMBER, &data->CallInfoMessage.lastRedirectingParty,
+		SCCP_CALLINFO_LAST_REDIRECTINGPARTY_VOICEMAIL, &data->CallInfoMessage.lastRedirectingVoiceMailbox,
 		SCCP_CALLINFO_ORIG_CALLEDPARTY_REDIRECT_REASON, &originalCdpnRedirectReason,
 		SCCP_CALLINFO_LAST_REDIRECT_REASON, &lastRedirectingReason,
 		SCCP_CALLINFO_PRESENTATION, &presentation,
 		SCCP_CALLINFO_KEY_SENTINEL);
 
+	data->CallInfoMessage.partyPIRestrictionBits = presentation ? 0xf : 0x0;
+	data->CallInfoMessage.lel_originalCdpnRedirectReason = htolel(originalCdpnRedirectReason);
+	data->CallInfoMessage.lel_lastRedirectingReason = htolel(lastRedirectingReason);
+	return len;
+}
+
+static void sccp_protocol_sendCallInfoV3 (const sccp_callinfo_t * const ci, const uint32_t callid, const skinny_calltype_t calltype, const uint8_t lineInstance, const uint8_t callInstance, const skinny_callsecuritystate_t callsecurityState, constDevicePtr device)
+{
+ 	pbx_assert(device != NULL);
+	sccp_msg_t *msg;
+
+	REQ(msg, CallInfoMessage);
+	if (iCallInfo.Encode(ci, SCCP_CALLINFO_ENCODING_V3, sccp_protocol_encodeCallInfoV3, &msg->data, sizeof(msg->data.CallInfoMessage)) < 0) {
+		sccp_free_packet(msg);
+		return;
+	}
+
 	// 7920's exception. They don't seem to reverse the interpretation of the presentation flag
 	if (device->skinny_type == SKINNY_DEVICETYPE_CISCO7920) {
-		msg->data.CallInfoMessage.partyPIRestrictionBits = presentation ? 0x0 : 0xf;
-	} else {
-		msg->data.CallInfoMessage.partyPIRestrictionBits = presentation ? 0xf : 0x0;
+		msg->data.CallInfoMessage.partyPIRestrictionBits = msg->data.CallInfoMessage.partyPIRestrictionBits ? 0x0 : 0xf;
 	}
 	msg->data.CallInfoMessage.lel_lineInstance = htolel(lineInstance);
 	msg->data.CallInfoMessage.lel_callReference = htolel(callid);
 	msg->data.CallInfoMessage.lel_callType = htolel(calltype);
 	msg->data.CallInfoMessage.lel_callInstance = htolel(callInstance);
 	msg->data.CallInfoMessage.lel_callSecurityStatus = htolel(callsecurityState);
-	msg->data.CallInfoMessage.lel_originalCdpnRedirectReason = htolel(originalCdpnRedirectReason);
-	msg->data.CallInfoMessage.lel_lastRedirectingReason = htolel(lastRedirectingReason);
 
 	//sccp_log((DEBUGCAT_CHANNEL | DEBUGCAT_LINE | DEBUGCAT_INDICATE)) (VERBOSE_PREFIX_3 "%s: Send callinfo(V3) for %s channel %d/%d on line instance %d\n", (device) ? device->id : "(null)", skinny_calltype2str(calltype), callid, callInstance, lineInstance);
 	//if ((GLOB(debug) & (DEBUGCAT_CHANNEL | DEBUGCAT_LINE | DEBUGCAT_INDICATE)) != 0) {
@@ -74,10 +95,12 @@ static void sccp_protocol_sendCallInfoV3 (const sccp_callinfo_t * const ci, cons
 	sccp_dev_send(device, msg);
 }
 
-static void sccp_protocol_sendCallInfoV7 (const sccp_callinfo_t * const ci, const uint32_t callid, const skinny_calltype_t calltype, const uint8_t lineInstance, const uint8_t callInstance, const skinny_callsecuritystate_t callsecurityState, constDevicePtr device)
+/*!
+ * \brief encode the CallInfoDynamicMessage body, returning the full message length
+ */
+static int sccp_protocol_encodeCallInfoV7(const sccp_callinfo_t * const ci, void * const buffer, const size_t size)
 {
- 	pbx_assert(device != NULL);
-	sccp_msg_t *msg = NULL;
+	sccp_data_t *msgdata = (sccp_data_t *) buffer;
 
 	unsigned int dataSize = 12;
 	char data[dataSize][StationMaxNameSize];
@@ -114,37 +137,53 @@ static void sccp_protocol_sendCallInfoV7 (const sccp_callinfo_t * const ci, cons
 		dummy_len += data_len[i];
 	}
 
-	int hdr_len = sizeof(msg->data.CallInfoDynamicMessage) + (dataSize - 3);
-	msg = sccp_build_packet(CallInfoDynamicMessage, hdr_len + dummy_len);
+	int hdr_len = sizeof(msgdata->CallInfoDynamicMessage) + (dataSize - 3);
+	if ((size_t) (hdr_len + dummy_len) > size) {
+		return -1;
+	}
+	memset(msgdata, 0, hdr_len + dummy_len);
 
-	msg->data.CallInfoDynamicMessage.lel_lineInstance = htolel(lineInstance);
-	msg->data.CallInfoDynamicMessage.lel_callReference = htolel(callid);
-	msg->data.CallInfoDynamicMessage.lel_callType = htolel(calltype);
-	msg->data.CallInfoDynamicMessage.partyPIRestrictionBits = presentation ? 0x0 : 0xf;
-	//! note callSecurityStatus:
-	// when indicating ringout we should set SKINNY_CALLSECURITYSTATE_UNKNOWN
-	// when indicating connected we should set SKINNY_CALLSECURITYSTATE_NOTAUTHENTICATED
-	msg->data.CallInfoDynamicMessage.lel_callSecurityStatus = htolel(callsecurityState);
-	msg->data.CallInfoDynamicMessage.lel_callInstance = htolel(callInstance);
-	msg->data.CallInfoDynamicMessage.lel_originalCdpnRedirectReason = htolel(originalCdpnRedirectReason);
-	msg->data.CallInfoDynamicMessage.lel_lastRedirectingReason = htolel(lastRedirectingReason);
+	msgdata->CallInfoDynamicMessage.partyPIRestrictionBits = presentation ? 0x0 : 0xf;
+	msgdata->CallInfoDynamicMessage.lel_originalCdpnRedirectReason = htolel(originalCdpnRedirectReason);
+	msgdata->CallInfoDynamicMessage.lel_lastRedirectingReason = htolel(lastRedirectingReason);
 
 	if (dummy_len) {
-		int bufferSize = dummy_len + dataSize;
-		char buffer[bufferSize];
+		char *buf = (char *) &msgdata->CallInfoDynamicMessage.dummy;
 		int pos = 0;
 
-		memset(&buffer[0], 0, bufferSize);
 		for (i = 0; i < dataSize; i++) {
 			if (data_len[i]) {
-				memcpy(&buffer[pos], data[i], data_len[i]);
+				memcpy(&buf[pos], data[i], data_len[i]);
 				pos += data_len[i] + 1;
 			} else {
 				pos += 1;
 			}
 		}
-		memcpy(&msg->data.CallInfoDynamicMessage.dummy, &buffer[0], bufferSize);
 	}
+	return hdr_len + dummy_len;
+}
+
+static void sccp_protocol_sendCallInfoV7 (const sccp_callinfo_t * const ci, const uint32_t callid, const skinny_calltype_t calltype, const uint8_t lineInstance, const uint8_t callInstance, const skinny_callsecuritystate_t callsecurityState, constDevicePtr device)
+{
+ 	pbx_assert(device != NULL);
+	sccp_msg_t *msg = NULL;
+	sccp_data_t body;
+
+	int len = iCallInfo.Encode(ci, SCCP_CALLINFO_ENCODING_V7, sccp_protocol_encodeCallInfoV7, &body, sizeof(body));
+	if (len < 0) {
+		return;
+	}
+	msg = sccp_build_packet(CallInfoDynamicMessage, len);
+	memcpy(&msg->data, &body, len);
+
+	msg->data.CallInfoDynamicMessage.lel_lineInstance = htolel(lineInstance);
+	msg->data.CallInfoDynamicMessage.lel_callReference = htolel(callid);
+	msg->data.CallInfoDynamicMessage.lel_callType = htolel(calltype);
+	//! note callSecurityStatus:
+	// when indicating ringout we should set SKINNY_CALLSECURITYSTATE_UNKNOWN
+	// when indicating connected we should set SKINNY_CALLSECURITYSTATE_NOTAUTHENTICATED
+	msg->data.CallInfoDynamicMessage.lel_callSecurityStatus = htolel(callsecurityState);
+	msg->data.CallInfoDynamicMessage.lel_callInstance = htolel(callInstance);
 
 	//sccp_log((DEBUGCAT_CHANNEL | DEBUGCAT_LINE | DEBUGCAT_INDICATE)) (VERBOSE_PREFIX_3 "%s: Send callinfo(V7) for %s channel %d/%d on line instance %d\n", (device) ? device->id : "(null)", skinny_calltype2str(calltype), callid, callInstance, lineInstance);
 	//if ((GLOB(debug) & (DEBUGCAT_CHANNEL | DEBUGCAT_LINE | DEBUGCAT_INDICATE)) != 0) {
@@ -154,10 +193,12 @@ static void sccp_protocol_sendCallInfoV7 (const sccp_callinfo_t * const ci, cons
 	sccp_dev_send(device, msg);
 }
 
-static void sccp_protocol_sendCallInfoV16 (const sccp_callinfo_t * const ci, const uint32_t callid, const skinny_calltype_t calltype, const uint8_t lineInstance, const uint8_t callInstance, const skinny_callsecuritystate_t callsecurityState, constDevicePtr device)
+/*!
+ * \brief encode the CallInfoDynamicMessage body (v16+, including the hunt pilot), returning the full message length
+ */
+static int sccp_protocol_encodeCallInfoV16(const sccp_callinfo_t * const ci, void * const buffer, const size_t size)
 {
- 	pbx_assert(device != NULL);
-	sccp_msg_t *msg = NULL;
+	sccp_data_t *msgdata = (sccp_data_t *) buffer;
 
 	unsigned int dataSize = 15;
 	char data[dataSize][StationMaxNameSize];
@@ -190,27 +231,46 @@ static void sccp_protocol_sendCallInfoV16 (const sccp_callinfo_t * const ci, con
 	unsigned int field = 0;
 	int data_len = 0;
 	int dummy_len = 0;
-	uint8_t *dummy = sccp_calloc(sizeof(uint8_t), dataSize * StationMaxNameSize);
-	if (!dummy) {
-		return;
+	for (field = 0; field < dataSize; field++) {
+		dummy_len += strlen(data[field]) + 1; 	//add NULL terminator
 	}
+	int hdr_len = sizeof(msgdata->CallInfoDynamicMessage) - 4;
+	if ((size_t) (hdr_len + dummy_len) > size) {
+		return -1;
+	}
+	memset(msgdata, 0, hdr_len);
+
+	uint8_t *dummy = (uint8_t *) &msgdata->CallInfoDynamicMessage.dummy;
+	dummy_len = 0;
 	for (field = 0; field < dataSize; field++) {
 		data_len = strlen(data[field]) + 1; 		//add NULL terminator
 		memcpy(dummy + dummy_len, data[field], data_len);
 		dummy_len += data_len;
 	}
-	int hdr_len = sizeof(msg->data.CallInfoDynamicMessage) - 4;
-	msg = sccp_build_packet(CallInfoDynamicMessage, hdr_len + dummy_len);
+	msgdata->CallInfoDynamicMessage.partyPIRestrictionBits		= presentation ? 0x0 : 0xf;
+	msgdata->CallInfoDynamicMessage.lel_originalCdpnRedirectReason	= htolel(originalCdpnRedirectReason);
+	msgdata->CallInfoDynamicMessage.lel_lastRedirectingReason	= htolel(lastRedirectingReason);
+	return hdr_len + dummy_len;
+}
+
+static void sccp_protocol_sendCallInfoV16 (const sccp_callinfo_t * const ci, const uint32_t callid, const skinny_calltype_t calltype, const uint8_t lineInstance, const uint8_t callInstance, const skinny_callsecuritystate_t callsecurityState, constDevicePtr device)
+{
+ 	pbx_assert(device != NULL);
+	sccp_msg_t *msg = NULL;
+	sccp_data_t body;
+
+	int len = iCallInfo.Encode(ci, SCCP_CALLINFO_ENCODING_V16, sccp_protocol_encodeCallInfoV16, &body, sizeof(body));
+	if (len < 0) {
+		return;
+	}
+	msg = sccp_build_packet(CallInfoDynamicMessage, len);
+	memcpy(&msg->data, &body, len);
+
 	msg->data.CallInfoDynamicMessage.lel_lineInstance		= htolel(lineInstance);
 	msg->data.CallInfoDynamicMessage.lel_callReference		= htolel(callid);
 	msg->data.CallInfoDynamicMessage.lel_callType			= htolel(calltype);
-	msg->data.CallInfoDynamicMessage.partyPIRestrictionBits		= presentation ? 0x0 : 0xf;
 	msg->data.CallInfoDynamicMessage.lel_callSecurityStatus		= htolel(callsecurityState);
 	msg->data.CallInfoDynamicMessage.lel_callInstance		= htolel(callInstance);
-	msg->data.CallInfoDynamicMessage.lel_originalCdpnRedirectReason	= htolel(originalCdpnRedirectReason);
-	msg->data.CallInfoDynamicMessage.lel_lastRedirectingReason	= htolel(lastRedirectingReason);
-	memcpy(&msg->data.CallInfoDynamicMessage.dummy, dummy, dummy_len);
-	sccp_free(dummy);
 	
 	//sccp_log((DEBUGCAT_CHANNEL | DEBUGCAT_LINE | DEBUGCAT_INDICATE)) (VERBOSE_PREFIX_3 "%s: Send callinfo(V20) for %s channel %d/%d on line instance %d\n", (device) ? device->id : "(null)", skinny_calltype2str(calltype), callid, callInstance, lineInstance);
 	//if ((GLOB(debug) & (DEBUGCAT_CHANNEL | DEBUGCAT_LINE | DEBUGCAT_INDICATE)) != 0) {
@@ -272,11 +332,12 @@ static void sccp_protocol_sendStaticDisplayprompt(constDevicePtr device, uint8_t
 {
 	sccp_msg_t *msg = NULL;
 
-	REQ(msg, DisplayPromptStatusMessage);
+	REQFIXED(msg, DisplayPromptStatusMessage);
 	msg->data.DisplayPromptStatusMessage.lel_messageTimeout = htolel(timeout);
 	msg->data.DisplayPromptStatusMessage.lel_callReference = htolel(callid);
 	msg->data.DisplayPromptStatusMessage.lel_lineInstance = htolel(lineInstance);
-	sccp_copy_string(msg->data.DisplayPromptStatusMessage.promptMessage, message, sizeof(msg->data.DisplayPromptStatusMessage.promptMessage));
+	strncpy(msg->data.DisplayPromptStatusMessage.promptMessage, message, sizeof(msg->data.DisplayPromptStatusMessage.promptMessage) - 1);	/* pads the rest with zero's */
+	msg->data.DisplayPromptStatusMessage.promptMessage[sizeof(msg->data.DisplayPromptStatusMessage.promptMessage) - 1] = '\0';
 
 	sccp_dev_send(device, msg);
 	sccp_log((DEBUGCAT_DEVICE | DEBUGCAT_LINE)) (VERBOSE_PREFIX_3 "%s: Display prompt on line %d, callid %d, timeout %d\n", device->id, lineInstance, callid, timeout);
@@ -53,6 +53,15 @@ SCCP_FILE_VERSION(__FILE__, "");
 //nb: SCCP_HASH_PRIME defined in config.h, default 563
 #define SCCP_SIMPLE_HASH(_a) (((unsigned long)(_a)) % SCCP_HASH_PRIME)
 #define SCCP_LIVE_MARKER 13
+/*
+ * Intrusive lookup: retain/release locate the object header by pointer arithmetic from the data pointer (container-of) and check
+ * the live marker and refcount, instead of searching the hash table under a rwlock. The hash table is then only used as a registry
+ * (updated on alloc/destroy) for 'sccp show refcount' and the shutdown cleanup. Refcount debug builds keep verifying every pointer
+ * against the hash table, to be able to report invalid references.
+ */
+#if !CS_REFCOUNT_DEBUG
+#define REFCOUNT_INTRUSIVE 1
+#endif
 //#define REFCOUNT_MAX_PARENTS 3
 #if CS_REFCOUNT_DEBUG
 #define REF_DEBUG_FILE_MAX_SIZE 10000000
@@ -336,6 +345,7 @@ static gcc_inline int __sccp_refcount_debug(const void *ptr, RefCountedObject *
 }
 #endif
 
+#ifndef REFCOUNT_INTRUSIVE
 static gcc_inline RefCountedObject *sccp_refcount_find_obj(const void *ptr, const char *filename, int lineno, const char *func)
 {
 	RefCountedObject *obj = NULL;
@@ -366,6 +376,30 @@ static gcc_inline RefCountedObject *sccp_refcount_find_obj(const void *ptr, cons
 	}
 	return found ? obj : NULL;
 }
+#endif
+
+/*!
+ * \brief Get the refcount object header belonging to a data pointer
+ * \note Uses the intrusive header lookup when REFCOUNT_INTRUSIVE is set, falling back to the hash table search otherwise
+ */
+static gcc_inline RefCountedObject *sccp_refcount_get_obj(const void *ptr, const char *filename, int lineno, const char *func)
+{
+#ifdef REFCOUNT_INTRUSIVE
+	RefCountedObject *obj = NULL;
+
+	if (ptr == NULL) {
+		return NULL;
+	}
+	obj = (RefCountedObject *) ((uintptr_t) ptr - offsetof(RefCountedObject, data));
+	if (do_expect(SCCP_LIVE_MARKER == obj->alive && obj->type > 0 && obj->type < ARRAY_LEN(obj_info))) {
+		return obj;
+	}
+	sccp_log((DEBUGCAT_REFCOUNT)) (VERBOSE_PREFIX_1 "SCCP: (sccp_refcount_get_obj) %p Already declared dead\n", obj);
+	return NULL;
+#else
+	return sccp_refcount_find_obj(ptr, filename, lineno, func);
+#endif
+}
 
 static gcc_inline void sccp_refcount_remove_obj(const void *ptr)
 {
@@ -629,7 +663,7 @@ int sccp_refcount_force_release(long findobj, char *identifier)
 
 void sccp_refcount_updateIdentifier(const void * const ptr, const char * const identifier)
 {
-	RefCountedObject *obj = sccp_refcount_find_obj(ptr, __FILE__, __LINE__, __PRETTY_FUNCTION__);
+	RefCountedObject *obj = sccp_refcount_get_obj(ptr, __FILE__, __LINE__, __PRETTY_FUNCTION__);
 	if (!obj) {
 		pbx_log(LOG_ERROR, "SCCP: (updateIdentifief) Refcount Object %p could not be found\n", ptr);
 		return;
@@ -697,7 +731,7 @@ gcc_inline void * const sccp_refcount_retain(const void * const ptr, const char
 	volatile int refcountval;
 	int newrefcountval;
 
-	if (do_expect((obj = sccp_refcount_find_obj(ptr, filename, lineno, func)) != NULL)) {
+	if (do_expect((obj = sccp_refcount_get_obj(ptr, filename, lineno, func)) != NULL)) {
 #if CS_REFCOUNT_DEBUG
 		__sccp_refcount_debug(ptr, obj, 1, filename, lineno, func);
 #endif
@@ -705,8 +739,15 @@ gcc_inline void * const sccp_refcount_retain(const void * const ptr, const char
 		refcountval = ATOMIC_INCR((&obj->refcount), 1, &obj->lock);
 		// ANNOTATE_HAPPENS_AFTER(&obj->refcount);
 		newrefcountval = refcountval + 1;
+#ifdef REFCOUNT_INTRUSIVE
+		if (dont_expect(refcountval <= 0)) {								// object is being finalized by another thread, don't revive it
+			ATOMIC_DECR((&obj->refcount), 1, &obj->lock);
+			pbx_log(LOG_ERROR, "SCCP: (retain) Refcount Object %p is being destroyed (%s:%d:%s)\n", ptr, filename, lineno, func);
+			return NULL;
+		}
+#endif
 		
-		if (dont_expect( (sccp_globals->debug & (((&obj_info[obj->type])->debugcat + DEBUGCAT_REFCOUNT))) == ((&obj_info[obj->type])->debugcat + DEBUGCAT_REFCOUNT))) {
+		if (sccp_debug_enabled(DEBUGCAT_REFCOUNT) && dont_expect( (sccp_globals->debug & (((&obj_info[obj->type])->debugcat + DEBUGCAT_REFCOUNT))) == ((&obj_info[obj->type])->debugcat + DEBUGCAT_REFCOUNT))) {
 			pbx_log(__LOG_VERBOSE, __FILE__, 0, "", " %-15.15s:%-4.4d (%-35.35s) %*.*s> %*s refcount increased %.2d  +> %.2d for %10s: %s (%p)\n", filename, lineno, func, refcountval, refcountval, "--------------------", 20 - refcountval, " ", refcountval, newrefcountval, (&obj_info[obj->type])->datatype, obj->identifier, obj);
 		}
 		return (void * const) obj->data;	/* regular exit */
@@ -742,7 +783,7 @@ gcc_inline void * const sccp_refcount_release(const void * * const ptr, const ch
 	int newrefcountval, alive;
 	sccp_debug_category_t debugcat;
 
-	if (do_expect( (obj = sccp_refcount_find_obj(*ptr, filename, lineno, func)) != NULL && obj->refcount > 0)) {
+	if (do_expect( (obj = sccp_refcount_get_obj(*ptr, filename, lineno, func)) != NULL && obj->refcount > 0)) {
 #if CS_REFCOUNT_DEBUG
 		__sccp_refcount_debug((void *) *ptr, obj, -1, filename, lineno, func);
 #endif
@@ -761,7 +802,7 @@ gcc_inline void * const sccp_refcount_release(const void * * const ptr, const ch
 			sccp_log((DEBUGCAT_REFCOUNT)) (VERBOSE_PREFIX_1 "SCCP: %-15.15s:%-4.4d (%-35.35s)) (release) Finalizing %p (%p) (alive:%d)\n", filename, lineno, func, obj, *ptr, alive);
 			sccp_refcount_remove_obj(*ptr);
 		} else {
-			if (dont_expect( (sccp_globals->debug & ((debugcat + DEBUGCAT_REFCOUNT))) == (debugcat ^ DEBUGCAT_REFCOUNT))) {
+			if (sccp_debug_enabled(DEBUGCAT_REFCOUNT) && dont_expect( (sccp_globals->debug & ((debugcat + DEBUGCAT_REFCOUNT))) == (debugcat ^ DEBUGCAT_REFCOUNT))) {
 				pbx_log(__LOG_VERBOSE, __FILE__, 0, "", " %-15.15s:%-4.4d (%-35.35s) <%*.*s %*s refcount decreased %.2d  <- %.2d for %10s: %s (%p)\n", filename, lineno, func, newrefcountval, newrefcountval, "--------------------", 20 - newrefcountval, " ", newrefcountval, refcountval, (&obj_info[obj->type])->datatype, obj->identifier, obj);
 			}
 		}
@@ -15,6 +15,7 @@
 SCCP_FILE_VERSION(__FILE__, "");
 
 #include "sccp_actions.h"
+#include "sccp_atomic.h"
 #include "sccp_cli.h"
 #include "sccp_device.h"
 #include "sccp_netsock.h"
@@ -38,16 +39,26 @@ SCCP_FILE_VERSION(__FILE__, "");
 #endif
 #include <asterisk/cli.h>
 #include <signal.h>
+#include <sys/uio.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <fcntl.h>
+#define CS_SESSION_REACTOR 1
+#endif
 
 /* global variables -> GLOBALS */
 static pthread_t accept_tid;
 static int accept_sock = -1;
 
-#define WRITE_BACKOFF 500											/* backoff time in millisecs, doubled every write retry (150+300+600+1200+2400+4800 = 9450 millisecs = 9.5 sec) */
+#define WRITE_BACKOFF 10											/* backoff time in millisecs, doubled every write retry (10+20+40+80+160+320 = 630 millisecs) */
+#define WRITE_RETRIES 6											/* maximum number of write retries, before giving up on a session which is not reading */
 #define SESSION_DEVICE_CLEANUP_TIME 10										/* wait time before destroying a device on thread exit */
 #define KEEPALIVE_ADDITIONAL_PERCENT_SESSION 1.05								/* extra time allowed for device keepalive overrun (percentage of GLOB(keepalive)) */
 #define KEEPALIVE_ADDITIONAL_PERCENT_DEVICE 1.20								/* extra time allowed for device keepalive overrun (percentage of GLOB(keepalive)) */
 #define KEEPALIVE_ADDITIONAL_PERCENT_ON_CALL 2.00								/* extra time allowed for device keepalive overrun (percentage of GLOB(keepalive)) */
+#define SESSION_REACTOR_MAX_EVENTS 64										/* maximum number of epoll events handled per reactor iteration */
+#define SESSION_REACTOR_TICK 1000										/* reactor housekeeping interval in millisecs (keepalive timeout / pending device updates) */
+#define SESSION_SENDQUEUE_SIZE 32										/* maximum number of outbound messages coalesced into a single sendmsg call */
 
 /* Lock Macro for Sessions */
 #define sccp_session_lock(x)			pbx_mutex_lock(&(x)->lock)
@@ -59,6 +70,29 @@ void sccp_session_device_thread_exit(void *session);
 void *sccp_session_device_thread(void *session);
 void __sccp_session_stopthread(sessionPtr session, uint8_t newRegistrationState);
 gcc_inline void recalc_wait_time(sccp_session_t *s);
+static int sccp_session_flush(sccp_session_t * s, boolean_t wait);
+
+typedef struct sccp_session_reactor sccp_session_reactor_t;
+
+#ifdef CS_SESSION_REACTOR
+/*!
+ * \brief SCCP Session Reactor Structure
+ * \note An I/O thread multiplexing many sessions using epoll. Every session is owned by exactly one reactor, which
+ * serializes all reading, message dispatching and session cleanup for it, preserving per-session message ordering.
+ */
+struct sccp_session_reactor {
+	pthread_t thread;											/*!< Reactor Thread */
+	int epfd;												/*!< Epoll File Descriptor */
+	int wakepipe[2];											/*!< Pipe used to wake up the reactor from epoll_wait */
+	volatile boolean_t stop;										/*!< Signal Reactor Stop */
+	SCCP_LIST_HEAD (, sccp_session_t) sessions;								/*!< Sessions owned by this reactor */
+	sccp_msg_t msg;												/*!< Scratch Message Buffer, used while dispatching */
+};														/*!< SCCP Session Reactor Structure */
+
+static sccp_session_reactor_t **session_reactors = NULL;
+static int session_reactor_count = 0;
+static void sccp_session_reactors_stop(void);
+#endif
 
 /*!
  * \brief SCCP Session Structure
@@ -75,8 +109,22 @@ struct sccp_session {
 	uint32_t protocolType;
 	volatile boolean_t session_stop;									/*!< Signal Session Stop */
 	sccp_mutex_t write_lock;										/*!< Prevent multiple threads writing to the socket at the same time */
+	sccp_mutex_t sendqueue_lock;										/*!< Protects sendqueue, sendqueue_len and cork */
+	sccp_msg_t *sendqueue[SESSION_SENDQUEUE_SIZE];								/*!< Outbound messages waiting to be written */
+	uint16_t sendqueue_len;											/*!< Number of messages in sendqueue */
+	uint16_t cork;												/*!< Nesting level of sccp_session_cork, while set the sendqueue is only flushed when it is full */
+	uint32_t tx_messages;											/*!< Number of messages written to the socket */
+	uint32_t tx_syscalls;											/*!< Number of sendmsg calls used to write them */
 	sccp_mutex_t lock;											/*!< Asterisk: Lock Me Up and Tie me Down */
+	volatile CAS32_TYPE refcount;										/*!< Owner reference plus one per sccp_session_retainByDevice, freed on the last release */
 	pthread_t session_thread;										/*!< Session Thread */
+	sccp_session_reactor_t *reactor;									/*!< Reactor owning this session (NULL when running on its own session thread) */
+	SCCP_LIST_ENTRY (sccp_session_t) reactor_list;								/*!< Linked List Entry for the Reactor Sessions List */
+	boolean_t oncall;											/*!< Device had an active channel when the keepalive was last calculated */
+	uint8_t admission;											/*!< Registration Admission State (protected by admission_lock) */
+	size_t recv_start;											/*!< Offset of the first unprocessed byte in recv_buffer */
+	size_t recv_len;											/*!< Number of bytes waiting in recv_buffer, starting at recv_start */
+	unsigned char recv_buffer[SCCP_MAX_PACKET * 2] __attribute__ ((aligned (8)));				/*!< Receive Buffer, complete messages are handled in place */
 	struct sockaddr_storage ourip;										/*!< Our IP is for rtp use */
 	struct sockaddr_storage ourIPv4;
 	char designator[40];
@@ -242,9 +290,9 @@ static gcc_inline int session_buffer2msg(sccp_session_t * s, unsigned char *buff
 		}
 		lenAccordingToOurProtocolSpec = 0;									// unknown message, read it and discard content completely
 	}
+	int lenAccordingToSpecOrHeader = lenAccordingToOurProtocolSpec > (int) SCCP_PACKET_HEADER ? lenAccordingToOurProtocolSpec : (int) SCCP_PACKET_HEADER;
 	if (dont_expect(lenAccordingToPacketHeader > lenAccordingToOurProtocolSpec)) {					// show out discarded bytes
 		pbx_log(LOG_WARNING, "%s: (session_dissect_msg) Incoming message is bigger(%d) than known size(%d). Packet looks like!\n", DEV_ID_LOG(s->device), lenAccordingToPacketHeader, lenAccordingToOurProtocolSpec);
-		buffer[lenAccordingToPacketHeader + 1] = '\0';								// terminate buffer
 		sccp_dump_packet(buffer, lenAccordingToPacketHeader);
 	}
 	
@@ -253,17 +301,36 @@ static gcc_inline int session_buffer2msg(sccp_session_t * s, unsigned char *buff
 		lenAccordingToOurProtocolSpec = lenAccordingToPacketHeader;
 	}
 
-	memset(msg, 0, SCCP_MAX_PACKET);
-	memcpy(msg, buffer, lenAccordingToOurProtocolSpec);
+	if (do_expect(lenAccordingToPacketHeader >= lenAccordingToSpecOrHeader && !((uintptr_t) buffer % __alignof__(sccp_msg_t)))) {
+		msg = (sccp_msg_t *) buffer;										// complete and aligned, handle the message in place
+	} else {
+		memcpy(msg, buffer, lenAccordingToOurProtocolSpec);							// short or unaligned, copy into the scratch message
+		if (lenAccordingToOurProtocolSpec < lenAccordingToSpecOrHeader) {
+			memset((unsigned char *) msg + lenAccordingToOurProtocolSpec, 0, lenAccordingToSpecOrHeader - lenAccordingToOurProtocolSpec);	// only clear what the handler can look at
+		}
+	}
 	msg->header.length = lenAccordingToOurProtocolSpec;								// patch up msg->header.length to new size
 	return sccp_handle_message(msg, s);
 }
 
-static gcc_inline int process_buffer(sccp_session_t * s, sccp_msg_t *msg, unsigned char *buffer, size_t *len)
+/*!
+ * \brief Handle all complete messages in the receive buffer
+ * \param s SCCP Session
+ * \param msg Scratch Message Buffer, only used for messages which can not be handled in place
+ * \param buffer Receive Buffer
+ * \param start Offset of the first unprocessed byte in buffer (updated)
+ * \param len Number of unprocessed bytes (updated)
+ * \return 0 on success, -1 on an invalid packet size, -2 when a message could not be handled
+ *
+ * \note Messages are consumed by advancing start, instead of moving the remaining data down after every message. Only a
+ * trailing incomplete packet is moved back to the start of the buffer, and only when there is no room left behind it.
+ */
+static gcc_inline int process_buffer(sccp_session_t * s, sccp_msg_t *msg, unsigned char *buffer, size_t *start, size_t *len)
 {
 	int res = 0;
 	while (*len >= SCCP_PACKET_HEADER && *len <= SCCP_MAX_PACKET * 2) {										// We have at least SCCP_PACKET_HEADER, so we have the payload length
-		uint32_t hdr_len = buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | (buffer[3] << 24);
+		unsigned char *packet = buffer + *start;
+		uint32_t hdr_len = packet[0] | (packet[1] << 8) | (packet[2] << 16) | (packet[3] << 24);
 		uint32_t payload_len = letohl(hdr_len) + (SCCP_PACKET_HEADER - 4);
 		if (*len < payload_len) {
 			break;												// Too short - haven't received whole payload yet, go poll for more
@@ -274,15 +341,18 @@ static gcc_inline int process_buffer(sccp_session_t * s, sccp_msg_t *msg, unsign
 			res = -1;
 			break;
 		}
-		if (dont_expect(session_buffer2msg(s, buffer, payload_len, msg) != 0)) {
+		if (dont_expect(session_buffer2msg(s, packet, payload_len, msg) != 0)) {
 			res = -2;
 			break;
 		}
-
+		*start += payload_len;
 		*len -= payload_len;
-		if (*len > 0) {												// Now shuffle the remaining data in the buffer back to the start
-			memmove(buffer + 0, buffer + payload_len, *len);
-		}
+	}
+	if (*len == 0) {
+		*start = 0;
+	} else if (*start + *len + SCCP_MAX_PACKET > SCCP_MAX_PACKET * 2) {						// not enough room left for the rest of this packet
+		memmove(buffer, buffer + *start, *len);
+		*start = 0;
 	}
 	return res;
 }
@@ -362,6 +432,71 @@ static boolean_t sccp_session_removeFromGlobals(sccp_session_t * s)
 	return res;
 }
 
+/*!
+ * \brief Retain the Session a Device is currently registered on
+ * \param device SCCP Device
+ * \return Retained SCCP Session or NULL when the device has no (active) session, to be released with sccp_session_release
+ *
+ * \note Used by threads other than the session owner, which need to cork/uncork or send to the same session pointer
+ * over a longer period of time. The session stays allocated until released, but can be stopped/closed in the meantime.
+ *
+ * \lock
+ *      - sessions
+ */
+sccp_session_t * sccp_session_retainByDevice(constDevicePtr device)
+{
+	sccp_session_t *session = NULL;
+	sccp_session_t *s = NULL;
+
+	if (!device) {
+		return NULL;
+	}
+	SCCP_RWLIST_RDLOCK(&GLOB(sessions));
+	SCCP_RWLIST_TRAVERSE(&GLOB(sessions), session, list) {
+		if (session == device->session) {								/* only sessions still in GLOB(sessions) can be retained */
+			ATOMIC_INCR(&session->refcount, 1, &session->lock);
+			s = session;
+			break;
+		}
+	}
+	SCCP_RWLIST_UNLOCK(&GLOB(sessions));
+	return s;
+}
+
+/*!
+ * \brief Free a Session after the last reference has been released
+ * \param s SCCP Session
+ */
+static void sccp_session_free(sccp_session_t * s)
+{
+	/* dropping messages which could not be written anymore */
+	pbx_mutex_lock(&s->sendqueue_lock);
+	while (s->sendqueue_len > 0) {
+		sccp_free_packet(s->sendqueue[--s->sendqueue_len]);
+	}
+	pbx_mutex_unlock(&s->sendqueue_lock);
+
+	/* destroying mutex and cleaning the session */
+	sccp_mutex_destroy(&s->sendqueue_lock);
+	sccp_mutex_destroy(&s->write_lock);
+	sccp_mutex_destroy(&s->lock);
+	sccp_free(s);
+}
+
+/*!
+ * \brief Release a Session reference
+ * \param sessionRef Pointer to the retained SCCP Session (set to NULL)
+ */
+void sccp_session_release(sccp_session_t ** sessionRef)
+{
+	sccp_session_t *s = *sessionRef;
+
+	*sessionRef = NULL;
+	if (s && ATOMIC_DECR(&s->refcount, 1, &s->lock) == 1) {
+		sccp_session_free(s);
+	}
+}
+
 
 /*!
  * \brief Terminate all session
@@ -375,6 +510,9 @@ void sccp_session_terminateAll()
 	sccp_session_t *s = NULL;
 
 	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "SCCP: Removing Sessions\n");
+#ifdef CS_SESSION_REACTOR
+	sccp_session_reactors_stop();										/* reactors destroy the sessions they own on exit */
+#endif
 	SCCP_RWLIST_TRAVERSE_SAFE_BEGIN(&GLOB(sessions), s, list) {
 		sccp_session_stopthread(s, SKINNY_DEVICE_RS_NONE);
 	}
@@ -492,13 +630,25 @@ static void destroy_session(sccp_session_t * s, uint8_t cleanupTime)
 
 	char addrStr[INET6_ADDRSTRLEN];
 	sccp_copy_string(addrStr, sccp_netsock_stringify_addr(&s->sin), sizeof(addrStr));
+	if (s->fds[0].fd > 0) {
+		sccp_session_flush(s, TRUE);									/* write what was queued before the session got stopped */
+	}
 	AUTO_RELEASE(sccp_device_t, d , s->device ? sccp_device_retain(s->device) : NULL);
-	if (d) {
+	if (d && d->session && d->session != s) {
+		/* device moved on to a new session before we got cleaned up (crossdevice cleanup by a reactor), leave it alone */
+		sccp_log((DEBUGCAT_SOCKET)) (VERBOSE_PREFIX_3 "%s: Destroy Session %s, device has registered on a new session\n", DEV_ID_LOG(s->device), addrStr);
+		sccp_session_lock(s);
+		sccp_device_t *device = s->device;
+		s->device = NULL;
+		sccp_session_unlock(s);
+		sccp_device_release(&device);									/* explicit release */
+	} else if (d) {
 		sccp_log((DEBUGCAT_SOCKET)) (VERBOSE_PREFIX_3 "%s: Destroy Device Session %s\n", DEV_ID_LOG(s->device), addrStr);
 		d->session = NULL;
 		sccp_dev_clean(d, (d->realtime) ? TRUE : FALSE);
 	}
 	sccp_session_releaseDevice(s);
+	sccp_session_admissionDone(s);
 
 	if (!sccp_session_removeFromGlobals(s)) {
 		sccp_log((DEBUGCAT_SOCKET)) (VERBOSE_PREFIX_3 "%s: Session could not be found in GLOB(session) %s\n", DEV_ID_LOG(s->device), addrStr);
@@ -517,10 +667,7 @@ static void destroy_session(sccp_session_t * s, uint8_t cleanupTime)
 		}
 		sccp_session_unlock(s);
 
-		/* destroying mutex and cleaning the session */
-		sccp_mutex_destroy(&s->lock);
-		sccp_free(s);
-		s = NULL;
+		sccp_session_release(&s);									/* owner reference, frees the session unless it is still retained */
 	}
 }
 
@@ -583,6 +730,42 @@ gcc_inline void recalc_wait_time(sccp_session_t *s)
 	}
 }
 
+/*!
+ * \brief Read pending data from the session socket and dispatch every complete message it contains
+ * \param s SCCP Session
+ * \param msg Scratch Message Buffer
+ * \return 0 on success, -1 when the connection was closed or returned an error, -2 when a message could not be handled (session has been stopped)
+ *
+ * \note Only called from the thread owning the session (session thread or reactor), which guarantees in-order message handling
+ */
+static int sccp_session_receive(sccp_session_t * s, sccp_msg_t * msg)
+{
+	int result = recv(s->fds[0].fd, s->recv_buffer + s->recv_start + s->recv_len, (SCCP_MAX_PACKET * 2) - s->recv_start - s->recv_len, MSG_DONTWAIT);
+	s->lastKeepAlive = time(0);
+	if (result <= 0) {
+		if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+			return 0;
+		}
+		socket_get_error(s, __FILE__, __LINE__, __PRETTY_FUNCTION__, errno);
+		return -1;
+	}
+	s->recv_len += result;
+	sccp_session_cork(s);											/* coalesce the responses to this batch of messages, flushed when we are done */
+	if (!((SCCP_MAX_PACKET * 2) - s->recv_start - s->recv_len) || process_buffer(s, msg, s->recv_buffer, &s->recv_start, &s->recv_len) != 0) {
+		sccp_session_uncork(s);
+		pbx_log(LOG_ERROR, "%s: (sccp_session_receive) Received a packet or message (with result:%d) which we could not handle, giving up session: %p!\n", s->designator, result, s);
+		sccp_dump_packet(s->recv_buffer + s->recv_start, MIN(s->recv_len, SCCP_MAX_PACKET));		/* process_buffer leaves recv_start at the offending packet */
+		if (s->device) {
+			sccp_device_sendReset(s->device, SKINNY_DEVICE_RESTART);
+		}
+		__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
+		return -2;
+	}
+	sccp_session_uncork(s);
+	s->lastKeepAlive = time(0);
+	return 0;
+}
+
 /*!
  * \brief Socket Device Thread
  * \param session SCCP Session
@@ -601,8 +784,6 @@ void *sccp_session_device_thread(void *session)
 
 	boolean_t oncall = TRUE;
 	boolean_t tokenThread = FALSE;
-	unsigned char recv_buffer[SCCP_MAX_PACKET * 2] = "";
-	size_t recv_len = 0;
 	sccp_msg_t msg = { {0,} };
 
 	pthread_cleanup_push(sccp_session_device_thread_exit, session);
@@ -651,24 +832,10 @@ void *sccp_session_device_thread(void *session)
 			}
 		} else if (res > 0) {										/* poll data processing */
 			if (s->fds[0].revents & POLLIN || s->fds[0].revents & POLLPRI) {			/* POLLIN | POLLPRI */
-				//sccp_log_and((DEBUGCAT_SOCKET + DEBUGCAT_HIGH)) (VERBOSE_PREFIX_2 "%s: Session New Data Arriving at buffer position:%lu\n", DEV_ID_LOG(s->device), recv_len);
-				int result = recv(s->fds[0].fd, recv_buffer + recv_len, (SCCP_MAX_PACKET * 2) - recv_len, 0);
-				s->lastKeepAlive = time(0);
-				if (result <= 0) {
-					if (result < 0 || (errno != EINTR || errno != EAGAIN)) {
-						socket_get_error(s, __FILE__, __LINE__, __PRETTY_FUNCTION__, errno);
-						break;
-					}				
-				} else if (!((recv_len += result) && ((SCCP_MAX_PACKET * 2) - recv_len) && process_buffer(s, &msg, recv_buffer, &recv_len) == 0)) {
-					pbx_log(LOG_ERROR, "%s: (netsock_device_thread) Received a packet or message (with result:%d) which we could not handle, giving up session: %p!\n", s->designator, result, s);
-					sccp_dump_msg(&msg);
-					if (s->device) {
-						sccp_device_sendReset(s->device, SKINNY_DEVICE_RESTART);
-					}
-					__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
+				//sccp_log_and((DEBUGCAT_SOCKET + DEBUGCAT_HIGH)) (VERBOSE_PREFIX_2 "%s: Session New Data Arriving at buffer position:%lu\n", DEV_ID_LOG(s->device), s->recv_len);
+				if (sccp_session_receive(s, &msg) != 0) {
 					break;
 				}
-				s->lastKeepAlive = time(0);
 			} else {										/* POLLHUP / POLLERR */
 				pbx_log(LOG_NOTICE, "%s: Closing session because we received POLLPRI/POLLHUP/POLLERR\n", s->designator);
 				__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
@@ -700,8 +867,8 @@ void __sccp_session_stopthread(sessionPtr session, uint8_t newRegistrationState)
 	if (session->device) {
 		sccp_device_setRegistrationState(session->device, newRegistrationState);
 	}
-	if (AST_PTHREADT_NULL != session->session_thread) {
-		shutdown(session->fds[0].fd, SHUT_RD);								// this will also wake up poll
+	if (AST_PTHREADT_NULL != session->session_thread || session->reactor) {
+		shutdown(session->fds[0].fd, SHUT_RD);								// this will also wake up poll/epoll
 		// which is waiting for a read event and close down the thread nicely
 	}
 }
@@ -729,12 +896,34 @@ static void __sccp_netsock_end_device_thread(sccp_session_t *session)
 	}
 }
 
+#ifdef CS_SESSION_REACTOR
+/*
+ * stop a reactor owned session from another thread. The owning reactor destroys the session when it handles the wake up, we
+ * do not wait for that: the caller might be another reactor, which would stall all of its own sessions in the mean time.
+ */
+static void __sccp_session_reactor_end_session(sccp_session_t *session)
+{
+	session->session_stop = TRUE;
+	shutdown(session->fds[0].fd, SHUT_RD);									// wakes up epoll_wait in the owning reactor
+}
+#endif
+
 /* check if same or different thread, choose thread cancel method accordingly */
 gcc_inline void sccp_session_stopthread(constSessionPtr session, uint8_t newRegistrationState)
 {
 	sccp_session_t * s = (sccp_session_t *)session;								/* discard const */
 	if (s) {
 		pthread_t ptid = pthread_self();
+#ifdef CS_SESSION_REACTOR
+		if (s->reactor) {
+			if (ptid == s->reactor->thread) {
+				__sccp_session_stopthread(s, newRegistrationState);			/* cleaned up by the reactor at the end of this iteration */
+			} else {
+				__sccp_session_reactor_end_session(s);
+			}
+			return;
+		}
+#endif
 		if (ptid == s->session_thread) {
 			__sccp_session_stopthread(s, newRegistrationState);
 		} else {
@@ -743,6 +932,306 @@ gcc_inline void sccp_session_stopthread(constSessionPtr session, uint8_t newRegi
 	}
 }
 
+#ifdef CS_SESSION_REACTOR
+/* -------------------------------------------------------------------------------------------------------SESSION REACTOR- */
+/*!
+ * \brief Periodic Session Housekeeping (Reactor)
+ * \param s SCCP Session
+ * \param now Current Time
+ *
+ * Replaces the poll timeout handling of the session thread: handles pending device updates, recalculates the keepalive
+ * when the device goes on/off call and closes sessions which timed out.
+ */
+static void sccp_session_reactor_housekeeping(sccp_session_t * s, time_t now)
+{
+	boolean_t tokenThread = FALSE;
+	AUTO_RELEASE(sccp_device_t, d , s->device ? sccp_device_retain(s->device) : NULL);
+	if (d) {
+		if (d->pendingUpdate || d->pendingDelete) {
+			pbx_rwlock_rdlock(&GLOB(lock));
+			boolean_t reload_in_progress = GLOB(reload_in_progress);
+			pbx_rwlock_unlock(&GLOB(lock));
+			if (reload_in_progress == FALSE) {
+				sccp_device_check_update(d);
+			}
+			return;										// s->device might have changed, check again on next tick
+		}
+		if ((d->active_channel ? TRUE : FALSE) != s->oncall) {
+			recalc_wait_time(s);
+			s->oncall = (d->active_channel) ? TRUE : FALSE;
+		}
+		if (d->status.token == SCCP_TOKEN_STATE_ACK) {
+			tokenThread = TRUE;								// only does TCP-Keepalive
+		}
+	}
+	uintmax_t timediff = (uintmax_t)now - (uintmax_t)s->lastKeepAlive;
+	if (!tokenThread && timediff >= s->keepAlive) {
+		pbx_log(LOG_NOTICE, "%s: Closing session because connection timed out after %ju seconds (ip-address: %s).\n", DEV_ID_LOG(s->device), timediff, s->designator);
+		__sccp_session_stopthread(s, SKINNY_DEVICE_RS_TIMEOUT);
+	}
+}
+
+/*!
+ * \brief Run the periodic housekeeping for all sessions owned by this reactor
+ * \param reactor SCCP Session Reactor
+ * \param now Current Time
+ *
+ * \note The sessions are collected (and retained) under the list lock, but handled after unlocking it, so that device
+ * updates / session stops do not hold up the accept thread handing over new sessions.
+ *
+ * \lock
+ *      - reactor->sessions
+ */
+static void sccp_session_reactor_tick(sccp_session_reactor_t * reactor, time_t now)
+{
+	sccp_session_t **sessions = NULL;
+	sccp_session_t *s = NULL;
+	int count = 0;
+	int i = 0;
+
+	SCCP_LIST_LOCK(&reactor->sessions);
+	if (SCCP_LIST_GETSIZE(&reactor->sessions) > 0 && (sessions = sccp_calloc(sizeof(sccp_session_t *), SCCP_LIST_GETSIZE(&reactor->sessions)))) {
+		SCCP_LIST_TRAVERSE(&reactor->sessions, s, reactor_list) {
+			if (!s->session_stop) {
+				ATOMIC_INCR(&s->refcount, 1, &s->lock);
+				sessions[count++] = s;
+			}
+		}
+	}
+	SCCP_LIST_UNLOCK(&reactor->sessions);
+
+	for (i = 0; i < count; i++) {
+		if (!sessions[i]->session_stop) {
+			sccp_session_reactor_housekeeping(sessions[i], now);
+		}
+		sccp_session_release(&sessions[i]);
+	}
+	if (sessions) {
+		sccp_free(sessions);
+	}
+}
+
+/*!
+ * \brief Remove and destroy all stopped sessions owned by this reactor
+ * \param reactor SCCP Session Reactor
+ * \param all Stop and destroy all sessions (reactor shutdown)
+ */
+static void sccp_session_reactor_reap(sccp_session_reactor_t * reactor, boolean_t all)
+{
+	sccp_session_t *s = NULL;
+	sccp_session_t *stopped = NULL;
+
+	do {
+		stopped = NULL;
+		SCCP_LIST_LOCK(&reactor->sessions);
+		SCCP_LIST_TRAVERSE_SAFE_BEGIN(&reactor->sessions, s, reactor_list) {
+			if (all || s->session_stop || s->fds[0].fd <= 0) {
+				SCCP_LIST_REMOVE_CURRENT(reactor_list);
+				stopped = s;
+				break;
+			}
+		}
+		SCCP_LIST_TRAVERSE_SAFE_END;
+		SCCP_LIST_UNLOCK(&reactor->sessions);
+
+		if (stopped) {
+			if (stopped->fds[0].fd > 0) {
+				epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, stopped->fds[0].fd, NULL);
+			}
+			sccp_log((DEBUGCAT_SOCKET)) (VERBOSE_PREFIX_3 "%s: Reactor cleaning up session\n", DEV_ID_LOG(stopped->device));
+			stopped->session_stop = TRUE;
+			destroy_session(stopped, SESSION_DEVICE_CLEANUP_TIME);
+		}
+	} while (stopped);
+}
+
+/*!
+ * \brief Session Reactor Thread
+ * \param data SCCP Session Reactor
+ *
+ * Waits for socket events on all sessions owned by this reactor, reads and dispatches their messages in order
+ * (using the same sccp_handle_message path as the session thread), runs the keepalive housekeeping once per
+ * SESSION_REACTOR_TICK and cleans up stopped sessions.
+ */
+static void *sccp_session_reactor_thread(void *data)
+{
+	sccp_session_reactor_t *reactor = (sccp_session_reactor_t *) data;
+	struct epoll_event events[SESSION_REACTOR_MAX_EVENTS];
+	time_t lastTick = 0;
+	int nfds = 0;
+	int i = 0;
+
+	while (!reactor->stop) {
+		nfds = epoll_wait(reactor->epfd, events, SESSION_REACTOR_MAX_EVENTS, SESSION_REACTOR_TICK);
+		if (nfds < 0) {
+			if (errno != EINTR) {
+				pbx_log(LOG_ERROR, "SCCP: (sccp_session_reactor_thread) epoll_wait returned error: %s (%d)\n", strerror(errno), errno);
+				usleep(1000);
+			}
+			continue;
+		}
+		for (i = 0; i < nfds; i++) {
+			sccp_session_t *s = (sccp_session_t *) events[i].data.ptr;
+			if (!s) {										/* wake up pipe */
+				char buf[16];
+				while (read(reactor->wakepipe[0], buf, sizeof(buf)) > 0);
+				continue;
+			}
+			if (s->session_stop) {
+				continue;
+			}
+			if (events[i].events & (EPOLLIN | EPOLLPRI)) {
+				if (sccp_session_receive(s, &reactor->msg) == -1) {
+					s->session_stop = TRUE;
+				}
+			} else if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+				pbx_log(LOG_NOTICE, "%s: Closing session because we received EPOLLHUP/EPOLLERR\n", s->designator);
+				__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
+			}
+		}
+
+		time_t now = time(0);
+		if (now != lastTick) {
+			lastTick = now;
+			sccp_session_reactor_tick(reactor, now);
+		}
+		sccp_session_reactor_reap(reactor, FALSE);
+	}
+	sccp_log((DEBUGCAT_SOCKET)) (VERBOSE_PREFIX_3 "SCCP: Exiting sccp_session reactor thread\n");
+	sccp_session_reactor_reap(reactor, TRUE);
+	return NULL;
+}
+
+/*!
+ * \brief Hand a new session over to the least loaded reactor
+ * \param s SCCP Session
+ * \return TRUE on success, FALSE when no reactor could take the session (caller falls back to a session thread)
+ */
+static boolean_t sccp_session_reactor_add(sccp_session_t * s)
+{
+	sccp_session_reactor_t *reactor = NULL;
+	struct epoll_event ev = {0};
+	int i = 0;
+
+	for (i = 0; i < session_reactor_count; i++) {
+		if (!session_reactors[i]->stop && (!reactor || SCCP_LIST_GETSIZE(&session_reactors[i]->sessions) < SCCP_LIST_GETSIZE(&reactor->sessions))) {
+			reactor = session_reactors[i];
+		}
+	}
+	if (!reactor) {
+		return FALSE;
+	}
+
+	SCCP_LIST_LOCK(&reactor->sessions);
+	s->reactor = reactor;
+	s->oncall = FALSE;
+	SCCP_LIST_INSERT_TAIL(&reactor->sessions, s, reactor_list);
+	ev.events = EPOLLIN | EPOLLPRI | EPOLLRDHUP;
+	ev.data.ptr = s;
+	if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, s->fds[0].fd, &ev) < 0) {
+		pbx_log(LOG_ERROR, "SCCP: (sccp_session_reactor_add) epoll_ctl failed: %s\n", strerror(errno));
+		SCCP_LIST_REMOVE(&reactor->sessions, s, reactor_list);
+		s->reactor = NULL;
+		SCCP_LIST_UNLOCK(&reactor->sessions);
+		return FALSE;
+	}
+	SCCP_LIST_UNLOCK(&reactor->sessions);
+	sccp_log((DEBUGCAT_SOCKET)) (VERBOSE_PREFIX_3 "SCCP: Session %d handed to reactor %p (sessions:%d)\n", s->fds[0].fd, reactor, SCCP_LIST_GETSIZE(&reactor->sessions));
+	return TRUE;
+}
+
+static void sccp_session_reactor_destroy(sccp_session_reactor_t * reactor)
+{
+	if (reactor->epfd > -1) {
+		close(reactor->epfd);
+	}
+	if (reactor->wakepipe[0] > -1) {
+		close(reactor->wakepipe[0]);
+		close(reactor->wakepipe[1]);
+	}
+	SCCP_LIST_HEAD_DESTROY(&reactor->sessions);
+	sccp_free(reactor);
+}
+
+static sccp_session_reactor_t *sccp_session_reactor_create(void)
+{
+	sccp_session_reactor_t *reactor = NULL;
+	struct epoll_event ev = {0};
+
+	if (!(reactor = sccp_calloc(sizeof *reactor, 1))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return NULL;
+	}
+	SCCP_LIST_HEAD_INIT(&reactor->sessions);
+	reactor->wakepipe[0] = reactor->wakepipe[1] = -1;
+	if ((reactor->epfd = epoll_create(SESSION_REACTOR_MAX_EVENTS)) < 0 || pipe(reactor->wakepipe) < 0) {
+		pbx_log(LOG_ERROR, "SCCP: (sccp_session_reactor_create) Unable to create epoll fd / wake pipe: %s\n", strerror(errno));
+		sccp_session_reactor_destroy(reactor);
+		return NULL;
+	}
+	fcntl(reactor->wakepipe[0], F_SETFL, fcntl(reactor->wakepipe[0], F_GETFL) | O_NONBLOCK);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->wakepipe[0], &ev) < 0 || pbx_pthread_create(&reactor->thread, NULL, sccp_session_reactor_thread, reactor)) {
+		pbx_log(LOG_ERROR, "SCCP: (sccp_session_reactor_create) Unable to start reactor: %s\n", strerror(errno));
+		sccp_session_reactor_destroy(reactor);
+		return NULL;
+	}
+	return reactor;
+}
+
+/*!
+ * \brief Start GLOB(session_threads) session reactors, if not already running
+ * \note a value of 0 keeps the traditional one thread per session behaviour
+ */
+static void sccp_session_reactors_start(void)
+{
+	int i = 0;
+	int count = GLOB(session_threads);
+
+	if (session_reactors || count <= 0) {
+		return;
+	}
+	if (!(session_reactors = sccp_calloc(sizeof(sccp_session_reactor_t *), count))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		if (!(session_reactors[session_reactor_count] = sccp_session_reactor_create())) {
+			break;
+		}
+		session_reactor_count++;
+	}
+	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "SCCP: Started %d session reactor thread(s)\n", session_reactor_count);
+}
+
+/*!
+ * \brief Stop all session reactors, destroying the sessions they own
+ */
+static void sccp_session_reactors_stop(void)
+{
+	int i = 0;
+
+	if (!session_reactors) {
+		return;
+	}
+	for (i = 0; i < session_reactor_count; i++) {
+		session_reactors[i]->stop = TRUE;
+		if (write(session_reactors[i]->wakepipe[1], "x", 1) < 0) {
+			pbx_log(LOG_NOTICE, "SCCP: (sccp_session_reactors_stop) unable to wake reactor: %s\n", strerror(errno));
+		}
+	}
+	for (i = 0; i < session_reactor_count; i++) {
+		pthread_join(session_reactors[i]->thread, NULL);
+		sccp_session_reactor_destroy(session_reactors[i]);
+		session_reactors[i] = NULL;
+	}
+	sccp_free(session_reactors);
+	session_reactors = NULL;
+	session_reactor_count = 0;
+}
+#endif
+
 static boolean_t sccp_session_new_socket_allowed(struct sockaddr_storage *sin)
 {
 	char addrStr[INET6_ADDRSTRLEN];
@@ -762,6 +1251,170 @@ static boolean_t sccp_session_new_socket_allowed(struct sockaddr_storage *sin)
 	return TRUE;
 }
 
+/*
+ * Registration Admission Control
+ *
+ * A registration (RegisterTokenRequest or RegisterMessage) is admitted when less than GLOB(registration_maxpending)
+ * registrations are in progress, and the token bucket of the subnet the phone connects from has a token left. Buckets are
+ * refilled at GLOB(registration_rate) tokens per second, up to GLOB(registration_burst). Phones which are not admitted are
+ * told to come back after GLOB(registration_backoff) seconds plus a random part, to spread their retries. An admitted
+ * session counts as pending until its device has registered, its registration is rejected (RegisterReject / TokenReject),
+ * or until the session ends. With registration_maxpending and registration_rate at 0 (default) admission control is off.
+ *
+ * Buckets live in a small direct mapped table. A bucket is only taken over by another subnet once it has filled up again,
+ * until then two colliding subnets share one bucket (which only makes the limit stricter).
+ */
+#define SESSION_ADMISSION_BUCKETS 256
+
+enum sccp_session_admission {
+	SESSION_ADMISSION_NONE = 0,
+	SESSION_ADMISSION_PENDING,
+	SESSION_ADMISSION_DONE,
+};
+
+typedef struct {
+	int family;												/*!< 0 = unused */
+	uint32_t subnet[4];											/*!< Masked address */
+	uint32_t tokens;											/*!< Available tokens in 1/1000 */
+	struct timeval refilled;
+} sccp_session_admission_bucket_t;
+
+static struct {
+	sccp_session_admission_bucket_t buckets[SESSION_ADMISSION_BUCKETS];
+	uint32_t pending;
+	uint32_t peak;
+	uint32_t admitted;
+	uint32_t rejected_busy;
+	uint32_t rejected_rate;
+} admission;
+AST_MUTEX_DEFINE_STATIC(admission_lock);
+
+static int sccp_session_admission_subnet(const struct sockaddr_storage *sin, uint32_t subnet[4])
+{
+	struct sockaddr_storage mapped;
+	uint8_t prefix = GLOB(registration_prefix) <= 32 ? GLOB(registration_prefix) : 32;
+
+	memset(subnet, 0, 4 * sizeof(uint32_t));
+	if (sccp_netsock_is_mapped_IPv4(sin) && sccp_netsock_ipv4_mapped(sin, &mapped)) {
+		sin = &mapped;
+	}
+	if (sin->ss_family == AF_INET) {
+		uint32_t addr = ntohl(((const struct sockaddr_in *) sin)->sin_addr.s_addr);
+		subnet[0] = prefix ? addr & (0xFFFFFFFFU << (32 - prefix)) : 0;
+		return AF_INET;
+	}
+	memcpy(subnet, &((const struct sockaddr_in6 *) sin)->sin6_addr, 8);					/* /64 */
+	return AF_INET6;
+}
+
+/* take a token from the bucket of the subnet of sin (admission_lock must be held) */
+static boolean_t sccp_session_admission_takeToken(const struct sockaddr_storage *sin)
+{
+	sccp_session_admission_bucket_t *bucket = NULL;
+	uint32_t subnet[4];
+	uint32_t burst = (GLOB(registration_burst) ? GLOB(registration_burst) : 1) * 1000;
+	struct timeval now = pbx_tvnow();
+	int family = sccp_session_admission_subnet(sin, subnet);
+	int64_t refill = 0;
+
+	bucket = &admission.buckets[(subnet[0] ^ subnet[1] ^ (subnet[0] >> 8) ^ (subnet[1] >> 16)) % SESSION_ADMISSION_BUCKETS];
+	if (bucket->family) {
+		refill = ast_tvdiff_ms(now, bucket->refilled) * GLOB(registration_rate);
+		bucket->tokens = (refill >= burst || bucket->tokens + refill >= burst) ? burst : bucket->tokens + (uint32_t) refill;
+	}
+	if (!bucket->family || (bucket->tokens == burst && (bucket->family != family || memcmp(bucket->subnet, subnet, sizeof(subnet))))) {
+		bucket->family = family;
+		memcpy(bucket->subnet, subnet, sizeof(subnet));
+		bucket->tokens = burst;
+	}
+	bucket->refilled = now;
+	if (bucket->tokens < 1000) {
+		return FALSE;
+	}
+	bucket->tokens -= 1000;
+	return TRUE;
+}
+
+/*!
+ * \brief Admit a registration on this session (see Registration Admission Control)
+ * \param session SCCP Session
+ * \param backoff_time Seconds the phone should wait before retrying (only set when not admitted)
+ * \return TRUE when the registration may continue
+ */
+boolean_t sccp_session_admitRegistration(constSessionPtr session, uint32_t *backoff_time)
+{
+	sccp_session_t * const s = (sccp_session_t * const) session;			/* discard const */
+	boolean_t res = TRUE;
+	const char *reason = NULL;
+
+	if (!s) {
+		return FALSE;
+	}
+	pbx_mutex_lock(&admission_lock);
+	if (s->admission == SESSION_ADMISSION_NONE) {
+		if (GLOB(registration_maxpending) && admission.pending >= GLOB(registration_maxpending)) {
+			admission.rejected_busy++;
+			reason = "too many registrations in progress";
+			res = FALSE;
+		} else if (GLOB(registration_rate) && !sccp_session_admission_takeToken(&s->sin)) {
+			admission.rejected_rate++;
+			reason = "subnet registration rate exceeded";
+			res = FALSE;
+		} else {
+			s->admission = SESSION_ADMISSION_PENDING;
+			admission.admitted++;
+			if (++admission.pending > admission.peak) {
+				admission.peak = admission.pending;
+			}
+		}
+	}
+	pbx_mutex_unlock(&admission_lock);
+
+	if (!res) {
+		*backoff_time = GLOB(registration_backoff) + sccp_random() % (GLOB(registration_backoff) + 1);
+		sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "%s: Registration not admitted (%s), come back in %d seconds\n", sccp_netsock_stringify_addr(&s->sin), reason, *backoff_time);
+	}
+	return res;
+}
+
+/*!
+ * \brief The registration on this session has finished (or the session ends), it no longer counts as pending
+ * \param session SCCP Session
+ */
+void sccp_session_admissionDone(constSessionPtr session)
+{
+	sccp_session_t * const s = (sccp_session_t * const) session;			/* discard const */
+
+	if (!s) {
+		return;
+	}
+	pbx_mutex_lock(&admission_lock);
+	if (s->admission == SESSION_ADMISSION_PENDING) {
+		admission.pending--;
+		s->admission = SESSION_ADMISSION_DONE;
+	}
+	pbx_mutex_unlock(&admission_lock);
+}
+
+/*!
+ * \brief The admitted registration on this session has been rejected, give up its pending slot
+ * \param s SCCP Session
+ *
+ * \note unlike sccp_session_admissionDone, a new attempt on the same session has to be admitted again
+ */
+static void sccp_session_admissionCancel(sccp_session_t * s)
+{
+	if (!s) {
+		return;
+	}
+	pbx_mutex_lock(&admission_lock);
+	if (s->admission == SESSION_ADMISSION_PENDING) {
+		admission.pending--;
+		s->admission = SESSION_ADMISSION_NONE;
+	}
+	pbx_mutex_unlock(&admission_lock);
+}
+
 static sccp_session_t * sccp_create_session(int new_socket)
 {
 	sccp_session_t *s;
@@ -772,12 +1425,15 @@ static sccp_session_t * sccp_create_session(int new_socket)
 	}
 
 	sccp_mutex_init(&s->lock);
+	sccp_mutex_init(&s->write_lock);
+	sccp_mutex_init(&s->sendqueue_lock);
 
 	s->fds[0].events = POLLIN | POLLPRI;
 	s->fds[0].revents = 0;
 	s->fds[0].fd = new_socket;
 	s->protocolType = SCCP_PROTOCOL;
 	s->lastKeepAlive = time(0);
+	s->refcount = 1;											/* owner reference, dropped by destroy_session */
 	
 	return s;
 } 
@@ -800,7 +1456,7 @@ static void sccp_session_set_ourip(sccp_session_t *s)
  * - checks if the incoming ip-address is within the global deny/permit range
  * - creates a new session struct
  * - adds the new session struct to the global sessions list
- * - starts a new sccp_session_device_thread
+ * - hands the session to one of the session reactors, or starts a new sccp_session_device_thread when no reactors are running
  */
 static void *accept_thread(void *ignore)
 {
@@ -831,6 +1487,11 @@ static void *accept_thread(void *ignore)
 		sccp_session_addToGlobals(s);
 		recalc_wait_time(s);
 		
+#ifdef CS_SESSION_REACTOR
+		if (sccp_session_reactor_add(s)) {
+			continue;
+		}
+#endif
 		if (pbx_pthread_create(&s->session_thread, NULL, sccp_session_device_thread, s)) {
 			destroy_session(s, 0);
 		}
@@ -937,6 +1598,9 @@ boolean_t sccp_session_bind_and_listen(struct sockaddr_storage *bindaddr)
 				accept_sock = -1;
 				break;
 			}
+#ifdef CS_SESSION_REACTOR
+			sccp_session_reactors_start();
+#endif
 			sccp_session_start_accept_thread();
 		} while(0);
 		freeaddrinfo(res);
@@ -974,7 +1638,7 @@ void sccp_session_sendmsg(const sccp_device_t * device, sccp_mid_t t)
  * \brief Socket Send
  * \param device SCCP Device
  * \param msg_in Message Data Structure (sccp_msg_t)
- * \return SCCP Session Send
+ * \return Number of bytes queued for sending, -1 on error (see sccp_session_send2)
  */
 int sccp_session_send(constDevicePtr device, const sccp_msg_t * msg_in)
 {
@@ -985,28 +1649,192 @@ int sccp_session_send(constDevicePtr device, const sccp_msg_t * msg_in)
 	if (s && !s->session_stop) {
 		return sccp_session_send2(s, msg);
 	} 
+	sccp_free_packet(msg);
 	return -1;
 }
 
+/*!
+ * \brief Write all messages currently waiting in the session sendqueue using as few sendmsg calls as possible
+ * \param s SCCP Session
+ * \return Number of bytes written, -1 on error (session has been stopped)
+ *
+ * \note A socket which stays full for WRITE_RETRIES backoffs belongs to a phone that stopped reading, its session is failed
+ * instead of blocking the writing thread (which might be a reactor serving other sessions) any longer.
+ *
+ * \lock
+ *      - session->write_lock (must be held by caller)
+ *      - session->sendqueue_lock
+ */
+static int __sccp_session_flush(sccp_session_t * s)
+{
+	sccp_msg_t *batch[SESSION_SENDQUEUE_SIZE];
+	struct iovec iov[SESSION_SENDQUEUE_SIZE];
+	struct msghdr mh = {0};
+	ssize_t bytesSent = 0;
+	ssize_t bufLen = 0;
+	ssize_t res = 0;
+	int backoff = WRITE_BACKOFF;
+	int retries = 0;
+	int flags = 0;
+	int count = 0;
+	int i = 0;
+
+	pbx_mutex_lock(&s->sendqueue_lock);
+	count = s->sendqueue_len;
+	memcpy(batch, s->sendqueue, count * sizeof(sccp_msg_t *));
+	s->sendqueue_len = 0;
+#ifdef MSG_MORE
+	if (s->cork) {
+		flags |= MSG_MORE;										/* flushing a full queue while corked, more is on its way */
+	}
+#endif
+	pbx_mutex_unlock(&s->sendqueue_lock);
+
+	if (!count) {
+		return 0;
+	}
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = batch[i];
+		iov[i].iov_len = letohl(batch[i]->header.length) + 8;
+		bufLen += iov[i].iov_len;
+	}
+	mh.msg_iov = iov;
+	mh.msg_iovlen = count;
+
+	while (bytesSent < bufLen && s->fds[0].fd > 0) {
+		res = sendmsg(s->fds[0].fd, &mh, flags);
+		if (res <= 0) {
+			if ((errno == EINTR || errno == EAGAIN) && retries++ < WRITE_RETRIES) {
+				struct pollfd pfd = { .fd = s->fds[0].fd, .events = POLLOUT };
+				sccp_netsock_poll(&pfd, 1, backoff);						/* wait for room in the socket buffer, at most backoff millisecs */
+				backoff *= 2;
+				continue;
+			}
+			socket_get_error(s, __FILE__, __LINE__, __PRETTY_FUNCTION__, errno);
+			__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
+			break;
+		}
+		s->tx_syscalls++;
+		bytesSent += res;
+		while (mh.msg_iovlen > 0 && (size_t) res >= mh.msg_iov->iov_len) {				/* skip fully written messages */
+			res -= mh.msg_iov->iov_len;
+			mh.msg_iov++;
+			mh.msg_iovlen--;
+		}
+		if (res > 0) {											/* partial write, continue where we left off */
+			mh.msg_iov->iov_base = (uint8_t *) mh.msg_iov->iov_base + res;
+			mh.msg_iov->iov_len -= res;
+		}
+	}
+	s->tx_messages += count - mh.msg_iovlen;
+
+	for (i = 0; i < count; i++) {
+		sccp_free_packet(batch[i]);
+	}
+
+	if (bytesSent < bufLen) {
+		pbx_log(LOG_ERROR, "%s: Could only send %d of %d bytes!\n", DEV_ID_LOG(s->device), (int) bytesSent, (int) bufLen);
+		return -1;
+	}
+	return bytesSent;
+}
+
+/*!
+ * \brief Flush the session sendqueue
+ * \param s SCCP Session
+ * \param wait Wait for a concurrent flush to finish, instead of leaving our messages to it
+ * \return Number of bytes written by this thread, -1 on error
+ *
+ * \note When another thread is already writing, that thread will pick up our messages before it lets go of the write_lock,
+ * so callers never block behind each other just to append a message.
+ */
+static int sccp_session_flush(sccp_session_t * s, boolean_t wait)
+{
+	int res = 0;
+	int written = 0;
+	boolean_t pending = FALSE;
+
+	do {
+		if (wait) {
+			pbx_mutex_lock(&s->write_lock);
+		} else if (pbx_mutex_trylock(&s->write_lock)) {
+			break;											/* current writer will re-check the queue after unlocking */
+		}
+		res = __sccp_session_flush(s);
+		pbx_mutex_unlock(&s->write_lock);
+		if (res < 0) {
+			return -1;
+		}
+		written += res;
+		wait = FALSE;
+
+		pbx_mutex_lock(&s->sendqueue_lock);
+		pending = (s->sendqueue_len > 0 && !s->cork) ? TRUE : FALSE;
+		pbx_mutex_unlock(&s->sendqueue_lock);
+	} while (pending && !s->session_stop);
+	return written;
+}
+
+/*!
+ * \brief Hold back outbound messages for this session until the matching sccp_session_uncork
+ * \param session SCCP Session
+ *
+ * \note Used around bursts of messages to the same device, so they can be written in a single system call.
+ * Calls can be nested, a full sendqueue is always written immediately.
+ */
+void sccp_session_cork(constSessionPtr session)
+{
+	sccp_session_t * const s = (sessionPtr) session;							/* discard const */
+	if (s) {
+		pbx_mutex_lock(&s->sendqueue_lock);
+		s->cork++;
+		pbx_mutex_unlock(&s->sendqueue_lock);
+	}
+}
+
+/*!
+ * \brief Release a sccp_session_cork, flushing the sendqueue when the session becomes idle
+ * \param session SCCP Session
+ */
+void sccp_session_uncork(constSessionPtr session)
+{
+	sccp_session_t * const s = (sessionPtr) session;							/* discard const */
+	boolean_t flush = FALSE;
+	if (s) {
+		pbx_mutex_lock(&s->sendqueue_lock);
+		if (s->cork > 0) {
+			s->cork--;
+		}
+		flush = (!s->cork && s->sendqueue_len > 0) ? TRUE : FALSE;
+		pbx_mutex_unlock(&s->sendqueue_lock);
+		if (flush && s->fds[0].fd > 0) {								/* also when stopping, a handler might have queued a last reply (UnregisterAck) */
+			sccp_session_flush(s, FALSE);
+		}
+	}
+}
+
 /*!
  * \brief Socket Send Message
  * \param session Session SCCP Session (can't be null)
  * \param msg Message Data Structure (sccp_msg_t) (Will be freed automatically at the end)
- * \return Result as Int
+ * \return Number of bytes queued for sending, -1 on error
+ *
+ * \note The message is appended to the session sendqueue, which is written immediately unless the session has been corked.
+ * A positive result therefore only means the message was accepted, a write error on a corked session surfaces later on
+ * (as a stopped session), not as the return value of this call.
  *
  * \lock
- *      - session
+ *      - session->sendqueue_lock
  */
 int sccp_session_send2(constSessionPtr session, sccp_msg_t * msg)
 {
 	sccp_session_t * const s = (sessionPtr) session;								/* discard const */
-	ssize_t res = 0;
 	uint32_t msgid = letohl(msg->header.lel_messageId);
-	ssize_t bytesSent;
-	ssize_t bufLen;
-	uint8_t *bufAddr;
+	int bufLen = letohl(msg->header.length) + 8;
+	boolean_t corked = FALSE;
 
 	if (s && s->session_stop) {
+		sccp_free_packet(msg);
 		return -1;
 	}
 
@@ -1015,11 +1843,10 @@ int sccp_session_send2(constSessionPtr session, sccp_msg_t * msg)
 		if (s) {
 			__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
 		}
-		sccp_free(msg);
+		sccp_free_packet(msg);
 		msg = NULL;
 		return -1;
 	}
-	int mysocket = s->fds[0].fd;
 
 	if (msgid == KeepAliveAckMessage || msgid == RegisterAckMessage || msgid == UnregisterAckMessage) {
 		msg->header.lel_protocolVer = 0;
@@ -1029,46 +1856,31 @@ int sccp_session_send2(constSessionPtr session, sccp_msg_t * msg)
 		msg->header.lel_protocolVer = 0;
 	}
 
-	if (msg && (GLOB(debug) & DEBUGCAT_MESSAGE) != 0) {
+	if (msg && sccp_debug_enabled(DEBUGCAT_MESSAGE)) {
 		uint32_t mid = letohl(msg->header.lel_messageId);
 
 		pbx_log(LOG_NOTICE, "%s: Send Message: %s(0x%04X) %d bytes length\n", DEV_ID_LOG(s->device), msgtype2str(mid), mid, msg->header.length);
 		sccp_dump_msg(msg);
 	}
 
-	uint backoff = WRITE_BACKOFF;
-	bytesSent = 0;
-	bufAddr = ((uint8_t *) msg);
-	bufLen = (ssize_t) (letohl(msg->header.length) + 8);
-	do {
-		pbx_mutex_lock(&s->write_lock);									/* prevent two threads writing at the same time. That should happen in a synchronized way */
-		res = send(mysocket, bufAddr + bytesSent, bufLen - bytesSent, 0);
-		pbx_mutex_unlock(&s->write_lock);
-		if (res <= 0) {
-			if (errno == EINTR) {
-				usleep(backoff);								/* back off to give network/other threads some time */
-				backoff *= 2;
-				continue;
-			}
-			socket_get_error(s, __FILE__, __LINE__, __PRETTY_FUNCTION__, errno);
-			if (s) {
-				__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
-			}
-			res = -1;
-			break;
+	pbx_mutex_lock(&s->sendqueue_lock);
+	while (s->sendqueue_len >= SESSION_SENDQUEUE_SIZE) {							/* queue full, write it out first */
+		pbx_mutex_unlock(&s->sendqueue_lock);
+		if (sccp_session_flush(s, TRUE) < 0 || s->session_stop) {
+			sccp_free_packet(msg);
+			return -1;
 		}
-		bytesSent += res;
-	} while (bytesSent < bufLen && s && !s->session_stop && mysocket > 0);
-
-	sccp_free(msg);
+		pbx_mutex_lock(&s->sendqueue_lock);
+	}
+	s->sendqueue[s->sendqueue_len++] = msg;
+	corked = s->cork ? TRUE : FALSE;
+	pbx_mutex_unlock(&s->sendqueue_lock);
 	msg = NULL;
 
-	if (bytesSent < bufLen) {
-		pbx_log(LOG_ERROR, "%s: Could only send %d of %d bytes!\n", DEV_ID_LOG(s->device), (int) bytesSent, (int) bufLen);
-		res = -1;
+	if (!corked && sccp_session_flush(s, FALSE) < 0) {
+		return -1;
 	}
-
-	return res;
+	return bufLen;
 }
 
 /*!
@@ -1081,6 +1893,7 @@ sccp_session_t *sccp_session_reject(constSessionPtr session, char *message)
 	sccp_msg_t *msg = NULL;
 	sccp_session_t * const s = (sccp_session_t * const) session;			/* discard const */
 
+	sccp_session_admissionCancel(s);
 	REQ(msg, RegisterRejectMessage);
 	sccp_copy_string(msg->data.RegisterRejectMessage.text, message, sizeof(msg->data.RegisterRejectMessage.text));
 	sccp_session_send2(s, msg);
@@ -1098,9 +1911,9 @@ void sccp_session_crossdevice_cleanup(constSessionPtr current_session, sessionPt
 	if (!current_session || !previous_session) {
 		return;
 	}
-	if (current_session != previous_session && previous_session->session_thread) {
+	if (current_session != previous_session && (previous_session->session_thread || previous_session->reactor)) {
 		sccp_log(DEBUGCAT_CORE) (VERBOSE_PREFIX_2 "%s: Previous session %p needs to be cleaned up and killed!\n", current_session->designator, previous_session->designator);
-		__sccp_netsock_end_device_thread(previous_session);
+		sccp_session_stopthread(previous_session, SKINNY_DEVICE_RS_NONE);
 	}
 	return;
 }
@@ -1123,6 +1936,7 @@ void sccp_session_tokenReject(constSessionPtr session, uint32_t backoff_time)
 {
 	sccp_msg_t *msg = NULL;
 
+	sccp_session_admissionCancel((sccp_session_t *) session);						/* discard const */
 	REQ(msg, RegisterTokenReject);
 	msg->data.RegisterTokenReject.lel_tokenRejWaitTime = htolel(backoff_time);
 	sccp_session_send2(session, msg);
@@ -1149,6 +1963,7 @@ void sccp_session_tokenRejectSPCP(constSessionPtr session, uint32_t features)
 {
 	sccp_msg_t *msg = NULL;
 
+	sccp_session_admissionCancel((sccp_session_t *) session);						/* discard const */
 	REQ(msg, SPCPRegisterTokenReject);
 	msg->data.SPCPRegisterTokenReject.lel_features = htolel(features);
 	sccp_session_send2(session, msg);
@@ -1290,7 +2105,10 @@ int sccp_cli_show_sessions(int fd, sccp_cli_totals_t *totals, struct mansession
 		CLI_AMI_TABLE_FIELD(State,		"-14.14",	s,	14,	(d) ? sccp_devicestate2str(sccp_device_getDeviceState(d)) : "--")		\
 		CLI_AMI_TABLE_FIELD(Type,		"-15.15",	s,	15,	(d) ? skinny_devicetype2str(d->skinny_type) : "--")	\
 		CLI_AMI_TABLE_FIELD(RegState,		"-10.10",	s,	10,	(d) ? skinny_registrationstate2str(sccp_device_getRegistrationState(d)) : "--")	\
-		CLI_AMI_TABLE_FIELD(Token,		"-10.10",	s,	10,	d ? sccp_tokenstate2str(d->status.token) : "--")
+		CLI_AMI_TABLE_FIELD(Token,		"-10.10",	s,	10,	d ? sccp_tokenstate2str(d->status.token) : "--")			\
+		CLI_AMI_TABLE_FIELD(TxMsgs,		"-8",		u,	8,	session->tx_messages)					\
+		CLI_AMI_TABLE_FIELD(TxCalls,		"-8",		u,	8,	session->tx_syscalls)					\
+		CLI_AMI_TABLE_FIELD(MsgPerCall,		"-10.2",	f,	10,	session->tx_syscalls ? (double) session->tx_messages / session->tx_syscalls : 0.0)
 #include "sccp_cli_table.h"
 
 	if (s) {
@@ -1300,4 +2118,108 @@ int sccp_cli_show_sessions(int fd, sccp_cli_totals_t *totals, struct mansession
 	return RESULT_SUCCESS;
 }
 
+/*!
+ * \brief Show Registration Admission Control Statistics
+ */
+int sccp_cli_show_admission(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[])
+{
+	int local_line_total = 0;
+	int once = 0;
+
+	pbx_mutex_lock(&admission_lock);
+#define CLI_AMI_TABLE_NAME Admission
+#define CLI_AMI_TABLE_PER_ENTRY_NAME Registrations
+#define CLI_AMI_TABLE_ITERATOR for(once=0;once<1;once++)
+#define CLI_AMI_TABLE_FIELDS 												\
+	CLI_AMI_TABLE_FIELD(Pending,		"-7.7",		u,	7,	admission.pending)			\
+	CLI_AMI_TABLE_FIELD(MaxPending,		"-10.10",	d,	10,	GLOB(registration_maxpending))		\
+	CLI_AMI_TABLE_FIELD(Peak,		"-6.6",		u,	6,	admission.peak)				\
+	CLI_AMI_TABLE_FIELD(Admitted,		"-10.10",	u,	10,	admission.admitted)			\
+	CLI_AMI_TABLE_FIELD(RejBusy,		"-8.8",		u,	8,	admission.rejected_busy)		\
+	CLI_AMI_TABLE_FIELD(RejRate,		"-8.8",		u,	8,	admission.rejected_rate)		\
+	CLI_AMI_TABLE_FIELD(Rate,		"-5.5",		d,	5,	GLOB(registration_rate))		\
+	CLI_AMI_TABLE_FIELD(Burst,		"-5.5",		d,	5,	GLOB(registration_burst))
+#include "sccp_cli_table.h"
+	local_line_total++;
+	pbx_mutex_unlock(&admission_lock);
+
+	if (s) {
+		totals->lines = local_line_total;
+		totals->tables = 1;
+	}
+	return RESULT_SUCCESS;
+}
+
+#if CS_TEST_FRAMEWORK
+#include <asterisk/test.h>
+
+AST_TEST_DEFINE(sccp_session_stopflush_tests)
+{
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "stopflush";
+			info->category = "/channels/chan_sccp/session/";
+			info->summary = "chan-sccp-b session flush on stop";
+			info->description = "chan-sccp-b writes a message queued on a corked session, after the session has been stopped";
+			return AST_TEST_NOT_RUN;
+	        case TEST_EXECUTE:
+	        	break;
+	}
+	sccp_session_t *s = NULL;
+	sccp_msg_t *msg = NULL;
+	sccp_msg_t reply = { {0,} };
+	int sv[2] = {-1, -1};
+	ssize_t len = 0;
+	enum ast_test_result_state res = AST_TEST_PASS;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 || !(s = sccp_create_session(sv[0]))) {
+		pbx_test_status_update(test, "Could not create session\n");
+		res = AST_TEST_FAIL;
+		goto EXIT;
+	}
+	s->session_thread = pthread_self();									/* pretend to be running, stopthread will shutdown the read side */
+	sccp_copy_string(s->designator, "stopflush", sizeof(s->designator));
+
+	pbx_test_status_update(test, "Queueing an UnregisterAck while corked, then stopping the session...\n");
+	sccp_session_cork(s);
+	REQ(msg, UnregisterAckMessage);
+	if (sccp_session_send2(s, msg) < 0) {
+		pbx_test_status_update(test, "Could not queue message\n");
+		res = AST_TEST_FAIL;
+	}
+	if (recv(sv[1], &reply, sizeof(reply), MSG_DONTWAIT) > 0) {
+		pbx_test_status_update(test, "Message was written while the session was corked\n");
+		res = AST_TEST_FAIL;
+	}
+	__sccp_session_stopthread(s, SKINNY_DEVICE_RS_NONE);
+	sccp_session_uncork(s);
+
+	len = recv(sv[1], &reply, sizeof(reply), MSG_DONTWAIT);
+	if (len < (ssize_t) SCCP_PACKET_HEADER || letohl(reply.header.lel_messageId) != UnregisterAckMessage) {
+		pbx_test_status_update(test, "Queued message was not written after stopping the session (%d bytes)\n", (int) len);
+		res = AST_TEST_FAIL;
+	}
+
+EXIT:
+	if (s) {
+		sccp_session_release(&s);
+	}
+	if (sv[0] > -1) {
+		close(sv[0]);
+		close(sv[1]);
+	}
+	return res;
+}
+
+static void __attribute__((constructor)) sccp_register_tests(void)
+{
+        AST_TEST_REGISTER(sccp_session_stopflush_tests);
+}
+
+static void __attribute__((destructor)) sccp_unregister_tests(void)
+{
+        AST_TEST_UNREGISTER(sccp_session_stopflush_tests);
+}
+#endif
+
 // kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -18,6 +18,10 @@ SCCP_API const char *const SCCP_CALL sccp_session_getDesignator(constSessionPtr
 SCCP_API void SCCP_CALL sccp_session_sendmsg(constDevicePtr device, sccp_mid_t t);
 SCCP_API int SCCP_CALL sccp_session_send(constDevicePtr device, const sccp_msg_t * msg_in);
 SCCP_API int SCCP_CALL sccp_session_send2(constSessionPtr session, sccp_msg_t * msg);
+SCCP_API void SCCP_CALL sccp_session_cork(constSessionPtr session);
+SCCP_API void SCCP_CALL sccp_session_uncork(constSessionPtr session);
+SCCP_API sccp_session_t * SCCP_CALL sccp_session_retainByDevice(constDevicePtr device);
+SCCP_API void SCCP_CALL sccp_session_release(sccp_session_t ** sessionRef);
 SCCP_API int SCCP_CALL sccp_session_retainDevice(constSessionPtr session, constDevicePtr device);
 SCCP_API void SCCP_CALL sccp_session_releaseDevice(constSessionPtr volatile session);
 SCCP_API sccp_session_t * SCCP_CALL sccp_session_reject(constSessionPtr session, char *message);
@@ -25,6 +29,8 @@ SCCP_API void SCCP_CALL sccp_session_tokenReject(constSessionPtr session, uint32
 SCCP_API void SCCP_CALL sccp_session_tokenAck(constSessionPtr session);
 SCCP_API void SCCP_CALL sccp_session_tokenRejectSPCP(constSessionPtr session, uint32_t features);
 SCCP_API void SCCP_CALL sccp_session_tokenAckSPCP(constSessionPtr session, uint32_t features);
+SCCP_API boolean_t SCCP_CALL sccp_session_admitRegistration(constSessionPtr session, uint32_t *backoff_time);
+SCCP_API void SCCP_CALL sccp_session_admissionDone(constSessionPtr session);
 SCCP_INLINE void sccp_session_stopthread(constSessionPtr session, uint8_t newRegistrationState);
 SCCP_API void SCCP_CALL sccp_session_setProtocol(constSessionPtr session, uint16_t protocolType);
 SCCP_API uint16_t SCCP_CALL sccp_session_getProtocol(constSessionPtr session);
@@ -37,6 +43,7 @@ SCCP_API boolean_t SCCP_CALL sccp_session_check_crossdevice(constSessionPtr sess
 SCCP_API sccp_device_t * const SCCP_CALL sccp_session_getDevice(constSessionPtr session, boolean_t required);
 SCCP_API boolean_t SCCP_CALL sccp_session_isValid(constSessionPtr session);
 SCCP_API int SCCP_CALL sccp_cli_show_sessions(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[]);
+SCCP_API int SCCP_CALL sccp_cli_show_admission(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[]);
 
 SCCP_API boolean_t SCCP_CALL sccp_session_bind_and_listen(struct sockaddr_storage *bindaddr);
 SCCP_API void SCCP_CALL sccp_session_stop_accept_thread(void);
@@ -15,6 +15,8 @@
 
 SCCP_FILE_VERSION(__FILE__, "");
 #include "sccp_threadpool.h"
+#include "sccp_atomic.h"
+#include <asterisk/cli.h>
 #include <signal.h>
 #undef pthread_create
 #if defined(__GNUC__) && __GNUC__ > 3 && defined(HAVE_SYS_INFO_H)
@@ -22,24 +24,81 @@ SCCP_FILE_VERSION(__FILE__, "");
 #endif
 //#define SEMAPHORE_LOCKED	(0)
 //#define SEMAPHORE_UNLOCKED	(1)
+
+/*
+ * Job queues are bounded rings of preallocated cells (Dmitry Vyukov's bounded mpmc queue). Producers and consumers
+ * claim a position with a single compare-and-swap and hand the cell over using its sequence number, so adding work
+ * does not take a lock or allocate memory. Without compiler builtins we fall back to a per-queue mutex around the
+ * same ring.
+ */
+#if defined(SCCP_BUILTIN_CAS32) && defined(SCCP_BUILTIN_INCR)
+#define THREADPOOL_LOCKFREE 1
+#define THREADPOOL_QUEUE_LOCK(_q)
+#define THREADPOOL_QUEUE_UNLOCK(_q)
+#define THREADPOOL_CAS(_ptr, _old, _new) (CAS32(_ptr, _old, _new, NULL) == (_old))
+#define THREADPOOL_BARRIER() __sync_synchronize()
+#else
+#define THREADPOOL_QUEUE_LOCK(_q) pbx_mutex_lock(&(_q)->lock)
+#define THREADPOOL_QUEUE_UNLOCK(_q) pbx_mutex_unlock(&(_q)->lock)
+#define THREADPOOL_CAS(_ptr, _old, _new) (*(_ptr) == (_old) ? (*(_ptr) = (_new), 1) : 0)
+#define THREADPOOL_BARRIER()
+#endif
+
 void sccp_threadpool_grow(sccp_threadpool_t * tp_p, int amount);
 void sccp_threadpool_shrink(sccp_threadpool_t * tp_p, int amount);
 
 typedef struct sccp_threadpool_thread sccp_threadpool_thread_t;
+typedef struct sccp_threadpool_queue sccp_threadpool_queue_t;
+
+/* Per worker statistics, only written by the owning thread */
+typedef struct sccp_threadpool_stats {
+	unsigned long executed;											/*!< Number of jobs executed */
+	unsigned long stolen;											/*!< Number of jobs taken from another worker's queue */
+	uint64_t wait_total;											/*!< Accumulated time jobs spent queued (usec) */
+	uint64_t wait_max;											/*!< Longest time a job spent queued (usec) */
+} sccp_threadpool_stats_t;
 
 struct sccp_threadpool_thread {
 	pthread_t thread;
 	sccp_threadpool_t *tp_p;
+	sccp_threadpool_queue_t *queue;										/*!< Local queue owned by this worker (or NULL) */
+	sccp_threadpool_stats_t stats;
 	SCCP_LIST_ENTRY (sccp_threadpool_thread_t) list;
 	boolean_t die;
 };
 
+/* Ring cell */
+typedef struct sccp_threadpool_cell {
+	volatile unsigned int sequence;
+	sccp_threadpool_job_t job;
+} sccp_threadpool_cell_t;
+
+/* Bounded multi producer / multi consumer job queue */
+struct sccp_threadpool_queue {
+	volatile unsigned int enqueue_pos;									/*!< Next position to be written (also total number of jobs enqueued) */
+	volatile unsigned int dequeue_pos;									/*!< Next position to be read */
+	unsigned int mask;											/*!< Number of cells - 1 (size is a power of two) */
+	unsigned int high_water_mark;										/*!< Highest depth seen */
+	sccp_threadpool_thread_t *owner;									/*!< Worker owning this (local) queue */
+	sccp_threadpool_cell_t *cells;
+#ifndef THREADPOOL_LOCKFREE
+	pbx_mutex_t lock;
+#endif
+};
+
 /* The threadpool */
 struct sccp_threadpool {
-	SCCP_LIST_HEAD (, sccp_threadpool_job_t) jobs;
+	sccp_threadpool_queue_t queue;										/*!< Shared job queue */
+	sccp_threadpool_queue_t local[THREADPOOL_MAX_SIZE];							/*!< Per worker job queues */
+	SCCP_LIST_HEAD (, sccp_threadpool_job_t) overflow;							/*!< Allocated jobs, only used when all queues are full */
 	SCCP_LIST_HEAD (, sccp_threadpool_thread_t) threads;
+	pbx_mutex_t lock;											/*!< Protects idle / work condition */
 	pbx_cond_t work;
 	pbx_cond_t exit;
+	volatile int idle;											/*!< Number of workers waiting for work */
+	volatile int next_queue;										/*!< Round robin position for new work */
+	unsigned int overflowed;										/*!< Number of jobs which had to go to the overflow list */
+	sccp_threadpool_stats_t retired;									/*!< Statistics of workers which have exited */
 	time_t last_size_check;											/*!< Time since last size check */
 	time_t last_resize;											/*!< Time since last resize */
 	int job_high_water_mark;										/*!< Highest number of jobs outstanding since last resize check */
@@ -57,11 +116,122 @@ struct sccp_threadpool {
  * xN                   = x can be any string. N stands for amount
  * */
 
+/* =================== RING QUEUE OPERATIONS ===================== */
+
+/* size needs to be a power of two */
+static boolean_t sccp_threadpool_queue_init(sccp_threadpool_queue_t * queue, unsigned int size)
+{
+	unsigned int i;
+
+	if (!(queue->cells = sccp_calloc(sizeof *queue->cells, size))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return FALSE;
+	}
+	for (i = 0; i < size; i++) {
+		queue->cells[i].sequence = i;
+	}
+	queue->mask = size - 1;
+	queue->enqueue_pos = 0;
+	queue->dequeue_pos = 0;
+	queue->high_water_mark = 0;
+	queue->owner = NULL;
+#ifndef THREADPOOL_LOCKFREE
+	pbx_mutex_init(&queue->lock);
+#endif
+	return TRUE;
+}
+
+static void sccp_threadpool_queue_destroy(sccp_threadpool_queue_t * queue)
+{
+	if (queue->cells) {
+		sccp_free(queue->cells);
+		queue->cells = NULL;
+#ifndef THREADPOOL_LOCKFREE
+		pbx_mutex_destroy(&queue->lock);
+#endif
+	}
+}
+
+static unsigned int sccp_threadpool_queue_depth(const sccp_threadpool_queue_t * queue)
+{
+	unsigned int dequeue_pos = queue->dequeue_pos;								/* read dequeue first, so depth can never go negative */
+
+	return queue->enqueue_pos - dequeue_pos;
+}
+
+/* returns FALSE when the queue is full */
+static boolean_t sccp_threadpool_queue_push(sccp_threadpool_queue_t * queue, const sccp_threadpool_job_t * job)
+{
+	sccp_threadpool_cell_t *cell;
+	unsigned int pos, depth;
+	int diff;
+
+	THREADPOOL_QUEUE_LOCK(queue);
+	pos = queue->enqueue_pos;
+	while (1) {
+		cell = &queue->cells[pos & queue->mask];
+		diff = (int) cell->sequence - (int) pos;
+		if (diff == 0) {
+			if (THREADPOOL_CAS(&queue->enqueue_pos, pos, pos + 1)) {
+				break;
+			}
+		} else if (diff < 0) {
+			THREADPOOL_QUEUE_UNLOCK(queue);
+			return FALSE;
+		}
+		pos = queue->enqueue_pos;
+	}
+	cell->job.function = job->function;
+	cell->job.arg = job->arg;
+	cell->job.queued = job->queued;
+	THREADPOOL_BARRIER();
+	cell->sequence = pos + 1;										/* publish */
+	THREADPOOL_QUEUE_UNLOCK(queue);
+
+	depth = sccp_threadpool_queue_depth(queue);
+	if (depth > queue->high_water_mark) {
+		queue->high_water_mark = depth;									/* statistics only, races are harmless */
+	}
+	return TRUE;
+}
+
+/* returns FALSE when the queue is empty */
+static boolean_t sccp_threadpool_queue_pop(sccp_threadpool_queue_t * queue, sccp_threadpool_job_t * job)
+{
+	sccp_threadpool_cell_t *cell;
+	unsigned int pos;
+	int diff;
+
+	THREADPOOL_QUEUE_LOCK(queue);
+	pos = queue->dequeue_pos;
+	while (1) {
+		cell = &queue->cells[pos & queue->mask];
+		diff = (int) cell->sequence - (int) (pos + 1);
+		if (diff == 0) {
+			if (THREADPOOL_CAS(&queue->dequeue_pos, pos, pos + 1)) {
+				break;
+			}
+		} else if (diff < 0) {
+			THREADPOOL_QUEUE_UNLOCK(queue);
+			return FALSE;
+		}
+		pos = queue->dequeue_pos;
+	}
+	job->function = cell->job.function;
+	job->arg = cell->job.arg;
+	job->queued = cell->job.queued;
+	THREADPOOL_BARRIER();
+	cell->sequence = pos + queue->mask + 1;									/* hand cell back to producers */
+	THREADPOOL_QUEUE_UNLOCK(queue);
+	return TRUE;
+}
+
 /* Initialise thread pool */
 sccp_threadpool_t *sccp_threadpool_init(int threadsN)
 {
 	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "Starting Threadpool\n");
 	sccp_threadpool_t *tp_p;
+	int q;
 
 #if defined(__GNUC__) && __GNUC__ > 3 && defined(HAVE_SYS_INFO_H)
 	threadsN = get_nprocs_conf();										// get current number of active processors
@@ -78,17 +248,33 @@ sccp_threadpool_t *sccp_threadpool_init(int threadsN)
 		return NULL;
 	}
 
+	/* Initialise the job queues */
+	if (!sccp_threadpool_queue_init(&tp_p->queue, THREADPOOL_QUEUE_SIZE)) {
+		sccp_free(tp_p);
+		return NULL;
+	}
+	for (q = 0; q < THREADPOOL_MAX_SIZE; q++) {
+		if (!sccp_threadpool_queue_init(&tp_p->local[q], THREADPOOL_LOCAL_QUEUE_SIZE)) {
+			while (q-- > 0) {
+				sccp_threadpool_queue_destroy(&tp_p->local[q]);
+			}
+			sccp_threadpool_queue_destroy(&tp_p->queue);
+			sccp_free(tp_p);
+			return NULL;
+		}
+	}
+	SCCP_LIST_HEAD_INIT(&tp_p->overflow);
+
 	/* initialize the thread pool */
 	SCCP_LIST_HEAD_INIT(&tp_p->threads);
 
-	/* Initialise the job queue */
-	SCCP_LIST_HEAD_INIT(&tp_p->jobs);
 	tp_p->last_size_check = time(0);
 	tp_p->job_high_water_mark = 0;
 	tp_p->last_resize = time(0);
 	tp_p->sccp_threadpool_shuttingdown = 0;
 
 	/* Initialise Condition */
+	pbx_mutex_init(&tp_p->lock);
 	pbx_cond_init(&(tp_p->work), NULL);
 	pbx_cond_init(&(tp_p->exit), NULL);
 
@@ -106,7 +292,7 @@ void sccp_threadpool_grow(sccp_threadpool_t * tp_p, int amount)
 {
 	pthread_attr_t attr;
 	sccp_threadpool_thread_t *tp_thread;
-	int t;
+	int t, q;
 
 	if (tp_p && !tp_p->sccp_threadpool_shuttingdown) {
 		for (t = 0; t < amount; t++) {
@@ -122,6 +308,13 @@ void sccp_threadpool_grow(sccp_threadpool_t * tp_p, int amount)
 			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 			pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 			SCCP_LIST_LOCK(&(tp_p->threads));
+			for (q = 0; q < THREADPOOL_MAX_SIZE; q++) {						/* claim a free local queue */
+				if (!tp_p->local[q].owner) {
+					tp_p->local[q].owner = tp_thread;
+					tp_thread->queue = &tp_p->local[q];
+					break;
+				}
+			}
 			SCCP_LIST_INSERT_HEAD(&(tp_p->threads), tp_thread, list);
 			SCCP_LIST_UNLOCK(&(tp_p->threads));
 			pbx_pthread_create(&(tp_thread->thread), &attr, (void *) sccp_threadpool_thread_do, (void *) tp_thread);
@@ -164,19 +357,21 @@ static void sccp_threadpool_check_size(sccp_threadpool_t * tp_p)
 		sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_check_resize) in thread: %p\n", (void *) pthread_self());
 		SCCP_LIST_LOCK(&(tp_p->threads));
 		{
-			if (SCCP_LIST_GETSIZE(&tp_p->jobs) > (SCCP_LIST_GETSIZE(&tp_p->threads) * 2) && SCCP_LIST_GETSIZE(&tp_p->threads) < THREADPOOL_MAX_SIZE) {	// increase
+			int jobs = sccp_threadpool_jobqueue_count(tp_p);
+
+			if (jobs > (SCCP_LIST_GETSIZE(&tp_p->threads) * 2) && SCCP_LIST_GETSIZE(&tp_p->threads) < THREADPOOL_MAX_SIZE) {	// increase
 				sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Add new thread to threadpool %p\n", tp_p);
 				sccp_threadpool_grow(tp_p, 1);
 				tp_p->last_resize = time(0);
 			} else if (((time(0) - tp_p->last_resize) > THREADPOOL_RESIZE_INTERVAL * 3) &&		// wait a little longer to decrease
-				   (SCCP_LIST_GETSIZE(&tp_p->threads) > THREADPOOL_MIN_SIZE && SCCP_LIST_GETSIZE(&tp_p->jobs) < (SCCP_LIST_GETSIZE(&tp_p->threads) / 2))) {	// decrease
+				   (SCCP_LIST_GETSIZE(&tp_p->threads) > THREADPOOL_MIN_SIZE && jobs < (SCCP_LIST_GETSIZE(&tp_p->threads) / 2))) {	// decrease
 				sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Remove thread %d from threadpool %p\n", SCCP_LIST_GETSIZE(&tp_p->threads) - 1, tp_p);
 				// kill last thread only if it is not executed by itself
 				sccp_threadpool_shrink(tp_p, 1);
 				tp_p->last_resize = time(0);
 			}
 			tp_p->last_size_check = time(0);
-			tp_p->job_high_water_mark = SCCP_LIST_GETSIZE(&tp_p->jobs);
+			tp_p->job_high_water_mark = jobs;
 			sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_check_resize) Number of threads: %d, job_high_water_mark: %d\n", SCCP_LIST_GETSIZE(&tp_p->threads), tp_p->job_high_water_mark);
 		}
 		SCCP_LIST_UNLOCK(&(tp_p->threads));
@@ -191,6 +386,16 @@ static void sccp_threadpool_thread_end(void *p)
 
 	SCCP_LIST_LOCK(&(tp_p->threads));
 	res = SCCP_LIST_REMOVE(&(tp_p->threads), tp_thread, list);
+	if (tp_thread->queue) {											/* jobs left behind will be stolen by the remaining workers */
+		tp_thread->queue->owner = NULL;
+		tp_thread->queue = NULL;
+	}
+	tp_p->retired.executed += tp_thread->stats.executed;
+	tp_p->retired.stolen += tp_thread->stats.stolen;
+	tp_p->retired.wait_total += tp_thread->stats.wait_total;
+	if (tp_thread->stats.wait_max > tp_p->retired.wait_max) {
+		tp_p->retired.wait_max = tp_thread->stats.wait_max;
+	}
 	SCCP_LIST_UNLOCK(&(tp_p->threads));
 
 	pbx_cond_signal(&(tp_p->exit));
@@ -199,6 +404,39 @@ static void sccp_threadpool_thread_end(void *p)
 	}
 }
 
+/* Fetch the next job: own queue first, then the shared queue, the overflow list and finally steal from the other workers */
+static boolean_t sccp_threadpool_next_job(sccp_threadpool_t * tp_p, sccp_threadpool_thread_t * tp_thread, sccp_threadpool_job_t * job)
+{
+	sccp_threadpool_queue_t *queue;
+	sccp_threadpool_job_t *overflow_job;
+	int q;
+
+	if (tp_thread->queue && sccp_threadpool_queue_pop(tp_thread->queue, job)) {
+		return TRUE;
+	}
+	if (sccp_threadpool_queue_pop(&tp_p->queue, job)) {
+		return TRUE;
+	}
+	if (SCCP_LIST_GETSIZE(&tp_p->overflow) > 0) {
+		SCCP_LIST_LOCK(&(tp_p->overflow));
+		overflow_job = SCCP_LIST_REMOVE_HEAD(&(tp_p->overflow), list);
+		SCCP_LIST_UNLOCK(&(tp_p->overflow));
+		if (overflow_job) {
+			*job = *overflow_job;
+			sccp_free(overflow_job);
+			return TRUE;
+		}
+	}
+	for (q = 0; q < THREADPOOL_MAX_SIZE; q++) {
+		queue = &tp_p->local[q];
+		if (queue != tp_thread->queue && sccp_threadpool_queue_depth(queue) > 0 && sccp_threadpool_queue_pop(queue, job)) {
+			tp_thread->stats.stolen++;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
 /* What each individual thread is doing */
 void sccp_threadpool_thread_do(void *p)
 {
@@ -208,49 +446,49 @@ void sccp_threadpool_thread_do(void *p)
 
 	pthread_cleanup_push(sccp_threadpool_thread_end, tp_thread);
 
-	int jobs = 0, threads = 0;
+	sccp_threadpool_job_t job;
+	struct timespec ts;
+	struct timeval tv;
+	uint64_t waited;
 
 	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Starting Threadpool JobQueue:%p\n", thread);
 	while (1) {
 		pthread_testcancel();
-		jobs = SCCP_LIST_GETSIZE(&tp_p->jobs);
-		threads = SCCP_LIST_GETSIZE(&tp_p->threads);
-
-		sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_thread_do) num_jobs: %d, thread: %p, num_threads: %d\n", jobs, thread, threads);
-
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-		SCCP_LIST_LOCK(&(tp_p->jobs));									/* LOCK */
-		while (SCCP_LIST_GETSIZE(&tp_p->jobs) == 0 && !tp_thread->die) {
-			sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_thread_do) Thread %p Waiting for New Work Condition\n", thread);
-			pbx_cond_wait(&(tp_p->work), &(tp_p->jobs.lock));
-		}
-		if (tp_thread->die && SCCP_LIST_GETSIZE(&tp_p->jobs) == 0) {
-			sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "JobQueue Die. Exiting thread %p...\n", thread);
-			SCCP_LIST_UNLOCK(&(tp_p->jobs));
-			break;
-		}
-		sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_thread_do) Let's work. num_jobs: %d, thread: %p, num_threads: %d\n", jobs, thread, threads);
-		{
-			/* Read job from queue and execute it */
-			void *(*func_buff) (void *arg) = NULL;
-			void *arg_buff = NULL;
-			sccp_threadpool_job_t *job;
-
-			if ((job = SCCP_LIST_REMOVE_HEAD(&(tp_p->jobs), list))) {
-				func_buff = job->function;
-				arg_buff = job->arg;
-			}
-			SCCP_LIST_UNLOCK(&(tp_p->jobs));
 
-			sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_thread_do) executing %p in thread: %p\n", job, thread);
-			if (job) {
-				func_buff(arg_buff);								/* run function */
-				sccp_free(job);									/* DEALLOC job */
+		if (!sccp_threadpool_next_job(tp_p, tp_thread, &job)) {
+			pbx_mutex_lock(&tp_p->lock);								/* LOCK */
+			tp_p->idle++;
+			THREADPOOL_BARRIER();									/* publish idle before re-checking the queues */
+			while (sccp_threadpool_jobqueue_count(tp_p) == 0 && !tp_thread->die) {
+				sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_thread_do) Thread %p Waiting for New Work Condition\n", thread);
+				gettimeofday(&tv, NULL);
+				ts.tv_sec = tv.tv_sec + 1;							/* safety net against a missed wakeup */
+				ts.tv_nsec = tv.tv_usec * 1000;
+				pbx_cond_timedwait(&(tp_p->work), &(tp_p->lock), &ts);
 			}
-			// check number of threads in threadpool
-			if ((time(0) - tp_p->last_size_check) > THREADPOOL_RESIZE_INTERVAL) {
-				sccp_threadpool_check_size(tp_p);						/* Check Resizing */
+			tp_p->idle--;
+			pbx_mutex_unlock(&tp_p->lock);
+			if (tp_thread->die && sccp_threadpool_jobqueue_count(tp_p) == 0) {
+				sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "JobQueue Die. Exiting thread %p...\n", thread);
+				break;
 			}
+			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+			continue;
+		}
+
+		waited = ast_tvdiff_us(pbx_tvnow(), job.queued);
+		tp_thread->stats.executed++;
+		tp_thread->stats.wait_total += waited;
+		if (waited > tp_thread->stats.wait_max) {
+			tp_thread->stats.wait_max = waited;
+		}
+		sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_thread_do) executing %p in thread: %p after %lu usec\n", job.function, thread, (unsigned long) waited);
+		job.function(job.arg);										/* run function */
+
+		// check number of threads in threadpool
+		if ((time(0) - tp_p->last_size_check) > THREADPOOL_RESIZE_INTERVAL) {
+			sccp_threadpool_check_size(tp_p);							/* Check Resizing */
 		}
 		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	}
@@ -264,20 +502,13 @@ int sccp_threadpool_add_work(sccp_threadpool_t * tp_p, void *(*function_p) (void
 {
 	// prevent new work while shutting down
 	if (!tp_p->sccp_threadpool_shuttingdown) {
-		sccp_threadpool_job_t *newJob;
-
-		if (!(newJob = sccp_calloc(sizeof *newJob, 1))) {
-        		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
-			exit(1);
-		}
-
-		/* add function and argument */
-		newJob->function = function_p;
-		newJob->arg = arg_p;
+		sccp_threadpool_job_t newJob = {
+			.function = function_p,
+			.arg = arg_p,
+		};
 
 		/* add job to queue */
-		sccp_threadpool_jobqueue_add(tp_p, newJob);
-		return 1;
+		return sccp_threadpool_jobqueue_add_job(tp_p, &newJob) ? 1 : 0;
 	} 
         pbx_log(LOG_ERROR, "sccp_threadpool_add_work(): Threadpool shutting down, denying new work\n");
         return 0;
@@ -290,13 +521,15 @@ boolean_t sccp_threadpool_destroy(sccp_threadpool_t * tp_p)
 		return FALSE;
 	}
 	sccp_threadpool_thread_t *tp_thread = NULL;
+	sccp_threadpool_job_t *job = NULL;
+	int q;
 
-	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "Destroying Threadpool %p with %d jobs\n", tp_p, SCCP_LIST_GETSIZE(&tp_p->jobs));
+	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "Destroying Threadpool %p with %d jobs\n", tp_p, sccp_threadpool_jobqueue_count(tp_p));
 
 	// After this point, no new jobs can be added
-	SCCP_LIST_LOCK(&(tp_p->jobs));
+	pbx_mutex_lock(&tp_p->lock);
 	tp_p->sccp_threadpool_shuttingdown = 1;
-	SCCP_LIST_UNLOCK(&(tp_p->jobs));
+	pbx_mutex_unlock(&tp_p->lock);
 
 	// shutdown is a kind of work too
 	SCCP_LIST_LOCK(&(tp_p->threads));
@@ -341,7 +574,17 @@ boolean_t sccp_threadpool_destroy(sccp_threadpool_t * tp_p)
 	/* Dealloc */
 	pbx_cond_destroy(&(tp_p->work));									/* Remove Condition */
 	pbx_cond_destroy(&(tp_p->exit));									/* Remove Condition */
-	SCCP_LIST_HEAD_DESTROY(&(tp_p->jobs));
+	pbx_mutex_destroy(&tp_p->lock);
+	SCCP_LIST_LOCK(&(tp_p->overflow));
+	while ((job = SCCP_LIST_REMOVE_HEAD(&(tp_p->overflow), list))) {
+		sccp_free(job);
+	}
+	SCCP_LIST_UNLOCK(&(tp_p->overflow));
+	SCCP_LIST_HEAD_DESTROY(&(tp_p->overflow));
+	for (q = 0; q < THREADPOOL_MAX_SIZE; q++) {
+		sccp_threadpool_queue_destroy(&tp_p->local[q]);
+	}
+	sccp_threadpool_queue_destroy(&tp_p->queue);
 	SCCP_LIST_HEAD_DESTROY(&(tp_p->threads));
 	sccp_free(tp_p);
 	tp_p = NULL;												/* DEALLOC thread pool */
@@ -356,38 +599,179 @@ int __PURE__ sccp_threadpool_thread_count(sccp_threadpool_t * tp_p)
 
 /* =================== JOB QUEUE OPERATIONS ===================== */
 
-/* Add job to queue */
-void sccp_threadpool_jobqueue_add(sccp_threadpool_t * tp_p, sccp_threadpool_job_t * newjob_p)
+/* Add job to queue (job is copied, nothing is allocated unless all queues are full) */
+boolean_t sccp_threadpool_jobqueue_add_job(sccp_threadpool_t * tp_p, sccp_threadpool_job_t * job)
 {
-	if (!tp_p || !newjob_p) {
+	sccp_threadpool_queue_t *queue = NULL;
+	sccp_threadpool_job_t *overflow_job;
+	unsigned int start;
+	int q, jobs;
+
+	if (!tp_p || !job || !job->function) {
 		pbx_log(LOG_ERROR, "(sccp_threadpool_jobqueue_add) no tp_p or no work pointer\n");
-		sccp_free(newjob_p);
-		return;
+		return FALSE;
 	}
-
-	sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_jobqueue_add) tp_p: %p, jobCount: %d\n", tp_p, SCCP_LIST_GETSIZE(&tp_p->jobs));
-	SCCP_LIST_LOCK(&(tp_p->jobs));
 	if (tp_p->sccp_threadpool_shuttingdown) {
 		pbx_log(LOG_ERROR, "(sccp_threadpool_jobqueue_add) shutting down. skipping work\n");
-		SCCP_LIST_UNLOCK(&(tp_p->jobs));
-		sccp_free(newjob_p);
-		return;
+		return FALSE;
+	}
+	job->queued = pbx_tvnow();
+
+	/* spread work over the workers' local queues, round robin */
+	start = (unsigned int) ATOMIC_INCR(&tp_p->next_queue, 1, &tp_p->lock);
+	for (q = 0; q < THREADPOOL_MAX_SIZE; q++) {
+		queue = &tp_p->local[(start + q) % THREADPOOL_MAX_SIZE];
+		if (queue->owner) {
+			break;
+		}
+		queue = NULL;
+	}
+	if (!(queue && sccp_threadpool_queue_push(queue, job)) && !sccp_threadpool_queue_push(&tp_p->queue, job)) {
+		if (!(overflow_job = sccp_calloc(sizeof *overflow_job, 1))) {
+			pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+			return FALSE;
+		}
+		overflow_job->function = job->function;
+		overflow_job->arg = job->arg;
+		overflow_job->queued = job->queued;
+		SCCP_LIST_LOCK(&(tp_p->overflow));
+		SCCP_LIST_INSERT_TAIL(&(tp_p->overflow), overflow_job, list);
+		tp_p->overflowed++;
+		SCCP_LIST_UNLOCK(&(tp_p->overflow));
+	}
+
+	jobs = sccp_threadpool_jobqueue_count(tp_p);
+	sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_jobqueue_add) tp_p: %p, jobCount: %d\n", tp_p, jobs);
+	if (jobs > tp_p->job_high_water_mark) {
+		tp_p->job_high_water_mark = jobs;
 	}
-	SCCP_LIST_INSERT_TAIL(&(tp_p->jobs), newjob_p, list);
-	SCCP_LIST_UNLOCK(&(tp_p->jobs));
 
-	if ((int)SCCP_LIST_GETSIZE(&tp_p->jobs) > tp_p->job_high_water_mark) {
-		tp_p->job_high_water_mark = SCCP_LIST_GETSIZE(&tp_p->jobs);
+	/* only take the lock when there is someone to wake up */
+	THREADPOOL_BARRIER();
+	if (tp_p->idle > 0) {
+		pbx_mutex_lock(&tp_p->lock);
+		pbx_cond_signal(&(tp_p->work));
+		pbx_mutex_unlock(&tp_p->lock);
 	}
-	pbx_cond_signal(&(tp_p->work));
+	return TRUE;
+}
+
+/* Add job to queue */
+void sccp_threadpool_jobqueue_add(sccp_threadpool_t * tp_p, sccp_threadpool_job_t * newjob_p)
+{
+	sccp_threadpool_jobqueue_add_job(tp_p, newjob_p);
+	sccp_free(newjob_p);
 }
 
 int sccp_threadpool_jobqueue_count(sccp_threadpool_t * tp_p)
 {
-	sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_jobqueue_count) tp_p: %p, jobCount: %d\n", tp_p, SCCP_LIST_GETSIZE(&tp_p->jobs));
-	return SCCP_LIST_GETSIZE(&tp_p->jobs);
+	unsigned int jobs = sccp_threadpool_queue_depth(&tp_p->queue);
+	int q;
+
+	for (q = 0; q < THREADPOOL_MAX_SIZE; q++) {
+		jobs += sccp_threadpool_queue_depth(&tp_p->local[q]);
+	}
+	jobs += SCCP_LIST_GETSIZE(&tp_p->overflow);
+	return (int) jobs;
 }
 
+/*!
+ * \brief Show Threadpool Queues and Workers
+ * \param fd Fd as int
+ * \param totals Total number of lines as int
+ * \param s AMI Session
+ * \param m Message
+ * \param argc Argc as int
+ * \param argv[] Argv[] as char
+ * \return Result as int
+ *
+ * \called_from_asterisk
+ */
+int sccp_show_threadpool(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[])
+{
+	sccp_threadpool_t *tp_p = GLOB(general_threadpool);
+	sccp_threadpool_queue_t *queue = NULL;
+	sccp_threadpool_thread_t *worker = NULL;
+	sccp_threadpool_stats_t stats;
+	int local_line_total = 0;
+	int qnum, once;
+
+	if (!tp_p) {
+		return RESULT_FAILURE;
+	}
+
+	SCCP_LIST_LOCK(&(tp_p->threads));
+	stats = tp_p->retired;
+	SCCP_LIST_TRAVERSE(&(tp_p->threads), worker, list) {
+		stats.executed += worker->stats.executed;
+		stats.stolen += worker->stats.stolen;
+		stats.wait_total += worker->stats.wait_total;
+		if (worker->stats.wait_max > stats.wait_max) {
+			stats.wait_max = worker->stats.wait_max;
+		}
+	}
+
+#define CLI_AMI_TABLE_NAME Threadpool
+#define CLI_AMI_TABLE_PER_ENTRY_NAME Pool
+#define CLI_AMI_TABLE_ITERATOR for(once=0;once<1;once++)
+#define CLI_AMI_TABLE_FIELDS 												\
+	CLI_AMI_TABLE_FIELD(Threads,		"-7.7",		d,	7,	SCCP_LIST_GETSIZE(&tp_p->threads))	\
+	CLI_AMI_TABLE_FIELD(Idle,		"-4.4",		d,	4,	tp_p->idle)				\
+	CLI_AMI_TABLE_FIELD(Depth,		"-6.6",		d,	6,	sccp_threadpool_jobqueue_count(tp_p))	\
+	CLI_AMI_TABLE_FIELD(HighWater,		"-9.9",		d,	9,	tp_p->job_high_water_mark)		\
+	CLI_AMI_TABLE_FIELD(Overflowed,		"-10.10",	u,	10,	tp_p->overflowed)			\
+	CLI_AMI_TABLE_FIELD(Executed,		"-10.10",	lu,	10,	stats.executed)				\
+	CLI_AMI_TABLE_FIELD(Stolen,		"-8.8",		lu,	8,	stats.stolen)				\
+	CLI_AMI_TABLE_FIELD(AvgWaitUs,		"-9.9",		lu,	9,	(unsigned long) (stats.executed ? stats.wait_total / stats.executed : 0))	\
+	CLI_AMI_TABLE_FIELD(MaxWaitUs,		"-9.9",		lu,	9,	(unsigned long) stats.wait_max)
+#include "sccp_cli_table.h"
+	local_line_total++;
+
+#define CLI_AMI_TABLE_NAME ThreadpoolQueues
+#define CLI_AMI_TABLE_PER_ENTRY_NAME Queue
+#define CLI_AMI_TABLE_ITERATOR for(qnum = -1; qnum < THREADPOOL_MAX_SIZE; qnum++)
+#define CLI_AMI_TABLE_BEFORE_ITERATION 											\
+		queue = (qnum < 0) ? &tp_p->queue : &tp_p->local[qnum];						\
+		if (qnum >= 0 && !queue->owner && !queue->enqueue_pos) {						\
+			continue;											\
+		}
+#define CLI_AMI_TABLE_FIELDS 												\
+	CLI_AMI_TABLE_FIELD(Queue,		"-6.6",		s,	6,	qnum < 0 ? "shared" : "local")		\
+	CLI_AMI_TABLE_FIELD(Num,		"-3",		d,	3,	qnum)					\
+	CLI_AMI_TABLE_FIELD(Owner,		"-15",		p,	15,	queue->owner ? (void *) queue->owner->thread : NULL)	\
+	CLI_AMI_TABLE_FIELD(Size,		"-5.5",		u,	5,	queue->mask + 1)			\
+	CLI_AMI_TABLE_FIELD(Depth,		"-5.5",		u,	5,	sccp_threadpool_queue_depth(queue))	\
+	CLI_AMI_TABLE_FIELD(HighWater,		"-9.9",		u,	9,	queue->high_water_mark)			\
+	CLI_AMI_TABLE_FIELD(Enqueued,		"-10.10",	u,	10,	queue->enqueue_pos)
+#include "sccp_cli_table.h"
+	local_line_total++;
+
+#define CLI_AMI_TABLE_NAME ThreadpoolWorkers
+#define CLI_AMI_TABLE_PER_ENTRY_NAME Worker
+#define CLI_AMI_TABLE_LIST_ITER_HEAD &tp_p->threads
+#define CLI_AMI_TABLE_LIST_ITER_TYPE sccp_threadpool_thread_t
+#define CLI_AMI_TABLE_LIST_ITER_VAR tp_thread
+#define CLI_AMI_TABLE_LIST_LOCK SCCP_LIST_LOCK
+#define CLI_AMI_TABLE_LIST_ITERATOR SCCP_LIST_TRAVERSE
+#define CLI_AMI_TABLE_LIST_UNLOCK SCCP_LIST_UNLOCK
+#define CLI_AMI_TABLE_FIELDS 												\
+	CLI_AMI_TABLE_FIELD(Thread,		"-15",		p,	15,	(void *) tp_thread->thread)		\
+	CLI_AMI_TABLE_FIELD(Queue,		"-5",		d,	5,	tp_thread->queue ? (int) (tp_thread->queue - tp_p->local) : -1)	\
+	CLI_AMI_TABLE_FIELD(Die,		"-3.3",		s,	3,	tp_thread->die ? "yes" : "no")		\
+	CLI_AMI_TABLE_FIELD(Executed,		"-10.10",	lu,	10,	tp_thread->stats.executed)		\
+	CLI_AMI_TABLE_FIELD(Stolen,		"-8.8",		lu,	8,	tp_thread->stats.stolen)		\
+	CLI_AMI_TABLE_FIELD(AvgWaitUs,		"-9.9",		lu,	9,	(unsigned long) (tp_thread->stats.executed ? tp_thread->stats.wait_total / tp_thread->stats.executed : 0))	\
+	CLI_AMI_TABLE_FIELD(MaxWaitUs,		"-9.9",		lu,	9,	(unsigned long) tp_thread->stats.wait_max)
+#include "sccp_cli_table.h"
+	local_line_total++;
+	SCCP_LIST_UNLOCK(&(tp_p->threads));
+
+	if (s) {
+		totals->lines = local_line_total;
+		totals->tables = 3;
+	}
+	return RESULT_SUCCESS;
+}
 
 #if CS_TEST_FRAMEWORK
 #include <asterisk/test.h>
@@ -485,16 +869,68 @@ AST_TEST_DEFINE(sccp_threadpool_work)
 	return AST_TEST_PASS;
 }
 
+AST_TEST_DEFINE(sccp_threadpool_ringqueue)
+{
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "ringqueue";
+			info->category = test_category;
+			info->summary = "chan-sccp-b threadpool ring queue";
+			info->description = "chan-sccp-b threadpool bounded job queue full/empty/wrap-around";
+			return AST_TEST_NOT_RUN;
+	        case TEST_EXECUTE:
+	        	break;
+	}
+	sccp_threadpool_queue_t queue = {0};
+	sccp_threadpool_job_t job = {0};
+	uintptr_t loop;
+
+	pbx_test_status_update(test, "Create ring queue of 8 entries\n");
+	pbx_test_validate(test, sccp_threadpool_queue_init(&queue, 8) == TRUE);
+	pbx_test_validate(test, sccp_threadpool_queue_pop(&queue, &job) == FALSE);
+
+	pbx_test_status_update(test, "Fill ring queue\n");
+	job.function = sccp_cli_threadpool_test_thread;
+	for (loop = 0; loop < 8; loop++) {
+		job.arg = (void *) loop;
+		pbx_test_validate(test, sccp_threadpool_queue_push(&queue, &job) == TRUE);
+	}
+	pbx_test_validate(test, sccp_threadpool_queue_push(&queue, &job) == FALSE);
+	pbx_test_validate(test, sccp_threadpool_queue_depth(&queue) == 8);
+
+	pbx_test_status_update(test, "Empty ring queue in order\n");
+	for (loop = 0; loop < 8; loop++) {
+		pbx_test_validate(test, sccp_threadpool_queue_pop(&queue, &job) == TRUE);
+		pbx_test_validate(test, job.arg == (void *) loop);
+	}
+	pbx_test_validate(test, sccp_threadpool_queue_pop(&queue, &job) == FALSE);
+
+	pbx_test_status_update(test, "Wrap around\n");
+	for (loop = 0; loop < 100; loop++) {
+		job.arg = (void *) loop;
+		pbx_test_validate(test, sccp_threadpool_queue_push(&queue, &job) == TRUE);
+		pbx_test_validate(test, sccp_threadpool_queue_pop(&queue, &job) == TRUE);
+		pbx_test_validate(test, job.arg == (void *) loop);
+	}
+	pbx_test_validate(test, sccp_threadpool_queue_depth(&queue) == 0);
+	pbx_test_validate(test, queue.high_water_mark == 8);
+
+	sccp_threadpool_queue_destroy(&queue);
+	return AST_TEST_PASS;
+}
+
 static void __attribute__((constructor)) sccp_register_tests(void)
 {
         AST_TEST_REGISTER(sccp_threadpool_create_destroy);
         AST_TEST_REGISTER(sccp_threadpool_work);
+        AST_TEST_REGISTER(sccp_threadpool_ringqueue);
 }
 
 static void __attribute__((destructor)) sccp_unregister_tests(void)
 {
         AST_TEST_UNREGISTER(sccp_threadpool_create_destroy);
         AST_TEST_UNREGISTER(sccp_threadpool_work);
+        AST_TEST_UNREGISTER(sccp_threadpool_ringqueue);
 }
 #endif
 
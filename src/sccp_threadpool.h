@@ -11,6 +11,12 @@
 #pragma once
 //#include "config.h"
 //#include "common.h"
+#include "sccp_cli.h"
+#include <sys/time.h>
+
+/* forward declarations */
+struct mansession;
+struct message;
 
 __BEGIN_C_EXTERN__
 /* Description:         Library providing a threading pool where you can add work on the fly. The number
@@ -39,11 +45,14 @@ __BEGIN_C_EXTERN__
  *                      |   threadpool      | thread1 | thread2 | ..            |
  *                      \_______________________________________________________/
  *      
- * Description:         Jobs are added to the job queue. Once a thread in the pool
- *                      is idle, it is assigned with the first job from the queue(and
- *                      erased from the queue). It's each thread's job to read from 
- *                      the queue serially(using lock) and executing each job
- *                      until the queue is empty.
+ * Description:         Jobs are copied into preallocated ring queues: one local queue
+ *                      per worker (filled round robin) and a shared queue which is used
+ *                      when the local queue is full. Each worker first empties its own
+ *                      queue, then the shared queue, and finally steals jobs from the
+ *                      other workers' queues. Idle workers wait on a condition which is
+ *                      only signalled when someone is actually waiting.
+ *                      When all queues are full, jobs are allocated and put on an
+ *                      overflow list, so work is never refused.
  * 
  */
 /* ================================= STRUCTURES ================================================ */
@@ -54,6 +63,7 @@ typedef struct sccp_threadpool_job sccp_threadpool_job_t;
 struct sccp_threadpool_job {
 	void *(*function) (void *arg);										/*!< function pointer         */
 	void *arg;												/*!< function's argument      */
+	struct timeval queued;											/*!< time the job was queued  */
 	SCCP_LIST_ENTRY (sccp_threadpool_job_t) list;
 };
 
@@ -132,8 +142,7 @@ SCCP_API int SCCP_CALL sccp_threadpool_jobqueue_init(sccp_threadpool_t * tp_p);
  * \brief Add job to queue
  * 
  * A new job will be added to the queue. The new job MUST be allocated
- * before passed to this function or else other functions like sccp_threadpool_jobqueue_empty()
- * will be broken.
+ * before passed to this function, it is copied into the queue and freed.
  * 
  * \param tp_p pointer to threadpool
  * \param newjob_p pointer to the new job(MUST BE ALLOCATED)
@@ -141,10 +150,26 @@ SCCP_API int SCCP_CALL sccp_threadpool_jobqueue_init(sccp_threadpool_t * tp_p);
  */
 SCCP_API void SCCP_CALL sccp_threadpool_jobqueue_add(sccp_threadpool_t * tp_p, sccp_threadpool_job_t * newjob_p);
 
+/*!
+ * \brief Add job to queue
+ * 
+ * The job is copied into one of the job queues, so it may live on the stack.
+ * 
+ * \param tp_p pointer to threadpool
+ * \param job pointer to the job
+ * \return TRUE on success
+ */
+SCCP_API boolean_t SCCP_CALL sccp_threadpool_jobqueue_add_job(sccp_threadpool_t * tp_p, sccp_threadpool_job_t * job);
+
 /*!
  * \brief Return Number of Jobs in the Queue
  * \param tp_p pointer to threadpool
  */
 SCCP_API int SCCP_CALL sccp_threadpool_jobqueue_count(sccp_threadpool_t * tp_p);
+
+/*!
+ * \brief Show threadpool queue depth and latency statistics (cli/ami)
+ */
+SCCP_API int SCCP_CALL sccp_show_threadpool(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[]);
 __END_C_EXTERN__
 // kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
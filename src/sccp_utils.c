@@ -354,6 +354,307 @@ int sccp_softkeyindex_find_label(sccp_device_t * d, unsigned int keymode, unsign
 }
 #endif
 
+/*
+ * Feature State Store
+ *
+ * Persistent feature state (cfwd, dnd, privacy, monitor, last dialed number) is written to the pbx database behind the
+ * back of the caller. Updates go into an in memory cache, which is flushed on the general threadpool
+ * SCCP_FEATURESTORE_FLUSH_DELAY ms after the first pending update. Updates of the same key in the meantime are coalesced,
+ * only the last value is written, and setting a key to the value it already has is not written at all. Reads are served
+ * from the cache, and only go to the database the first time a key is read (also when it is not in the database). The
+ * cache is dropped on every 'sccp reload', to pick up changes made to the database behind our back (database put/del).
+ */
+#define SCCP_FEATURESTORE_BUCKETS 127
+#define SCCP_FEATURESTORE_FLUSH_DELAY 250
+
+typedef struct sccp_featurestore_entry sccp_featurestore_entry_t;
+struct sccp_featurestore_entry {
+	sccp_featurestore_entry_t *next;									/*!< Bucket chain */
+	sccp_featurestore_entry_t *nextDirty;									/*!< Pending write chain */
+	boolean_t dirty;											/*!< Value has not been written yet */
+	char *value;												/*!< NULL: not in the database (removed) */
+	char *key;
+	char family[];
+};
+
+typedef struct {
+	char *family;
+	char *key;
+	char *value;
+} sccp_featurestore_write_t;
+
+static struct {
+	sccp_featurestore_entry_t *buckets[SCCP_FEATURESTORE_BUCKETS];
+	sccp_featurestore_entry_t *dirty;
+	int schedId;
+	boolean_t stopped;
+} featurestore = {
+	.schedId = -1,
+};
+AST_MUTEX_DEFINE_STATIC(featurestore_lock);
+AST_MUTEX_DEFINE_STATIC(featurestore_flush_lock);								/* keeps flushes in order */
+
+/* (featurestore_lock must be held) */
+static sccp_featurestore_entry_t *sccp_featurestore_find(const char *family, const char *key, unsigned int bucket)
+{
+	sccp_featurestore_entry_t *entry = NULL;
+
+	for (entry = featurestore.buckets[bucket]; entry; entry = entry->next) {
+		if (sccp_strequals(entry->family, family) && sccp_strequals(entry->key, key)) {
+			break;
+		}
+	}
+	return entry;
+}
+
+/* (featurestore_lock must be held) */
+static sccp_featurestore_entry_t *sccp_featurestore_add(const char *family, const char *key, unsigned int bucket)
+{
+	size_t familylen = strlen(family) + 1;
+	sccp_featurestore_entry_t *entry = sccp_calloc(sizeof(sccp_featurestore_entry_t) + familylen + strlen(key) + 1, 1);
+
+	if (!entry) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return NULL;
+	}
+	memcpy(entry->family, family, familylen);
+	entry->key = entry->family + familylen;
+	strcpy(entry->key, key);
+	entry->next = featurestore.buckets[bucket];
+	featurestore.buckets[bucket] = entry;
+	return entry;
+}
+
+static unsigned int sccp_featurestore_bucket(const char *family, const char *key)
+{
+	return (sccp_strcase_hash(family) * 31 + sccp_strcase_hash(key)) % SCCP_FEATURESTORE_BUCKETS;
+}
+
+/*!
+ * \brief Write all pending feature state updates to the pbx database
+ */
+static void *sccp_featurestore_flush(void *data)
+{
+	sccp_featurestore_write_t *writes = NULL;
+	sccp_featurestore_entry_t *entry = NULL;
+	int count = 0;
+	int idx = 0;
+
+	pbx_mutex_lock(&featurestore_flush_lock);
+	pbx_mutex_lock(&featurestore_lock);
+	for (entry = featurestore.dirty; entry; entry = entry->nextDirty) {
+		count++;
+	}
+	if (count && (writes = sccp_calloc(sizeof(sccp_featurestore_write_t), count))) {
+		while ((entry = featurestore.dirty)) {
+			featurestore.dirty = entry->nextDirty;
+			entry->nextDirty = NULL;
+			entry->dirty = FALSE;
+			writes[idx].family = entry->family;						/* entries live until sccp_featurestore_module_stop */
+			writes[idx].key = entry->key;
+			writes[idx].value = entry->value ? pbx_strdup(entry->value) : NULL;
+			idx++;
+		}
+	} else if (count) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");				/* keep them dirty, next flush */
+	}
+	pbx_mutex_unlock(&featurestore_lock);
+
+	for (idx = 0; writes && idx < count; idx++) {
+		if (writes[idx].value) {
+			iPbx.feature_addToDatabase(writes[idx].family, writes[idx].key, writes[idx].value);
+			sccp_free(writes[idx].value);
+		} else {
+			iPbx.feature_removeFromDatabase(writes[idx].family, writes[idx].key);
+		}
+	}
+	if (writes) {
+		sccp_log((DEBUGCAT_FEATURE)) (VERBOSE_PREFIX_3 "SCCP: feature store wrote %d entries\n", count);
+		sccp_free(writes);
+	}
+	pbx_mutex_unlock(&featurestore_flush_lock);
+	return NULL;
+}
+
+static int sccp_featurestore_flush_cb(const void *data)
+{
+	pbx_mutex_lock(&featurestore_lock);
+	if (featurestore.stopped) {									/* cancelled by module_stop, which does the final flush itself */
+		pbx_mutex_unlock(&featurestore_lock);
+		return 0;
+	}
+	featurestore.schedId = -1;									/* ours: put only re-arms after this, module_stop sets stopped first */
+	pbx_mutex_unlock(&featurestore_lock);
+	if (!GLOB(general_threadpool) || !sccp_threadpool_add_work(GLOB(general_threadpool), sccp_featurestore_flush, NULL)) {
+		sccp_featurestore_flush(NULL);
+	}
+	return 0;
+}
+
+/*!
+ * \brief Store a feature state value in the pbx database (write-behind)
+ * \param family Database Family
+ * \param key Database Key
+ * \param value Value to store, NULL removes the key
+ */
+void sccp_featurestore_put(const char *family, const char *key, const char *value)
+{
+	unsigned int bucket = sccp_featurestore_bucket(family, key);
+	sccp_featurestore_entry_t *entry = NULL;
+	boolean_t writeNow = FALSE;
+
+	pbx_mutex_lock(&featurestore_lock);
+	if (featurestore.stopped) {
+		writeNow = TRUE;
+	} else if ((entry = sccp_featurestore_find(family, key, bucket)) && (value ? (entry->value && sccp_strequals(entry->value, value)) : !entry->value)) {
+		/* unchanged */
+	} else if (entry || (entry = sccp_featurestore_add(family, key, bucket))) {
+		if (entry->value) {
+			sccp_free(entry->value);
+		}
+		entry->value = value ? pbx_strdup(value) : NULL;
+		if (!entry->dirty) {
+			entry->dirty = TRUE;
+			entry->nextDirty = featurestore.dirty;
+			featurestore.dirty = entry;
+		}
+		if (featurestore.schedId < 0 && (featurestore.schedId = iPbx.sched_add(SCCP_FEATURESTORE_FLUSH_DELAY, sccp_featurestore_flush_cb, NULL)) < 0) {
+			featurestore.schedId = -1;
+			writeNow = TRUE;
+		}
+	} else {
+		writeNow = TRUE;
+	}
+	pbx_mutex_unlock(&featurestore_lock);
+
+	if (writeNow) {
+		sccp_featurestore_flush(NULL);
+		if (!entry) {										/* not cached (stopped / out of memory) */
+			if (value) {
+				iPbx.feature_addToDatabase(family, key, value);
+			} else {
+				iPbx.feature_removeFromDatabase(family, key);
+			}
+		}
+	}
+}
+
+/*!
+ * \brief Get a feature state value, from the feature store cache or else from the pbx database
+ * \param family Database Family
+ * \param key Database Key
+ * \param out Output buffer
+ * \param outlen Size of out
+ * \return TRUE when the key has a value
+ */
+boolean_t sccp_featurestore_get(const char *family, const char *key, char *out, int outlen)
+{
+	unsigned int bucket = sccp_featurestore_bucket(family, key);
+	sccp_featurestore_entry_t *entry = NULL;
+	boolean_t found = FALSE;
+	char buffer[256] = "";
+	boolean_t inDatabase = FALSE;
+
+	pbx_mutex_lock(&featurestore_lock);
+	if ((entry = sccp_featurestore_find(family, key, bucket)) && entry->value) {
+		sccp_copy_string(out, entry->value, outlen);
+		found = TRUE;
+	}
+	pbx_mutex_unlock(&featurestore_lock);
+	if (entry || !iPbx.feature_getFromDatabase) {
+		return found;
+	}
+
+	/* first read of this key, remember what the database has */
+	inDatabase = iPbx.feature_getFromDatabase(family, key, buffer, sizeof(buffer));
+	pbx_mutex_lock(&featurestore_lock);
+	if (!(entry = sccp_featurestore_find(family, key, bucket)) && !featurestore.stopped && (entry = sccp_featurestore_add(family, key, bucket))) {
+		entry->value = inDatabase ? pbx_strdup(buffer) : NULL;
+	}
+	if (entry ? entry->value != NULL : inDatabase) {							/* a put might have overtaken us */
+		sccp_copy_string(out, entry ? entry->value : buffer, outlen);
+		found = TRUE;
+	}
+	pbx_mutex_unlock(&featurestore_lock);
+	return found;
+}
+
+/*!
+ * \brief Write the pending feature states and drop the cached ones, so that they are read from the pbx database again (reload)
+ *
+ * \note entries updated again while we were writing stay in the cache (they are dirty)
+ */
+void sccp_featurestore_invalidate(void)
+{
+	sccp_featurestore_entry_t *entry = NULL;
+	sccp_featurestore_entry_t **entryRef = NULL;
+	int bucket = 0;
+	int dropped = 0;
+
+	sccp_featurestore_flush(NULL);
+
+	pbx_mutex_lock(&featurestore_flush_lock);							/* a running flush still uses the entry family/key */
+	pbx_mutex_lock(&featurestore_lock);
+	for (bucket = 0; bucket < SCCP_FEATURESTORE_BUCKETS; bucket++) {
+		entryRef = &featurestore.buckets[bucket];
+		while ((entry = *entryRef)) {
+			if (entry->dirty) {
+				entryRef = &entry->next;
+				continue;
+			}
+			*entryRef = entry->next;
+			if (entry->value) {
+				sccp_free(entry->value);
+			}
+			sccp_free(entry);
+			dropped++;
+		}
+	}
+	pbx_mutex_unlock(&featurestore_lock);
+	pbx_mutex_unlock(&featurestore_flush_lock);
+	sccp_log((DEBUGCAT_FEATURE)) (VERBOSE_PREFIX_3 "SCCP: feature store dropped %d cached entries\n", dropped);
+}
+
+/*!
+ * \brief Write the pending feature states and release the feature store cache (module unload)
+ */
+void sccp_featurestore_module_stop(void)
+{
+	sccp_featurestore_entry_t *entry = NULL;
+	int bucket = 0;
+	int schedId = -1;
+
+	pbx_mutex_lock(&featurestore_lock);
+	if (featurestore.stopped) {
+		pbx_mutex_unlock(&featurestore_lock);
+		return;
+	}
+	featurestore.stopped = TRUE;									/* from now on put writes directly, nothing gets dirty anymore */
+	schedId = featurestore.schedId;
+	featurestore.schedId = -1;
+	pbx_mutex_unlock(&featurestore_lock);
+	if (schedId > -1) {
+		schedId = SCCP_SCHED_DEL(schedId);							/* outside featurestore_lock, the callback takes it */
+	}
+
+	sccp_featurestore_flush(NULL);									/* final flush, a flush already queued on the threadpool finds nothing left */
+
+	pbx_mutex_lock(&featurestore_flush_lock);
+	pbx_mutex_lock(&featurestore_lock);
+	for (bucket = 0; bucket < SCCP_FEATURESTORE_BUCKETS; bucket++) {
+		while ((entry = featurestore.buckets[bucket])) {
+			featurestore.buckets[bucket] = entry->next;
+			if (entry->value) {
+				sccp_free(entry->value);
+			}
+			sccp_free(entry);
+		}
+	}
+	featurestore.dirty = NULL;
+	pbx_mutex_unlock(&featurestore_lock);
+	pbx_mutex_unlock(&featurestore_flush_lock);
+}
+
 /*!
  * \brief Handle Feature Change Event for persistent feature storage
  * \param event SCCP Event
@@ -394,31 +695,31 @@ void sccp_util_featureStorageBackend(const sccp_event_t * event)
 				switch (event->event.featureChanged.featureType) {
 					case SCCP_FEATURE_CFWDALL:
 						if (linedevice->cfwdAll.enabled) {
-							iPbx.feature_addToDatabase(cfwdDeviceLineStore, "cfwdAll", linedevice->cfwdAll.number);
-							iPbx.feature_addToDatabase(cfwdLineDeviceStore, "cfwdAll", linedevice->cfwdAll.number);
+							sccp_featurestore_put(cfwdDeviceLineStore, "cfwdAll", linedevice->cfwdAll.number);
+							sccp_featurestore_put(cfwdLineDeviceStore, "cfwdAll", linedevice->cfwdAll.number);
 							sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "%s: db put %s\n", DEV_ID_LOG(device), cfwdDeviceLineStore);
 						} else {
-							iPbx.feature_removeFromDatabase(cfwdDeviceLineStore, "cfwdAll");
-							iPbx.feature_removeFromDatabase(cfwdLineDeviceStore, "cfwdAll");
+							sccp_featurestore_put(cfwdDeviceLineStore, "cfwdAll", NULL);
+							sccp_featurestore_put(cfwdLineDeviceStore, "cfwdAll", NULL);
 							sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "%s: db clear %s\n", DEV_ID_LOG(device), cfwdDeviceLineStore);
 						}
 						break;
 					case SCCP_FEATURE_CFWDBUSY:
 						if (linedevice->cfwdBusy.enabled) {
-							iPbx.feature_addToDatabase(cfwdDeviceLineStore, "cfwdBusy", linedevice->cfwdBusy.number);
-							iPbx.feature_addToDatabase(cfwdLineDeviceStore, "cfwdBusy", linedevice->cfwdBusy.number);
+							sccp_featurestore_put(cfwdDeviceLineStore, "cfwdBusy", linedevice->cfwdBusy.number);
+							sccp_featurestore_put(cfwdLineDeviceStore, "cfwdBusy", linedevice->cfwdBusy.number);
 							sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "%s: db put %s\n", DEV_ID_LOG(device), cfwdDeviceLineStore);
 						} else {
-							iPbx.feature_removeFromDatabase(cfwdDeviceLineStore, "cfwdBusy");
-							iPbx.feature_removeFromDatabase(cfwdLineDeviceStore, "cfwdBusy");
+							sccp_featurestore_put(cfwdDeviceLineStore, "cfwdBusy", NULL);
+							sccp_featurestore_put(cfwdLineDeviceStore, "cfwdBusy", NULL);
 							sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "%s: db clear %s\n", DEV_ID_LOG(device), cfwdDeviceLineStore);
 						}
 						break;
 					case SCCP_FEATURE_CFWDNONE:
-						iPbx.feature_removeFromDatabase(cfwdDeviceLineStore, "cfwdAll");
-						iPbx.feature_removeFromDatabase(cfwdDeviceLineStore, "cfwdBusy");
-						iPbx.feature_removeFromDatabase(cfwdLineDeviceStore, "cfwdAll");
-						iPbx.feature_removeFromDatabase(cfwdLineDeviceStore, "cfwdBusy");
+						sccp_featurestore_put(cfwdDeviceLineStore, "cfwdAll", NULL);
+						sccp_featurestore_put(cfwdDeviceLineStore, "cfwdBusy", NULL);
+						sccp_featurestore_put(cfwdLineDeviceStore, "cfwdAll", NULL);
+						sccp_featurestore_put(cfwdLineDeviceStore, "cfwdBusy", NULL);
 						sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "%s: cfwd cleared from db\n", DEV_ID_LOG(device));
 					default:
 						break;
@@ -430,14 +731,14 @@ void sccp_util_featureStorageBackend(const sccp_event_t * event)
 			if (device->dndFeature.previousStatus != device->dndFeature.status) {
 				if (!device->dndFeature.status) {
 					sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "%s: change dnd to off\n", DEV_ID_LOG(device));
-					iPbx.feature_removeFromDatabase(family, "dnd");
+					sccp_featurestore_put(family, "dnd", NULL);
 				} else {
 					if (device->dndFeature.status == SCCP_DNDMODE_SILENT) {
 						sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "%s: change dnd to silent\n", DEV_ID_LOG(device));
-						iPbx.feature_addToDatabase(family, "dnd", "silent");
+						sccp_featurestore_put(family, "dnd", "silent");
 					} else {
 						sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "%s: change dnd to reject\n", DEV_ID_LOG(device));
-						iPbx.feature_addToDatabase(family, "dnd", "reject");
+						sccp_featurestore_put(family, "dnd", "reject");
 					}
 				}
 				device->dndFeature.previousStatus = device->dndFeature.status;
@@ -446,12 +747,12 @@ void sccp_util_featureStorageBackend(const sccp_event_t * event)
 		case SCCP_FEATURE_PRIVACY:
 			if (device->privacyFeature.previousStatus != device->privacyFeature.status) {
 				if (!device->privacyFeature.status) {
-					iPbx.feature_removeFromDatabase(family, "privacy");
+					sccp_featurestore_put(family, "privacy", NULL);
 				} else {
 					char data[256];
 
 					snprintf(data, sizeof(data), "%d", device->privacyFeature.status);
-					iPbx.feature_addToDatabase(family, "privacy", data);
+					sccp_featurestore_put(family, "privacy", data);
 				}
 				device->privacyFeature.previousStatus = device->privacyFeature.status;
 			}
@@ -459,9 +760,9 @@ void sccp_util_featureStorageBackend(const sccp_event_t * event)
 		case SCCP_FEATURE_MONITOR:
 			if (device->monitorFeature.previousStatus != device->monitorFeature.status) {
 				if (device->monitorFeature.status & SCCP_FEATURE_MONITOR_STATE_REQUESTED) {
-					iPbx.feature_addToDatabase(family, "monitor", "on");
+					sccp_featurestore_put(family, "monitor", "on");
 				} else {
-					iPbx.feature_removeFromDatabase(family, "monitor");
+					sccp_featurestore_put(family, "monitor", NULL);
 				}
 				device->monitorFeature.previousStatus = device->monitorFeature.status;
 			}
@@ -772,6 +1073,25 @@ gcc_inline boolean_t sccp_strcaseequals(const char *data1, const char *data2)
 	return FALSE;
 }
 
+/*!
+ * \brief Case insensitive string hash (djb2), used to index devices/lines by name
+ * \param data String to be hashed
+ * \return hash value, equal for strings which are sccp_strcaseequals
+ */
+unsigned int __PURE__ sccp_strcase_hash(const char *data)
+{
+	unsigned int hash = 5381;
+
+	if (data) {
+		unsigned char c;
+
+		while ((c = (unsigned char) *data++)) {
+			hash = ((hash << 5) + hash) + (unsigned int) tolower(c);
+		}
+	}
+	return hash;
+}
+
 int __PURE__ sccp_strIsNumeric(const char *s)
 {
 	if (*s) {
@@ -787,6 +1107,243 @@ int __PURE__ sccp_strIsNumeric(const char *s)
 	return 0;
 }
 
+/*
+ * Compiled Host Access Rules
+ *
+ * The rules of a list are stored in two path compressed binary (patricia) trees, one for IPv4 and one for IPv6, keyed on the
+ * masked network address and prefix length. Every node carries the rule which wins for addresses below it: the last rule
+ * in the list which matches all of them. A lookup therefor only has to find the deepest node matching the address, which
+ * gives the same result as walking the list (last match wins), in at most 32/128 steps independent of the number of rules.
+ */
+typedef struct sccp_ha_node sccp_ha_node_t;
+struct sccp_ha_node {
+	uint8_t key[16];											/*!< Masked network address (network byte order) */
+	uint8_t bits;												/*!< Prefix length */
+	int rule;												/*!< Position in the list of the last rule with exactly this prefix, -1 if none */
+	int sense;
+	int match_rule;												/*!< Position of the rule winning for this prefix (inherited), -1 if none */
+	int match_sense;
+	sccp_ha_node_t *child[2];
+};
+
+struct sccp_ha_tree {
+	sccp_ha_node_t *root[2];										/*!< 0: IPv4, 1: IPv6 */
+};
+
+#define HA_KEY_BIT(_key, _bit) (((_key)[(_bit) >> 3] >> (7 - ((_bit) & 7))) & 1)
+
+/* number of leading bits a and b have in common, up to max */
+static uint8_t sccp_ha_common_bits(const uint8_t *a, const uint8_t *b, uint8_t max)
+{
+	uint8_t bits = 0;
+
+	while (bits < max && !(a[bits >> 3] ^ b[bits >> 3])) {
+		bits = (bits & ~7) + 8;
+	}
+	while (bits < max && HA_KEY_BIT(a, bits) == HA_KEY_BIT(b, bits)) {
+		bits++;
+	}
+	return bits > max ? max : bits;
+}
+
+/* prefix length of a netmask, -1 if it is not contiguous (and cannot be stored in the tree) */
+static int sccp_ha_prefixlen(const uint8_t *mask, int maxbits)
+{
+	int bits = 0;
+	int bit;
+
+	while (bits < maxbits && HA_KEY_BIT(mask, bits)) {
+		bits++;
+	}
+	for (bit = bits; bit < maxbits; bit++) {
+		if (HA_KEY_BIT(mask, bit)) {
+			return -1;
+		}
+	}
+	return bits;
+}
+
+static sccp_ha_node_t *sccp_ha_node_new(const uint8_t *key, uint8_t bits)
+{
+	sccp_ha_node_t *node = sccp_calloc(sizeof *node, 1);
+
+	if (node) {
+		uint8_t byte;
+
+		for (byte = 0; byte < 16 && byte * 8 < bits; byte++) {				/* only keep the prefix */
+			node->key[byte] = key[byte];
+		}
+		if (bits & 7) {
+			node->key[bits >> 3] &= (uint8_t) (0xFF << (8 - (bits & 7)));
+		}
+		node->bits = bits;
+		node->rule = -1;
+		node->match_rule = -1;
+	}
+	return node;
+}
+
+/* find or insert the node for key/bits */
+static sccp_ha_node_t *sccp_ha_node_get(sccp_ha_node_t **link, const uint8_t *key, uint8_t bits)
+{
+	sccp_ha_node_t *node = NULL;
+	sccp_ha_node_t *split = NULL;
+	uint8_t common = 0;
+
+	while ((node = *link)) {
+		common = sccp_ha_common_bits(node->key, key, node->bits < bits ? node->bits : bits);
+		if (common < node->bits) {
+			break;
+		}
+		if (node->bits == bits) {
+			return node;
+		}
+		link = &node->child[HA_KEY_BIT(key, node->bits)];
+	}
+	if (!node) {
+		return (*link = sccp_ha_node_new(key, bits));
+	}
+
+	/* key diverges from node (or is a prefix of it) at bit 'common' */
+	if (common == bits) {
+		if (!(split = sccp_ha_node_new(key, bits))) {
+			return NULL;
+		}
+		split->child[HA_KEY_BIT(node->key, bits)] = node;
+		return (*link = split);
+	}
+	if (!(split = sccp_ha_node_new(key, common))) {
+		return NULL;
+	}
+	if (!(split->child[HA_KEY_BIT(key, common)] = sccp_ha_node_new(key, bits))) {
+		sccp_free(split);
+		return NULL;
+	}
+	split->child[HA_KEY_BIT(node->key, common)] = node;
+	*link = split;
+	return split->child[HA_KEY_BIT(key, common)];
+}
+
+/* hand the winning rule down the tree */
+static void sccp_ha_node_inherit(sccp_ha_node_t *node, int match_rule, int match_sense)
+{
+	for (; node; node = node->child[1]) {
+		if (node->rule > match_rule) {
+			match_rule = node->rule;
+			match_sense = node->sense;
+		}
+		node->match_rule = match_rule;
+		node->match_sense = match_sense;
+		sccp_ha_node_inherit(node->child[0], match_rule, match_sense);
+	}
+}
+
+static void sccp_ha_node_free(sccp_ha_node_t *node)
+{
+	while (node) {
+		sccp_ha_node_t *next = node->child[1];
+
+		sccp_ha_node_free(node->child[0]);
+		sccp_free(node);
+		node = next;
+	}
+}
+
+static void sccp_ha_tree_free(struct sccp_ha_tree *tree)
+{
+	if (tree) {
+		sccp_ha_node_free(tree->root[0]);
+		sccp_ha_node_free(tree->root[1]);
+		sccp_free(tree);
+	}
+}
+
+static int sccp_ha_tree_apply(const struct sccp_ha_tree *tree, const struct sockaddr_storage *addr, int defaultValue)
+{
+	struct sockaddr_storage mapped_addr;
+	const sccp_ha_node_t *node = NULL;
+	const uint8_t *key = NULL;
+	uint8_t bits = 0;
+	int res = defaultValue;
+
+	if (sccp_netsock_is_mapped_IPv4(addr) && sccp_netsock_ipv4_mapped(addr, &mapped_addr)) {
+		addr = &mapped_addr;
+	}
+	if (addr->ss_family == AF_INET) {
+		key = (const uint8_t *) &((const struct sockaddr_in *) addr)->sin_addr;
+		bits = 32;
+		node = tree->root[0];
+	} else if (addr->ss_family == AF_INET6) {
+		key = (const uint8_t *) &((const struct sockaddr_in6 *) addr)->sin6_addr;
+		bits = 128;
+		node = tree->root[1];
+	}
+	while (node && sccp_ha_common_bits(node->key, key, node->bits) == node->bits) {
+		if (node->match_rule >= 0) {
+			res = node->match_sense;
+		}
+		if (node->bits == bits) {
+			break;
+		}
+		node = node->child[HA_KEY_BIT(key, node->bits)];
+	}
+	return res;
+}
+
+/*!
+ * \brief Compile a list of Host Access Rules into a lookup tree, used by sccp_apply_ha from then on
+ * \param ha The head of the list of HAs
+ *
+ * \note Lists containing non contiguous netmasks (like 255.0.255.0) are not compiled and keep being walked rule by rule.
+ * \note The tree is dropped again when a rule is appended to the list.
+ */
+void sccp_compile_ha(struct sccp_ha *ha)
+{
+	struct sccp_ha_tree *tree = NULL;
+	const struct sccp_ha *current_ha = NULL;
+	int rule = 0;
+
+	if (!ha) {
+		return;
+	}
+	sccp_ha_tree_free(ha->tree);
+	ha->tree = NULL;
+	if (!(tree = sccp_calloc(sizeof *tree, 1))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return;
+	}
+	for (current_ha = ha; current_ha; current_ha = current_ha->next, rule++) {
+		const uint8_t *key = NULL;
+		sccp_ha_node_t *node = NULL;
+		int bits = -1;
+		int family = 0;
+
+		if (current_ha->netaddr.ss_family == AF_INET) {
+			key = (const uint8_t *) &((const struct sockaddr_in *) &current_ha->netaddr)->sin_addr;
+			bits = sccp_ha_prefixlen((const uint8_t *) &((const struct sockaddr_in *) &current_ha->netmask)->sin_addr, 32);
+		} else if (current_ha->netaddr.ss_family == AF_INET6) {
+			key = (const uint8_t *) &((const struct sockaddr_in6 *) &current_ha->netaddr)->sin6_addr;
+			bits = sccp_ha_prefixlen((const uint8_t *) &((const struct sockaddr_in6 *) &current_ha->netmask)->sin6_addr, 128);
+			family = 1;
+		}
+		if (bits < 0) {
+			sccp_log(DEBUGCAT_HIGH) (VERBOSE_PREFIX_2 "SCCP: (sccp_compile_ha) rule %s/%s cannot be compiled, using the list\n", sccp_netsock_stringify_addr(&current_ha->netaddr), sccp_netsock_stringify_addr(&current_ha->netmask));
+			sccp_ha_tree_free(tree);
+			return;
+		}
+		if (!(node = sccp_ha_node_get(&tree->root[family], key, (uint8_t) bits))) {
+			pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+			sccp_ha_tree_free(tree);
+			return;
+		}
+		node->rule = rule;
+		node->sense = current_ha->sense;
+	}
+	sccp_ha_node_inherit(tree->root[0], -1, 0);
+	sccp_ha_node_inherit(tree->root[1], -1, 0);
+	ha->tree = tree;
+}
+
 /*!
  * \brief Free a list of Host Access Rules
  * \param ha The head of the list of HAs to free
@@ -796,6 +1353,9 @@ void sccp_free_ha(struct sccp_ha *ha)
 {
 	struct sccp_ha *hal;
 
+	if (ha) {
+		sccp_ha_tree_free(ha->tree);
+	}
 	while (ha) {
 		hal = ha;
 		ha = ha->next;
@@ -882,23 +1442,8 @@ int sccp_apply_ha(const struct sccp_ha *ha, const struct sockaddr_storage *addr)
 	return sccp_apply_ha_default(ha, addr, AST_SENSE_ALLOW);
 }
 
-/*!
- * \brief Apply a set of rules to a given IP address
- *
- * \details
- * The list of host access rules is traversed, beginning with the
- * input rule. If the IP address given matches a rule, the "sense"
- * of that rule is used as the return value. Note that if an IP
- * address matches multiple rules that the last one matched will be
- * the one whose sense will be returned.
- *
- * \param ha The head of the list of host access rules to follow
- * \param addr An sockaddr_storage whose address is considered when matching rules
- * \param defaultValue int value
- * \retval AST_SENSE_ALLOW The IP address passes our ACL
- * \retval AST_SENSE_DENY The IP address fails our ACL
- */
-int sccp_apply_ha_default(const struct sccp_ha *ha, const struct sockaddr_storage *addr, int defaultValue)
+/* walk the list of host access rules one by one (not compiled, see sccp_compile_ha) */
+static int sccp_apply_ha_list(const struct sccp_ha *ha, const struct sockaddr_storage *addr, int defaultValue)
 {
 	/* Start optimistic */
 	int res = defaultValue;
@@ -910,7 +1455,7 @@ int sccp_apply_ha_default(const struct sccp_ha *ha, const struct sockaddr_storag
 		struct sockaddr_storage mapped_addr;
 		const struct sockaddr_storage *addr_to_use;
 
-		if (sccp_netsock_is_IPv4(&ha->netaddr)) {
+		if (sccp_netsock_is_IPv4(&current_ha->netaddr)) {
 			if (sccp_netsock_is_IPv6(addr)) {
 				if (sccp_netsock_is_mapped_IPv4(addr)) {
 					if (!sccp_netsock_ipv4_mapped(addr, &mapped_addr)) {
@@ -953,6 +1498,31 @@ int sccp_apply_ha_default(const struct sccp_ha *ha, const struct sockaddr_storag
 	return res;
 }
 
+/*!
+ * \brief Apply a set of rules to a given IP address
+ *
+ * \details
+ * The list of host access rules is traversed, beginning with the
+ * input rule. If the IP address given matches a rule, the "sense"
+ * of that rule is used as the return value. Note that if an IP
+ * address matches multiple rules that the last one matched will be
+ * the one whose sense will be returned. When the list has been
+ * compiled (sccp_compile_ha), the same result is looked up in its tree.
+ *
+ * \param ha The head of the list of host access rules to follow
+ * \param addr An sockaddr_storage whose address is considered when matching rules
+ * \param defaultValue int value
+ * \retval AST_SENSE_ALLOW The IP address passes our ACL
+ * \retval AST_SENSE_DENY The IP address fails our ACL
+ */
+int sccp_apply_ha_default(const struct sccp_ha *ha, const struct sockaddr_storage *addr, int defaultValue)
+{
+	if (ha && ha->tree) {
+		return sccp_ha_tree_apply(ha->tree, addr, defaultValue);
+	}
+	return sccp_apply_ha_list(ha, addr, defaultValue);
+}
+
 /*!
  * \brief
  * Parse an IPv4 or IPv6 address string.
@@ -1110,6 +1680,10 @@ struct sccp_ha *sccp_append_ha(const char *sense, const char *stuff, struct sccp
 	int addr_is_v4;
 
 	ret = path;
+	if (ret && ret->tree) {											/* rules are changing, tree is out of date */
+		sccp_ha_tree_free(ret->tree);
+		ret->tree = NULL;
+	}
 	while (path) {
 		prev = path;
 		path = path->next;
@@ -1433,6 +2007,194 @@ AST_TEST_DEFINE(chan_sccp_acl_invalid_tests)
 	return res;
 }
 
+#define SCCP_ACL_TREE_ROUNDS 20
+#define SCCP_ACL_TREE_ADDRESSES 256
+#define SCCP_ACL_TREE_RANDOM(_seed) ((_seed) = (_seed) * 1103515245 + 12345, ((_seed) >> 16) & 0x7FFF)
+AST_TEST_DEFINE(chan_sccp_acl_tree_tests)
+{
+	struct sccp_ha *ha = NULL;
+	struct sockaddr_storage addrs[SCCP_ACL_TREE_ADDRESSES];
+	int results[SCCP_ACL_TREE_ADDRESSES][2];
+	char buf[64];
+	uint32_t seed = 0x5CC9;
+	int error = 0;
+	int round, i;
+	struct timeval start;
+	int64_t list_us = 0;
+	int64_t tree_us = 0;
+	enum ast_test_result_state res = AST_TEST_PASS;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "tree";
+		info->category = "/channels/chan_sccp/acl/";
+		info->summary = "chan-sccp-b compiled ha test";
+		info->description = "chan-sccp-b compiled ha (tree) gives the same results as walking the list of rules";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	pbx_test_status_update(test, "Executing chan-sccp-b compiled ha tests...\n");
+	for (round = 0; round < SCCP_ACL_TREE_ROUNDS && res == AST_TEST_PASS; round++) {
+		/* overlapping random rules within 10.0.0.0/22 and fd00::/118, plus the occasional catch all */
+		for (i = 0; i < (round + 1) * 10; i++) {
+			int r = SCCP_ACL_TREE_RANDOM(seed);
+			int net = SCCP_ACL_TREE_RANDOM(seed) & 3;
+			int host = SCCP_ACL_TREE_RANDOM(seed) & 255;
+			int prefix = SCCP_ACL_TREE_RANDOM(seed);
+			if (r % 50 == 0) {
+				snprintf(buf, sizeof(buf), (r & 1) ? "0.0.0.0/0" : "::/0");
+			} else if (r % 4) {
+				snprintf(buf, sizeof(buf), "10.0.%d.%d/%d", net, host, 16 + prefix % 17);
+			} else {
+				snprintf(buf, sizeof(buf), "fd00::%x:%x/%d", net, host, 16 + prefix % 113);
+			}
+			ha = sccp_append_ha((r & 2) ? "permit" : "deny", buf, ha, &error);
+			if (error) {
+				pbx_test_status_update(test, "round %d: rule %s not accepted\n", round, buf);
+				res = AST_TEST_FAIL;
+			}
+		}
+		for (i = 0; i < SCCP_ACL_TREE_ADDRESSES; i++) {
+			int r = SCCP_ACL_TREE_RANDOM(seed);
+			int net = SCCP_ACL_TREE_RANDOM(seed) & 7;
+			int host = SCCP_ACL_TREE_RANDOM(seed) & 255;
+			if (r % 3 == 0) {
+				snprintf(buf, sizeof(buf), "10.0.%d.%d", net, host);
+			} else if (r % 3 == 1) {
+				snprintf(buf, sizeof(buf), "fd00::%x:%x", net, host);
+			} else {
+				snprintf(buf, sizeof(buf), "::ffff:10.0.%d.%d", net, host);
+			}
+			sccp_sockaddr_storage_parse(&addrs[i], buf, PARSE_PORT_FORBID);
+		}
+
+		start = pbx_tvnow();
+		for (i = 0; i < SCCP_ACL_TREE_ADDRESSES; i++) {
+			results[i][0] = sccp_apply_ha_default(ha, &addrs[i], AST_SENSE_ALLOW);
+			results[i][1] = sccp_apply_ha_default(ha, &addrs[i], AST_SENSE_DENY);
+		}
+		list_us += ast_tvdiff_us(pbx_tvnow(), start);
+
+		sccp_compile_ha(ha);
+		if (!ha->tree) {
+			pbx_test_status_update(test, "round %d: list of %d rules was not compiled\n", round, (round + 1) * 10);
+			res = AST_TEST_FAIL;
+			break;
+		}
+		start = pbx_tvnow();
+		for (i = 0; i < SCCP_ACL_TREE_ADDRESSES; i++) {
+			if (sccp_apply_ha_default(ha, &addrs[i], AST_SENSE_ALLOW) != results[i][0] || sccp_apply_ha_default(ha, &addrs[i], AST_SENSE_DENY) != results[i][1]) {
+				pbx_test_status_update(test, "round %d: %s differs between list and tree\n", round, sccp_netsock_stringify_addr(&addrs[i]));
+				res = AST_TEST_FAIL;
+			}
+		}
+		tree_us += ast_tvdiff_us(pbx_tvnow(), start);
+	}
+	pbx_test_status_update(test, "%d lookups: list %lld us, tree %lld us\n", round * SCCP_ACL_TREE_ADDRESSES * 2, (long long) list_us, (long long) tree_us);
+
+	/* a non contiguous netmask cannot be compiled, the list is used instead */
+	if (res == AST_TEST_PASS) {
+		ha = sccp_append_ha("deny", "10.0.0.0/255.0.255.0", ha, &error);
+		sccp_compile_ha(ha);
+		if (error || ha->tree) {
+			pbx_test_status_update(test, "non contiguous netmask was compiled\n");
+			res = AST_TEST_FAIL;
+		}
+	}
+	sccp_free_ha(ha);
+	ha = NULL;
+
+	return res;
+}
+
+AST_TEST_DEFINE(chan_sccp_strcase_hash)
+{
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "strcaseHash";
+		info->category = "/channels/chan_sccp/utils/";
+		info->summary = "sccp_strcase_hash unit test";
+		info->description = "sccp_strcase_hash should match the way sccp_strcaseequals compares";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	pbx_test_status_update(test, "Executing sccp_strcase_hash...\n");
+	pbx_test_validate(test, sccp_strcase_hash("SEP001122334455") == sccp_strcase_hash("sep001122334455"));
+	pbx_test_validate(test, sccp_strcase_hash("SEP001122334455") == sccp_strcase_hash("Sep001122334455"));
+	pbx_test_validate(test, sccp_strcase_hash("SEP001122334455") != sccp_strcase_hash("SEP001122334456"));
+	pbx_test_validate(test, sccp_strcase_hash("") == sccp_strcase_hash(NULL));
+	return AST_TEST_PASS;
+}
+
+AST_TEST_DEFINE(chan_sccp_featurestore)
+{
+	const char *family = "SCCP/chan_sccp_test";
+	char buffer[256] = "";
+	enum ast_test_result_state res = AST_TEST_PASS;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "featurestore";
+		info->category = "/channels/chan_sccp/utils/";
+		info->summary = "write-behind feature store unit test";
+		info->description = "feature state updates should be readable immediately, coalesced and written to the database on flush";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	pbx_test_status_update(test, "Executing feature store put/get...\n");
+	sccp_featurestore_put(family, "dnd", "silent");
+	sccp_featurestore_put(family, "dnd", "reject");
+	sccp_featurestore_put(family, "privacy", "1");
+	sccp_featurestore_put(family, "privacy", NULL);
+	if (!sccp_featurestore_get(family, "dnd", buffer, sizeof(buffer)) || !sccp_strequals(buffer, "reject")) {
+		pbx_test_status_update(test, "dnd should read back 'reject' before the flush, got '%s'\n", buffer);
+		res = AST_TEST_FAIL;
+	}
+	if (sccp_featurestore_get(family, "privacy", buffer, sizeof(buffer))) {
+		pbx_test_status_update(test, "privacy should have been removed\n");
+		res = AST_TEST_FAIL;
+	}
+
+	pbx_test_status_update(test, "Executing feature store flush...\n");
+	sccp_featurestore_flush(NULL);
+	if (!iPbx.feature_getFromDatabase(family, "dnd", buffer, sizeof(buffer)) || !sccp_strequals(buffer, "reject")) {
+		pbx_test_status_update(test, "database should contain dnd=reject after the flush\n");
+		res = AST_TEST_FAIL;
+	}
+	if (iPbx.feature_getFromDatabase(family, "privacy", buffer, sizeof(buffer))) {
+		pbx_test_status_update(test, "database should not contain privacy after the flush\n");
+		res = AST_TEST_FAIL;
+	}
+
+	sccp_featurestore_put(family, "dnd", NULL);
+	sccp_featurestore_flush(NULL);
+	if (iPbx.feature_getFromDatabase(family, "dnd", buffer, sizeof(buffer))) {
+		pbx_test_status_update(test, "database should not contain dnd after removing it\n");
+		res = AST_TEST_FAIL;
+	}
+
+	pbx_test_status_update(test, "Executing feature store invalidate after a database change behind its back...\n");
+	iPbx.feature_addToDatabase(family, "dnd", "silent");
+	if (sccp_featurestore_get(family, "dnd", buffer, sizeof(buffer))) {
+		pbx_test_status_update(test, "dnd should still be served (as removed) from the cache\n");
+		res = AST_TEST_FAIL;
+	}
+	sccp_featurestore_invalidate();
+	if (!sccp_featurestore_get(family, "dnd", buffer, sizeof(buffer)) || !sccp_strequals(buffer, "silent")) {
+		pbx_test_status_update(test, "dnd should be read from the database again after invalidate, got '%s'\n", buffer);
+		res = AST_TEST_FAIL;
+	}
+	iPbx.feature_removeFromDatabase(family, "dnd");
+	sccp_featurestore_invalidate();
+	return res;
+}
+
 AST_TEST_DEFINE(chan_sccp_reduce_codec_set)
 {
 	switch (cmd) {
@@ -1888,16 +2650,22 @@ static void __attribute__((constructor)) sccp_register_tests(void)
 {
 	AST_TEST_REGISTER(chan_sccp_acl_tests);
 	AST_TEST_REGISTER(chan_sccp_acl_invalid_tests);
+	AST_TEST_REGISTER(chan_sccp_acl_tree_tests);
 	AST_TEST_REGISTER(chan_sccp_reduce_codec_set);
 	AST_TEST_REGISTER(chan_sccp_combine_codec_sets);
+	AST_TEST_REGISTER(chan_sccp_strcase_hash);
+	AST_TEST_REGISTER(chan_sccp_featurestore);
 }
 
 static void __attribute__((destructor)) sccp_unregister_tests(void)
 {
 	AST_TEST_UNREGISTER(chan_sccp_acl_tests);
 	AST_TEST_UNREGISTER(chan_sccp_acl_invalid_tests);
+	AST_TEST_UNREGISTER(chan_sccp_acl_tree_tests);
 	AST_TEST_UNREGISTER(chan_sccp_reduce_codec_set);
 	AST_TEST_UNREGISTER(chan_sccp_combine_codec_sets);
+	AST_TEST_UNREGISTER(chan_sccp_strcase_hash);
+	AST_TEST_UNREGISTER(chan_sccp_featurestore);
 }
 #endif
 
@@ -99,6 +99,10 @@ SCCP_API unsigned SCCP_CALL int sccp_app_separate_args(char *buf, char delim, ch
 #endif
 
 SCCP_API void SCCP_CALL sccp_util_featureStorageBackend(const sccp_event_t * event);
+SCCP_API void SCCP_CALL sccp_featurestore_put(const char *family, const char *key, const char *value);
+SCCP_API boolean_t SCCP_CALL sccp_featurestore_get(const char *family, const char *key, char *out, int outlen);
+SCCP_API void SCCP_CALL sccp_featurestore_invalidate(void);
+SCCP_API void SCCP_CALL sccp_featurestore_module_stop(void);
 #if 0 /* unused */
 SCCP_API int SCCP_CALL sccp_softkeyindex_find_label(sccp_device_t * d, unsigned int keymode, unsigned int softkey);
 #endif
@@ -113,6 +117,7 @@ SCCP_INLINE SCCP_CALL size_t sccp_strlen(const char *data);
 SCCP_INLINE SCCP_CALL boolean_t sccp_strlen_zero(const char *data);
 SCCP_INLINE SCCP_CALL boolean_t sccp_strequals(const char *data1, const char *data2);
 SCCP_INLINE SCCP_CALL boolean_t sccp_strcaseequals(const char *data1, const char *data2);
+SCCP_API unsigned int __PURE__ SCCP_CALL sccp_strcase_hash(const char *data);
 SCCP_API int __PURE__ SCCP_CALL sccp_strIsNumeric(const char *s);
 
 SCCP_API void SCCP_CALL sccp_free_ha(struct sccp_ha *ha);
@@ -122,6 +127,7 @@ SCCP_API int SCCP_CALL sccp_apply_ha_default(const struct sccp_ha *ha, const str
 SCCP_API int SCCP_CALL sccp_sockaddr_split_hostport(char *str, char **host, char **port, int flags);
 SCCP_API int SCCP_CALL sccp_sockaddr_storage_parse(struct sockaddr_storage *addr, const char *str, int flags);
 SCCP_API struct sccp_ha * SCCP_CALL sccp_append_ha(const char *sense, const char *stuff, struct sccp_ha *path, int *error);
+SCCP_API void SCCP_CALL sccp_compile_ha(struct sccp_ha *ha);
 SCCP_API void SCCP_CALL sccp_print_ha(struct ast_str *buf, int buflen, struct sccp_ha *path);
 SCCP_API void SCCP_CALL sccp_print_group(struct ast_str *buf, int buflen, sccp_group_t group);
 SCCP_API int SCCP_CALL sccp_strversioncmp(const char *s1, const char *s2);
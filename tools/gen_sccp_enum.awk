@@ -48,9 +48,31 @@ function my_strtonum(str,        ret, n, i, k, c)
     return ret
 }
 
+#
+# Compare two strings the way strcasecmp does (for ascii), independent of the awk implementation and locale
+#
+function ci_cmp(a, b,        n, i, ca, cb)
+{
+    a = tolower(a)
+    b = tolower(b)
+    n = length(a) < length(b) ? length(a) : length(b)
+    for (i = 1; i <= n; i++) {
+        ca = ord[substr(a, i, 1)]
+        cb = ord[substr(b, i, 1)]
+        if (ca != cb) {
+            return ca < cb ? -1 : 1
+        }
+    }
+    return length(a) - length(b)
+}
+
 BEGIN {
 	out_header_file = "sccp_enum.h"
 	out_source_file = "sccp_enum.c"
+	for (i = 32; i < 127; i++) {
+		ord[sprintf("%c", i)] = i
+	}
+	Tests = ""
 
         #
         # gen enum headerfile
@@ -82,6 +104,35 @@ BEGIN {
 	
 	print "static const char ERROR_2FMT[] = \"SCCP: Error during lookup of '%d' in %s2str\\n\";" > out_source_file
 	print "static const char LOOKUPERROR_FMT[] = \"SCCP: LOOKUP ERROR, %s_str2val('%s') not found\\n\";" > out_source_file
+	print "" > out_source_file
+	print "/* str2val index entry, the index of every enum is sorted case-insensitively on str */" > out_source_file
+	print "typedef struct {" > out_source_file
+	print "\tconst char *const str;" > out_source_file
+	print "\tconst uint32_t val;" > out_source_file
+	print "} sccp_enum_index_t;" > out_source_file
+	print "" > out_source_file
+	print "/* binary search lookup_str in index, returns the position in index or -1 */" > out_source_file
+	print "static int sccp_enum_index_find(const sccp_enum_index_t *const index, const uint32_t len, const char *lookup_str)" > out_source_file
+	print "{" > out_source_file
+	print "\tuint32_t lo = 0;" > out_source_file
+	print "\tuint32_t hi = len;" > out_source_file
+	print "\tif (!lookup_str) {" > out_source_file
+	print "\t\tlookup_str = \"\";" > out_source_file
+	print "\t}" > out_source_file
+	print "\twhile (lo < hi) {" > out_source_file
+	print "\t\tuint32_t mid = lo + (hi - lo) / 2;" > out_source_file
+	print "\t\tint cmp = strcasecmp(index[mid].str, lookup_str);" > out_source_file
+	print "\t\tif (cmp == 0) {" > out_source_file
+	print "\t\t\treturn (int) mid;" > out_source_file
+	print "\t\t}" > out_source_file
+	print "\t\tif (cmp < 0) {" > out_source_file
+	print "\t\t\tlo = mid + 1;" > out_source_file
+	print "\t\t} else {" > out_source_file
+	print "\t\t\thi = mid;" > out_source_file
+	print "\t\t}" > out_source_file
+	print "\t}" > out_source_file
+	print "\treturn -1;" > out_source_file
+	print "}" > out_source_file
 
 	enum_name = ""
 	Comment = ""
@@ -377,26 +428,67 @@ codeSkip == 1			{ next }
 		}
 		print "}\n" > out_source_file
 		
-		# sccp_channelstate_t sccp_channelstate_str2val(const char *lookup_str) {
-		print namespace "_" enum_name "_t " namespace "_" enum_name "_str2val(const char *lookup_str) {" > out_source_file
-		if (sparse == 0) {
-			print "\tuint32_t idx;" > out_source_file
-			print "\tfor (idx = 0; idx < ARRAY_LEN(" namespace "_" enum_name "_map); idx++) {" > out_source_file
-			print "\t\tif (sccp_strcaseequals(" namespace "_" enum_name "_map[idx], lookup_str)) {" > out_source_file
-			if (bitfield == 0) {
-				print "\t\t\treturn ("namespace "_" enum_name "_t) idx;" > out_source_file
+		# static const sccp_enum_index_t sccp_channelstate_index[] = {
+		# entries sorted case-insensitively on text (insertion sort), for duplicate texts only the first entry is kept
+		n = 0
+		for ( i = 0; i < e; ++i) {
+			if (Entry_ifdef[i] != "") {
+				continue
+			}
+			dup = 0
+			for ( j = n - 1; j >= 0; --j) {
+				cmp = ci_cmp(Entry_text[Sorted[j]], Entry_text[i])
+				if (cmp == 0) {
+					dup = 1
+				}
+				if (cmp <= 0) {
+					break
+				}
+				Sorted[j + 1] = Sorted[j]
+			}
+			if (dup) {
+				for ( j = j + 1; j < n; ++j) {
+					Sorted[j] = Sorted[j + 1]
+				}
+				continue
+			}
+			Sorted[j + 1] = i
+			n++
+		}
+		print "static const sccp_enum_index_t " namespace "_" enum_name "_index[] = {" > out_source_file
+		for ( j = 0; j < n; ++j) {
+			i = Sorted[j]
+			if (i > 0 && Entry_ifdef[i - 1] != "") {
+				print "#ifdef " Entry_ifdef[i - 1] > out_source_file
+				print "\t{\"" Entry_text[i] "\", " Entry_id[i] "}," > out_source_file
+				print "#endif" > out_source_file
 			} else {
-				print "\t\t\treturn ("namespace "_" enum_name "_t) (1 << idx);" > out_source_file
+				print "\t{\"" Entry_text[i] "\", " Entry_id[i] "}," > out_source_file
 			}
-			print "\t\t}" > out_source_file
-			print "\t}" > out_source_file
-		} else {
-			for ( i = 0; i < e; ++i) {
-				print "\tif (sccp_strcaseequals(" namespace "_" enum_name "_map[" i "], lookup_str)) {" > out_source_file
-				print "\t\treturn " Entry_id[i] ";" > out_source_file
-				print "\t}" > out_source_file
+		}
+		print "};\n" > out_source_file
+
+		# generated self-test: every text has to be found again (case-insensitively) and map back onto the same text
+		test = ""
+		for ( j = 0; j < n; ++j) {
+			i = Sorted[j]
+			check = "\tpbx_test_validate(test, " namespace "_" enum_name "_str2val(\"" toupper(Entry_text[i]) "\") == " Entry_id[i] ");\n"
+			if (bitfield == 0) {
+				check = check "\tpbx_test_validate(test, sccp_strcaseequals(" namespace "_" enum_name "2str(" namespace "_" enum_name "_str2val(\"" Entry_text[i] "\")), \"" Entry_text[i] "\"));\n"
 			}
+			if (i > 0 && Entry_ifdef[i - 1] != "") {
+				check = "#ifdef " Entry_ifdef[i - 1] "\n" check "#endif\n"
+			}
+			test = test check
 		}
+		Tests = Tests "\tpbx_test_status_update(test, \"" namespace "_" enum_name "\\n\");\n" test
+
+		# sccp_channelstate_t sccp_channelstate_str2val(const char *lookup_str) {
+		print namespace "_" enum_name "_t " namespace "_" enum_name "_str2val(const char *lookup_str) {" > out_source_file
+		print "\tint idx = sccp_enum_index_find(" namespace "_" enum_name "_index, ARRAY_LEN(" namespace "_" enum_name "_index), lookup_str);" > out_source_file
+		print "\tif (idx >= 0) {" > out_source_file
+		print "\t\treturn (" namespace "_" enum_name "_t) " namespace "_" enum_name "_index[idx].val;" > out_source_file
+		print "\t}" > out_source_file
 		print "\tpbx_log(LOG_ERROR, LOOKUPERROR_FMT, __" namespace "_" enum_name "_str, lookup_str);" > out_source_file
 		print "\treturn "toupper(namespace) "_" toupper(enum_name) "_SENTINEL;" > out_source_file
 		print "}\n" > out_source_file
@@ -434,6 +526,35 @@ codeSkip == 1			{ next }
 }
 
 END {
+	# generated self-test, round-trips every strenum entry through str2val and 2str
+	print "\n#if CS_TEST_FRAMEWORK" > out_source_file
+	print "#include <asterisk/test.h>" > out_source_file
+	print "AST_TEST_DEFINE(sccp_enum_str2val_tests)" > out_source_file
+	print "{" > out_source_file
+	print "\tswitch(cmd) {" > out_source_file
+	print "\t\tcase TEST_INIT:" > out_source_file
+	print "\t\t\tinfo->name = \"str2val\";" > out_source_file
+	print "\t\t\tinfo->category = \"/channels/chan_sccp/enum/\";" > out_source_file
+	print "\t\t\tinfo->summary = \"chan-sccp-b generated enum lookup test\";" > out_source_file
+	print "\t\t\tinfo->description = \"chan-sccp-b every generated enum text can be looked up case-insensitively and maps back onto itself\";" > out_source_file
+	print "\t\t\treturn AST_TEST_NOT_RUN;" > out_source_file
+	print "\t\tcase TEST_EXECUTE:" > out_source_file
+	print "\t\t\tbreak;" > out_source_file
+	print "\t}" > out_source_file
+	printf "%s", Tests > out_source_file
+	print "\tpbx_test_validate(test, sccp_channelstate_str2val(\"chan-sccp-b unknown enum text\") == SCCP_CHANNELSTATE_SENTINEL);" > out_source_file
+	print "\treturn AST_TEST_PASS;" > out_source_file
+	print "}\n" > out_source_file
+	print "static void __attribute__((constructor)) sccp_register_tests(void)" > out_source_file
+	print "{" > out_source_file
+	print "\tAST_TEST_REGISTER(sccp_enum_str2val_tests);" > out_source_file
+	print "}\n" > out_source_file
+	print "static void __attribute__((destructor)) sccp_unregister_tests(void)" > out_source_file
+	print "{" > out_source_file
+	print "\tAST_TEST_UNREGISTER(sccp_enum_str2val_tests);" > out_source_file
+	print "}" > out_source_file
+	print "#endif" > out_source_file
+
 	# add guard
 	print "__END_C_EXTERN__" >out_header_file 
 	close (out_header_file)